@@ -0,0 +1,324 @@
+// SPDX-License-Identifier: GPLv3-or-later
+/*
+ * elfbench.c - patch size and time for executables, with and without
+ *		the branch filter
+ * Copyright Peter Jones <pjones@redhat.com>
+ *
+ * Each pair of files is diffed with each binary engine, once as it is
+ * and once through the branch filter xdl_bcj_detect() picks for the
+ * old file, and each patch is applied and checked.  With no files, the
+ * pair is this program and a copy of it with some code added in the
+ * middle, and the calls around it fixed up the way the linker would.
+ * Output is CSV on stdout.
+ */
+
+#include "bindiff.h"
+
+#include <elf.h>
+#include <time.h>
+#include <xdiff.h>
+
+int verbose = 0;
+
+#define EB_INSERT 64
+
+struct buf {
+	char *ptr;
+	size_t size;
+	size_t alloc;
+};
+
+struct engine {
+	const char *name;
+	int (*diff)(mmbuffer_t *a, mmbuffer_t *b, xdemitcb_t *ecb);
+};
+
+static int
+diff_bdiff(mmbuffer_t *a, mmbuffer_t *b, xdemitcb_t *ecb)
+{
+	bdiffparam_t bdp = { .bsize = 16, .flags = 0 };
+
+	return xdl_bdiff_mb(a, b, &bdp, ecb);
+}
+
+static int
+diff_rabdiff(mmbuffer_t *a, mmbuffer_t *b, xdemitcb_t *ecb)
+{
+	return xdl_rabdiff_mb(a, b, ecb);
+}
+
+static const struct engine engines[] = {
+	{ "bdiff", diff_bdiff },
+	{ "rabdiff", diff_rabdiff },
+};
+
+static const char * const filter_names[] = {
+	[XDL_BCJ_NONE] = "none",
+	[XDL_BCJ_X86] = "x86",
+	[XDL_BCJ_ARM64] = "arm64",
+};
+
+static int
+buf_outf(void *priv, mmbuffer_t *mb, size_t nbuf)
+{
+	struct buf *buf = priv;
+
+	for (size_t i = 0; i < nbuf; i++) {
+		if (buf->size + mb[i].size > buf->alloc) {
+			size_t alloc = MAX(buf->alloc * 2,
+					   buf->size + mb[i].size);
+			char *ptr = realloc(buf->ptr, alloc);
+
+			if (!ptr)
+				return -1;
+			buf->ptr = ptr;
+			buf->alloc = alloc;
+		}
+		memcpy(buf->ptr + buf->size, mb[i].ptr, mb[i].size);
+		buf->size += mb[i].size;
+	}
+	return 0;
+}
+
+static void
+load(const char *path, struct buf *buf)
+{
+	struct stat sb;
+	ssize_t rc;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &sb) < 0)
+		err(1, "Could not open \"%s\"", path);
+	buf->size = buf->alloc = sb.st_size;
+	buf->ptr = malloc(MAX(buf->size, 1));
+	if (!buf->ptr)
+		err(1, "Could not allocate memory");
+	for (size_t pos = 0; pos < buf->size; pos += rc) {
+		rc = read(fd, buf->ptr + pos, buf->size - pos);
+		if (rc <= 0)
+			err(1, "Could not read \"%s\"", path);
+	}
+	close(fd);
+}
+
+/*
+ * The middle of .text, or of the file if we can't find it.
+ */
+static size_t
+text_middle(struct buf *buf)
+{
+	Elf64_Ehdr *ehdr = (Elf64_Ehdr *)buf->ptr;
+	Elf64_Shdr *shdr, *strtab;
+
+	if (buf->size < sizeof(*ehdr) || memcmp(ehdr->e_ident, ELFMAG, SELFMAG) ||
+	    ehdr->e_ident[EI_CLASS] != ELFCLASS64 ||
+	    ehdr->e_shoff + ehdr->e_shnum * sizeof(*shdr) > buf->size ||
+	    ehdr->e_shstrndx >= ehdr->e_shnum)
+		return buf->size / 2;
+
+	shdr = (Elf64_Shdr *)(buf->ptr + ehdr->e_shoff);
+	strtab = &shdr[ehdr->e_shstrndx];
+	for (unsigned int i = 0; i < ehdr->e_shnum; i++) {
+		if (strtab->sh_offset + shdr[i].sh_name + 6 > buf->size ||
+		    shdr[i].sh_offset + shdr[i].sh_size > buf->size)
+			continue;
+		if (!strcmp(buf->ptr + strtab->sh_offset + shdr[i].sh_name,
+			    ".text"))
+			return shdr[i].sh_offset + shdr[i].sh_size / 2;
+	}
+	return buf->size / 2;
+}
+
+/*
+ * Add EB_INSERT bytes of nops in the middle of the code, and fix up
+ * every x86 call or jump whose displacement now crosses them, which is
+ * what a function getting a little bigger does.  This isn't a
+ * disassembler, so it fixes up the odd false positive in data too.
+ */
+static void
+grow(struct buf *old, struct buf *new)
+{
+	size_t at = text_middle(old);
+
+	new->size = new->alloc = old->size + EB_INSERT;
+	new->ptr = malloc(new->size);
+	if (!new->ptr)
+		err(1, "Could not allocate memory");
+	memcpy(new->ptr, old->ptr, at);
+	memset(new->ptr + at, 0x90, EB_INSERT);
+	memcpy(new->ptr + at + EB_INSERT, old->ptr + at, old->size - at);
+
+	for (size_t i = 0; i + 5 <= old->size; i++) {
+		uint8_t *op = (uint8_t *)old->ptr + i;
+		int64_t here, target;
+		int32_t rel;
+		size_t pos;
+
+		if ((op[0] != 0xe8 && op[0] != 0xe9) ||
+		    (op[4] != 0x00 && op[4] != 0xff) || (i < at && i + 5 > at))
+			continue;
+		memcpy(&rel, op + 1, sizeof(rel));
+		here = i + 5;
+		target = here + rel;
+		pos = i < at ? i : i + EB_INSERT;
+		if (i < at && target >= (int64_t)at)
+			rel += EB_INSERT;
+		else if (i >= at && target < (int64_t)at)
+			rel -= EB_INSERT;
+		else
+			continue;
+		memcpy(new->ptr + pos + 1, &rel, sizeof(rel));
+	}
+}
+
+static double
+now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void
+filter_copy(int filter, struct buf *src, mmbuffer_t *dst)
+{
+	dst->size = src->size;
+	dst->ptr = malloc(MAX(src->size, 1));
+	if (!dst->ptr)
+		err(1, "Could not allocate memory");
+	xdl_bcj_encode(filter, src->ptr, src->size, dst->ptr);
+}
+
+/*
+ * Times include copying and filtering the inputs, since that's part of
+ * what using the filter costs; the unfiltered runs make the same copies
+ * so the two are comparable.
+ */
+static void
+bench(const char *oname, const char *nname, struct buf *old, struct buf *new,
+      const struct engine *e, int filter, unsigned int rounds)
+{
+	double dbest = 0, abest = 0, start;
+	struct buf patch = { 0, }, out = { 0, };
+
+	for (unsigned int r = 0; r < rounds; r++) {
+		mmbuffer_t a, b;
+		char *dec;
+		xdemitcb_t ecb = { .priv = &patch, .outf = buf_outf };
+		mmfile_t mfp;
+
+		patch.size = 0;
+		start = now_ms();
+		filter_copy(filter, old, &a);
+		filter_copy(filter, new, &b);
+		if (e->diff(&a, &b, &ecb) < 0)
+			errx(1, "%s failed on \"%s\"", e->name, nname);
+		free(b.ptr);
+		free(a.ptr);
+		if (r == 0 || now_ms() - start < dbest)
+			dbest = now_ms() - start;
+
+		out.size = 0;
+		ecb.priv = &out;
+		start = now_ms();
+		filter_copy(filter, old, &a);
+		if (xdl_init_mmfile(&mfp, 8 * 1024, XDL_MMF_ATOMIC) < 0 ||
+		    xdl_mmfile_ptradd(&mfp, patch.ptr, patch.size,
+				      XDL_MMB_READONLY) < 0)
+			errx(1, "Could not set up the patch");
+		if (xdl_bpatch_refs(&a, 1, &mfp, &ecb) < 0)
+			errx(1, "Could not apply the patch for \"%s\"", nname);
+		dec = malloc(MAX(out.size, 1));
+		if (!dec)
+			err(1, "Could not allocate memory");
+		if (xdl_bcj_decode(filter, out.ptr, out.size, dec) < 0)
+			errx(1, "Could not undo the filter on \"%s\"", nname);
+		xdl_free_mmfile(&mfp);
+		free(a.ptr);
+		if (r == 0 || now_ms() - start < abest)
+			abest = now_ms() - start;
+
+		if (out.size != new->size || memcmp(dec, new->ptr, new->size))
+			errx(1, "%s with filter %s got \"%s\" wrong", e->name,
+			     filter_names[filter], nname);
+		free(dec);
+	}
+
+	printf("%s,%s,%s,%s,%zu,%zu,%zu,%.3f,%.3f\n", oname, nname, e->name,
+	       filter_names[filter], old->size, new->size, patch.size, dbest,
+	       abest);
+	fflush(stdout);
+
+	free(out.ptr);
+	free(patch.ptr);
+}
+
+static void NORETURN
+usage(int status)
+{
+	FILE *out = status ? stderr : stdout;
+
+	fprintf(out, "usage: %s [--rounds N] [OLD NEW]...\n",
+		program_invocation_short_name);
+	exit(status);
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned int rounds = 3;
+	int first = 0, npairs;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--rounds") && i + 1 < argc) {
+			rounds = strtoul(argv[++i], NULL, 0);
+		} else if (!strcmp(argv[i], "--help")) {
+			usage(0);
+		} else {
+			first = i;
+			break;
+		}
+	}
+	npairs = first ? (argc - first) / 2 : 1;
+	if (rounds == 0 || (first && (argc - first) % 2))
+		usage(1);
+
+	printf("old,new,engine,filter,src_size,tgt_size,patch_size,diff_ms,"
+	       "apply_ms\n");
+	for (int p = 0; p < npairs; p++) {
+		const char *oname, *nname;
+		struct buf old, new;
+		int filter;
+
+		if (first) {
+			oname = argv[first + p * 2];
+			nname = argv[first + p * 2 + 1];
+			load(oname, &old);
+			load(nname, &new);
+		} else {
+			oname = "/proc/self/exe";
+			nname = "grown";
+			load(oname, &old);
+			grow(&old, &new);
+		}
+
+		filter = xdl_bcj_detect(old.ptr, old.size);
+		for (size_t e = 0; e < sizeof(engines) / sizeof(engines[0]);
+		     e++) {
+			bench(oname, nname, &old, &new, &engines[e],
+			      XDL_BCJ_NONE, rounds);
+			if (filter != XDL_BCJ_NONE)
+				bench(oname, nname, &old, &new, &engines[e],
+				      filter, rounds);
+		}
+
+		free(new.ptr);
+		free(old.ptr);
+	}
+
+	return 0;
+}
+
+// vim:fenc=utf-8:tw=75:noet
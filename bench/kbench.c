@@ -0,0 +1,471 @@
+// SPDX-License-Identifier: GPLv3-or-later
+/*
+ * kbench.c - microbenchmarks for the inner kernels
+ * Copyright Peter Jones <pjones@redhat.com>
+ *
+ * Each kernel is run by itself over a sweep of sizes and alignments, so
+ * a rewrite of one of them can be judged without the rest of the diff
+ * getting in the way.  Output is CSV on stdout.
+ */
+
+#include "bindiff.h"
+
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#else
+#define HAVE_TSC 0
+#endif
+
+#include "xinclude.h"
+
+int verbose = 0;
+
+/*
+ * Buffers are allocated with this much slack in front, and the input
+ * is placed at an offset from a 64 byte boundary.
+ */
+#define KB_ALIGN 64
+
+/* how long one sample should take, in ns */
+#define KB_SAMPLE_NS 100000
+#define KB_WARMUP 3
+
+struct kernel {
+	const char *name;
+	bool text;
+	void *(*setup)(uint8_t *a, size_t size);
+	void (*teardown)(void *ctx);
+	uint64_t (*run)(void *ctx, uint8_t *a, uint8_t *b, size_t size);
+};
+
+static volatile uint64_t sink;
+
+static uint64_t
+run_adler32(void *ctx UNUSED, uint8_t *a, uint8_t *b UNUSED, size_t size)
+{
+	return xdl_adler32(0, a, size);
+}
+
+static uint64_t
+run_rabin(void *ctx UNUSED, uint8_t *a, uint8_t *b UNUSED, size_t size)
+{
+	return xdl_rabin_scan(a, size);
+}
+
+static uint64_t
+run_hash_record(void *ctx UNUSED, uint8_t *a, uint8_t *b UNUSED, size_t size)
+{
+	const char *ptr = (const char *)a, *top = ptr + size;
+	uint64_t ha = 0;
+
+	while (ptr < top)
+		ha ^= xdl_hash_record(&ptr, top);
+	return ha;
+}
+
+struct classify_ctx {
+	size_t nrec;
+	unsigned int hbits;
+	xrecord_t *recs;
+	unsigned long *ha;
+	xrecord_t **rhash;
+};
+
+static void *
+setup_classify(uint8_t *a, size_t size)
+{
+	struct classify_ctx *ctx;
+	const char *ptr = (const char *)a, *top = ptr + size;
+	size_t n = 0;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (!ctx)
+		err(1, "Could not allocate memory");
+	for (size_t i = 0; i < size; i++)
+		n += a[i] == '\n';
+	n += 1;
+
+	ctx->recs = calloc(n, sizeof(*ctx->recs));
+	ctx->ha = calloc(n, sizeof(*ctx->ha));
+	ctx->hbits = xdl_hashbits(n);
+	ctx->rhash = calloc(1ul << ctx->hbits, sizeof(*ctx->rhash));
+	if (!ctx->recs || !ctx->ha || !ctx->rhash)
+		err(1, "Could not allocate memory");
+
+	while (ptr < top) {
+		const char *start = ptr;
+
+		ctx->ha[ctx->nrec] = xdl_hash_record(&ptr, top);
+		ctx->recs[ctx->nrec].ptr = start;
+		ctx->recs[ctx->nrec].size = ptr - start;
+		ctx->nrec += 1;
+	}
+	return ctx;
+}
+
+static void
+teardown_classify(void *ctxp)
+{
+	struct classify_ctx *ctx = ctxp;
+
+	free(ctx->rhash);
+	free(ctx->ha);
+	free(ctx->recs);
+	free(ctx);
+}
+
+/*
+ * Classifying rewrites each record's hash, so every call puts them back
+ * first.  That, and setting up the classifier, is part of what gets
+ * timed, the same as it is in xdl_prepare_env().
+ */
+static uint64_t
+run_classify(void *ctxp, uint8_t *a UNUSED, uint8_t *b UNUSED,
+	     size_t size UNUSED)
+{
+	struct classify_ctx *ctx = ctxp;
+	xdlclassifier_t cf;
+	uint64_t classes;
+
+	if (xdl_init_classifier(&cf, ctx->nrec + 1) < 0)
+		err(1, "Could not initialize classifier");
+	memset(ctx->rhash, 0, (1ul << ctx->hbits) * sizeof(*ctx->rhash));
+	for (size_t i = 0; i < ctx->nrec; i++) {
+		ctx->recs[i].ha = ctx->ha[i];
+		if (xdl_classify_record(&cf, ctx->rhash, ctx->hbits,
+					&ctx->recs[i]) < 0)
+			err(1, "Could not classify record");
+	}
+	classes = cf.count;
+	xdl_free_classifier(&cf);
+	return classes;
+}
+
+static uint64_t
+run_match_fwd(void *ctx UNUSED, uint8_t *a, uint8_t *b, size_t size)
+{
+	return xdl_match_fwd(a, b, size);
+}
+
+static uint64_t
+run_match_bwd(void *ctx UNUSED, uint8_t *a, uint8_t *b, size_t size)
+{
+	return xdl_match_bwd(a + size, b + size, size);
+}
+
+static uint64_t
+run_prepare_hex(void *ctx UNUSED, uint8_t *a, uint8_t *b UNUSED, size_t size)
+{
+	char line[128];
+	size_t off = 0, consumed = 0;
+	uint64_t total = 0;
+
+	while (off < size) {
+		ssize_t sz = prepare_hex(a + off, size - off, &consumed, line,
+					 sizeof(line), off, 0);
+		if (sz < 0)
+			err(1, "prepare_hex() failed");
+		total += sz;
+		off += consumed;
+	}
+	return total;
+}
+
+static uint64_t
+run_write_mmfile(void *ctx UNUSED, uint8_t *a, uint8_t *b UNUSED, size_t size)
+{
+	mmfile_t mmf;
+	uint64_t total;
+
+	if (xdl_init_mmfile(&mmf, 8 * 1024, 0) < 0)
+		err(1, "Could not initialize mmfile");
+	/* roughly what a run of INS ops looks like */
+	for (size_t off = 0; off < size; off += 256) {
+		if (xdl_write_mmfile(&mmf, a + off, MIN(256, size - off)) < 0)
+			err(1, "Could not write mmfile");
+	}
+	total = xdl_mmfile_size(&mmf);
+	xdl_free_mmfile(&mmf);
+	return total;
+}
+
+/*
+ * One 32 byte node per 32 bytes of input, which is about what the
+ * bdiff index costs.
+ */
+static uint64_t
+run_cha_alloc(void *ctx UNUSED, uint8_t *a UNUSED, uint8_t *b UNUSED,
+	      size_t size)
+{
+	chastore_t cha;
+	uint64_t total = 0;
+
+	if (xdl_cha_init(&cha, 32, 1024) < 0)
+		err(1, "Could not initialize chastore");
+	for (size_t i = 0; i < MAX(size / 32, 1); i++) {
+		uint8_t *node = xdl_cha_alloc(&cha);
+
+		if (!node)
+			err(1, "Could not allocate node");
+		node[0] = i;
+		total += node[0];
+	}
+	xdl_cha_free(&cha);
+	return total;
+}
+
+/*
+ * Each pass filters a into b; the work doesn't depend on what's there.
+ */
+static uint64_t
+run_bcj_x86(void *ctx UNUSED, uint8_t *a, uint8_t *b, size_t size)
+{
+	return xdl_bcj_encode(XDL_BCJ_X86, (char *)a, size, (char *)b);
+}
+
+static uint64_t
+run_bcj_arm64(void *ctx UNUSED, uint8_t *a, uint8_t *b, size_t size)
+{
+	return xdl_bcj_encode(XDL_BCJ_ARM64, (char *)a, size, (char *)b);
+}
+
+static const struct kernel kernels[] = {
+	{ "adler32", false, NULL, NULL, run_adler32 },
+	{ "rabin", false, NULL, NULL, run_rabin },
+	{ "hash_record", true, NULL, NULL, run_hash_record },
+	{ "classify_record", true, setup_classify, teardown_classify,
+	  run_classify },
+	{ "match_fwd", false, NULL, NULL, run_match_fwd },
+	{ "match_bwd", false, NULL, NULL, run_match_bwd },
+	{ "prepare_hex", false, NULL, NULL, run_prepare_hex },
+	{ "write_mmfile", false, NULL, NULL, run_write_mmfile },
+	{ "cha_alloc", false, NULL, NULL, run_cha_alloc },
+	{ "bcj_x86", false, NULL, NULL, run_bcj_x86 },
+	{ "bcj_arm64", false, NULL, NULL, run_bcj_arm64 },
+};
+
+static const size_t sizes[] = { 64, 256, 4096, 65536, 1024 * 1024 };
+static const size_t aligns[] = { 0, 1, 3, 8 };
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static inline uint64_t
+now_tsc(void)
+{
+#if HAVE_TSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+static void
+fill(uint8_t *buf, size_t size, bool text)
+{
+	uint64_t state = 0x9e3779b97f4a7c15ull;
+	size_t eol = 0;
+
+	for (size_t i = 0; i < size; i++) {
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		if (!text) {
+			buf[i] = state;
+		} else if (i == eol) {
+			buf[i] = '\n';
+			eol = i + 8 + state % 72;
+		} else {
+			buf[i] = 'a' + state % 26;
+		}
+	}
+}
+
+static int
+u64_compare(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/*
+ * Time one kernel at one size and alignment.  The number of calls per
+ * sample is picked so a sample is long enough for the clock to be
+ * meaningful, a few samples are thrown away to warm things up, and then
+ * anything more than 4.5 MADs (about 3 standard deviations) above the
+ * median is dropped as noise.
+ */
+static void
+measure(const struct kernel *k, uint8_t *a, uint8_t *b, size_t size,
+	size_t align, unsigned int nsamples)
+{
+	uint64_t *ns, *tsc, reps = 1, start, elapsed, tstart;
+	uint64_t median, mad, *dev, sum_ns = 0, sum_tsc = 0;
+	unsigned int kept = 0;
+	void *ctx = NULL;
+
+	ns = calloc(nsamples, sizeof(*ns));
+	tsc = calloc(nsamples, sizeof(*tsc));
+	dev = calloc(nsamples, sizeof(*dev));
+	if (!ns || !tsc || !dev)
+		err(1, "Could not allocate memory");
+
+	if (k->setup)
+		ctx = k->setup(a, size);
+
+	for (;;) {
+		start = now_ns();
+		for (uint64_t r = 0; r < reps; r++)
+			sink += k->run(ctx, a, b, size);
+		elapsed = now_ns() - start;
+		if (elapsed >= KB_SAMPLE_NS || reps >= (1ull << 30))
+			break;
+		reps *= elapsed ? MAX(2, KB_SAMPLE_NS / elapsed) : 16;
+	}
+
+	for (unsigned int s = 0; s < KB_WARMUP + nsamples; s++) {
+		tstart = now_tsc();
+		start = now_ns();
+		for (uint64_t r = 0; r < reps; r++)
+			sink += k->run(ctx, a, b, size);
+		elapsed = now_ns() - start;
+		if (s >= KB_WARMUP) {
+			ns[s - KB_WARMUP] = elapsed;
+			tsc[s - KB_WARMUP] = now_tsc() - tstart;
+		}
+	}
+
+	if (k->teardown)
+		k->teardown(ctx);
+
+	memcpy(dev, ns, nsamples * sizeof(*dev));
+	qsort(dev, nsamples, sizeof(*dev), u64_compare);
+	median = dev[nsamples / 2];
+	for (unsigned int s = 0; s < nsamples; s++)
+		dev[s] = ns[s] > median ? ns[s] - median : median - ns[s];
+	qsort(dev, nsamples, sizeof(*dev), u64_compare);
+	mad = dev[nsamples / 2];
+
+	for (unsigned int s = 0; s < nsamples; s++) {
+		if (ns[s] > median + mad * 9 / 2 + 1)
+			continue;
+		sum_ns += ns[s];
+		sum_tsc += tsc[s];
+		kept += 1;
+	}
+
+	double calls = (double)kept * reps;
+	double nspb = sum_ns / calls / size;
+
+	printf("%s,%zu,%zu,%.4f,%.4f,", k->name, size, align, nspb,
+	       sum_ns / calls);
+	if (HAVE_TSC)
+		printf("%.4f,", sum_tsc / calls / size);
+	else
+		printf(",");
+	printf("%.3f,%u,%u\n", nspb > 0 ? 1.0 / nspb : 0.0, kept,
+	       nsamples - kept);
+	fflush(stdout);
+
+	free(dev);
+	free(tsc);
+	free(ns);
+}
+
+static void NORETURN
+usage(int status)
+{
+	FILE *out = status ? stderr : stdout;
+
+	fprintf(out, "usage: %s [--samples N] [--size N] [KERNEL...]\n",
+		program_invocation_short_name);
+	fprintf(out, "kernels:");
+	for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++)
+		fprintf(out, " %s", kernels[i].name);
+	fprintf(out, "\n");
+	exit(status);
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned int nsamples = 15;
+	size_t only_size = 0, maxsize = 0;
+	bool *selected;
+	bool any = false;
+	uint8_t *abuf, *bbuf;
+	size_t nkernels = sizeof(kernels) / sizeof(kernels[0]);
+
+	selected = calloc(nkernels, sizeof(*selected));
+	if (!selected)
+		err(1, "Could not allocate memory");
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--samples") && i + 1 < argc) {
+			nsamples = strtoul(argv[++i], NULL, 0);
+		} else if (!strcmp(argv[i], "--size") && i + 1 < argc) {
+			only_size = strtoull(argv[++i], NULL, 0);
+		} else if (!strcmp(argv[i], "--help")) {
+			usage(0);
+		} else {
+			size_t k;
+
+			for (k = 0; k < nkernels; k++) {
+				if (!strcmp(argv[i], kernels[k].name))
+					break;
+			}
+			if (k == nkernels)
+				usage(1);
+			selected[k] = any = true;
+		}
+	}
+	if (nsamples == 0)
+		usage(1);
+
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+		maxsize = MAX(maxsize, sizes[s]);
+	maxsize = MAX(maxsize, only_size);
+	abuf = aligned_alloc(KB_ALIGN, ALIGN(maxsize + KB_ALIGN, KB_ALIGN));
+	bbuf = aligned_alloc(KB_ALIGN, ALIGN(maxsize + KB_ALIGN, KB_ALIGN));
+	if (!abuf || !bbuf)
+		err(1, "Could not allocate memory");
+
+	printf("kernel,size,align,ns_per_byte,ns_per_call,tsc_per_byte,"
+	       "gb_per_s,samples,rejected\n");
+	for (size_t k = 0; k < nkernels; k++) {
+		if (any && !selected[k])
+			continue;
+		for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+			size_t size = only_size ? only_size : sizes[s];
+
+			for (size_t al = 0; al < sizeof(aligns) / sizeof(aligns[0]);
+			     al++) {
+				uint8_t *a = abuf + aligns[al];
+				uint8_t *b = bbuf + aligns[al];
+
+				fill(a, size, kernels[k].text);
+				memcpy(b, a, size);
+				measure(&kernels[k], a, b, size, aligns[al],
+					nsamples);
+			}
+			if (only_size)
+				break;
+		}
+	}
+
+	free(bbuf);
+	free(abuf);
+	free(selected);
+	return 0;
+}
+
+// vim:fenc=utf-8:tw=75:noet
@@ -0,0 +1,81 @@
+// SPDX-License-Identifier: GPLv3-or-later
+/*
+ * render.c - measure how fast we can render a hexdiff
+ * Copyright Peter Jones <pjones@redhat.com>
+ *
+ * "make bench" builds this with UNC_DEBUG_LEVEL 0, 1 (the default) and
+ * 2, which is what the hot paths cost back when they used debug().
+ */
+
+#include "bindiff.h"
+
+#include <time.h>
+
+int verbose = 0;
+
+int
+main(int argc, char *argv[])
+{
+	size_t size = 4 * 1024 * 1024;
+	unsigned int rounds = 3;
+	struct timespec start, end, elapsed;
+	uint64_t best = UINT64_MAX;
+	uint64_t state = 0x9e3779b97f4a7c15ull;
+	uint8_t *data;
+	FILE *null;
+
+	if (argc > 1)
+		size = strtoull(argv[1], NULL, 0);
+	if (argc > 2)
+		rounds = strtoul(argv[2], NULL, 0);
+	if (size == 0 || rounds == 0)
+		errx(1, "usage: %s [SIZE [ROUNDS]]", program_invocation_short_name);
+
+	data = malloc(size);
+	if (!data)
+		err(1, "Could not allocate %zu bytes", size);
+	for (size_t i = 0; i < size; i++) {
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		data[i] = state;
+	}
+
+	null = fopen("/dev/null", "w");
+	if (!null)
+		err(1, "Could not open /dev/null");
+
+	for (unsigned int round = 0; round < rounds; round++) {
+		uint64_t opos = 0, npos = 0;
+		size_t off = 0;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		/*
+		 * Alternate ops the way a real diff does, with lengths that
+		 * don't line up with the 16 byte rows.
+		 */
+		for (unsigned int i = 0; off < size; i++) {
+			hexdiff_op_t op = (hexdiff_op_t)(i % 3);
+			size_t len = MIN(size - off, 4093 + (i % 7) * 11);
+
+			fhexdifff(null, "", op, &opos, &npos, data + off, len,
+				  op == DELETE ? red : op == COPY ? blue : green);
+			off += len;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		tssub(&end, &start, &elapsed);
+		best = MIN(best, (uint64_t)elapsed.tv_sec * NSEC_PER_SEC +
+				 elapsed.tv_nsec);
+	}
+
+	printf("%s: UNC_DEBUG_LEVEL=%d %zu bytes best of %u: %.3fs %.2f MB/s\n",
+	       program_invocation_short_name, UNC_DEBUG_LEVEL, size, rounds,
+	       best / 1e9, (size / 1e6) / (best / 1e9));
+
+	fclose(null);
+	free(data);
+	return 0;
+}
+
+// vim:fenc=utf-8:tw=75:noet
@@ -7,13 +7,21 @@
 #include "bindiff.h"
 
 #include <getopt.h>
+#include <pthread.h>
+#include <sys/random.h>
 #include <xdiff.h>
 
+/*
+ * How many hunks the differ can get ahead of the renderer by.
+ */
+#define PIPELINE_DEPTH 4096
+
 struct palette {
 	struct color normal;
 	struct color delete;
 	struct color copy;
 	struct color insert;
+	struct color ref;
 };
 
 static struct palette palette = {
@@ -21,9 +29,50 @@ static struct palette palette = {
 	.delete = { .attr = no_attr_change, .bg = white, .fg = red },
 	.copy = { .attr = no_attr_change, .bg = white, .fg = blue },
 	.insert = { .attr = no_attr_change, .bg = white, .fg = green },
+	.ref = { .attr = no_attr_change, .bg = white, .fg = magenta },
 };
 
 int verbose = 1;
+static bool interactive = false;
+static bool timings = false;
+static bool mem_report_enabled = false;
+static unsigned int repeat = 1;
+static char **ref_files = NULL;
+static int n_refs = 0;
+static bool make_patch_enabled = false;
+static bool apply_enabled = false;
+static bool format_set = false;
+static patch_format_t patch_format = PATCH_NATIVE;
+static int patch_filter = XDL_BCJ_NONE;
+static bool filter_set = false;
+static bool elf_mode = false;
+static unsigned int jobs = 0;
+static bool uring = false;
+static bool pipeline = false;
+static bool reflink = false;
+static bool in_place = false;
+static bool selfref = false;
+static long rabin_window = 0;
+static uint64_t rabin_poly = 0;
+
+enum {
+	OPT_APPLY = 0x100,
+	OPT_ELF,
+	OPT_FILTER,
+	OPT_FORMAT,
+	OPT_IN_PLACE,
+	OPT_MAKE_PATCH,
+	OPT_MEM_REPORT,
+	OPT_PIPELINE,
+	OPT_RABIN_POLY,
+	OPT_RABIN_WINDOW,
+	OPT_REF,
+	OPT_REFLINK,
+	OPT_REPEAT,
+	OPT_SELF,
+	OPT_TIMINGS,
+	OPT_URING,
+};
 
 static void NORETURN
 usage(int ret)
@@ -31,15 +80,61 @@ usage(int ret)
 	FILE *out = ret == 0 ? stdout : stderr;
 	fprintf(out,
 		"Usage: %s [OPTION...] FILE FILE\n"
+		"       %s --apply [OPTION...] FILE PATCH\n"
+		"       %s --make-patch --self [OPTION...] [FILE] FILE\n"
+		"       %s --apply --self [OPTION...] [FILE] PATCH\n"
 		"Help options:\n"
+		"      --apply                       Apply PATCH to FILE, write the result\n"
+		"                                    to stdout\n"
 		"  -d DIFFER, --differ DIFFER        Use DIFFER diff algorithm\n"
 		"                                    \"list\" shows options,\n"
 		"                                    * denotes the default\n"
+		"      --elf                         Diff ELF files a section at a time\n"
+		"      --filter FILTER               Filter branches in machine code with\n"
+		"                                    --make-patch and --apply: *none,\n"
+		"                                    x86, arm64, or auto from the ELF\n"
+		"                                    header\n"
+		"      --format FORMAT               Write --make-patch output as FORMAT,\n"
+		"                                    *native or vcdiff\n"
+		"      --in-place                    With --make-patch, write a patch\n"
+		"                                    that --apply --in-place applies\n"
+		"                                    over FILE itself, which can be\n"
+		"                                    resumed if it's stopped\n"
+		"  -i, --interactive                 Browse the diff in a pager\n"
+		"  -j N, --jobs N                    Diff up to N sections at once with\n"
+		"                                    --elf, or apply on N threads with\n"
+		"                                    --apply, default one per CPU\n"
+		"      --make-patch                  Write a patch to stdout instead of\n"
+		"                                    showing the diff\n"
+		"      --mem-report                  Report libxdiff memory use on stderr\n"
+		"      --pipeline                    Show the diff while it's still being\n"
+		"                                    made\n"
 		"  -q                                Be less verbose\n"
+		"      --rabin-poly POLY             Use the irreducible polynomial POLY,\n"
+		"                                    in hex, for xrabdiff's fingerprints,\n"
+		"                                    or \"random\" for a new one\n"
+		"      --rabin-window N              Use an N byte window with xrabdiff\n"
+		"                                    and xcdcdiff:\n"
+		"                                    16, *20, 32, 64 or 128, or with\n"
+		"                                    xgeardiff: 16, *32 or 64\n"
+		"      --ref FILE                    Also copy from FILE, may be repeated\n"
+		"      --reflink                     With --apply, have the kernel do big\n"
+		"                                    copies from FILE and --ref files,\n"
+		"                                    sharing blocks where it can\n"
+		"      --repeat N                    Run N times (implies --timings)\n"
+		"      --self                        With --make-patch, also copy from\n"
+		"                                    the part of the target that's\n"
+		"                                    already been made; FILE may be\n"
+		"                                    empty, or left out here and with\n"
+		"                                    --apply\n"
+		"      --timings                     Report per-phase timings on stderr\n"
+		"      --uring                       Read files with io_uring instead of\n"
+		"                                    mapping them\n"
 		"  -v                                Be more verbose\n"
 		"  -?, --help                        Show this help message\n"
 		"      --usage                       Display brief usage message\n",
-		program_invocation_short_name);
+		program_invocation_short_name, program_invocation_short_name,
+		program_invocation_short_name, program_invocation_short_name);
 	exit(ret);
 }
 
@@ -146,36 +241,40 @@ count_diffs(const char *buf0, const char *buf1, const size_t sz)
 	((((uint64_t)(val)) >= ((uint64_t)(start))) && \
 	 (((uint64_t)(val)) < (((uint64_t)(start)) + ((uint64_t)(size)))))
 
-struct hunk {
-        struct color *color;
-        hexdiff_op_t op;
-        size_t apos, bpos;
-        char *buf;
-        size_t sz;
-};
-
 struct priv {
 	char *files[2];
 	mmbuffer_t *mmb1, *mmb2;
+	mmbuffer_t *srcs;
+	int nsrc;
+	struct differ *differ;
 	size_t apos, bpos;
 	bool first;
 	size_t opos;
-	struct hunk *hunks;
+	struct differ_hunk *hunks;
 	size_t n_hunks;
 	size_t n_hunk_bufs;
+	struct queue *queue;
 };
 
 static void
 add_hunk(struct priv *priv, hexdiff_op_t op, off_t apos, off_t bpos, char *buf,
          size_t sz)
 {
-	struct hunk *hunk;
+	struct differ_hunk *hunk;
 
-	if (priv->n_hunks == priv->n_hunk_bufs) {
-		struct hunk *hunks;
+	if (priv->n_hunks == priv->n_hunk_bufs && priv->queue) {
+		/*
+		 * In a pipeline we only hold on to the newest hunk, which
+		 * collect_ref_copy() may still fix up; the one before it
+		 * can go on to be rendered.
+		 */
+		queue_push(priv->queue, &priv->hunks[0]);
+		priv->n_hunks = 0;
+	} else if (priv->n_hunks == priv->n_hunk_bufs) {
+		struct differ_hunk *hunks;
 
 		hunks = realloc(priv->hunks, (priv->n_hunk_bufs + 1024) *
-		                                     sizeof(struct hunk));
+		                                     sizeof(struct differ_hunk));
 		if (!hunks)
 			err(1, "Could not allocate memory");
 		//debug("allocated %d hunks (%zu total) at %p", 1024, priv->n_hunk_bufs + 1024, hunks);
@@ -187,14 +286,15 @@ add_hunk(struct priv *priv, hexdiff_op_t op, off_t apos, off_t bpos, char *buf,
 	hunk->op = op;
 	hunk->buf = buf;
 	hunk->sz = sz;
+	hunk->src = 0;
 	switch (op) {
 	case DELETE:
 		hunk->color = &palette.delete;
 		hunk->apos = apos;
 		priv->apos = apos + sz;
 		hunk->bpos = bpos;
-		debug("DELETE apos:0x%08lx->0x%08lx bpos:0x%08lx->0x%08lx", hunk->apos,
-		      priv->apos, hunk->bpos, priv->bpos);
+		trace(hunk_delete, "DELETE apos:0x%08lx->0x%08lx bpos:0x%08lx->0x%08lx",
+		      hunk->apos, priv->apos, hunk->bpos, priv->bpos);
 		break;
 	case COPY:
 		hunk->color = &palette.copy;
@@ -202,16 +302,16 @@ add_hunk(struct priv *priv, hexdiff_op_t op, off_t apos, off_t bpos, char *buf,
 		priv->apos = apos + sz;
 		hunk->bpos = bpos;
 		priv->bpos = bpos + sz;
-		debug("  COPY apos:0x%08lx->0x%08lx bpos:0x%08lx->0x%08lx", hunk->apos,
-		      priv->apos, hunk->bpos, priv->bpos);
+		trace(hunk_copy, "  COPY apos:0x%08lx->0x%08lx bpos:0x%08lx->0x%08lx",
+		      hunk->apos, priv->apos, hunk->bpos, priv->bpos);
 		break;
 	case INSERT:
 		hunk->color = &palette.insert;
 		hunk->apos = apos;
 		hunk->bpos = bpos;
 		priv->bpos = bpos + sz;
-		debug("INSERT apos:0x%08lx->0x%08lx bpos:0x%08lx->0x%08lx", hunk->apos,
-		      priv->apos, hunk->bpos, priv->bpos);
+		trace(hunk_insert, "INSERT apos:0x%08lx->0x%08lx bpos:0x%08lx->0x%08lx",
+		      hunk->apos, priv->apos, hunk->bpos, priv->bpos);
 		break;
 	case IGNORE:
 		break;
@@ -233,7 +333,7 @@ collect_insert(struct priv *priv, char *buf, size_t sz)
 	} else if (inside(buf, priv->mmb2->ptr, priv->mmb2->size)) {
 		bpos = buf - priv->mmb2->ptr;
 	}
-	debug("insert 0x%zx-0x%zx (0x%lx) from:%s",
+	trace(collect_insert, "insert 0x%zx-0x%zx (0x%lx) from:%s",
 	      apos, bpos, sz,
 	      inside(buf, priv->mmb1->ptr, priv->mmb1->size)   ? priv->files[0]
 	      : inside(buf, priv->mmb2->ptr, priv->mmb2->size) ? priv->files[1]
@@ -248,8 +348,8 @@ collect_insert(struct priv *priv, char *buf, size_t sz)
 static int
 collect_copy(struct priv *priv, size_t off, size_t sz)
 {
-	debug("copy 0x%zx-0x%zx (0x%lx) from:%s", off, off + sz, sz,
-	      priv->files[0]);
+	trace(collect_copy, "copy 0x%zx-0x%zx (0x%lx) from:%s", off, off + sz,
+	      sz, priv->files[0]);
 	//debug("priv:%p", priv);
 	//add_hunk(priv, IGNORE, NULL, 0);
 	size_t apos = off;
@@ -258,14 +358,38 @@ collect_copy(struct priv *priv, size_t off, size_t sz)
 			 priv->mmb1->ptr + priv->apos, apos - priv->apos);
 	}
 	add_hunk(priv, COPY, apos, priv->bpos,
-		 priv->mmb1->ptr + apos + off, sz);
+		 priv->mmb1->ptr + apos, sz);
 	return 0;
 }
 
+/*
+ * Copies from a --ref file don't move us along in the first file, so
+ * they never leave a DELETE gap behind them.
+ */
 static int
-collect(void *privp, mmbuffer_t *mmbuf, size_t count)
+collect_ref_copy(struct priv *priv, int src, size_t off, size_t sz)
+{
+	struct differ_hunk *hunk;
+	size_t apos = priv->apos;
+
+	if (src < 1 || src >= priv->nsrc ||
+	    off + sz > (size_t)priv->srcs[src].size)
+		errx(3, "bad copy from reference %d 0x%zx-0x%zx", src, off,
+		     off + sz);
+	trace(collect_copy, "copy 0x%zx-0x%zx (0x%lx) from:%s", off, off + sz,
+	      sz, ref_files[src - 1]);
+
+	add_hunk(priv, COPY, off, priv->bpos, priv->srcs[src].ptr + off, sz);
+	hunk = &priv->hunks[priv->n_hunks - 1];
+	hunk->src = src;
+	hunk->color = &palette.ref;
+	priv->apos = apos;
+	return 0;
+}
+
+static int
+collect_op(struct priv *priv, mmbuffer_t *mmbuf, size_t count)
 {
-	struct priv *priv = (struct priv *)privp;
 	int prev = 0;
 
 	//debug("priv:%p", priv);
@@ -281,6 +405,11 @@ collect(void *privp, mmbuffer_t *mmbuf, size_t count)
 		debug("adler32 is 0x%04x, size is 0x%x", *adler32, *size);
 		return 0;
 	}
+	if (count == 1 && mmbuf->size > 0 && mmbuf->ptr[0] == XDL_BDOP_SRC) {
+		debug("reference %d is %s", (uint8_t)mmbuf->ptr[1],
+		      ref_files[(uint8_t)mmbuf->ptr[1] - 1]);
+		return 0;
+	}
 
 	/*
 	 * for each transaction, we get either a direct or indirect
@@ -321,9 +450,9 @@ collect(void *privp, mmbuffer_t *mmbuf, size_t count)
 #endif
 			switch (p[0]) {
 			case XDL_BDOP_INSB:
-				return collect_insert(priv, &p[1], 1);
 			case XDL_BDOP_INS:
-				prev = p[0];
+				/* the data is always the next buffer */
+				prev = XDL_BDOP_INS;
 				break;
 			case XDL_BDOP_CPY:
 				prev = 0;
@@ -331,6 +460,11 @@ collect(void *privp, mmbuffer_t *mmbuf, size_t count)
 				off = *(uint32_t *)&p[1];
 				sz = *(uint32_t *)&p[5];
 				return collect_copy(priv, off, sz);
+			case XDL_BDOP_CPYS:
+				off = *(uint32_t *)&p[2];
+				sz = *(uint32_t *)&p[6];
+				return collect_ref_copy(priv, (uint8_t)p[1], off,
+							sz);
 			}
 			break;
 		}
@@ -338,33 +472,49 @@ collect(void *privp, mmbuffer_t *mmbuf, size_t count)
 	return 0;
 }
 
+static int
+collect(void *privp, mmbuffer_t *mmbuf, size_t count)
+{
+	struct priv *priv = (struct priv *)privp;
+	size_t bpos = priv->bpos;
+	int rc;
+
+	timing_start(TIMING_COLLECT);
+	rc = collect_op(priv, mmbuf, count);
+	timing_stop(TIMING_COLLECT, priv->bpos - bpos);
+	return rc;
+}
+
 static void
 collect_diff(struct priv *priv)
 {
 	xdemitcb_t emitcb = { .priv = (void *)priv, .outf = collect };
-	bdiffparam_t bdp = {
-		16,
-	};
 	int rc;
 
-	rc = xdl_bdiff_mb(priv->mmb1, priv->mmb2, &bdp, &emitcb);
+	rc = priv->differ->diff(priv->srcs, priv->nsrc, priv->mmb2, &emitcb);
 	if (rc < 0)
 		err(2, "could not bdiff files");
 }
 
+static bool
+swap_hunks(struct differ_hunk *thishunk, struct differ_hunk *nexthunk)
+{
+	return thishunk->op == INSERT && nexthunk->op == DELETE &&
+	       thishunk->apos == nexthunk->apos;
+}
+
 static void
 process_diff(struct priv *priv)
 {
 	for (size_t i = 0; i < priv->n_hunks; i++) {
-		struct hunk *thishunk = &priv->hunks[i];
-		struct hunk tmp;
+		struct differ_hunk *thishunk = &priv->hunks[i];
+		struct differ_hunk tmp;
 
 
 		if (i + 1 < priv->n_hunks) {
-			struct hunk *nexthunk = &priv->hunks[i + 1];
+			struct differ_hunk *nexthunk = &priv->hunks[i + 1];
 
-			if (thishunk->op == INSERT && nexthunk->op == DELETE &&
-			    thishunk->apos == nexthunk->apos) {
+			if (swap_hunks(thishunk, nexthunk)) {
 				memcpy(&tmp, nexthunk, sizeof(tmp));
 				memcpy(nexthunk, thishunk, sizeof(tmp));
 				memcpy(thishunk, &tmp, sizeof(tmp));
@@ -394,66 +544,151 @@ process_diff(struct priv *priv)
 }
 
 static void
-emit_diff(struct priv *priv)
+emit_hunk(struct differ_hunk *hunk)
 {
-	for (size_t i = 0; i < priv->n_hunks; i++) {
-		struct hunk *hunk = &priv->hunks[i];
-		size_t apos, bpos;
-		switch (hunk->op) {
-		case DELETE:
-			apos = hunk->apos;
-			bpos = 0xffffffff;
-			debug("DELETE apos:0x%08lx bpos:0x%08lx sz:0x%08lx",
-			      apos, bpos, hunk->sz);
-			break;
-		case COPY:
-			apos = hunk->apos;
-			bpos = hunk->bpos;
-			debug("  COPY apos:0x%08lx bpos:0x%08lx sz:0x%08lx",
-			      apos, bpos, hunk->sz);
-			break;
-		case INSERT:
-			apos = 0xffffffff;
-			bpos = hunk->bpos;
-			debug("INSERT apos:0x%08lx bpos:0x%08lx sz:0x%08lx",
-			      apos, bpos, hunk->sz);
-			break;
-		default:
-			break;
-		}
+	size_t apos, bpos;
 
-		hexdiff(hunk->op, &apos, &bpos, hunk->buf, hunk->sz,
-			hunk->color->fg);
+	switch (hunk->op) {
+	case DELETE:
+		apos = hunk->apos;
+		bpos = 0xffffffff;
+		debug("DELETE apos:0x%08lx bpos:0x%08lx sz:0x%08lx",
+		      apos, bpos, hunk->sz);
+		break;
+	case COPY:
+		apos = hunk->apos;
+		bpos = hunk->bpos;
+		debug("  COPY apos:0x%08lx bpos:0x%08lx sz:0x%08lx",
+		      apos, bpos, hunk->sz);
+		break;
+	case INSERT:
+		apos = 0xffffffff;
+		bpos = hunk->bpos;
+		debug("INSERT apos:0x%08lx bpos:0x%08lx sz:0x%08lx",
+		      apos, bpos, hunk->sz);
+		break;
+	default:
+		break;
 	}
+
+	hexdiff(hunk->op, &apos, &bpos, hunk->buf, hunk->sz, hunk->color->fg);
+}
+
+static void
+emit_diff(struct priv *priv)
+{
+	for (size_t i = 0; i < priv->n_hunks; i++)
+		emit_hunk(&priv->hunks[i]);
 	//hexdiff(COPY, &priv->apos, &priv->bpos, priv->mmb1->ptr+priv->apos+off, sz);
 	//hexdiff(INSERT, &priv->apos, &priv->bpos, buf, sz);
 }
 
+static void *
+pipeline_collect(void *privp)
+{
+	struct priv *priv = privp;
+
+	collect_diff(priv);
+	if (priv->n_hunks)
+		queue_push(priv->queue, &priv->hunks[0]);
+	queue_close(priv->queue);
+	return NULL;
+}
+
+/*
+ * The differ and collecting its ops get a thread of their own, and the
+ * hunks come over to us to be reordered and rendered as they're made,
+ * so the output starts long before the diff is done.  Reordering only
+ * ever swaps neighbours, so we only have to hold on to one hunk.
+ */
+static void
+pipeline_diff(struct priv *priv)
+{
+	struct differ_hunk held, hunk;
+	bool have = false;
+	pthread_t thread;
+	int rc;
+
+	priv->queue = queue_new(PIPELINE_DEPTH, sizeof(struct differ_hunk));
+	if (!priv->queue)
+		err(1, "Could not allocate memory");
+	rc = pthread_create(&thread, NULL, pipeline_collect, priv);
+	if (rc) {
+		errno = rc;
+		err(1, "Could not start the differ thread");
+	}
+
+	while (queue_pop(priv->queue, &hunk)) {
+		if (!have) {
+			held = hunk;
+			have = true;
+		} else if (swap_hunks(&held, &hunk)) {
+			emit_hunk(&hunk);
+		} else {
+			emit_hunk(&held);
+			held = hunk;
+		}
+	}
+	if (have)
+		emit_hunk(&held);
+
+	pthread_join(thread, NULL);
+	queue_free(priv->queue);
+	priv->queue = NULL;
+}
+
 static void
-do_diff(char *file[2], mmbuffer_t *mmb1, mmbuffer_t *mmb2)
+do_diff(struct differ *differ, char *file[2], mmbuffer_t *srcs, int nsrc,
+	mmbuffer_t *mmb2)
 {
 	int rc;
+	size_t hunkbytes = 0;
 	struct priv priv = {
 		.files = { file[0], file[1] },
 		.first = true,
-		.mmb1 = mmb1,
+		.mmb1 = &srcs[0],
 		.mmb2 = mmb2,
+		.srcs = srcs,
+		.nsrc = nsrc,
+		.differ = differ,
 	};
+	mmbuffer_t *mmb1 = &srcs[0];
 
-	priv.hunks = calloc(1024, sizeof(struct hunk));
+	priv.n_hunk_bufs = pipeline ? 1 : 1024;
+	priv.hunks = calloc(priv.n_hunk_bufs, sizeof(struct differ_hunk));
 	if (!priv.hunks)
 		err(1, "Could not allocate memory");
 	// debug("allocated %d hunks (%zu total) at %p", 1024, priv.n_hunk_bufs + 1024, priv.hunks);
-	priv.n_hunk_bufs = 1024;
 
 	debug("mmb1:%p = { %p-%p (0x%lx) }", mmb1, mmb1->ptr,
 	      mmb1->ptr + mmb1->size, mmb1->size);
 	debug("mmb2:%p = { %p-%p (0x%lx) }", mmb2, mmb2->ptr,
 	      mmb2->ptr + mmb2->size, mmb2->size);
 
+	if (pipeline) {
+		pipeline_diff(&priv);
+		free(priv.hunks);
+		return;
+	}
+
 	collect_diff(&priv);
+
+	for (size_t i = 0; i < priv.n_hunks; i++)
+		hunkbytes += priv.hunks[i].sz;
+
+	timing_start(TIMING_REORDER);
 	process_diff(&priv);
-	emit_diff(&priv);
+	timing_stop(TIMING_REORDER, hunkbytes);
+
+	timing_start(TIMING_RENDER);
+	if (interactive) {
+		rc = view_diff(priv.hunks, priv.n_hunks);
+		if (rc < 0)
+			err(1, "Could not run the interactive viewer");
+	} else {
+		emit_diff(&priv);
+	}
+	timing_stop(TIMING_RENDER, hunkbytes);
 
 	free(priv.hunks);
 	priv.hunks = NULL;
@@ -461,14 +696,68 @@ do_diff(char *file[2], mmbuffer_t *mmb1, mmbuffer_t *mmb2)
 	priv.n_hunk_bufs = 0;
 }
 
+/*
+ * Everything is set reading at once, but we only wait for the sources
+ * here.  The differs index those before they look at the target, so if
+ * nothing else needs the target first, it can keep coming in while
+ * that happens.
+ */
+static void
+read_files(struct reader *rd, char *files[2], mmbuffer_t *srcs,
+	   mmbuffer_t *tgt, bool overlap)
+{
+	int n;
+
+	if (reader_add(rd, files[0], &srcs[0]) < 0)
+		err(1, "Could not open \"%s\"", files[0]);
+	for (int r = 0; r < n_refs; r++) {
+		if (reader_add(rd, ref_files[r], &srcs[r + 1]) < 0)
+			err(1, "Could not open \"%s\"", ref_files[r]);
+	}
+	n = reader_add(rd, files[1], tgt);
+	if (n < 0)
+		err(1, "Could not open \"%s\"", files[1]);
+	if (reader_start(rd) < 0)
+		err(1, "Could not start reading");
+
+	for (int r = 0; r <= n_refs; r++) {
+		if (reader_wait(rd, r) < 0)
+			err(1, "Could not read \"%s\"",
+			    r ? ref_files[r - 1] : files[0]);
+	}
+	if (overlap)
+		reader_overlap(rd, n);
+	else if (reader_wait(rd, n) < 0)
+		err(1, "Could not read \"%s\"", files[1]);
+}
+
 int
 main(int argc, char *argv[])
 {
-	char *sopts = "qduv?";
+	char *sopts = "qd:ij:uv?";
 	struct option lopts[] = { { "help", no_argument, 0, '?' },
 		                  { "quiet", no_argument, 0, 'q' },
+		                  { "apply", no_argument, 0, OPT_APPLY },
 				  { "differ", required_argument, 0, 'd' },
+		                  { "elf", no_argument, 0, OPT_ELF },
+		                  { "filter", required_argument, 0, OPT_FILTER },
+		                  { "format", required_argument, 0, OPT_FORMAT },
+		                  { "in-place", no_argument, 0, OPT_IN_PLACE },
+		                  { "interactive", no_argument, 0, 'i' },
+		                  { "jobs", required_argument, 0, 'j' },
+		                  { "make-patch", no_argument, 0, OPT_MAKE_PATCH },
+		                  { "mem-report", no_argument, 0, OPT_MEM_REPORT },
+		                  { "pipeline", no_argument, 0, OPT_PIPELINE },
+		                  { "rabin-poly", required_argument, 0, OPT_RABIN_POLY },
+		                  { "rabin-window", required_argument, 0,
+		                    OPT_RABIN_WINDOW },
+		                  { "ref", required_argument, 0, OPT_REF },
+		                  { "reflink", no_argument, 0, OPT_REFLINK },
+		                  { "repeat", required_argument, 0, OPT_REPEAT },
+		                  { "self", no_argument, 0, OPT_SELF },
+		                  { "timings", no_argument, 0, OPT_TIMINGS },
 		                  { "unified", no_argument, 0, 'u' },
+		                  { "uring", no_argument, 0, OPT_URING },
 		                  { "usage", no_argument, 0, 0 },
 		                  { "verbose", no_argument, 0, 'v' },
 		                  { 0, 0, 0, 0 } };
@@ -476,9 +765,15 @@ main(int argc, char *argv[])
 	int i = 0;
 	char *files[] = { NULL, NULL };
 	int fds[] = { -1, -1 };
+	int *ref_fds = NULL;
 	int rc;
 	struct differ *differ = NULL;
-	mmbuffer_t mmb1 = { 0, }, mmb2 = { 0, };
+	struct reader *rd = NULL;
+	bool overlap;
+	bool no_source = false;
+	mmbuffer_t *srcs = NULL;
+	mmbuffer_t mmb2 = { 0, };
+	size_t srcsize = 0, tgtsize = 0;
 
 	while ((c = getopt_long(argc, argv, sopts, lopts, &i)) != -1) {
 		debug("c:%c optarg:\"%s\"\n", c, optarg);
@@ -491,16 +786,157 @@ main(int argc, char *argv[])
 		case 'd':
 			if (!strcmp(optarg, "xbdiff")) {
 				differ = &xbdiff;
+			} else if (!strcmp(optarg, "xcdcdiff")) {
+				differ = &xcdcdiff;
+			} else if (!strcmp(optarg, "xgeardiff")) {
+				differ = &xgeardiff;
 			} else if (!strcmp(optarg, "xrabdiff")) {
 				differ = &xrabdiff;
 			} else if (!strcmp(optarg, "help") ||
 				   !strcmp(optarg, "list")) {
-				printf("differs: *xbdiff xrabdiff\n");
+				printf("differs: *xbdiff xcdcdiff xgeardiff xrabdiff\n");
 				exit(0);
 			} else {
 				warnx("unknown differ \"%s\"", optarg);
 				usage(EXIT_FAILURE);
 			}
+			break;
+		case 'i':
+			interactive = true;
+			break;
+		case 'j': {
+			char *end = NULL;
+			unsigned long n;
+
+			errno = 0;
+			n = strtoul(optarg, &end, 0);
+			if (errno || !end || *end || n < 1 || n > UINT_MAX) {
+				warnx("invalid job count \"%s\"", optarg);
+				usage(EXIT_FAILURE);
+			}
+			jobs = n;
+			break;
+		}
+		case OPT_APPLY:
+			apply_enabled = true;
+			break;
+		case OPT_ELF:
+			elf_mode = true;
+			break;
+		case OPT_FILTER:
+			if (!strcmp(optarg, "none")) {
+				patch_filter = XDL_BCJ_NONE;
+			} else if (!strcmp(optarg, "x86")) {
+				patch_filter = XDL_BCJ_X86;
+			} else if (!strcmp(optarg, "arm64")) {
+				patch_filter = XDL_BCJ_ARM64;
+			} else if (!strcmp(optarg, "auto")) {
+				patch_filter = PATCH_FILTER_AUTO;
+			} else {
+				warnx("unknown filter \"%s\"", optarg);
+				usage(EXIT_FAILURE);
+			}
+			filter_set = true;
+			break;
+		case OPT_FORMAT:
+			if (!strcmp(optarg, "native")) {
+				patch_format = PATCH_NATIVE;
+			} else if (!strcmp(optarg, "vcdiff")) {
+				patch_format = PATCH_VCDIFF;
+			} else {
+				warnx("unknown patch format \"%s\"", optarg);
+				usage(EXIT_FAILURE);
+			}
+			format_set = true;
+			break;
+		case OPT_IN_PLACE:
+			in_place = true;
+			break;
+		case OPT_MAKE_PATCH:
+			make_patch_enabled = true;
+			break;
+		case OPT_REPEAT: {
+			char *end = NULL;
+			unsigned long n;
+
+			errno = 0;
+			n = strtoul(optarg, &end, 0);
+			if (errno || !end || *end || n < 1 || n > UINT_MAX) {
+				warnx("invalid repeat count \"%s\"", optarg);
+				usage(EXIT_FAILURE);
+			}
+			repeat = n;
+			timings = true;
+			break;
+		}
+		case OPT_MEM_REPORT:
+			mem_report_enabled = true;
+			break;
+		case OPT_PIPELINE:
+			pipeline = true;
+			break;
+		case OPT_RABIN_POLY:
+			if (!strcmp(optarg, "random")) {
+				uint64_t seed;
+
+				if (getrandom(&seed, sizeof(seed), 0) !=
+				    sizeof(seed))
+					err(1, "Could not get a random seed");
+				xdl_rabin_polygen(seed, &rabin_poly);
+			} else {
+				char *end = NULL;
+
+				errno = 0;
+				rabin_poly = strtoull(optarg, &end, 16);
+				if (errno || !end || *end ||
+				    xdl_rabin_polycheck(rabin_poly) < 0) {
+					warnx("invalid rabin polynomial \"%s\"",
+					      optarg);
+					usage(EXIT_FAILURE);
+				}
+			}
+			break;
+		case OPT_RABIN_WINDOW: {
+			char *end = NULL;
+			unsigned long n;
+
+			errno = 0;
+			n = strtoul(optarg, &end, 0);
+			if (errno || !end || *end ||
+			    (n != 16 && n != 20 && n != 32 && n != 64 &&
+			     n != 128)) {
+				warnx("invalid rabin window size \"%s\"", optarg);
+				usage(EXIT_FAILURE);
+			}
+			rabin_window = n;
+			break;
+		}
+		case OPT_REF: {
+			char **new_refs;
+
+			if (n_refs + 1 >= XDL_BDIFF_MAXSRC)
+				errx(1, "too many --ref files, the limit is %d",
+				     XDL_BDIFF_MAXSRC - 1);
+			new_refs = realloc(ref_files,
+					   (n_refs + 1) * sizeof(*ref_files));
+			if (!new_refs)
+				err(1, "Could not allocate memory");
+			ref_files = new_refs;
+			ref_files[n_refs++] = optarg;
+			break;
+		}
+		case OPT_REFLINK:
+			reflink = true;
+			break;
+		case OPT_SELF:
+			selfref = true;
+			break;
+		case OPT_TIMINGS:
+			timings = true;
+			break;
+		case OPT_URING:
+			uring = true;
+			break;
 		case 'u':
 			/* for compatibility */
 			break;
@@ -519,9 +955,12 @@ main(int argc, char *argv[])
 		}
 	}
 	unc_set_debug(NULL, verbose > 1);
+	if (rabin_poly)
+		debug("rabin polynomial 0x%"PRIx64"\n", rabin_poly);
+	xrabdiff_set_params(rabin_window, rabin_poly);
 
-	if (!differ)
-		differ = &xbdiff;
+	if (interactive && !isatty(STDIN_FILENO) && !isatty(STDOUT_FILENO))
+		errx(1, "--interactive needs a terminal");
 
 	for (; optind < argc; optind++) {
 		int x;
@@ -536,23 +975,225 @@ main(int argc, char *argv[])
 			usage(EXIT_FAILURE);
 		}
 	}
+	/*
+	 * With --self a target can be made out of nothing but itself, so
+	 * FILE can be left out, and then it's the same as an empty one.
+	 */
+	if (selfref && files[0] && !files[1]) {
+		files[1] = files[0];
+		files[0] = "/dev/null";
+		no_source = true;
+	}
 	if (!files[0] || !files[1]) {
 		warnx("too few arguments");
 		usage(EXIT_FAILURE);
 	}
 
-	rc = get_map(files[0], &fds[0], &mmb1);
-	if (rc < 0)
-		err(1, "Could not open and map \"%s\"", files[0]);
+	if (interactive && repeat > 1)
+		errx(1, "--repeat can't be used with --interactive");
+	if (make_patch_enabled && apply_enabled)
+		errx(1, "--make-patch can't be used with --apply");
+	if ((make_patch_enabled || apply_enabled) && (interactive || repeat > 1))
+		errx(1, "--%s can't be used with --interactive or --repeat",
+		     apply_enabled ? "apply" : "make-patch");
+	if (format_set && !make_patch_enabled)
+		errx(1, "--format needs --make-patch");
+	if (filter_set && !make_patch_enabled && !apply_enabled)
+		errx(1, "--filter needs --make-patch or --apply");
+	if (patch_format == PATCH_VCDIFF && n_refs > 0)
+		errx(1, "VCDIFF patches can't use --ref files");
+	if (jobs && !elf_mode && !apply_enabled)
+		errx(1, "--jobs needs --elf or --apply");
+	if (reflink && !apply_enabled)
+		errx(1, "--reflink needs --apply");
+	/*
+	 * The kernel copies from the files, and with --uring we've read
+	 * them and let them go.
+	 */
+	if (reflink && uring)
+		errx(1, "--reflink can't be used with --uring");
+	/*
+	 * Only xrabdiff and the differs built on it have a window or a
+	 * polynomial.  With --elf and no differ picked, some sections get
+	 * xrabdiff, but otherwise the default is xbdiff.
+	 */
+	if ((rabin_window || rabin_poly) &&
+	    (apply_enabled || differ == &xbdiff || (!differ && !elf_mode)))
+		errx(1, "--rabin-%s can't be used with %s",
+		     rabin_window ? "window" : "poly",
+		     apply_enabled ? "--apply" : "xbdiff");
+	if (differ == &xgeardiff && rabin_poly)
+		errx(1, "--rabin-poly can't be used with xgeardiff");
+	if (differ == &xgeardiff && rabin_window && rabin_window != 16 &&
+	    rabin_window != 32 && rabin_window != 64)
+		errx(1, "xgeardiff needs a --rabin-window of 16, 32 or 64");
+	if (pipeline && (make_patch_enabled || apply_enabled || interactive))
+		errx(1, "--pipeline can't be used with --%s",
+		     make_patch_enabled ? "make-patch" :
+		     apply_enabled ? "apply" : "interactive");
+	if (in_place && !make_patch_enabled && !apply_enabled)
+		errx(1, "--in-place needs --make-patch or --apply");
+	/*
+	 * The file is rewritten as it's read, so there's nothing else
+	 * to copy from, and nothing to filter it or read it with.
+	 */
+	if (in_place && (format_set || filter_set || n_refs > 0 || reflink ||
+			 uring))
+		errx(1, "--in-place can't be used with --%s",
+		     format_set ? "format" : filter_set ? "filter" :
+		     n_refs > 0 ? "ref" : reflink ? "reflink" : "uring");
+	if (in_place && no_source)
+		errx(1, "--in-place needs a FILE to patch");
+	if (selfref && !make_patch_enabled && !apply_enabled)
+		errx(1, "--self needs --make-patch or --apply");
+	/*
+	 * Sections are diffed one by one, so there's no target
+	 * before them to copy from.
+	 */
+	if (selfref && elf_mode)
+		errx(1, "--elf can't be used with --self");
+	if (selfref && make_patch_enabled)
+		differ_flags |= XDL_BDF_SELFREF;
+	if (in_place)
+		patch_format = PATCH_INPLACE;
+	if (elf_mode && (apply_enabled || n_refs > 0))
+		errx(1, "--elf can't be used with --%s",
+		     apply_enabled ? "apply" : "ref");
+	/*
+	 * The filter moves bytes around, so the filtered files don't have
+	 * sections where their headers say they are.
+	 */
+	if (elf_mode && patch_filter != XDL_BCJ_NONE)
+		errx(1, "--elf can't be used with --filter");
+	/*
+	 * The memory report is broken down by phase, so it needs the
+	 * phase tracking even if we aren't printing times.
+	 */
+	if (mem_report_enabled)
+		mem_init();
+	if ((timings || mem_report_enabled) && timing_init(repeat) < 0)
+		err(1, "Could not set up timings");
 
-	rc = get_map(files[1], &fds[1], &mmb2);
-	if (rc < 0)
-		err(1, "Could not open and map \"%s\"", files[1]);
+	if (elf_mode) {
+		/*
+		 * Phases are tracked for the whole process, so with timings
+		 * or the memory report the sections go one at a time.
+		 */
+		if (timings || mem_report_enabled)
+			jobs = 1;
+		else if (!jobs)
+			jobs = MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+		differ = elf_differ(differ, jobs);
+	} else if (!differ) {
+		differ = &xbdiff;
+	}
+	if (apply_enabled && !jobs)
+		jobs = MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
 
-	do_diff(files, &mmb1, &mmb2);
+	/*
+	 * Timings are kept for the whole process, so with them the stages
+	 * have to take turns.
+	 */
+	if (timings || mem_report_enabled)
+		pipeline = false;
+
+	/*
+	 * Only plain diffs look at nothing but the sources before the
+	 * differ starts scanning, and timings need the phase hook.
+	 */
+	overlap = !elf_mode && !apply_enabled &&
+		  patch_filter == XDL_BCJ_NONE && !timings &&
+		  !mem_report_enabled;
+
+	srcs = calloc(n_refs + 1, sizeof(*srcs));
+	ref_fds = calloc(n_refs + 1, sizeof(*ref_fds));
+	if (!srcs || !ref_fds)
+		err(1, "Could not allocate memory");
+
+	if (uring) {
+		rd = reader_new();
+		if (!rd)
+			err(1, "Could not allocate memory");
+	}
+
+	for (unsigned int run = 0; run < repeat; run++) {
+		timing_start(TIMING_MAP);
+		if (uring) {
+			read_files(rd, files, srcs, &mmb2, overlap);
+		} else if (!(apply_enabled && in_place)) {
+			rc = get_map(files[0], &fds[0], &srcs[0]);
+			if (rc < 0)
+				err(1, "Could not open and map \"%s\"",
+				    files[0]);
+
+			for (int r = 0; r < n_refs; r++) {
+				rc = get_map(ref_files[r], &ref_fds[r + 1],
+					     &srcs[r + 1]);
+				if (rc < 0)
+					err(1, "Could not open and map \"%s\"",
+					    ref_files[r]);
+			}
+		}
+		if (!uring) {
+			rc = get_map(files[1], &fds[1], &mmb2);
+			if (rc < 0)
+				err(1, "Could not open and map \"%s\"",
+				    files[1]);
+		}
+		srcsize = 0;
+		for (int r = 0; r <= n_refs; r++)
+			srcsize += srcs[r].size;
+		timing_stop(TIMING_MAP, srcsize + mmb2.size);
+		tgtsize = mmb2.size;
+
+		if (make_patch_enabled) {
+			rc = make_patch(differ, patch_format, patch_filter,
+					srcs, n_refs + 1, &mmb2, STDOUT_FILENO);
+			if (rc < 0)
+				err(2, "could not make a patch");
+		} else if (apply_enabled && in_place) {
+			/*
+			 * FILE is rewritten where it is, so it isn't mapped;
+			 * the patch is all we hold onto.
+			 */
+			rc = apply_inplace(files[0], &mmb2);
+			if (rc < 0)
+				errx(2, "could not apply \"%s\" to \"%s\"",
+				     files[1], files[0]);
+		} else if (apply_enabled) {
+			ref_fds[0] = fds[0];
+			rc = apply_patch(srcs, n_refs + 1, &mmb2,
+					 patch_filter, STDOUT_FILENO, jobs,
+					 reflink ? ref_fds : NULL);
+			if (rc < 0)
+				errx(2, "could not apply \"%s\" to \"%s\"",
+				     files[1], files[0]);
+		} else {
+			do_diff(differ, files, srcs, n_refs + 1, &mmb2);
+		}
+
+		if (uring) {
+			reader_put(rd);
+		} else {
+			if (fds[0] >= 0)
+				put_map(fds[0], &srcs[0]);
+			for (int r = 0; r < n_refs; r++)
+				put_map(ref_fds[r + 1], &srcs[r + 1]);
+			put_map(fds[1], &mmb2);
+		}
+		timing_end_run();
+	}
+	reader_free(rd);
 
-	put_map(fds[0], &mmb1);
-	put_map(fds[1], &mmb2);
+	fflush(stdout);
+	if (timings)
+		timing_report(stderr);
+	if (mem_report_enabled)
+		mem_report(stderr, repeat, srcsize, tgtsize);
+	timing_fini();
+	free(ref_fds);
+	free(srcs);
+	free(ref_files);
 
 	return 0;
 
@@ -36,77 +36,87 @@ set_fg(char *buf, size_t bufsz, text_color_t color)
 	return snprintf(buf, bufsz, "\033[38:5:%dm", color);
 }
 
-#define snpf(fn, off_, b_, bs_, args_...)                          \
-	({                                                         \
-		ssize_t rc_;                                       \
-		debug("buf:%p bufsz:%zd off:%zd", b_, bs_, off_);  \
-		rc_ = fn(((b_) ? ((b_) + (off_)) : NULL),          \
-		         ((bs_) ? ((bs_) - (off_)) : 0), ##args_); \
-		if (rc_ >= 0)                                      \
-			(off) += rc_;                              \
-		rc_;                                               \
-	})
+/*
+ * The escapes wrapped around a colored string only depend on the color,
+ * so we build them once and keep them in a small per-thread cache
+ * instead of running three snprintf()s for every string we print.
+ */
+#define COLOR_ESC_CACHE_SIZE 16
+
+struct color_esc {
+	bool valid;
+	struct color color;
+	size_t prefixsz;
+	char prefix[32];
+};
+
+static const char color_suffix[] = "\x1b\x38";
+#define COLOR_SUFFIX_SZ (sizeof(color_suffix) - 1)
+
+static __thread struct color_esc color_esc_cache[COLOR_ESC_CACHE_SIZE];
+
+static const struct color_esc *
+get_color_esc(struct color color)
+{
+	unsigned int hash = ((unsigned int)color.attr * 31 +
+			     (unsigned int)color.bg) * 31 +
+			    (unsigned int)color.fg;
+	struct color_esc *esc;
+	size_t off = 0;
+
+	esc = &color_esc_cache[hash % COLOR_ESC_CACHE_SIZE];
+	if (esc->valid && esc->color.attr == color.attr &&
+	    esc->color.bg == color.bg && esc->color.fg == color.fg)
+		return esc;
+
+	off += save_cursor(esc->prefix + off, sizeof(esc->prefix) - off);
+	if (color.bg != no_color_change)
+		off += set_bg(esc->prefix + off, sizeof(esc->prefix) - off,
+			      color.bg);
+	if (color.fg != no_color_change)
+		off += set_fg(esc->prefix + off, sizeof(esc->prefix) - off,
+			      color.fg);
+
+	esc->color = color;
+	esc->prefixsz = off;
+	esc->valid = true;
+	return esc;
+}
 
+/*
+ * Format into buf, snprintf() style: we always return the length the
+ * whole thing needs, and only write what fits (with a NUL if there's
+ * room for one).  The format string is only expanded once.
+ */
 ssize_t
 vsncprintf(char *ibuf, size_t ibufsz, struct color color, char *fmt, va_list ap)
 {
-	va_list aq;
-	ssize_t rc = 0, sz;
-	off_t off = 0;
+	const struct color_esc *esc = get_color_esc(color);
 	char *buf = (ibuf && ibufsz) ? ibuf : NULL;
 	size_t bufsz = buf ? ibufsz : 0;
-	int tty;
-	size_t deltav = 0, deltah = 0;
-
-	tty = isatty(STDOUT_FILENO);
-	debug("isatty(%d):%d", STDOUT_FILENO, tty);
-	if (tty < 0)
-		tty = 0;
-	tty = 1;
-
-	if (tty) {
-		sz = snpf(save_cursor, off, buf, bufsz);
-		if (sz < 0)
-			return sz;
-		rc += sz;
+	size_t off;
+	int sz;
 
-		if (color.bg != no_color_change) {
-			sz = snpf(set_bg, off, buf, bufsz, color.bg);
-			if (sz < 0)
-				return sz;
-			rc += sz;
-		}
+	if (buf)
+		memcpy(buf, esc->prefix, MIN(esc->prefixsz, bufsz));
+	off = esc->prefixsz;
 
-		if (color.fg != no_color_change) {
-			sz = snpf(set_fg, off, buf, bufsz, color.fg);
-			if (sz < 0)
-				return sz;
-			rc += sz;
-		}
-	}
-
-	sz = snpf(vsnprintf, off, buf, bufsz, fmt, ap);
+	sz = vsnprintf(off < bufsz ? buf + off : NULL,
+		       off < bufsz ? bufsz - off : 0, fmt, ap);
 	if (sz < 0)
 		return sz;
-	rc += sz;
+	off += sz;
 
-	if (tty) {
-		sz = snpf(restore_cursor, off, buf, bufsz);
-		if (sz < 0)
-			return sz;
-		rc += sz;
+	if (off < bufsz)
+		memcpy(buf + off, color_suffix,
+		       MIN(COLOR_SUFFIX_SZ, bufsz - off));
+	off += COLOR_SUFFIX_SZ;
 
-#if 0
-		sz = snpf(snprintf, off, buf, bufsz, "\x1b[%zuC ", vis);
-		if (sz < 0)
-			return sz;
-		rc += sz;
-#endif
-	}
+	if (bufsz)
+		buf[MIN(off, bufsz - 1)] = '\0';
 
-	return rc;
+	return off;
 }
-#undef snpf
 
 ssize_t
 sncprintf(char *buf, size_t bufsz, struct color color, char *fmt, ...)
@@ -120,35 +130,71 @@ sncprintf(char *buf, size_t bufsz, struct color color, char *fmt, ...)
 	return rc;
 }
 
-ssize_t
-vfcprintf(FILE *out, struct color color, char *fmt, va_list ap)
+/*
+ * Scratch space for vfcprintf() and vascprintf().  It lives on the heap
+ * so huge strings don't eat the stack, and it's kept around between
+ * calls so the common case is no allocation at all.  If something
+ * enormous comes through we give the memory back afterwards rather than
+ * pinning it for the life of the thread.
+ */
+#define COLOR_BUF_MIN 4096
+#define COLOR_BUF_KEEP 65536
+
+static __thread char *color_buf;
+static __thread size_t color_bufsz;
+
+static ssize_t
+color_format(struct color color, char *fmt, va_list ap)
 {
 	ssize_t sz;
-	char *buf = NULL;
-	size_t bufsz = 0;
 	va_list aq;
 
+	if (!color_buf) {
+		color_buf = malloc(COLOR_BUF_MIN);
+		if (!color_buf)
+			return -1;
+		color_bufsz = COLOR_BUF_MIN;
+	}
+
 	va_copy(aq, ap);
-	sz = vsncprintf(buf, bufsz, color, fmt, ap);
-	va_end(ap);
-	if (sz <= 0) {
+	sz = vsncprintf(color_buf, color_bufsz, color, fmt, aq);
+	va_end(aq);
+	if (sz < 0 || (size_t)sz < color_bufsz)
 		return sz;
-	}
 
-	bufsz = sz + 1;
-	buf = alloca(sz);
-	if (!buf) {
-		errno = ENOMEM;
+	/*
+	 * Only when it didn't fit do we format a second time.
+	 */
+	free(color_buf);
+	color_bufsz = ALIGN((size_t)sz + 1, COLOR_BUF_MIN);
+	color_buf = malloc(color_bufsz);
+	if (!color_buf) {
+		color_bufsz = 0;
 		return -1;
 	}
 
-	memset(buf, 0, bufsz);
-	sz = vsncprintf(buf, bufsz, color, fmt, aq);
-	if (sz <= 0)
-		return sz;
+	return vsncprintf(color_buf, color_bufsz, color, fmt, ap);
+}
 
-	dhexdumpf("", buf, bufsz);
-	sz = fwrite(buf, 1, bufsz, out);
+static void
+color_format_done(void)
+{
+	if (color_bufsz > COLOR_BUF_KEEP) {
+		free(color_buf);
+		color_buf = NULL;
+		color_bufsz = 0;
+	}
+}
+
+ssize_t
+vfcprintf(FILE *out, struct color color, char *fmt, va_list ap)
+{
+	ssize_t sz;
+
+	sz = color_format(color, fmt, ap);
+	if (sz > 0)
+		sz = fwrite(color_buf, 1, sz, out);
+	color_format_done();
 	return sz;
 }
 
@@ -168,33 +214,27 @@ ssize_t
 vascprintf(char **ibuf, struct color color, char *fmt, va_list ap)
 {
 	ssize_t sz;
-	char *buf = NULL;
-	size_t bufsz = 0;
-	va_list aq;
+	char *buf;
 
 	if (!ibuf) {
 		errno = EINVAL;
 		return -1;
 	}
 
-	va_copy(aq, ap);
-	sz = vsncprintf(buf, bufsz, color, fmt, ap);
-	va_end(ap);
-	if (sz <= 0) {
-		if (sz == 0) {
-			*ibuf = NULL;
-		}
+	sz = color_format(color, fmt, ap);
+	if (sz < 0)
 		return sz;
-	}
 
-	bufsz = sz;
-	buf = calloc(1, sz);
+	buf = malloc(sz + 1);
 	if (!buf) {
+		color_format_done();
 		errno = ENOMEM;
 		return -1;
 	}
+	memcpy(buf, color_buf, sz + 1);
+	color_format_done();
 
-	sz = vsncprintf(buf, bufsz, color, fmt, aq);
+	*ibuf = buf;
 	return sz;
 }
 
@@ -10,6 +10,13 @@ PUBLIC bool unc_debug_arg_ = false;
 PUBLIC bool unc_debug_once_ = true;
 PUBLIC int unc_debug_pfx_len_ = 0;
 
+#ifdef UNC_HAVE_SDT
+#define trace_define_(name_)                                \
+	PUBLIC USED volatile unsigned short trace_semaphore_(name_) \
+		__attribute__((__section__(".probes")));
+UNC_PROBES(trace_define_)
+#endif
+
 /**
  * test a debug criterion
  *
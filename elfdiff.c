@@ -0,0 +1,677 @@
+// SPDX-License-Identifier: GPLv3-or-later
+/*
+ * elfdiff.c - diff ELF files a section at a time
+ * Copyright Peter Jones <pjones@redhat.com>
+ *
+ * Each file is cut into regions: one for every section that has bytes
+ * in the file, and one for every gap between them, which is where the
+ * ELF and program headers, padding, and the section header table live.
+ * A region of the new file gets diffed against the region of the same
+ * name in the old one, so a differ only ever has to index one section,
+ * and since the pairs don't depend on each other, they can be spread
+ * over threads.
+ *
+ * Each pair's ops are kept in a list, and once every pair is done the
+ * lists are stitched together in the new file's order into one diff of
+ * the whole files: copies get the old region's offset added, and
+ * inserts point back into the new file.  Whatever is downstream sees
+ * the same kind of ops any other differ makes.
+ */
+
+#include "bindiff.h"
+
+#include <elf.h>
+#include <pthread.h>
+#include <xdiff.h>
+
+/*
+ * Sections at least this big get xrabdiff even if they aren't code.
+ */
+#define ELF_RABDIFF_MIN (1024 * 1024)
+
+struct elf_region {
+	char *name;
+	size_t off;
+	size_t size;
+	bool exec;
+};
+
+struct elf_op {
+	uint8_t op;
+	size_t off;
+	size_t size;
+};
+
+struct elf_pair {
+	const char *name;
+	mmbuffer_t a, b;
+	size_t aoff, boff;
+	struct differ *differ;
+	const char *how;
+	struct elf_op *ops;
+	size_t n_ops;
+	size_t n_op_bufs;
+	bool first;
+	size_t copied;
+	size_t inserted;
+	double ms;
+	int rc;
+};
+
+struct elf_job {
+	struct elf_pair *pairs;
+	size_t *order;
+	size_t n_pairs;
+	size_t next;
+};
+
+struct elf_file {
+	const unsigned char *ptr;
+	size_t size;
+	bool is64;
+	bool msb;
+};
+
+struct stitch {
+	xdemitcb_t *ecb;
+	mmbuffer_t *tgt;
+	size_t bpos;
+	struct elf_op pending;
+};
+
+static struct differ *elf_base;
+static unsigned int elf_jobs = 1;
+
+static uint64_t
+elf_get(struct elf_file *ef, size_t off, size_t sz)
+{
+	uint64_t v = 0;
+
+	for (size_t i = 0; i < sz; i++)
+		v |= (uint64_t)ef->ptr[off + i]
+		     << (ef->msb ? (sz - 1 - i) * 8 : i * 8);
+	return v;
+}
+
+#define member_size(type, f) sizeof(((type *)0)->f)
+
+/*
+ * Read field f of the Ehdr or Shdr at off, whichever class the file is.
+ * The caller makes sure the whole header is inside the file.
+ */
+#define elf_field(ef, off, type, f)                                      \
+	((ef)->is64 ? elf_get((ef), (off) + offsetof(Elf64_##type, f),   \
+			      member_size(Elf64_##type, f))              \
+		    : elf_get((ef), (off) + offsetof(Elf32_##type, f),   \
+			      member_size(Elf32_##type, f)))
+
+static int
+cmp_region(const void *a, const void *b)
+{
+	const struct elf_region *ra = a, *rb = b;
+
+	if (ra->off != rb->off)
+		return ra->off < rb->off ? -1 : 1;
+	if (ra->size != rb->size)
+		return ra->size > rb->size ? -1 : 1;
+	return 0;
+}
+
+/*
+ * The sections that have bytes in the file, sorted by offset, or -1 if
+ * this isn't an ELF file we can make sense of.
+ */
+static int
+elf_sections(mmbuffer_t *mmb, struct elf_region **sectionsp, size_t *np)
+{
+	struct elf_file ef = {
+		.ptr = (const unsigned char *)mmb->ptr,
+		.size = mmb->size,
+	};
+	size_t shoff, shentsize, shnum, shstrndx, stroff, strsize, sh;
+	struct elf_region *sections;
+	size_t n = 0;
+
+	if (ef.size < EI_NIDENT || memcmp(ef.ptr, ELFMAG, SELFMAG))
+		return -1;
+	switch (ef.ptr[EI_CLASS]) {
+	case ELFCLASS32:
+		ef.is64 = false;
+		break;
+	case ELFCLASS64:
+		ef.is64 = true;
+		break;
+	default:
+		return -1;
+	}
+	switch (ef.ptr[EI_DATA]) {
+	case ELFDATA2LSB:
+		ef.msb = false;
+		break;
+	case ELFDATA2MSB:
+		ef.msb = true;
+		break;
+	default:
+		return -1;
+	}
+	if (ef.size < (ef.is64 ? sizeof(Elf64_Ehdr) : sizeof(Elf32_Ehdr)))
+		return -1;
+
+	shoff = elf_field(&ef, 0, Ehdr, e_shoff);
+	shentsize = elf_field(&ef, 0, Ehdr, e_shentsize);
+	shnum = elf_field(&ef, 0, Ehdr, e_shnum);
+	shstrndx = elf_field(&ef, 0, Ehdr, e_shstrndx);
+	if (shoff == 0 || shoff > ef.size ||
+	    shentsize < (ef.is64 ? sizeof(Elf64_Shdr) : sizeof(Elf32_Shdr)) ||
+	    ef.size - shoff < shentsize)
+		return -1;
+	/*
+	 * Files with too many sections for the ELF header keep the real
+	 * counts in section 0.
+	 */
+	if (shnum == 0)
+		shnum = elf_field(&ef, shoff, Shdr, sh_size);
+	if (shstrndx == SHN_XINDEX)
+		shstrndx = elf_field(&ef, shoff, Shdr, sh_link);
+	if (shnum > (ef.size - shoff) / shentsize || shstrndx >= shnum)
+		return -1;
+
+	sh = shoff + shstrndx * shentsize;
+	stroff = elf_field(&ef, sh, Shdr, sh_offset);
+	strsize = elf_field(&ef, sh, Shdr, sh_size);
+	if (stroff > ef.size || strsize > ef.size - stroff)
+		return -1;
+
+	sections = calloc(shnum, sizeof(*sections));
+	if (!sections)
+		err(1, "Could not allocate memory");
+	for (size_t i = 1; i < shnum; i++) {
+		size_t name, type, off, size, flags;
+
+		sh = shoff + i * shentsize;
+		name = elf_field(&ef, sh, Shdr, sh_name);
+		type = elf_field(&ef, sh, Shdr, sh_type);
+		off = elf_field(&ef, sh, Shdr, sh_offset);
+		size = elf_field(&ef, sh, Shdr, sh_size);
+		flags = elf_field(&ef, sh, Shdr, sh_flags);
+		if (type == SHT_NULL || type == SHT_NOBITS || size == 0 ||
+		    off > ef.size || size > ef.size - off)
+			continue;
+
+		if (name < strsize)
+			sections[n].name = strndup((char *)ef.ptr + stroff + name,
+						   strsize - name);
+		else
+			sections[n].name = strdup("");
+		if (!sections[n].name)
+			err(1, "Could not allocate memory");
+		sections[n].off = off;
+		sections[n].size = size;
+		sections[n].exec = flags & SHF_EXECINSTR;
+		n++;
+	}
+	qsort(sections, n, sizeof(*sections), cmp_region);
+
+	*sectionsp = sections;
+	*np = n;
+	return 0;
+}
+
+static void
+add_region(struct elf_region **regions, size_t *n, char *name, size_t off,
+	   size_t size, bool exec)
+{
+	struct elf_region *new_regions;
+
+	new_regions = realloc(*regions, (*n + 1) * sizeof(**regions));
+	if (!new_regions || !name)
+		err(1, "Could not allocate memory");
+	*regions = new_regions;
+	new_regions[*n].name = name;
+	new_regions[*n].off = off;
+	new_regions[*n].size = size;
+	new_regions[*n].exec = exec;
+	*n += 1;
+}
+
+static char *
+gap_name(const char *prev)
+{
+	char *name = NULL;
+
+	if (!prev)
+		return strdup("[headers]");
+	if (asprintf(&name, "[after %s]", prev) < 0)
+		return NULL;
+	return name;
+}
+
+/*
+ * Cut a file into regions that cover all of it, in order.  A section
+ * that overlaps one before it is dropped; its bytes are already in a
+ * region.
+ */
+static void
+elf_regions(mmbuffer_t *mmb, struct elf_region **regionsp, size_t *np)
+{
+	struct elf_region *sections = NULL, *regions = NULL;
+	size_t n_sections = 0, n = 0, pos = 0;
+	const char *prev = NULL;
+
+	if (elf_sections(mmb, &sections, &n_sections) < 0) {
+		if (mmb->size > 0)
+			add_region(&regions, &n, strdup("[file]"), 0,
+				   mmb->size, false);
+		*regionsp = regions;
+		*np = n;
+		return;
+	}
+
+	for (size_t i = 0; i < n_sections; i++) {
+		struct elf_region *s = &sections[i];
+
+		if (s->off < pos) {
+			free(s->name);
+			continue;
+		}
+		if (s->off > pos)
+			add_region(&regions, &n, gap_name(prev), pos,
+				   s->off - pos, false);
+		add_region(&regions, &n, s->name, s->off, s->size, s->exec);
+		prev = s->name;
+		pos = s->off + s->size;
+	}
+	if (pos < mmb->size)
+		add_region(&regions, &n, gap_name(prev), pos, mmb->size - pos,
+			   false);
+	free(sections);
+
+	*regionsp = regions;
+	*np = n;
+}
+
+static void
+free_regions(struct elf_region *regions, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		free(regions[i].name);
+	free(regions);
+}
+
+/*
+ * Sections can share a name, so the nth one in the new file pairs with
+ * the nth one in the old file.
+ */
+static struct elf_region *
+find_region(struct elf_region *regions, size_t n, const char *name,
+	    size_t nth)
+{
+	for (size_t i = 0; i < n; i++) {
+		if (strcmp(regions[i].name, name))
+			continue;
+		if (nth-- == 0)
+			return &regions[i];
+	}
+	return NULL;
+}
+
+static struct differ *
+pick_differ(struct elf_region *r)
+{
+	if (elf_base)
+		return elf_base;
+	return r->exec || r->size >= ELF_RABDIFF_MIN ? &xrabdiff : &xbdiff;
+}
+
+static void
+pair_add(struct elf_pair *pair, uint8_t op, size_t off, size_t size)
+{
+	if (pair->n_ops == pair->n_op_bufs) {
+		struct elf_op *ops;
+
+		ops = realloc(pair->ops,
+			      (pair->n_op_bufs + 64) * sizeof(*pair->ops));
+		if (!ops)
+			err(1, "Could not allocate memory");
+		pair->ops = ops;
+		pair->n_op_bufs += 64;
+	}
+	pair->ops[pair->n_ops].op = op;
+	pair->ops[pair->n_ops].off = off;
+	pair->ops[pair->n_ops].size = size;
+	pair->n_ops += 1;
+	if (op == XDL_BDOP_INS)
+		pair->inserted += size;
+	else
+		pair->copied += size;
+}
+
+static uint32_t
+get_le32(const char *buf)
+{
+	const unsigned char *p = (const unsigned char *)buf;
+
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void
+put_le32(unsigned char *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+/*
+ * The differs hand us their header first, then make one call per op:
+ * an insert is the op and then its data, a copy is a single buffer.
+ * Insert data isn't kept, it's always the next bytes of the new file.
+ */
+static int
+pair_outf(void *priv, mmbuffer_t *mb, size_t nbuf)
+{
+	struct elf_pair *pair = priv;
+	uint8_t op;
+
+	if (pair->first) {
+		pair->first = false;
+		return 0;
+	}
+	if (nbuf < 1 || mb[0].size < 1)
+		goto einval;
+
+	op = mb[0].ptr[0];
+	if (nbuf == 2 && (op == XDL_BDOP_INS || op == XDL_BDOP_INSB)) {
+		pair_add(pair, XDL_BDOP_INS, 0, mb[1].size);
+		return 0;
+	}
+	if (nbuf == 1 && mb[0].size >= 9 &&
+	    (op == XDL_BDOP_CPY || op == XDL_BDOP_CPYT)) {
+		pair_add(pair, op, get_le32(mb[0].ptr + 1),
+			 get_le32(mb[0].ptr + 5));
+		return 0;
+	}
+einval:
+	errno = EINVAL;
+	return -1;
+}
+
+/*
+ * Unchanged sections, and ones with nothing to diff against, don't need
+ * a differ at all.
+ */
+static void
+diff_pair(struct elf_pair *pair)
+{
+	xdemitcb_t ecb = { .priv = pair, .outf = pair_outf };
+	struct timespec start, end;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (pair->a.size == pair->b.size &&
+	    !memcmp(pair->a.ptr, pair->b.ptr, pair->b.size)) {
+		pair->how = "same";
+		pair_add(pair, XDL_BDOP_CPY, 0, pair->b.size);
+	} else if (pair->a.size == 0) {
+		pair->how = "new";
+		pair_add(pair, XDL_BDOP_INS, 0, pair->b.size);
+	} else {
+		pair->how = pair->differ->name;
+		pair->first = true;
+		pair->rc = pair->differ->diff(&pair->a, 1, &pair->b, &ecb);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	pair->ms = (end.tv_sec - start.tv_sec) * 1e3 +
+		   (end.tv_nsec - start.tv_nsec) / 1e6;
+}
+
+static void *
+worker(void *arg)
+{
+	struct elf_job *job = arg;
+	size_t i;
+
+	while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) <
+	       job->n_pairs)
+		diff_pair(&job->pairs[job->order[i]]);
+	return NULL;
+}
+
+static int
+cmp_pair_size(const void *a, const void *b, void *arg)
+{
+	struct elf_pair *pairs = arg;
+	size_t sa = pairs[*(const size_t *)a].b.size;
+	size_t sb = pairs[*(const size_t *)b].b.size;
+
+	return sa > sb ? -1 : sa < sb;
+}
+
+/*
+ * Biggest first, so a big .text doesn't get started last and leave the
+ * other threads with nothing to do.  This thread works too, and if we
+ * can't start as many threads as we wanted, the ones we have pick up
+ * the slack.
+ */
+static void
+run_pairs(struct elf_pair *pairs, size_t n)
+{
+	struct elf_job job = { .pairs = pairs, .n_pairs = n };
+	size_t nthreads = MIN((size_t)elf_jobs, n);
+	pthread_t *threads = NULL;
+	size_t started = 0;
+
+	job.order = calloc(MAX(n, 1), sizeof(*job.order));
+	if (nthreads > 1)
+		threads = calloc(nthreads - 1, sizeof(*threads));
+	if (!job.order || (nthreads > 1 && !threads))
+		err(1, "Could not allocate memory");
+	for (size_t i = 0; i < n; i++)
+		job.order[i] = i;
+	qsort_r(job.order, n, sizeof(*job.order), cmp_pair_size, pairs);
+
+	while (started + 1 < nthreads &&
+	       pthread_create(&threads[started], NULL, worker, &job) == 0)
+		started++;
+	worker(&job);
+	for (size_t i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	free(threads);
+	free(job.order);
+}
+
+static int
+stitch_flush(struct stitch *st)
+{
+	struct elf_op *op = &st->pending;
+	unsigned char buf[9];
+	mmbuffer_t mb[2];
+	int rc;
+
+	if (op->op == 0)
+		return 0;
+
+	mb[0].ptr = (char *)buf;
+	if (op->op == XDL_BDOP_INS) {
+		if (op->size > 255) {
+			buf[0] = XDL_BDOP_INSB;
+			put_le32(buf + 1, op->size);
+			mb[0].size = 5;
+		} else {
+			buf[0] = XDL_BDOP_INS;
+			buf[1] = op->size;
+			mb[0].size = 2;
+		}
+		mb[1].ptr = st->tgt->ptr + st->bpos;
+		mb[1].size = op->size;
+		rc = st->ecb->outf(st->ecb->priv, mb, 2);
+	} else {
+		buf[0] = op->op;
+		put_le32(buf + 1, op->off);
+		put_le32(buf + 5, op->size);
+		mb[0].size = 9;
+		rc = st->ecb->outf(st->ecb->priv, mb, 1);
+	}
+	st->bpos += op->size;
+	op->op = 0;
+	return rc < 0 ? -1 : 0;
+}
+
+/*
+ * Ops that pick up where the last one left off are merged, which mostly
+ * happens at the seams between regions.
+ */
+static int
+stitch_op(struct stitch *st, uint8_t op, size_t off, size_t size)
+{
+	struct elf_op *p = &st->pending;
+
+	if (p->op == op &&
+	    (op == XDL_BDOP_INS || p->off + p->size == off)) {
+		p->size += size;
+		return 0;
+	}
+	if (stitch_flush(st) < 0)
+		return -1;
+	p->op = op;
+	p->off = off;
+	p->size = size;
+	return 0;
+}
+
+static int
+stitch_pairs(struct elf_pair *pairs, size_t n, mmbuffer_t *src,
+	     mmbuffer_t *tgt, xdemitcb_t *ecb)
+{
+	struct stitch st = { .ecb = ecb, .tgt = tgt, };
+	unsigned char hdr[8];
+	mmbuffer_t mb = { .ptr = (char *)hdr, .size = sizeof(hdr) };
+
+	put_le32(hdr, xdl_mmb_adler32(src));
+	put_le32(hdr + 4, src->size);
+	if (ecb->outf(ecb->priv, &mb, 1) < 0)
+		return -1;
+
+	for (size_t i = 0; i < n; i++) {
+		struct elf_pair *pair = &pairs[i];
+
+		for (size_t j = 0; j < pair->n_ops; j++) {
+			struct elf_op *op = &pair->ops[j];
+			size_t off = op->off;
+
+			if (op->op == XDL_BDOP_CPY)
+				off += pair->aoff;
+			else if (op->op == XDL_BDOP_CPYT)
+				off += pair->boff;
+			if (stitch_op(&st, op->op, off, op->size) < 0)
+				return -1;
+		}
+	}
+	return stitch_flush(&st);
+}
+
+static void
+report(FILE *out, struct elf_pair *pairs, size_t n, struct elf_region *old,
+       bool *paired, size_t n_old)
+{
+	size_t copied = 0, inserted = 0;
+
+	fprintf(out, "%-24s %10s %10s %-9s %10s %10s %9s\n", "section", "old",
+		"new", "differ", "copied", "inserted", "ms");
+	for (size_t i = 0; i < n; i++) {
+		fprintf(out, "%-24s %10zu %10zu %-9s %10zu %10zu %9.3f\n",
+			pairs[i].name, (size_t)pairs[i].a.size,
+			(size_t)pairs[i].b.size, pairs[i].how,
+			pairs[i].copied, pairs[i].inserted, pairs[i].ms);
+		copied += pairs[i].copied;
+		inserted += pairs[i].inserted;
+	}
+	for (size_t i = 0; i < n_old; i++) {
+		if (!paired[i])
+			fprintf(out, "%-24s %10zu %10s %-9s\n", old[i].name,
+				old[i].size, "-", "removed");
+	}
+	fprintf(out, "%-24s %10s %10s %-9s %10zu %10zu\n", "total", "", "", "",
+		copied, inserted);
+}
+
+static int
+elfdiff_diff(mmbuffer_t *srcs, int nsrc, mmbuffer_t *tgt, xdemitcb_t *ecb)
+{
+	struct elf_region *old = NULL, *new = NULL;
+	size_t n_old = 0, n_new = 0;
+	struct elf_pair *pairs;
+	bool *paired;
+	int rc = 0;
+
+	if (nsrc != 1) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	elf_regions(&srcs[0], &old, &n_old);
+	elf_regions(tgt, &new, &n_new);
+	pairs = calloc(MAX(n_new, 1), sizeof(*pairs));
+	paired = calloc(MAX(n_old, 1), sizeof(*paired));
+	if (!pairs || !paired)
+		err(1, "Could not allocate memory");
+
+	for (size_t i = 0; i < n_new; i++) {
+		struct elf_pair *pair = &pairs[i];
+		struct elf_region *o;
+		size_t nth = 0;
+
+		for (size_t j = 0; j < i; j++)
+			nth += !strcmp(new[j].name, new[i].name);
+		pair->name = new[i].name;
+		pair->b.ptr = tgt->ptr + new[i].off;
+		pair->b.size = new[i].size;
+		pair->boff = new[i].off;
+		pair->differ = pick_differ(&new[i]);
+
+		o = find_region(old, n_old, new[i].name, nth);
+		if (o) {
+			pair->a.ptr = srcs[0].ptr + o->off;
+			pair->a.size = o->size;
+			pair->aoff = o->off;
+			paired[o - old] = true;
+		}
+	}
+
+	run_pairs(pairs, n_new);
+
+	for (size_t i = 0; i < n_new; i++) {
+		if (pairs[i].rc < 0) {
+			warnx("could not diff section %s", pairs[i].name);
+			rc = -1;
+		}
+	}
+	if (rc == 0)
+		rc = stitch_pairs(pairs, n_new, &srcs[0], tgt, ecb);
+	if (rc == 0 && verbose > 0)
+		report(stderr, pairs, n_new, old, paired, n_old);
+
+	for (size_t i = 0; i < n_new; i++)
+		free(pairs[i].ops);
+	free(pairs);
+	free(paired);
+	free_regions(new, n_new);
+	free_regions(old, n_old);
+	return rc;
+}
+
+static struct differ elfdiff = {
+	.name = "elf",
+	.diff = elfdiff_diff,
+};
+
+HIDDEN struct differ *
+elf_differ(struct differ *base, unsigned int jobs)
+{
+	elf_base = base;
+	elf_jobs = MAX(jobs, 1);
+	return &elfdiff;
+}
+
+// vim:fenc=utf-8:tw=75:noet
@@ -6,12 +6,10 @@
 
 #include "bindiff.h"
 
-bool hexdebug = false;
-
 #define HDBUF ((buf && bufsz > 0) ? (buf + off) : NULL)
 #define HDLIM ((buf && bufsz > 0) ? (bufsz - off) : 0)
 
-static inline ssize_t UNUSED
+ssize_t
 prepare_hex(void *data, size_t size, size_t *consumed,
 	    char *buf, size_t bufsz,
 	    size_t position, int64_t skew)
@@ -32,11 +30,9 @@ prepare_hex(void *data, size_t size, size_t *consumed,
 	}
 
 	*consumed = 0;
-	if (hexdebug) {
-		dprintf("=dbg %s\t", __func__);
-		dprintf("before:%zu after:%zu data:%p size:%zu position:0x%lx skew:0x%lx ",
-			before, after, data, size, position, skew);
-	}
+	trace(prepare_hex,
+	      "before:%zu after:%zu data:%p size:%zu position:0x%lx skew:0x%lx",
+	      before, after, data, size, position, skew);
 
 	for (i = 0; i < before; i++) {
 		sz = snprintf(HDBUF, HDLIM, "   %s", i == 7 ? " " : "");
@@ -44,7 +40,6 @@ prepare_hex(void *data, size_t size, size_t *consumed,
 			return sz;
 		off += sz;
 	}
-	debug("off:%zd", off);
 	for (j = 0; j < 16 - after - before; j++) {
 		uint8_t d = ((uint8_t *)data)[j];
 		sz = snprintf(HDBUF, HDLIM, "%c%c%s%s",
@@ -56,9 +51,7 @@ prepare_hex(void *data, size_t size, size_t *consumed,
 			return sz;
 		off += sz;
 	}
-	debug("off:%zd", off);
 	*consumed = 16 - after - before;
-	debug("*consumed:%zd = 16 - after:%zd - before:%zd", *consumed, after, before);
 	j += i;
 	for (i = 0; i < after; i++) {
 		sz = snprintf(HDBUF, HDLIM, "  %s%s",
@@ -68,11 +61,7 @@ prepare_hex(void *data, size_t size, size_t *consumed,
 			return sz;
 		off += sz;
 	}
-	debug("off:%zd", off);
-	if (hexdebug) {
-		debug("consumed:0x%zx, ret:0x%zx\n", *consumed, off);
-		fflush(stdout);
-	}
+	trace(prepare_hex_done, "consumed:0x%zx, ret:0x%zx", *consumed, off);
 	return off;
 }
 
@@ -88,10 +77,8 @@ prepare_text(void *data, size_t size, char *buf, size_t bufsz,
 	size_t before = (position - skew) % 16;
 	size_t after = (before + size > 16) ? 0 : 16 - (before + size);
 
-	if (hexdebug) {
-		dprintf("=dbg %s\t", __func__);
-		dprintf("before:%zu after:%zu data:%p\n", before, after, data);
-	}
+	trace(prepare_text, "before:%zu after:%zu data:%p", before, after,
+	      data);
 
 	if (size == 0) {
 		if (HDBUF)
@@ -158,10 +145,8 @@ vfhexdumpf(FILE *f, const char *const fmt, uint8_t *data, size_t size,
 		sz = prepare_hex(data + offset, size - offset, &consumed,
 				 hexbuf, sizeof(hexbuf),
 		                 (size_t)data + offset, at % 16);
-		debug("prepare_hex(%p, %zd, %zd, %p, %zd, %zd, %zd) = %zd",
-		      data + offset, size - offset, consumed,
-		      hexbuf, sizeof(hexbuf),
-		      (size_t)data + offset, at % 16, sz);
+		trace(hexdump_line, "prepare_hex(%p, %zd, %zd) = %zd",
+		      data + offset, size - offset, consumed, sz);
 		if (consumed == 0 || sz < 0)
 			return;
 
@@ -232,6 +217,72 @@ dhexdumpat(void *data, size_t size, size_t at)
 		hexdumpat(data, size, at);
 }
 
+/*
+ * format one line of a hexdiff op into buf, without the trailing newline
+ * returns the number of bytes written and sets *consumed to how much of
+ * data the line covers.
+ */
+ssize_t
+hexdiff_line(char *buf, size_t bufsz, hexdiff_op_t op, uint64_t opos,
+	     uint64_t npos, uint8_t *data, size_t size, text_color_t fg,
+	     size_t *consumed)
+{
+	const char opc[] = "- +";
+	uint64_t pos;
+	text_color_t color = fg;
+	size_t off = 0;
+	ssize_t sz;
+
+	if (!consumed) {
+		errno = EINVAL;
+		return -1;
+	}
+	*consumed = 0;
+
+	switch (op) {
+	case DELETE:
+		pos = opos;
+		break;
+	case COPY:
+		pos = npos;
+		if (opos == npos)
+			color = black;
+		break;
+	case INSERT:
+		pos = npos;
+		break;
+	case IGNORE:
+	default:
+		return 0;
+	}
+
+	sz = snprintf(HDBUF, HDLIM, "%c\033[38:5:%dm%08lx  ", opc[op], color,
+		      pos);
+	if (sz < 0)
+		return sz;
+	off += sz;
+
+	sz = prepare_hex(data, size, consumed, HDBUF, HDLIM, pos, 0);
+	trace(hexdiff_line, "prepare_hex(%p, %zd, %zd, 0x%lx) = %zd", data,
+	      size, *consumed, pos, sz);
+	if (sz < 0)
+		return sz;
+	off += sz;
+
+	sz = snprintf(HDBUF, HDLIM, op == INSERT ? "  \033[38:5:%dm" : "  ",
+		      black);
+	if (sz < 0)
+		return sz;
+	off += sz;
+
+	sz = prepare_text(data, size, HDBUF, HDLIM, pos, 0, color, black);
+	if (sz < 0)
+		return sz;
+	off += sz;
+
+	return off;
+}
+
 /*
  * variadic hexdiff-to-file, formatted
  * emits one diff op
@@ -242,90 +293,22 @@ vfhexdifff(FILE *f, const char *const fmt, va_list ap, hexdiff_op_t op,
            uint64_t *opos, uint64_t *npos, uint8_t *data, size_t size,
 	   text_color_t fg)
 {
-	const char opc[] = "- +";
 	size_t offset = 0;
 
-	if (hexdebug)
-		debug("data:%p size:%zd opos:0x%zx npos:0x%zx color:%d\n", data, size,
-		      *opos, *npos, fg);
+	trace(hexdiff, "data:%p size:%zd opos:0x%zx npos:0x%zx color:%d", data,
+	      size, *opos, *npos, fg);
 	while (offset < size) {
 		char linebuf[4096];
-		ssize_t sz = 0;
-		size_t tmpsz = 0;
+		ssize_t sz;
 		size_t consumed = 0;
 
-		switch (op) {
-		case DELETE:
-			sz = prepare_hex(data + offset, size - offset, &consumed,
-					 linebuf + tmpsz, sizeof(linebuf) - tmpsz,
-					 *opos, 0);
-			debug("prepare_hex(%p, %zd, %zd, %p, %zd, %zd, %zd) = %zd",
-			      data + offset, size - offset, consumed,
-			      linebuf + tmpsz, sizeof(linebuf) - tmpsz,
-			      *opos, (size_t)0, sz);
-			if (consumed == 0)
-				break;
-			if (sz < 0)
-				break;
-			tmpsz += sz;
-			sz = snprintf(linebuf + tmpsz, sizeof(linebuf) - tmpsz,
-				      "\033[38:5:%dm", black);
-
-			tmpsz += snprintf(linebuf + tmpsz, sizeof(linebuf) - tmpsz, "  ");
-			tmpsz += prepare_text(data + offset, size - offset,
-					      linebuf + tmpsz, sizeof(linebuf) - tmpsz,
-					      *opos, 0, fg, black);
-
-			vfprintf(f, fmt, ap);
-			fprintf(f, "%c\033[38:5:%dm%08lx  %s\n",
-				opc[op], fg, *opos, linebuf);
-			break;
-		case COPY:
-			sz = prepare_hex(data + offset, size - offset, &consumed,
-					 linebuf + tmpsz, sizeof(linebuf) - tmpsz,
-					 *npos, 0);
-			debug("prepare_hex(%p, %zd, %zd, %p, %zd, %zd, %zd) = %zd",
-			      data + offset, size - offset, consumed,
-			      linebuf + tmpsz, sizeof(linebuf) - tmpsz,
-			      *npos, (size_t)0, sz);
-			if (sz < 0)
-				break;
-			tmpsz += sz;
-			tmpsz += snprintf(linebuf + tmpsz, sizeof(linebuf) - tmpsz, "  ");
-			prepare_text(data + offset, size - offset,
-				     linebuf + tmpsz, sizeof(linebuf) - tmpsz, *npos, 0,
-				     *opos == *npos ? black : fg, black);
-			vfprintf(f, fmt, ap);
-			fprintf(f, "%c\033[38:5:%dm%08lx  %s\n",
-				opc[op], *opos == *npos ? black : fg, *npos, linebuf);
+		sz = hexdiff_line(linebuf, sizeof(linebuf), op, *opos, *npos,
+				  data + offset, size - offset, fg, &consumed);
+		if (sz < 0 || consumed == 0)
 			break;
-		case INSERT:
-			sz = prepare_hex(data + offset, size - offset, &consumed,
-					 linebuf + tmpsz, sizeof(linebuf) - tmpsz,
-			                 *npos, 0);
-			debug("prepare_hex(%p, %zd, %zd, %p, %zd, %zd, %zd) = %zd",
-			      data + offset, size - offset, consumed,
-			      linebuf + tmpsz, sizeof(linebuf) - tmpsz,
-			      *npos, (size_t)0, sz);
-			if (consumed == 0)
-				break;
-			if (sz < 0)
-				break;
-			tmpsz += sz;
-			tmpsz += snprintf(linebuf + tmpsz, sizeof(linebuf) - tmpsz,
-					  "  \033[38:5:%dm", black);
-			tmpsz += prepare_text(data + offset, size - offset,
-					      linebuf + tmpsz, sizeof(linebuf) - tmpsz,
-					      *npos, 0, fg, black);
-			vfprintf(f, fmt, ap);
-			fprintf(f, "%c\033[38:5:%dm%08lx  %s\n",
-				opc[op], fg, *npos, linebuf);
-			break;
-		case IGNORE:
-			continue;
-		default:
-			break;
-		}
+
+		vfprintf(f, fmt, ap);
+		fprintf(f, "%s\n", linebuf);
 
 		offset += consumed;
 
@@ -367,7 +350,6 @@ void
 hexdiff(hexdiff_op_t op, uint64_t *opos, uint64_t *npos, void *data, size_t sz,
 	text_color_t fg)
 {
-	hexdebug = true;
 	switch (op) {
 	case DELETE:
 	case COPY:
@@ -377,7 +359,6 @@ hexdiff(hexdiff_op_t op, uint64_t *opos, uint64_t *npos, void *data, size_t sz,
 	case IGNORE:
 		break;
 	}
-	hexdebug = false;
 }
 
 // vim:fenc=utf-8:tw=75:noet
@@ -37,8 +37,15 @@ extern int verbose;
 #include "hexdump.h"
 #include "math.h"
 #include "time.h"
+#include "timing.h"
+#include "mem.h"
 #include "tty.h"
 #include "diffapi.h"
+#include "elfdiff.h"
+#include "patch.h"
+#include "queue.h"
+#include "reader.h"
+#include "viewer.h"
 
 #endif /* !BINDIFF_H_ */
 // vim:fenc=utf-8:tw=75:noet
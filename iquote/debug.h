@@ -21,6 +21,65 @@
 extern bool unc_debug_arg_, unc_debug_once_;
 extern int unc_debug_pfx_len_;
 
+/*
+ * trace(probe, fmt, args...) is for hot paths, where debug() is too
+ * expensive to leave in.  What it turns into depends on UNC_DEBUG_LEVEL:
+ *
+ *   0 - only the USDT probe "bindiff:probe" (if we have <sys/sdt.h>),
+ *       which is a nop until something like perf or bpftrace attaches
+ *   1 - the probe, plus debug() output behind a single test of
+ *       unc_debug_arg_ that's marked unlikely (the default)
+ *   2 - the probe, plus an unconditional debug(), i.e. the old cost
+ *
+ * USDT arguments need to be integers or pointers, and there can be at
+ * most 12 of them.
+ *
+ * Each probe has a semaphore, bindiff_<probe>_semaphore, that the tracer
+ * counts up while it's attached, and the probe's arguments are only
+ * worked out when that isn't zero.  The semaphores are defined in
+ * debug.c, so a new probe has to go in UNC_PROBES too.
+ */
+#ifndef UNC_DEBUG_LEVEL
+#define UNC_DEBUG_LEVEL 1
+#endif
+
+#define UNC_PROBES(probe_)       \
+	probe_(collect_copy)     \
+	probe_(collect_insert)   \
+	probe_(hexdiff)          \
+	probe_(hexdiff_line)     \
+	probe_(hexdump_line)     \
+	probe_(hunk_copy)        \
+	probe_(hunk_delete)      \
+	probe_(hunk_insert)      \
+	probe_(prepare_hex)      \
+	probe_(prepare_hex_done) \
+	probe_(prepare_text)
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+#define UNC_HAVE_SDT 1
+#endif
+#endif
+
+#ifdef UNC_HAVE_SDT
+#define trace_semaphore_(name_) bindiff_##name_##_semaphore
+#define trace_declare_(name_)                                   \
+	extern volatile unsigned short trace_semaphore_(name_) \
+		__attribute__((__section__(".probes")));
+UNC_PROBES(trace_declare_)
+
+#define trace_probe_(name_, args_...)                             \
+	({                                                        \
+		if (__builtin_expect(trace_semaphore_(name_), 0)) \
+			STAP_PROBEV(bindiff, name_, ##args_);     \
+	})
+#else
+#define trace_probe_(name_, args_...)
+#endif
+
 #ifdef UNC_COMMON_NO_DEBUG
 #define dprintc(x)
 #define dprints(x, y)
@@ -30,6 +89,7 @@ extern int unc_debug_pfx_len_;
 #define debug_(f_, l_, fmt_, args_...)
 #define debugnonl(fmt, args...)
 #define debug(fmt, args...)
+#define trace(name_, fmt_, args_...) ({ trace_probe_(name_, ##args_); })
 #define dassert(x)
 #define dassertp(p, x)
 #else
@@ -102,6 +162,23 @@ extern void unc_set_debug(const char *criteria, bool enable);
 
 #define debug(fmt, args...) debug_(__FILE__, __LINE__, __func__, fmt, ##args)
 
+#if UNC_DEBUG_LEVEL >= 2
+#define trace(name_, fmt_, args_...)            \
+	({                                      \
+		trace_probe_(name_, ##args_);   \
+		debug(fmt_, ##args_);           \
+	})
+#elif UNC_DEBUG_LEVEL == 1
+#define trace(name_, fmt_, args_...)                       \
+	({                                                 \
+		trace_probe_(name_, ##args_);              \
+		if (__builtin_expect(unc_debug_arg_, 0))   \
+			debug(fmt_, ##args_);              \
+	})
+#else
+#define trace(name_, fmt_, args_...) ({ trace_probe_(name_, ##args_); })
+#endif
+
 #define dassert(x)                                                \
 	({                                                        \
 		if (!(x))                                         \
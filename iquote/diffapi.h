@@ -21,6 +21,7 @@ struct differ_hunk {
         size_t apos, bpos;
         char *buf;
         size_t sz;
+        int src;
 };
 
 struct differ_priv {
@@ -32,14 +33,41 @@ struct differ_priv {
 	size_t n_hunk_bufs;
 };
 
+struct s_mmbuffer;
+struct s_xdemitcb;
+
 typedef void collect_t(void *priv);
 
+/*
+ * Diff tgt against nsrc sources; srcs[0] is the file we're diffing
+ * against, and the rest are references the differ may also copy from.
+ */
+typedef int diff_t(struct s_mmbuffer *srcs, int nsrc, struct s_mmbuffer *tgt,
+		   struct s_xdemitcb *ecb);
+
 struct differ {
+	const char *name;
 	collect_t *collect;
+	diff_t *diff;
 };
 
 extern struct differ xbdiff;
 extern struct differ xrabdiff;
+extern struct differ xgeardiff;
+extern struct differ xcdcdiff;
+
+/*
+ * XDL_BDF_* flags every differ passes to libxdiff along with its own;
+ * XDL_BDF_SELFREF from --self is the only one that makes sense here.
+ */
+extern uint32_t differ_flags;
+
+/*
+ * A window size or polynomial of 0 leaves xrabdiff with libxdiff's.
+ * xgeardiff takes the window size too, but has no polynomial, and
+ * xcdcdiff takes both for what it diffs between the chunks it matches.
+ */
+HIDDEN void xrabdiff_set_params(long wndsize, uint64_t poly);
 
 #endif /* !DIFFAPI_H_ */
 // vim:fenc=utf-8:tw=75:noet
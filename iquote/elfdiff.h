@@ -0,0 +1,20 @@
+// SPDX-License-Identifier: GPLv3-or-later
+/*
+ * elfdiff.h - diff ELF files a section at a time
+ * Copyright Peter Jones <pjones@redhat.com>
+ */
+
+#ifndef ELFDIFF_H_
+#define ELFDIFF_H_
+
+/*
+ * Returns a differ that splits both files into their sections, pairs
+ * them up by name, and diffs each pair on its own, up to jobs of them
+ * at a time.  Every pair is diffed with base, or if base is NULL, with
+ * whichever differ suits that section.  The result is one ordinary
+ * diff of the whole files.  Files that aren't ELF are diffed whole.
+ */
+HIDDEN struct differ *elf_differ(struct differ *base, unsigned int jobs);
+
+#endif /* !ELFDIFF_H_ */
+// vim:fenc=utf-8:tw=75:noet
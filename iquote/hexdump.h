@@ -8,8 +8,6 @@
 
 #include <ctype.h>
 
-extern bool hexdebug;
-
 typedef enum
 {
 	DELETE,
@@ -18,6 +16,7 @@ typedef enum
 	IGNORE
 } hexdiff_op_t;
 
+ssize_t prepare_hex(void *data, size_t size, size_t *consumed, char *buf, size_t bufsz, size_t position, int64_t skew);
 void vfhexdumpf(FILE *f, const char *const fmt, uint8_t *data, size_t size, uint64_t at, int highlight, int regular, va_list ap);
 void fhexdumpf(FILE *f, const char *const fmt, uint8_t *data, size_t size, uint64_t at, int highlight, int regular, ...);
 void hexdump(void *data, size_t size);
@@ -25,6 +24,7 @@ void hexdumpat(void *data, size_t size, size_t at);
 void dhexdump(void *data, size_t size);
 void dhexdumpf(const char *fmt, void *data, size_t size, ...);
 void dhexdumpat(void *data, size_t size, size_t at);
+ssize_t hexdiff_line(char *buf, size_t bufsz, hexdiff_op_t op, uint64_t opos, uint64_t npos, uint8_t *data, size_t size, text_color_t fg, size_t *consumed);
 void vfhexdifff(FILE *f, const char *const fmt, va_list ap, hexdiff_op_t op, uint64_t *opos, uint64_t *npos, uint8_t *data, size_t size, text_color_t fg);
 void fhexdifff(FILE *f, const char *const fmt, hexdiff_op_t op, uint64_t *oposp, uint64_t *nposp, uint8_t *data, size_t size, text_color_t fg, ...);
 void hexdiff(hexdiff_op_t op, uint64_t *opos, uint64_t *npos, void *data, size_t sz, text_color_t fg);
@@ -0,0 +1,16 @@
+// SPDX-License-Identifier: GPLv3-or-later
+/*
+ * mem.h - libxdiff allocation accounting
+ * Copyright Peter Jones <pjones@redhat.com>
+ */
+
+#ifndef MEM_H_
+#define MEM_H_
+
+HIDDEN void mem_init(void);
+HIDDEN void mem_phase_mark(timing_phase_t phase);
+HIDDEN void mem_report(FILE *out, unsigned int runs, size_t srcsize,
+		       size_t tgtsize);
+
+#endif /* !MEM_H_ */
+// vim:fenc=utf-8:tw=75:noet
@@ -0,0 +1,49 @@
+// SPDX-License-Identifier: GPLv3-or-later
+/*
+ * patch.h - writing and applying patch files
+ * Copyright Peter Jones <pjones@redhat.com>
+ */
+
+#ifndef PATCH_H_
+#define PATCH_H_
+
+typedef enum {
+	PATCH_NATIVE,
+	PATCH_VCDIFF,
+	PATCH_INPLACE,
+} patch_format_t;
+
+/*
+ * filter is one of libxdiff's XDL_BCJ_* values, or this to pick one
+ * from the ELF header of the file the patch applies to.
+ */
+#define PATCH_FILTER_AUTO -1
+
+struct s_mmbuffer;
+struct differ;
+
+/*
+ * srcs[0] is the file the patch applies to, and the rest are --ref
+ * files.  VCDIFF and in place patches only have the one source, so
+ * nsrc must be 1 for them.
+ * A patch made with a filter has to be applied with the same one.
+ * When fd is a regular file, native patches are applied on up to jobs
+ * threads, and if src_fds has the files srcs were mapped from, big
+ * copies from them are left to the kernel.
+ */
+HIDDEN int make_patch(struct differ *differ, patch_format_t format,
+		      int filter, struct s_mmbuffer *srcs, int nsrc,
+		      struct s_mmbuffer *tgt, int fd);
+HIDDEN int apply_patch(struct s_mmbuffer *srcs, int nsrc,
+		       struct s_mmbuffer *patch, int filter, int fd,
+		       unsigned int jobs, const int *src_fds);
+
+/*
+ * Rewrites the file at path with an in place patch, keeping a journal
+ * at path with ".inplace" on the end while it's at it.  If that's
+ * there already, this carries on from where it says.
+ */
+HIDDEN int apply_inplace(const char *path, struct s_mmbuffer *patch);
+
+#endif /* !PATCH_H_ */
+// vim:fenc=utf-8:tw=75:noet
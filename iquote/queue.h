@@ -0,0 +1,26 @@
+// SPDX-License-Identifier: GPLv3-or-later
+/*
+ * queue.h - a bounded queue from one thread to another
+ * Copyright Peter Jones <pjones@redhat.com>
+ */
+
+#ifndef QUEUE_H_
+#define QUEUE_H_
+
+struct queue;
+
+/*
+ * One thread pushes and one thread pops; anything else needs a lock
+ * around it.  n is rounded up to a power of two.  Pushing waits while
+ * the queue is full, and popping waits while it's empty, until the
+ * pushing side calls queue_close(), after which queue_pop() returns
+ * false once everything has been taken out.
+ */
+HIDDEN struct queue *queue_new(size_t n, size_t esize);
+HIDDEN void queue_push(struct queue *q, const void *e);
+HIDDEN bool queue_pop(struct queue *q, void *e);
+HIDDEN void queue_close(struct queue *q);
+HIDDEN void queue_free(struct queue *q);
+
+#endif /* !QUEUE_H_ */
+// vim:fenc=utf-8:tw=75:noet
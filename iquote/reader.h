@@ -0,0 +1,42 @@
+// SPDX-License-Identifier: GPLv3-or-later
+/*
+ * reader.h - reading files in with io_uring
+ * Copyright Peter Jones <pjones@redhat.com>
+ */
+
+#ifndef READER_H_
+#define READER_H_
+
+struct s_mmbuffer;
+struct reader;
+
+/*
+ * Files are added one at a time, and each gets a buffer of its own to
+ * be read into.  reader_start() sets all of them reading, in the order
+ * they were added, and reader_wait() waits for one of them, or for all
+ * of them if n is -1.  If the kernel doesn't have io_uring, or won't
+ * let us use it, everything is read with pread() by reader_start().
+ */
+HIDDEN struct reader *reader_new(void);
+HIDDEN int reader_add(struct reader *rd, const char *filename,
+		      struct s_mmbuffer *mmb);
+HIDDEN int reader_start(struct reader *rd);
+HIDDEN int reader_wait(struct reader *rd, int n);
+
+/*
+ * Lets libxdiff start indexing the sources before file n is in, by
+ * waiting for it when a differ starts scanning.  Until then a thread of
+ * its own keeps the reads going.  This takes libxdiff's phase hook, so
+ * it can't be used along with timings.
+ */
+HIDDEN void reader_overlap(struct reader *rd, int n);
+
+/*
+ * Waits for anything still being read, and frees every file's buffer,
+ * so the reader can be used for the next batch.
+ */
+HIDDEN void reader_put(struct reader *rd);
+HIDDEN void reader_free(struct reader *rd);
+
+#endif /* !READER_H_ */
+// vim:fenc=utf-8:tw=75:noet
@@ -110,19 +110,19 @@ eoverflow:
 }
 
 #ifndef tvneg
-#define tvneg(tv)                                                \
-	({                                                       \
-		struct timeval tv_;                              \
-		normalize_timeval(&(tv), &tv_);                  \
-	(tv_.tv_sec < 0 || (tv_.tv_sec == 0 && tv_.tv_usec < 0); \
+#define tvneg(tv)                                                         \
+	({                                                                \
+		struct timeval tv_;                                       \
+		normalize_timeval(&(tv), &tv_);                           \
+		(tv_.tv_sec < 0 || (tv_.tv_sec == 0 && tv_.tv_usec < 0)); \
 	})
 #endif
 #ifndef tsneg
-#define tsneg(ts)                                                \
-	({                                                       \
-		struct timespec ts_;                             \
-		normalize_timespec(&(ts), &ts_);                 \
-	(ts_.tv_sec < 0 || (ts_.tv_sec == 0 && ts_.tv_nsec < 0); \
+#define tsneg(ts)                                                         \
+	({                                                                \
+		struct timespec ts_;                                      \
+		normalize_timespec(&(ts), &ts_);                          \
+		(ts_.tv_sec < 0 || (ts_.tv_sec == 0 && ts_.tv_nsec < 0)); \
 	})
 #endif
 #ifndef tvzero
@@ -344,11 +344,11 @@ tscmp(const struct timespec *const a, const struct timespec *const b,
 		return true;
 
 	if (tspos(difference))
-		*result = lt;
+		*result = gt;
 	else if (tszero(difference))
 		*result = eq;
 	else
-		*result = gt;
+		*result = lt;
 
 	return false;
 }
@@ -529,11 +529,11 @@ tvcmp(const struct timeval *const a, const struct timeval *const b,
 		return true;
 
 	if (tvpos(difference))
-		*result = lt;
+		*result = gt;
 	else if (tvzero(difference))
 		*result = eq;
 	else
-		*result = gt;
+		*result = lt;
 
 	return false;
 }
@@ -0,0 +1,36 @@
+// SPDX-License-Identifier: GPLv3-or-later
+/*
+ * timing.h - per-phase wall and cpu time accounting
+ * Copyright Peter Jones <pjones@redhat.com>
+ */
+
+#ifndef TIMING_H_
+#define TIMING_H_
+
+typedef enum {
+	TIMING_MAP,
+	TIMING_INDEX,
+	TIMING_SCAN,
+	TIMING_COLLECT,
+	TIMING_REORDER,
+	TIMING_RENDER,
+	TIMING_MAX,
+} timing_phase_t;
+
+extern const char * const timing_phase_names[TIMING_MAX];
+
+/*
+ * Phases nest: starting one while another is running pauses the outer
+ * one, so each phase is only charged for its own time.  All of these
+ * are no-ops until timing_init() has been called.
+ */
+HIDDEN int timing_init(unsigned int runs);
+HIDDEN void timing_fini(void);
+HIDDEN void timing_start(timing_phase_t phase);
+HIDDEN void timing_stop(timing_phase_t phase, size_t bytes);
+HIDDEN void timing_end_run(void);
+HIDDEN timing_phase_t timing_phase(void);
+HIDDEN void timing_report(FILE *out);
+
+#endif /* !TIMING_H_ */
+// vim:fenc=utf-8:tw=75:noet
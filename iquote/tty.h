@@ -7,7 +7,26 @@
 #ifndef TTY_H_
 #define TTY_H_
 
+#include <termios.h>
+
+enum {
+	TTY_KEY_EOF = 0x100,
+	TTY_KEY_ESC,
+	TTY_KEY_UP,
+	TTY_KEY_DOWN,
+	TTY_KEY_PGUP,
+	TTY_KEY_PGDN,
+	TTY_KEY_HOME,
+	TTY_KEY_END,
+	TTY_KEY_UNKNOWN,
+};
+
 HIDDEN ssize_t get_esc_sz(const char *buf, const size_t size);
+HIDDEN size_t tty_clip(const char *buf, const size_t size, const size_t cols);
+HIDDEN int tty_get_size(int fd, unsigned int *rows, unsigned int *cols);
+HIDDEN int tty_raw(int fd, struct termios *saved);
+HIDDEN int tty_restore(int fd, const struct termios *saved);
+HIDDEN int tty_read_key(int fd);
 
 #endif /* !TTY_H_ */
 // vim:fenc=utf-8:tw=75:noet
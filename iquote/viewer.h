@@ -0,0 +1,13 @@
+// SPDX-License-Identifier: GPLv3-or-later
+/*
+ * viewer.h - interactive viewport over a list of diff hunks
+ * Copyright Peter Jones <pjones@redhat.com>
+ */
+
+#ifndef VIEWER_H_
+#define VIEWER_H_
+
+extern int view_diff(struct differ_hunk *hunks, size_t n_hunks);
+
+#endif /* !VIEWER_H_ */
+// vim:fenc=utf-8:tw=75:noet
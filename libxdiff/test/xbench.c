@@ -0,0 +1,962 @@
+/*
+ *  LibXDiff by Davide Libenzi ( File Differential Library )
+ *  Copyright (C) 2003  Davide Libenzi
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *  Davide Libenzi <davidel@xmailserver.org>
+ *
+ */
+
+/*
+ * Deterministic benchmark for every libxdiff engine.  Each corpus is
+ * generated from a fixed seed, so two runs of the same build see exactly
+ * the same bytes and the CSV rows from two commits can be compared
+ * directly.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+#include "xmacros.h"
+#include "xdiff.h"
+#include "xtestutils.h"
+
+#define XDLB_SEED 0x9e3779b97f4a7c15ULL
+#define XDLB_CHAIN 4
+
+/*
+ * A corpus is --size bytes shifted right by "shift", for the ones bdiff
+ * is quadratic on, so that the default run doesn't take all day.
+ */
+typedef struct s_xdlbcorpus {
+	char const *name;
+	int text, shift;
+	void (*gen)(uint64_t *rs, char *buf, size_t size);
+	int (*mutate)(uint64_t *rs, mmbuffer_t const *src, mmbuffer_t *dst);
+} xdlbcorpus_t;
+
+typedef struct s_xdlbcase {
+	mmfile_t orig, cur, other;
+	mmfile_t bpch, tpch, mpch;
+	mmfile_t chain[XDLB_CHAIN + 1];
+	mmfile_t cpch[XDLB_CHAIN];
+} xdlbcase_t;
+
+typedef struct s_xdlbengine {
+	char const *name;
+	int text;
+	int (*run)(xdlbcase_t *xc, mmfile_t *out);
+	long (*ops)(xdlbcase_t *xc, mmfile_t *out);
+	long (*psize)(xdlbcase_t *xc, mmfile_t *out);
+	mmfile_t *(*expect)(xdlbcase_t *xc);
+} xdlbengine_t;
+
+typedef struct s_xdlbmem {
+	max_align_t align;
+	size_t size;
+} xdlbmem_t;
+
+static size_t xdlb_live, xdlb_peak;
+
+static void *
+xdlb_malloc(void *priv, size_t size)
+{
+	xdlbmem_t *hdr;
+
+	if ((hdr = malloc(sizeof(xdlbmem_t) + size)) == NULL) {
+		return NULL;
+	}
+	hdr->size = size;
+	xdlb_live += size;
+	if (xdlb_live > xdlb_peak)
+		xdlb_peak = xdlb_live;
+
+	return hdr + 1;
+}
+
+static void
+xdlb_free(void *priv, void *ptr)
+{
+	xdlbmem_t *hdr;
+
+	if (ptr == NULL)
+		return;
+	hdr = (xdlbmem_t *)ptr - 1;
+	xdlb_live -= hdr->size;
+	free(hdr);
+}
+
+static void *
+xdlb_realloc(void *priv, void *ptr, size_t size)
+{
+	xdlbmem_t *hdr;
+	size_t osize;
+
+	if (ptr == NULL)
+		return xdlb_malloc(priv, size);
+	hdr = (xdlbmem_t *)ptr - 1;
+	osize = hdr->size;
+	if ((hdr = realloc(hdr, sizeof(xdlbmem_t) + size)) == NULL) {
+		return NULL;
+	}
+	hdr->size = size;
+	xdlb_live += size - osize;
+	if (xdlb_live > xdlb_peak)
+		xdlb_peak = xdlb_live;
+
+	return hdr + 1;
+}
+
+/*
+ * xorshift64*, so the corpora don't depend on the libc rand().
+ */
+static uint64_t
+xdlb_rand(uint64_t *rs)
+{
+	*rs ^= *rs >> 12;
+	*rs ^= *rs << 25;
+	*rs ^= *rs >> 27;
+
+	return *rs * 0x2545f4914f6cdd1dULL;
+}
+
+static size_t
+xdlb_range(uint64_t *rs, size_t n)
+{
+	return n ? (size_t)(xdlb_rand(rs) % n) : 0;
+}
+
+static void
+xdlb_gen_random(uint64_t *rs, char *buf, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++)
+		buf[i] = (char)xdlb_rand(rs);
+}
+
+/*
+ * Mostly zeros, with short repeating patterns here and there, which is
+ * what a lot of firmware and filesystem images look like.
+ */
+static void
+xdlb_gen_sparse(uint64_t *rs, char *buf, size_t size)
+{
+	size_t i, j, len;
+	char pat[16];
+
+	memset(buf, 0, size);
+	for (i = 0; i < size; i += len) {
+		len = 256 + xdlb_range(rs, 4096);
+		if (xdlb_range(rs, 4))
+			continue;
+		for (j = 0; j < sizeof(pat); j++)
+			pat[j] = (char)xdlb_rand(rs);
+		for (j = i; j < i + len && j < size; j++)
+			buf[j] = pat[(j - i) % (1 + (i % sizeof(pat)))];
+	}
+}
+
+static void
+xdlb_gen_text(uint64_t *rs, char *buf, size_t size)
+{
+	size_t i, len;
+
+	for (i = 0; i < size; ) {
+		len = 8 + xdlb_range(rs, 72);
+		for (; len > 0 && i < size - 1; len--, i++)
+			buf[i] = xdlb_range(rs, 6) ? 'a' + xdlb_range(rs, 26) : ' ';
+		buf[i++] = '\n';
+	}
+}
+
+static int
+xdlb_mutate_new(uint64_t *rs, mmbuffer_t const *src, mmbuffer_t *dst)
+{
+	if ((dst->ptr = malloc(src->size)) == NULL) {
+		return -1;
+	}
+	dst->size = src->size;
+	xdlb_gen_random(rs, dst->ptr, dst->size);
+
+	return 0;
+}
+
+/*
+ * Insert, delete and move blocks around, so that most of the data is
+ * still there but almost none of it is at the same offset.
+ */
+static int
+xdlb_mutate_shift(uint64_t *rs, mmbuffer_t const *src, mmbuffer_t *dst)
+{
+	size_t spos, dpos, len, dsize;
+
+	dsize = src->size + src->size / 4;
+	if ((dst->ptr = malloc(dsize)) == NULL) {
+		return -1;
+	}
+	for (spos = dpos = 0; spos < src->size && dpos < dsize; ) {
+		len = 1024 + xdlb_range(rs, 16384);
+		len = XDL_MIN(len, src->size - spos);
+		len = XDL_MIN(len, dsize - dpos);
+		switch (xdlb_range(rs, 8)) {
+		case 0:
+			xdlb_gen_random(rs, dst->ptr + dpos, len);
+			dpos += len;
+			break;
+		case 1:
+			spos += len;
+			break;
+		case 2:
+			memcpy(dst->ptr + dpos,
+			       src->ptr + xdlb_range(rs, src->size - len), len);
+			dpos += len;
+			break;
+		default:
+			memcpy(dst->ptr + dpos, src->ptr + spos, len);
+			spos += len;
+			dpos += len;
+			break;
+		}
+	}
+	dst->size = dpos;
+
+	return 0;
+}
+
+static int
+xdlb_mutate_flip(uint64_t *rs, mmbuffer_t const *src, mmbuffer_t *dst)
+{
+	size_t i, n;
+
+	if ((dst->ptr = malloc(src->size)) == NULL) {
+		return -1;
+	}
+	dst->size = src->size;
+	memcpy(dst->ptr, src->ptr, src->size);
+	for (i = 0, n = src->size / 4096 + 1; i < n; i++)
+		dst->ptr[xdlb_range(rs, dst->size)] ^= 1 << xdlb_range(rs, 8);
+
+	return 0;
+}
+
+/*
+ * Replace, insert and delete about one line in forty.
+ */
+static int
+xdlb_mutate_lines(uint64_t *rs, mmbuffer_t const *src, mmbuffer_t *dst)
+{
+	size_t spos, dpos, len, dsize;
+	char const *eol;
+
+	dsize = src->size * 2 + 128;
+	if ((dst->ptr = malloc(dsize)) == NULL) {
+		return -1;
+	}
+	for (spos = dpos = 0; spos < src->size; spos += len) {
+		eol = memchr(src->ptr + spos, '\n', src->size - spos);
+		len = eol ? (size_t)(eol - (src->ptr + spos)) + 1 :
+			src->size - spos;
+		switch (xdlb_range(rs, 40)) {
+		case 0:
+			break;
+		case 1:
+		case 2:
+			xdlb_gen_text(rs, dst->ptr + dpos, len);
+			dpos += len;
+			break;
+		case 3:
+			memcpy(dst->ptr + dpos, src->ptr + spos, len);
+			dpos += len;
+			/* fall through */
+		case 4:
+			xdlb_gen_text(rs, dst->ptr + dpos, len);
+			dpos += len;
+			break;
+		default:
+			memcpy(dst->ptr + dpos, src->ptr + spos, len);
+			dpos += len;
+			break;
+		}
+	}
+	dst->size = dpos;
+
+	return 0;
+}
+
+static xdlbcorpus_t xdlb_corpora[] = {
+	{ "random", 0, 0, xdlb_gen_random, xdlb_mutate_new },
+	{ "shifted", 0, 0, xdlb_gen_random, xdlb_mutate_shift },
+	{ "flips", 0, 0, xdlb_gen_random, xdlb_mutate_flip },
+	{ "sparse", 0, 3, xdlb_gen_sparse, xdlb_mutate_shift },
+	{ "text", 1, 0, xdlb_gen_text, xdlb_mutate_lines },
+};
+
+static int
+xdlb_mmfile_outf(void *priv, mmbuffer_t *mb, size_t nbuf)
+{
+	mmfile_t *mmf = priv;
+
+	if (xdl_writem_mmfile(mmf, mb, nbuf) < 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Every input is kept in a single block, since that's what the binary
+ * engines want.
+ */
+static int
+xdlb_load(mmfile_t *mmf, char const *data, size_t size)
+{
+	if (xdl_init_mmfile(mmf, size ? size : 1, XDL_MMF_ATOMIC) < 0) {
+		return -1;
+	}
+	if (size && xdl_write_mmfile(mmf, data, size) != (ssize_t)size) {
+		xdl_free_mmfile(mmf);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+xdlb_compact(mmfile_t *mmf)
+{
+	mmfile_t mmfc;
+	long size = xdl_mmfile_size(mmf);
+
+	if (xdl_mmfile_compact(mmf, &mmfc, size > 0 ? size : 1,
+	                       XDL_MMF_ATOMIC) < 0) {
+		return -1;
+	}
+	xdl_free_mmfile(mmf);
+	*mmf = mmfc;
+
+	return 0;
+}
+
+static int
+xdlb_derive(xdlbcorpus_t const *xcp, uint64_t *rs, mmfile_t *src,
+            mmfile_t *dst)
+{
+	mmbuffer_t smb, dmb;
+	int res;
+
+	smb.ptr = xdl_mmfile_first(src, &smb.size);
+	if (smb.ptr == NULL)
+		smb.size = 0;
+	if (xcp->mutate(rs, &smb, &dmb) < 0) {
+		return -1;
+	}
+	res = xdlb_load(dst, dmb.ptr, dmb.size);
+	free(dmb.ptr);
+
+	return res;
+}
+
+static int
+xdlb_do_bdiff(mmfile_t *mf1, mmfile_t *mf2, mmfile_t *mfp)
+{
+	bdiffparam_t bdp;
+
+	bdp.bsize = 16;
+	bdp.flags = 0;
+	if (xdlt_do_bindiff(mf1, mf2, &bdp, mfp) < 0 || xdlb_compact(mfp) < 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
+static void
+xdlb_free_case(xdlbcase_t *xc)
+{
+	int i;
+
+	for (i = 0; i < XDLB_CHAIN; i++) {
+		if (xc->cpch[i].head)
+			xdl_free_mmfile(&xc->cpch[i]);
+	}
+	for (i = 0; i <= XDLB_CHAIN; i++) {
+		if (xc->chain[i].head)
+			xdl_free_mmfile(&xc->chain[i]);
+	}
+	if (xc->mpch.head)
+		xdl_free_mmfile(&xc->mpch);
+	if (xc->tpch.head)
+		xdl_free_mmfile(&xc->tpch);
+	if (xc->bpch.head)
+		xdl_free_mmfile(&xc->bpch);
+	if (xc->other.head)
+		xdl_free_mmfile(&xc->other);
+	if (xc->cur.head)
+		xdl_free_mmfile(&xc->cur);
+	if (xc->orig.head)
+		xdl_free_mmfile(&xc->orig);
+}
+
+/*
+ * Build everything the engines need for one corpus: the two versions,
+ * a third one for merge3, a chain of versions for bpatch_multi, and the
+ * patches the apply side of the benchmark consumes.
+ */
+static int
+xdlb_setup(xdlbcorpus_t const *xcp, uint64_t seed, size_t size,
+           xdlbcase_t *xc)
+{
+	uint64_t rs = seed;
+	xpparam_t xpp;
+	xdemitconf_t xecfg;
+	char *data;
+	int i;
+
+	memset(xc, 0, sizeof(*xc));
+	size = XDL_MAX(size >> xcp->shift, 64);
+	if ((data = malloc(size)) == NULL) {
+		return -1;
+	}
+	xcp->gen(&rs, data, size);
+	if (xdlb_load(&xc->orig, data, size) < 0) {
+		free(data);
+		return -1;
+	}
+	free(data);
+	if (xdlb_derive(xcp, &rs, &xc->orig, &xc->cur) < 0 ||
+	    xdlb_derive(xcp, &rs, &xc->orig, &xc->other) < 0 ||
+	    xdlb_do_bdiff(&xc->orig, &xc->cur, &xc->bpch) < 0) {
+		xdlb_free_case(xc);
+		return -1;
+	}
+
+	if (xdlb_load(&xc->chain[0], xdl_mmfile_first(&xc->orig, &size),
+	              size) < 0) {
+		xdlb_free_case(xc);
+		return -1;
+	}
+	for (i = 0; i < XDLB_CHAIN; i++) {
+		if (xdlb_derive(xcp, &rs, &xc->chain[i], &xc->chain[i + 1]) < 0 ||
+		    xdlb_do_bdiff(&xc->chain[i], &xc->chain[i + 1],
+		                  &xc->cpch[i]) < 0) {
+			xdlb_free_case(xc);
+			return -1;
+		}
+	}
+
+	if (xcp->text) {
+		xpp.flags = 0;
+		xecfg.ctxlen = 3;
+		if (xdlt_do_diff(&xc->orig, &xc->cur, &xpp, &xecfg,
+		                 &xc->tpch) < 0 ||
+		    xdlt_do_diff(&xc->orig, &xc->other, &xpp, &xecfg,
+		                 &xc->mpch) < 0) {
+			xdlb_free_case(xc);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int
+xdlb_run_bdiff(xdlbcase_t *xc, mmfile_t *out)
+{
+	bdiffparam_t bdp;
+
+	bdp.bsize = 16;
+	bdp.flags = 0;
+
+	return xdlt_do_bindiff(&xc->orig, &xc->cur, &bdp, out);
+}
+
+static int
+xdlb_run_bdiff_self(xdlbcase_t *xc, mmfile_t *out)
+{
+	bdiffparam_t bdp;
+
+	bdp.bsize = 16;
+	bdp.flags = XDL_BDF_SELFREF;
+
+	return xdlt_do_bindiff(&xc->orig, &xc->cur, &bdp, out);
+}
+
+/*
+ * bdiff with its ops going straight into the VCDIFF encoder, so this is
+ * what the encoder costs on top of "bdiff".
+ */
+static int
+xdlb_run_vcdiff(xdlbcase_t *xc, mmfile_t *out)
+{
+	bdiffparam_t bdp;
+	mmbuffer_t mb1, mb2;
+	xdemitcb_t ecb, vecb;
+	xdvcdenc_t *enc;
+	int res;
+
+	bdp.bsize = 16;
+	bdp.flags = 0;
+	mb1.ptr = xdl_mmfile_first(&xc->orig, &mb1.size);
+	mb2.ptr = xdl_mmfile_first(&xc->cur, &mb2.size);
+	if (xdl_init_mmfile(out, 8 * 1024, XDL_MMF_ATOMIC) < 0) {
+		return -1;
+	}
+	vecb.priv = out;
+	vecb.outf = xdlb_mmfile_outf;
+	if ((enc = xdl_vcdiff_enc_init(&vecb)) == NULL) {
+		xdl_free_mmfile(out);
+		return -1;
+	}
+	ecb.priv = enc;
+	ecb.outf = xdl_vcdiff_enc_outf;
+	res = xdl_bdiff_mbv(&mb1, 1, &mb2, &bdp, &ecb);
+	if (res == 0)
+		res = xdl_vcdiff_enc_end(enc);
+	xdl_vcdiff_enc_free(enc);
+	if (res < 0)
+		xdl_free_mmfile(out);
+
+	return res;
+}
+
+static int
+xdlb_run_rabdiff(xdlbcase_t *xc, mmfile_t *out)
+{
+	return xdlt_do_rabdiff(&xc->orig, &xc->cur, out);
+}
+
+static int
+xdlb_run_rabdiff_gear(xdlbcase_t *xc, mmfile_t *out)
+{
+	rabdiffparam_t rdp;
+
+	rdp.flags = XDL_BDF_GEAR;
+	rdp.wndsize = 0;
+	rdp.poly = 0;
+
+	return xdlt_do_rabdiffp(&xc->orig, &xc->cur, &rdp, out);
+}
+
+static int
+xdlb_run_cdcdiff(xdlbcase_t *xc, mmfile_t *out)
+{
+	mmbuffer_t mb1, mb2;
+	cdcdiffparam_t cdp;
+	xdemitcb_t ecb;
+
+	cdp.avgbits = 0;
+	cdp.rdp.flags = 0;
+	cdp.rdp.wndsize = 0;
+	cdp.rdp.poly = 0;
+	mb1.ptr = xdl_mmfile_first(&xc->orig, &mb1.size);
+	mb2.ptr = xdl_mmfile_first(&xc->cur, &mb2.size);
+	if (xdl_init_mmfile(out, 8 * 1024, XDL_MMF_ATOMIC) < 0) {
+		return -1;
+	}
+	ecb.priv = out;
+	ecb.outf = xdlb_mmfile_outf;
+	if (xdl_cdcdiff_mbvp(&mb1, 1, &mb2, &cdp, &ecb) < 0) {
+		xdl_free_mmfile(out);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+xdlb_run_bpatch(xdlbcase_t *xc, mmfile_t *out)
+{
+	return xdlt_do_binpatch(&xc->orig, &xc->bpch, out);
+}
+
+static int
+xdlb_run_bpatch_multi(xdlbcase_t *xc, mmfile_t *out)
+{
+	mmbuffer_t base, pch[XDLB_CHAIN];
+	xdemitcb_t ecb;
+	int i;
+
+	base.ptr = xdl_mmfile_first(&xc->chain[0], &base.size);
+	for (i = 0; i < XDLB_CHAIN; i++)
+		pch[i].ptr = xdl_mmfile_first(&xc->cpch[i], &pch[i].size);
+	if (xdl_init_mmfile(out, 8 * 1024, XDL_MMF_ATOMIC) < 0) {
+		return -1;
+	}
+	ecb.priv = out;
+	ecb.outf = xdlb_mmfile_outf;
+	if (xdl_bpatch_multi(&base, pch, XDLB_CHAIN, &ecb) < 0) {
+		xdl_free_mmfile(out);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+xdlb_run_diff(xdlbcase_t *xc, mmfile_t *out)
+{
+	xpparam_t xpp;
+	xdemitconf_t xecfg;
+
+	xpp.flags = 0;
+	xecfg.ctxlen = 3;
+
+	return xdlt_do_diff(&xc->orig, &xc->cur, &xpp, &xecfg, out);
+}
+
+static int
+xdlb_run_patch(xdlbcase_t *xc, mmfile_t *out)
+{
+	return xdlt_do_patch(&xc->orig, &xc->tpch, XDL_PATCH_NORMAL, out);
+}
+
+/*
+ * Conflicting hunks are part of the workload, so the rejects are
+ * thrown away rather than treated as a failure.
+ */
+static int
+xdlb_run_merge3(xdlbcase_t *xc, mmfile_t *out)
+{
+	xdemitcb_t ecb, rjecb;
+	mmfile_t mmfrj;
+
+	if (xdl_init_mmfile(out, 8 * 1024, XDL_MMF_ATOMIC) < 0) {
+		return -1;
+	}
+	if (xdl_init_mmfile(&mmfrj, 8 * 1024, XDL_MMF_ATOMIC) < 0) {
+		xdl_free_mmfile(out);
+		return -1;
+	}
+	ecb.priv = out;
+	ecb.outf = xdlb_mmfile_outf;
+	rjecb.priv = &mmfrj;
+	rjecb.outf = xdlb_mmfile_outf;
+	if (xdl_merge3(&xc->orig, &xc->cur, &xc->other, &ecb, &rjecb) < 0) {
+		xdl_free_mmfile(&mmfrj);
+		xdl_free_mmfile(out);
+		return -1;
+	}
+	xdl_free_mmfile(&mmfrj);
+
+	return 0;
+}
+
+static long
+xdlb_count_bops(mmfile_t *mfp)
+{
+	long ops = 0;
+	size_t size, len;
+	unsigned char const *data, *top;
+
+	if (xdlb_compact(mfp) < 0 ||
+	    (data = xdl_mmfile_first(mfp, &size)) == NULL || size < 8) {
+		return -1;
+	}
+	for (top = data + size, data += 8; data < top; ops++) {
+		switch (*data) {
+		case XDL_BDOP_INS:
+			data += 2 + data[1];
+			break;
+		case XDL_BDOP_INSB:
+			XDL_LE32_GET(data + 1, len);
+			data += 5 + len;
+			break;
+		case XDL_BDOP_CPY:
+		case XDL_BDOP_CPYT:
+			data += 9;
+			break;
+		default:
+			return -1;
+		}
+	}
+
+	return ops;
+}
+
+static long
+xdlb_count_hunks(mmfile_t *mfp)
+{
+	long hunks = 0;
+	size_t size, i;
+	int bol = 1;
+	char const *data;
+
+	for (data = xdl_mmfile_first(mfp, &size); data != NULL;
+	     data = xdl_mmfile_next(mfp, &size)) {
+		for (i = 0; i < size; i++) {
+			if (bol && data[i] == '@')
+				hunks++;
+			bol = data[i] == '\n';
+		}
+	}
+
+	/* every hunk header starts with "@@" */
+	return hunks / 2;
+}
+
+static long
+xdlb_ops_out(xdlbcase_t *xc, mmfile_t *out)
+{
+	return xdlb_count_bops(out);
+}
+
+static long
+xdlb_ops_bpatch(xdlbcase_t *xc, mmfile_t *out)
+{
+	return xdlb_count_bops(&xc->bpch);
+}
+
+static long
+xdlb_ops_chain(xdlbcase_t *xc, mmfile_t *out)
+{
+	long ops = 0, n;
+	int i;
+
+	for (i = 0; i < XDLB_CHAIN; i++) {
+		if ((n = xdlb_count_bops(&xc->cpch[i])) < 0) {
+			return -1;
+		}
+		ops += n;
+	}
+
+	return ops;
+}
+
+static long
+xdlb_hunks_out(xdlbcase_t *xc, mmfile_t *out)
+{
+	return xdlb_count_hunks(out);
+}
+
+static long
+xdlb_hunks_patch(xdlbcase_t *xc, mmfile_t *out)
+{
+	return xdlb_count_hunks(&xc->tpch);
+}
+
+static long
+xdlb_hunks_merge(xdlbcase_t *xc, mmfile_t *out)
+{
+	return xdlb_count_hunks(&xc->mpch);
+}
+
+static long
+xdlb_psize_out(xdlbcase_t *xc, mmfile_t *out)
+{
+	return xdl_mmfile_size(out);
+}
+
+static long
+xdlb_psize_bpatch(xdlbcase_t *xc, mmfile_t *out)
+{
+	return xdl_mmfile_size(&xc->bpch);
+}
+
+static long
+xdlb_psize_chain(xdlbcase_t *xc, mmfile_t *out)
+{
+	long size = 0;
+	int i;
+
+	for (i = 0; i < XDLB_CHAIN; i++)
+		size += xdl_mmfile_size(&xc->cpch[i]);
+
+	return size;
+}
+
+static long
+xdlb_psize_patch(xdlbcase_t *xc, mmfile_t *out)
+{
+	return xdl_mmfile_size(&xc->tpch);
+}
+
+static long
+xdlb_psize_merge(xdlbcase_t *xc, mmfile_t *out)
+{
+	return xdl_mmfile_size(&xc->mpch);
+}
+
+static mmfile_t *
+xdlb_expect_cur(xdlbcase_t *xc)
+{
+	return &xc->cur;
+}
+
+static mmfile_t *
+xdlb_expect_chain(xdlbcase_t *xc)
+{
+	return &xc->chain[XDLB_CHAIN];
+}
+
+static xdlbengine_t xdlb_engines[] = {
+	{ "bdiff", 0, xdlb_run_bdiff, xdlb_ops_out, xdlb_psize_out, NULL },
+	{ "bdiff_self", 0, xdlb_run_bdiff_self, xdlb_ops_out, xdlb_psize_out,
+	  NULL },
+	{ "rabdiff", 0, xdlb_run_rabdiff, xdlb_ops_out, xdlb_psize_out, NULL },
+	{ "rabdiff_gear", 0, xdlb_run_rabdiff_gear, xdlb_ops_out, xdlb_psize_out,
+	  NULL },
+	{ "cdcdiff", 0, xdlb_run_cdcdiff, xdlb_ops_out, xdlb_psize_out, NULL },
+	{ "vcdiff", 0, xdlb_run_vcdiff, xdlb_ops_bpatch, xdlb_psize_out, NULL },
+	{ "bpatch", 0, xdlb_run_bpatch, xdlb_ops_bpatch, xdlb_psize_bpatch,
+	  xdlb_expect_cur },
+	{ "bpatch_multi", 0, xdlb_run_bpatch_multi, xdlb_ops_chain,
+	  xdlb_psize_chain, xdlb_expect_chain },
+	{ "diff", 1, xdlb_run_diff, xdlb_hunks_out, xdlb_psize_out, NULL },
+	{ "patch", 1, xdlb_run_patch, xdlb_hunks_patch, xdlb_psize_patch,
+	  xdlb_expect_cur },
+	{ "merge3", 1, xdlb_run_merge3, xdlb_hunks_merge, xdlb_psize_merge,
+	  NULL },
+};
+
+static double
+xdlb_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Best of "rounds" runs.  Peak memory is whatever libxdiff had live on
+ * top of the inputs, including the output it was writing into.
+ */
+static int
+xdlb_bench(xdlbcorpus_t const *xcp, xdlbengine_t const *xep, xdlbcase_t *xc,
+           int rounds)
+{
+	mmfile_t out;
+	double start, best = 0;
+	size_t peak = 0;
+	long ops, psize;
+	int i;
+
+	for (i = 0; i < rounds; i++) {
+		size_t base = xdlb_live;
+
+		xdlb_peak = xdlb_live;
+		start = xdlb_now();
+		if (xep->run(xc, &out) < 0) {
+			fprintf(stderr, "%s: %s failed\n", xcp->name, xep->name);
+			return -1;
+		}
+		start = xdlb_now() - start;
+		if (i == 0 || start < best)
+			best = start;
+		if (xdlb_peak - base > peak)
+			peak = xdlb_peak - base;
+		if (i < rounds - 1)
+			xdl_free_mmfile(&out);
+	}
+
+	if (xep->expect && xdl_mmfile_cmp(&out, xep->expect(xc))) {
+		fprintf(stderr, "%s: %s produced the wrong output\n", xcp->name,
+		        xep->name);
+		xdl_free_mmfile(&out);
+		return -1;
+	}
+	ops = xep->ops(xc, &out);
+	psize = xep->psize(xc, &out);
+
+	printf("%s,%s,%ld,%ld,%ld,%ld,%.2f,%zu\n", xcp->name, xep->name,
+	       xdl_mmfile_size(&xc->orig), xdl_mmfile_size(&xc->cur), psize,
+	       ops, best > 0 ? (xdl_mmfile_size(&xc->cur) / 1e6) / best : 0.0,
+	       peak);
+	fflush(stdout);
+	xdl_free_mmfile(&out);
+
+	return 0;
+}
+
+static void
+xdlb_usage(char const *prg)
+{
+	fprintf(stderr, "use: %s [--size N] [--rounds N] [--seed N] "
+	        "[--corpus NAME] [--engine NAME]\n", prg);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int i, j, rounds = 3, res = 0;
+	size_t size = 1024 * 1024;
+	uint64_t seed = XDLB_SEED;
+	char const *corpus = NULL, *engine = NULL;
+	memallocator_t malt;
+	xdlbcase_t xc;
+
+	malt.priv = NULL;
+	malt.malloc = xdlb_malloc;
+	malt.free = xdlb_free;
+	malt.realloc = xdlb_realloc;
+	xdl_set_allocator(&malt);
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--size") && i + 1 < argc) {
+			size = strtoul(argv[++i], NULL, 0);
+		} else if (!strcmp(argv[i], "--rounds") && i + 1 < argc) {
+			rounds = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+			seed = strtoull(argv[++i], NULL, 0);
+		} else if (!strcmp(argv[i], "--corpus") && i + 1 < argc) {
+			corpus = argv[++i];
+		} else if (!strcmp(argv[i], "--engine") && i + 1 < argc) {
+			engine = argv[++i];
+		} else {
+			xdlb_usage(argv[0]);
+			return 1;
+		}
+	}
+	if (size < 64 || rounds < 1 || seed == 0) {
+		xdlb_usage(argv[0]);
+		return 1;
+	}
+
+	printf("corpus,engine,src_size,tgt_size,patch_size,ops,mbps,peak_mem\n");
+	for (i = 0; i < (int)(sizeof(xdlb_corpora) / sizeof(xdlb_corpora[0]));
+	     i++) {
+		xdlbcorpus_t const *xcp = &xdlb_corpora[i];
+
+		if (corpus && strcmp(corpus, xcp->name))
+			continue;
+		/*
+		 * Every corpus gets its own seed, so adding one doesn't change
+		 * the data the others see.
+		 */
+		if (xdlb_setup(xcp, seed + i, size, &xc) < 0) {
+			fprintf(stderr, "%s: setup failed\n", xcp->name);
+			res = 1;
+			continue;
+		}
+		for (j = 0; j < (int)(sizeof(xdlb_engines) /
+		                      sizeof(xdlb_engines[0])); j++) {
+			xdlbengine_t const *xep = &xdlb_engines[j];
+
+			if ((engine && strcmp(engine, xep->name)) ||
+			    (xep->text && !xcp->text))
+				continue;
+			if (xdlb_bench(xcp, xep, &xc, rounds) < 0)
+				res = 1;
+		}
+		xdlb_free_case(&xc);
+	}
+
+	return res;
+}
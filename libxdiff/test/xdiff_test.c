@@ -136,6 +136,7 @@ main(int argc, char *argv[])
 	xpp.flags = 0;
 	xecfg.ctxlen = ctxlen;
 	bdp.bsize = bsize;
+	bdp.flags = 0;
 	if (xdlt_load_mmfile(argv[i], &mf1, do_bdiff || do_bpatch) < 0) {
 		return 2;
 	}
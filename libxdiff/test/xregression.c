@@ -67,6 +67,7 @@ main(int argc, char *argv[])
 	xpp.flags = 0;
 	xecfg.ctxlen = 3;
 	bdp.bsize = 16;
+	bdp.flags = 0;
 
 	for (i = 1; i < argc; i++) {
 		if (!strcmp(argv[i], "--size")) {
@@ -102,6 +103,14 @@ main(int argc, char *argv[])
 			fprintf(stderr, "OK\n");
 		}
 
+		fprintf(stderr, "Running SEEK  test : %d ... ", i);
+		if (xdlt_auto_seekregress(&bdp, size, rmod, chmax) < 0) {
+			fprintf(stderr, "FAIL\n");
+			break;
+		} else {
+			fprintf(stderr, "OK\n");
+		}
+
 		fprintf(stderr, "Running RBIN  test : %d ... ", i);
 		if (xdlt_auto_rabinregress(size, rmod, chmax) < 0) {
 			fprintf(stderr, "FAIL\n");
@@ -110,6 +119,30 @@ main(int argc, char *argv[])
 			fprintf(stderr, "OK\n");
 		}
 
+		fprintf(stderr, "Running RABP  test : %d ... ", i);
+		if (xdlt_auto_rabpolyregress(size, rmod, chmax) < 0) {
+			fprintf(stderr, "FAIL\n");
+			break;
+		} else {
+			fprintf(stderr, "OK\n");
+		}
+
+		fprintf(stderr, "Running GEAR  test : %d ... ", i);
+		if (xdlt_auto_gearregress(size, rmod, chmax) < 0) {
+			fprintf(stderr, "FAIL\n");
+			break;
+		} else {
+			fprintf(stderr, "OK\n");
+		}
+
+		fprintf(stderr, "Running CDC   test : %d ... ", i);
+		if (xdlt_auto_cdcregress(size, rmod, chmax) < 0) {
+			fprintf(stderr, "FAIL\n");
+			break;
+		} else {
+			fprintf(stderr, "OK\n");
+		}
+
 		fprintf(stderr, "Running MBIN  test : %d ... ", i);
 		if (xdlt_auto_mbinregress(&bdp, size, rmod, chmax, 32) != 0) {
 			fprintf(stderr, "FAIL\n");
@@ -117,6 +150,54 @@ main(int argc, char *argv[])
 		} else {
 			fprintf(stderr, "OK\n");
 		}
+
+		fprintf(stderr, "Running REFS  test : %d ... ", i);
+		if (xdlt_auto_refbinregress(&bdp, size, rmod, chmax, 4) != 0) {
+			fprintf(stderr, "FAIL\n");
+			break;
+		} else {
+			fprintf(stderr, "OK\n");
+		}
+
+		fprintf(stderr, "Running SELF  test : %d ... ", i);
+		if (xdlt_auto_selfregress(&bdp, size, rmod, chmax) != 0) {
+			fprintf(stderr, "FAIL\n");
+			break;
+		} else {
+			fprintf(stderr, "OK\n");
+		}
+
+		fprintf(stderr, "Running VCD   test : %d ... ", i);
+		if (xdlt_auto_vcdregress(&bdp, size, rmod, chmax) != 0) {
+			fprintf(stderr, "FAIL\n");
+			break;
+		} else {
+			fprintf(stderr, "OK\n");
+		}
+
+		fprintf(stderr, "Running BCJ   test : %d ... ", i);
+		if (xdlt_auto_bcjregress(&bdp, size) != 0) {
+			fprintf(stderr, "FAIL\n");
+			break;
+		} else {
+			fprintf(stderr, "OK\n");
+		}
+
+		fprintf(stderr, "Running STORE test : %d ... ", i);
+		if (xdlt_auto_storeregress(&bdp, size, rmod, chmax, 24) != 0) {
+			fprintf(stderr, "FAIL\n");
+			break;
+		} else {
+			fprintf(stderr, "OK\n");
+		}
+
+		fprintf(stderr, "Running INPL  test : %d ... ", i);
+		if (xdlt_auto_inplaceregress(&bdp, size, rmod, chmax) != 0) {
+			fprintf(stderr, "FAIL\n");
+			break;
+		} else {
+			fprintf(stderr, "OK\n");
+		}
 	}
 
 	return 0;
@@ -55,7 +55,7 @@
 #define XDLT_STD_BLKSIZE (1024 * 8)
 #define XDLT_MAX_LINE_SIZE 80
 
-static int xdlt_mmfile_outf(void *priv, mmbuffer_t *mb, int nbuf);
+static int xdlt_mmfile_outf(void *priv, mmbuffer_t *mb, size_t nbuf);
 
 int
 xdlt_dump_mmfile(char const *fname, mmfile_t *mmf)
@@ -119,7 +119,7 @@ xdlt_load_mmfile(char const *fname, mmfile_t *mf, int binmode)
 }
 
 static int
-xdlt_mmfile_outf(void *priv, mmbuffer_t *mb, int nbuf)
+xdlt_mmfile_outf(void *priv, mmbuffer_t *mb, size_t nbuf)
 {
 	mmfile_t *mmf = priv;
 
@@ -384,6 +384,33 @@ xdlt_do_rabdiff(mmfile_t *mf1, mmfile_t *mf2, mmfile_t *mfp)
 	return 0;
 }
 
+int
+xdlt_do_rabdiffp(mmfile_t *mf1, mmfile_t *mf2, rabdiffparam_t const *rdp,
+                 mmfile_t *mfp)
+{
+	mmbuffer_t mb1, mb2;
+	xdemitcb_t ecb;
+
+	if (!xdl_mmfile_iscompact(mf1) || !xdl_mmfile_iscompact(mf2)) {
+		return -1;
+	}
+	if ((mb1.ptr = (char *)xdl_mmfile_first(mf1, &mb1.size)) == NULL)
+		mb1.size = 0;
+	if ((mb2.ptr = (char *)xdl_mmfile_first(mf2, &mb2.size)) == NULL)
+		mb2.size = 0;
+	if (xdl_init_mmfile(mfp, XDLT_STD_BLKSIZE, XDL_MMF_ATOMIC) < 0) {
+		return -1;
+	}
+	ecb.priv = mfp;
+	ecb.outf = xdlt_mmfile_outf;
+	if (xdl_rabdiff_mbvp(&mb1, 1, &mb2, rdp, &ecb) < 0) {
+		xdl_free_mmfile(mfp);
+		return -1;
+	}
+
+	return 0;
+}
+
 int
 xdlt_do_binpatch(mmfile_t *mf, mmfile_t *mfp, mmfile_t *mfr)
 {
@@ -478,6 +505,80 @@ xdlt_auto_binregress(bdiffparam_t const *bdp, long size, double rmod, int chmax)
 	return 0;
 }
 
+/*
+ * Patch from a copy of the source that's cut into lots of small blocks,
+ * some of them empty, so that every copy has to seek across blocks.
+ */
+int
+xdlt_auto_seekregress(bdiffparam_t const *bdp, long size, double rmod,
+                      int chmax)
+{
+	int res = -1;
+	long i, n;
+	size_t pos, bsize;
+	char *blk, c;
+	mmfile_t mf1, mf1c, mf2, mf2c, mfs, mfp, mfr;
+
+	if (xdlt_create_file(&mf1, size) < 0) {
+		return -1;
+	}
+	if (xdlt_change_file(&mf1, &mf2, rmod, chmax) < 0) {
+		xdl_free_mmfile(&mf1);
+		return -1;
+	}
+	if (xdl_mmfile_compact(&mf2, &mf2c, XDLT_STD_BLKSIZE, XDL_MMF_ATOMIC) <
+	    0) {
+		xdl_free_mmfile(&mf2);
+		xdl_free_mmfile(&mf1);
+		return -1;
+	}
+	xdl_free_mmfile(&mf2);
+	if (xdl_mmfile_compact(&mf1, &mf1c, XDLT_STD_BLKSIZE, XDL_MMF_ATOMIC) <
+	    0) {
+		xdl_free_mmfile(&mf2c);
+		xdl_free_mmfile(&mf1);
+		return -1;
+	}
+	xdl_free_mmfile(&mf1);
+	if (xdl_init_mmfile(&mfs, XDLT_STD_BLKSIZE, 0) < 0) {
+		xdl_free_mmfile(&mf2c);
+		xdl_free_mmfile(&mf1c);
+		return -1;
+	}
+	if ((blk = (char *)xdl_mmfile_first(&mf1c, &bsize)) == NULL)
+		bsize = 0;
+	for (pos = 0; pos < bsize; pos += n) {
+		n = rand() % 128;
+		n = XDL_MIN(n, (long)(bsize - pos));
+		if (xdl_mmfile_ptradd(&mfs, blk + pos, n, XDL_MMB_READONLY) < 0)
+			goto out;
+	}
+
+	for (i = 0; i < 256 && bsize; i++) {
+		pos = (size_t)rand() % bsize;
+		if (xdl_seek_mmfile(&mfs, pos) < 0 ||
+		    xdl_read_mmfile(&mfs, &c, 1) != 1 || c != blk[pos])
+			goto out;
+	}
+	if (xdl_seek_mmfile(&mfs, bsize) == 0)
+		goto out;
+
+	if (xdlt_do_bindiff(&mf1c, &mf2c, bdp, &mfp) < 0)
+		goto out;
+	if (xdlt_do_binpatch(&mfs, &mfp, &mfr) == 0) {
+		res = xdl_mmfile_cmp(&mfr, &mf2c) ? -1 : 0;
+		xdl_free_mmfile(&mfr);
+	}
+	xdl_free_mmfile(&mfp);
+
+out:
+	xdl_free_mmfile(&mfs);
+	xdl_free_mmfile(&mf2c);
+	xdl_free_mmfile(&mf1c);
+
+	return res;
+}
+
 int
 xdlt_auto_rabinregress(long size, double rmod, int chmax)
 {
@@ -508,6 +609,93 @@ xdlt_auto_rabinregress(long size, double rmod, int chmax)
 	return 0;
 }
 
+/*
+ * Round trip a patch made by xdl_rabdiff_mbvp() with rdp.
+ */
+static int
+xdlt_auto_rabpregress(rabdiffparam_t const *rdp, long size, double rmod,
+                      int chmax)
+{
+	int res;
+	mmfile_t mf1, mf2, mf2c, mfp, mfr;
+
+	if (xdlt_create_file(&mf1, size) < 0) {
+		return -1;
+	}
+	if (xdlt_change_file(&mf1, &mf2, rmod, chmax) < 0) {
+		xdl_free_mmfile(&mf1);
+		return -1;
+	}
+	if (xdl_mmfile_compact(&mf2, &mf2c, XDLT_STD_BLKSIZE, XDL_MMF_ATOMIC) <
+	    0) {
+		xdl_free_mmfile(&mf2);
+		xdl_free_mmfile(&mf1);
+		return -1;
+	}
+	xdl_free_mmfile(&mf2);
+	if ((res = xdlt_do_rabdiffp(&mf1, &mf2c, rdp, &mfp)) == 0) {
+		if ((res = xdlt_do_binpatch(&mf1, &mfp, &mfr)) == 0) {
+			if (xdl_mmfile_cmp(&mfr, &mf2c))
+				res = -1;
+			xdl_free_mmfile(&mfr);
+		}
+		xdl_free_mmfile(&mfp);
+	}
+	xdl_free_mmfile(&mf2c);
+	xdl_free_mmfile(&mf1);
+
+	return res;
+}
+
+/*
+ * Check that the default polynomial passes xdl_rabin_polycheck() and a
+ * multiple of it doesn't, then round trip a patch made with a random
+ * window size and a freshly generated polynomial.
+ */
+int
+xdlt_auto_rabpolyregress(long size, double rmod, int chmax)
+{
+	static long const wnds[] = { 16, 20, 32, 64, 128 };
+	uint64_t poly;
+	rabdiffparam_t rdp;
+
+	if (xdl_rabin_polycheck(0x36f7381af4d70d33ULL) < 0 ||
+	    xdl_rabin_polycheck(0x36f7381af4d70d33ULL << 1) == 0) {
+		return -1;
+	}
+	if (xdl_rabin_polygen(((uint64_t)rand() << 32) ^ (uint64_t)rand(),
+	                      &poly) < 0 ||
+	    xdl_rabin_polycheck(poly) < 0) {
+		return -1;
+	}
+	rdp.flags = (rand() & 1) ? XDL_BDF_SELFREF : 0;
+	rdp.wndsize = wnds[rand() % (sizeof(wnds) / sizeof(wnds[0]))];
+	rdp.poly = poly;
+
+	return xdlt_auto_rabpregress(&rdp, size, rmod, chmax);
+}
+
+/*
+ * The same with a gear hash, which only takes some of the window sizes,
+ * and no polynomial.
+ */
+int
+xdlt_auto_gearregress(long size, double rmod, int chmax)
+{
+	static long const wnds[] = { 0, 16, 32, 64 };
+	rabdiffparam_t rdp;
+
+	rdp.flags = XDL_BDF_GEAR | ((rand() & 1) ? XDL_BDF_SELFREF : 0);
+	rdp.wndsize = wnds[rand() % (sizeof(wnds) / sizeof(wnds[0]))];
+	rdp.poly = 1;
+	if (xdlt_auto_rabpregress(&rdp, size, rmod, chmax) == 0) {
+		return -1;
+	}
+	rdp.poly = 0;
+
+	return xdlt_auto_rabpregress(&rdp, size, rmod, chmax);
+}
+
 int
 xdlt_auto_mbinregress(bdiffparam_t const *bdp, long size, double rmod,
                       int chmax, int n)
@@ -607,3 +795,1182 @@ xdlt_auto_mbinregress(bdiffparam_t const *bdp, long size, double rmod,
 
 	return res;
 }
+
+typedef struct s_xdltplcopy {
+	mmbuffer_t *mbs, *mbt;
+	char *out;
+	long n;
+} xdltplcopy_t;
+
+/*
+ * Take every other copy, after making sure it says where the bytes
+ * really come from.
+ */
+static int
+xdlt_plan_copy(void *priv, xdbpcopy_t const *cp)
+{
+	xdltplcopy_t *pc = (xdltplcopy_t *)priv;
+
+	if (cp->tpos + cp->size > pc->mbt->size ||
+	    memcmp(pc->mbs[cp->sid].ptr + cp->off, pc->mbt->ptr + cp->tpos,
+	           cp->size))
+		return -1;
+	if (pc->n++ % 2)
+		return 1;
+	memcpy(pc->out + cp->tpos, pc->mbs[cp->sid].ptr + cp->off, cp->size);
+
+	return 0;
+}
+
+/*
+ * Apply the patch through xdl_bpatch_plan(), with some of the copies
+ * done outside it, running the pieces of the target back to front to
+ * make sure they don't depend on each other.  The sources' sums are
+ * handed to it already worked out, each from three pieces put back
+ * together with xdl_adler32_combine().
+ */
+static int
+xdlt_do_planpatch(mmbuffer_t *mbs, int n, mmfile_t *mfp, mmbuffer_t *mbt)
+{
+	int i, j, res;
+	long pcut[4];
+	size_t size, cut[9];
+	uint32_t fps[XDL_BDIFF_MAXSRC];
+	char *out;
+	mmbuffer_t mbp;
+	xdbpplan_t *plan;
+	xdltplcopy_t pc;
+
+	for (i = 0; i < n; i++) {
+		pcut[0] = 0;
+		pcut[1] = mbs[i].size / 3;
+		pcut[2] = mbs[i].size - mbs[i].size / 5;
+		pcut[3] = mbs[i].size;
+		for (fps[i] = 0, j = 0; j < 3; j++) {
+			mbp.ptr = mbs[i].ptr + pcut[j];
+			mbp.size = pcut[j + 1] - pcut[j];
+			fps[i] = xdl_adler32_combine(fps[i], xdl_mmb_adler32(&mbp),
+			                             mbp.size);
+		}
+	}
+	if ((plan = xdl_bpatch_plan(mbs, n, mfp, fps)) == NULL)
+		return -1;
+	if ((size = xdl_bpatch_plan_size(plan)) != mbt->size ||
+	    (out = (char *)xdl_malloc(size + 1)) == NULL) {
+		xdl_bpatch_plan_free(plan);
+		return -1;
+	}
+	pc.mbs = mbs;
+	pc.mbt = mbt;
+	pc.out = out;
+	pc.n = 0;
+	if (xdl_bpatch_plan_copies(plan, 64, xdlt_plan_copy, &pc) < 0) {
+		xdl_free(out);
+		xdl_bpatch_plan_free(plan);
+		return -1;
+	}
+	cut[0] = 0;
+	cut[8] = size;
+	for (i = 1; i < 8; i++)
+		cut[i] = XDL_MAX(cut[i - 1], (size_t)rand() % (size + 1));
+	for (i = 7; i >= 0; i--)
+		xdl_bpatch_plan_run(plan, cut[i], XDL_MAX(cut[i], cut[i + 1]),
+		                    out);
+	xdl_bpatch_plan_self(plan, out);
+	res = memcmp(out, mbt->ptr, size) ? -1 : 0;
+	xdl_free(out);
+	xdl_bpatch_plan_free(plan);
+
+	return res;
+}
+
+/*
+ * Diff mft against the n sources in mbs, with xdl_bdiff_mbv() or, if rabin
+ * is set, xdl_rabdiff_mbv(), and make sure the patch gives back mft, both
+ * streamed and through a plan.
+ */
+int
+xdlt_do_refregress(mmbuffer_t *mbs, int n, mmfile_t *mft,
+                   bdiffparam_t const *bdp, int rabin)
+{
+	int res;
+	mmfile_t mfp, mfr;
+	mmbuffer_t mbt;
+	xdemitcb_t ecb;
+
+	if ((mbt.ptr = (char *)xdl_mmfile_first(mft, &mbt.size)) == NULL)
+		mbt.size = 0;
+
+	if (xdl_init_mmfile(&mfp, XDLT_STD_BLKSIZE, XDL_MMF_ATOMIC) < 0) {
+		return -1;
+	}
+	ecb.priv = &mfp;
+	ecb.outf = xdlt_mmfile_outf;
+	if ((rabin ? xdl_rabdiff_mbv(mbs, n, &mbt, bdp->flags, &ecb)
+	           : xdl_bdiff_mbv(mbs, n, &mbt, bdp, &ecb)) < 0) {
+		xdl_free_mmfile(&mfp);
+		return -1;
+	}
+	if (xdl_init_mmfile(&mfr, XDLT_STD_BLKSIZE, XDL_MMF_ATOMIC) < 0) {
+		xdl_free_mmfile(&mfp);
+		return -1;
+	}
+	ecb.priv = &mfr;
+	if ((res = xdl_bpatch_refs(mbs, n, &mfp, &ecb)) == 0 &&
+	    (res = xdl_mmfile_cmp(&mfr, mft)) == 0)
+		res = xdlt_do_planpatch(mbs, n, &mfp, &mbt);
+	xdl_free_mmfile(&mfr);
+	xdl_free_mmfile(&mfp);
+
+	return res;
+}
+
+/*
+ * Make a base file and n - 1 references, each one a change of the one
+ * before it, then a target that's a change of the last reference, so
+ * that most of what the target has in common with the base only exists
+ * in the references.
+ */
+int
+xdlt_auto_refbinregress(bdiffparam_t const *bdp, long size, double rmod,
+                        int chmax, int n)
+{
+	int i, res;
+	mmbuffer_t *mbs;
+	mmfile_t *mf;
+	mmfile_t mfn;
+
+	if ((mbs = (mmbuffer_t *)xdl_malloc(n * sizeof(mmbuffer_t))) ==
+	    NULL) {
+		return -1;
+	}
+	if ((mf = (mmfile_t *)xdl_malloc((n + 1) * sizeof(mmfile_t))) == NULL) {
+		xdl_free(mbs);
+		return -1;
+	}
+	if (xdlt_create_file(&mf[0], size) < 0) {
+		xdl_free(mf);
+		xdl_free(mbs);
+		return -1;
+	}
+	for (i = 1; i <= n; i++) {
+		if (xdlt_change_file(&mf[i - 1], &mfn, rmod, chmax) < 0) {
+			for (i--; i >= 0; i--)
+				xdl_free_mmfile(&mf[i]);
+			xdl_free(mf);
+			xdl_free(mbs);
+			return -1;
+		}
+		if (xdl_mmfile_compact(&mfn, &mf[i], XDLT_STD_BLKSIZE,
+		                       XDL_MMF_ATOMIC) < 0) {
+			xdl_free_mmfile(&mfn);
+			for (i--; i >= 0; i--)
+				xdl_free_mmfile(&mf[i]);
+			xdl_free(mf);
+			xdl_free(mbs);
+			return -1;
+		}
+		xdl_free_mmfile(&mfn);
+	}
+	for (i = 0; i < n; i++)
+		if ((mbs[i].ptr = (char *)xdl_mmfile_first(&mf[i],
+		                                           &mbs[i].size)) == NULL)
+			mbs[i].size = 0;
+
+	if ((res = xdlt_do_refregress(mbs, n, &mf[n], bdp, 0)) == 0)
+		res = xdlt_do_refregress(mbs, n, &mf[n], bdp, 1);
+
+	for (i = n; i >= 0; i--)
+		xdl_free_mmfile(&mf[i]);
+	xdl_free(mf);
+	xdl_free(mbs);
+
+	return res;
+}
+
+static int
+xdlt_append_mmfile(mmfile_t *mfd, mmfile_t *mfs)
+{
+	size_t size;
+	char const *blk;
+
+	for (blk = xdl_mmfile_first(mfs, &size); blk;
+	     blk = xdl_mmfile_next(mfs, &size))
+		if (xdl_write_mmfile(mfd, blk, size) != (ssize_t)size)
+			return -1;
+
+	return 0;
+}
+
+/*
+ * Make a target with a chunk of new data repeated all through it, and
+ * check that XDL_BDF_SELFREF patches for it round trip through both
+ * engines and both patchers.  Against an empty source, the patch has to
+ * come out smaller than the target.
+ */
+int
+xdlt_auto_selfregress(bdiffparam_t const *bdp, long size, double rmod,
+                      int chmax)
+{
+	int i, res;
+	mmfile_t mf1, mf2, mfx, mft, mfe, mfp;
+	mmbuffer_t mbs[1];
+	bdiffparam_t sbdp;
+
+	sbdp = *bdp;
+	sbdp.flags |= XDL_BDF_SELFREF;
+	if (xdlt_create_file(&mf1, size) < 0) {
+		return -1;
+	}
+	if (xdlt_change_file(&mf1, &mf2, rmod, chmax) < 0) {
+		xdl_free_mmfile(&mf1);
+		return -1;
+	}
+	if (xdlt_create_file(&mfx, size / 8 + 1) < 0) {
+		xdl_free_mmfile(&mf2);
+		xdl_free_mmfile(&mf1);
+		return -1;
+	}
+	if (xdl_init_mmfile(&mft, XDLT_STD_BLKSIZE, XDL_MMF_ATOMIC) < 0) {
+		xdl_free_mmfile(&mfx);
+		xdl_free_mmfile(&mf2);
+		xdl_free_mmfile(&mf1);
+		return -1;
+	}
+	for (res = 0, i = 0; i < 4 && res == 0; i++) {
+		if (xdlt_append_mmfile(&mft, &mfx) < 0 ||
+		    (i % 2 && xdlt_append_mmfile(&mft, &mf2) < 0))
+			res = -1;
+	}
+	xdl_free_mmfile(&mfx);
+	xdl_free_mmfile(&mf2);
+	if (res == 0 && xdl_mmfile_compact(&mft, &mf2, XDLT_STD_BLKSIZE,
+	                                   XDL_MMF_ATOMIC) < 0)
+		res = -1;
+	xdl_free_mmfile(&mft);
+	if (res < 0) {
+		xdl_free_mmfile(&mf1);
+		return -1;
+	}
+
+	if ((mbs[0].ptr = (char *)xdl_mmfile_first(&mf1, &mbs[0].size)) == NULL)
+		mbs[0].size = 0;
+	if ((res = xdlt_do_binregress(&mf1, &mf2, &sbdp)) == 0)
+		res = xdlt_do_refregress(mbs, 1, &mf2, &sbdp, 1);
+
+	if (res == 0 && xdl_init_mmfile(&mfe, XDLT_STD_BLKSIZE,
+	                                XDL_MMF_ATOMIC) == 0) {
+		if ((res = xdlt_do_binregress(&mfe, &mf2, &sbdp)) == 0 &&
+		    (res = xdlt_do_bindiff(&mfe, &mf2, &sbdp, &mfp)) == 0) {
+			if (xdl_mmfile_size(&mfp) >= xdl_mmfile_size(&mf2))
+				res = -1;
+			xdl_free_mmfile(&mfp);
+		}
+		xdl_free_mmfile(&mfe);
+	}
+	xdl_free_mmfile(&mf2);
+	xdl_free_mmfile(&mf1);
+
+	return res;
+}
+
+/*
+ * Diff mft against mfs with xdl_cdcdiff_mbvp(), make sure the patch
+ * gives back mft, and hand back how big the patch was.
+ */
+static int
+xdlt_do_cdcregress(mmfile_t *mfs, mmfile_t *mft, cdcdiffparam_t const *cdp,
+                   long *psize)
+{
+	int res;
+	mmfile_t mfp, mfr;
+	mmbuffer_t mbs, mbt;
+	xdemitcb_t ecb;
+
+	if ((mbs.ptr = (char *)xdl_mmfile_first(mfs, &mbs.size)) == NULL)
+		mbs.size = 0;
+	if ((mbt.ptr = (char *)xdl_mmfile_first(mft, &mbt.size)) == NULL)
+		mbt.size = 0;
+	if (xdl_init_mmfile(&mfp, XDLT_STD_BLKSIZE, XDL_MMF_ATOMIC) < 0) {
+		return -1;
+	}
+	ecb.priv = &mfp;
+	ecb.outf = xdlt_mmfile_outf;
+	if (xdl_cdcdiff_mbvp(&mbs, 1, &mbt, cdp, &ecb) < 0) {
+		xdl_free_mmfile(&mfp);
+		return -1;
+	}
+	*psize = xdl_mmfile_size(&mfp);
+	if ((res = xdlt_do_binpatch(mfs, &mfp, &mfr)) == 0) {
+		if (xdl_mmfile_cmp(&mfr, mft))
+			res = -1;
+		xdl_free_mmfile(&mfr);
+	}
+	xdl_free_mmfile(&mfp);
+
+	return res;
+}
+
+/*
+ * A target with nothing from mf1 in it, made of a new file followed by
+ * a few changed copies of it, so with XDL_BDF_SELFREF it's all copies
+ * from itself and lots of gaps that only have the whole of mf1 to go
+ * on.
+ */
+static int
+xdlt_cdc_selfgaps(mmfile_t *mf1, cdcdiffparam_t const *cdp, long size,
+                  double rmod, int chmax)
+{
+	int i, res;
+	long psize;
+	mmfile_t mfx, mfc, mft, mftc;
+	cdcdiffparam_t scdp = *cdp;
+
+	if (xdlt_create_file(&mfx, size) < 0) {
+		return -1;
+	}
+	if (xdl_init_mmfile(&mft, XDLT_STD_BLKSIZE, XDL_MMF_ATOMIC) < 0) {
+		xdl_free_mmfile(&mfx);
+		return -1;
+	}
+	res = xdlt_append_mmfile(&mft, &mfx);
+	for (i = 0; i < 8 && res == 0; i++) {
+		if ((res = xdlt_change_file(&mfx, &mfc, rmod, chmax)) < 0)
+			break;
+		res = xdlt_append_mmfile(&mft, &mfc);
+		xdl_free_mmfile(&mfc);
+	}
+	xdl_free_mmfile(&mfx);
+	if (res == 0 && xdl_mmfile_compact(&mft, &mftc, XDLT_STD_BLKSIZE,
+	                                   XDL_MMF_ATOMIC) < 0)
+		res = -1;
+	xdl_free_mmfile(&mft);
+	if (res < 0)
+		return -1;
+
+	scdp.rdp.flags |= XDL_BDF_SELFREF;
+	res = xdlt_do_cdcregress(mf1, &mftc, &scdp, &psize);
+	xdl_free_mmfile(&mftc);
+
+	return res;
+}
+
+/*
+ * Make a target that's a change of the source with its two halves
+ * swapped around, and the first of them again on the end, and round
+ * trip it through the chunking engine with random chunk sizes and
+ * rabdiff settings.  The source against itself has to come out as
+ * little more than copies.
+ */
+int
+xdlt_auto_cdcregress(long size, double rmod, int chmax)
+{
+	static int const avgbits[] = { 6, 8, 10 };
+	int res;
+	long psize;
+	size_t half;
+	char const *blk;
+	mmfile_t mf1, mf2, mf2c, mft, mftc;
+	cdcdiffparam_t cdp;
+
+	cdp.avgbits = avgbits[rand() % (sizeof(avgbits) / sizeof(avgbits[0]))];
+	cdp.rdp.flags = ((rand() & 1) ? XDL_BDF_SELFREF : 0) |
+	                ((rand() & 1) ? XDL_BDF_GEAR : 0);
+	cdp.rdp.wndsize = 0;
+	cdp.rdp.poly = 0;
+
+	if (xdlt_create_file(&mf1, size) < 0) {
+		return -1;
+	}
+	if (xdlt_change_file(&mf1, &mf2, rmod, chmax) < 0) {
+		xdl_free_mmfile(&mf1);
+		return -1;
+	}
+	if (xdl_mmfile_compact(&mf2, &mf2c, XDLT_STD_BLKSIZE, XDL_MMF_ATOMIC) <
+	    0) {
+		xdl_free_mmfile(&mf2);
+		xdl_free_mmfile(&mf1);
+		return -1;
+	}
+	xdl_free_mmfile(&mf2);
+	if (xdl_init_mmfile(&mft, XDLT_STD_BLKSIZE, XDL_MMF_ATOMIC) < 0) {
+		xdl_free_mmfile(&mf2c);
+		xdl_free_mmfile(&mf1);
+		return -1;
+	}
+	if ((blk = xdl_mmfile_first(&mf2c, &half)) == NULL)
+		half = 0;
+	half /= 2;
+	res = 0;
+	if (half && (xdl_write_mmfile(&mft, blk + half,
+	                              xdl_mmfile_size(&mf2c) - half) < 0 ||
+	             xdl_write_mmfile(&mft, blk, half) < 0 ||
+	             xdl_write_mmfile(&mft, blk, half) < 0))
+		res = -1;
+	xdl_free_mmfile(&mf2c);
+	if (res == 0 && xdl_mmfile_compact(&mft, &mftc, XDLT_STD_BLKSIZE,
+	                                   XDL_MMF_ATOMIC) < 0)
+		res = -1;
+	xdl_free_mmfile(&mft);
+	if (res < 0) {
+		xdl_free_mmfile(&mf1);
+		return -1;
+	}
+
+	if ((res = xdlt_do_cdcregress(&mf1, &mftc, &cdp, &psize)) == 0 &&
+	    (res = xdlt_do_cdcregress(&mf1, &mf1, &cdp, &psize)) == 0 &&
+	    psize > size / 2 + 64)
+		res = -1;
+	if (res == 0)
+		res = xdlt_cdc_selfgaps(&mf1, &cdp, size, rmod, chmax);
+	xdl_free_mmfile(&mftc);
+	xdl_free_mmfile(&mf1);
+
+	return res;
+}
+
+/*
+ * Diff mf2 against mf1, feeding the engine's ops straight into the
+ * VCDIFF encoder, and make sure the decoder gives back mf2, and that it
+ * won't apply to anything but mf1.  The same patch made the long way,
+ * by converting a finished binary patch, has to come out byte for byte
+ * the same.
+ */
+int
+xdlt_do_vcdregress(mmfile_t *mf1, mmfile_t *mf2, bdiffparam_t const *bdp,
+                   int rabin)
+{
+	int res;
+	mmfile_t mfp, mfv, mfc, mfr;
+	mmbuffer_t mb1, mb2, mbw;
+	xdemitcb_t ecb, vecb;
+	xdvcdenc_t *enc;
+
+	if ((mb1.ptr = (char *)xdl_mmfile_first(mf1, &mb1.size)) == NULL)
+		mb1.size = 0;
+	if ((mb2.ptr = (char *)xdl_mmfile_first(mf2, &mb2.size)) == NULL)
+		mb2.size = 0;
+
+	if (xdl_init_mmfile(&mfv, XDLT_STD_BLKSIZE, XDL_MMF_ATOMIC) < 0) {
+		return -1;
+	}
+	vecb.priv = &mfv;
+	vecb.outf = xdlt_mmfile_outf;
+	if ((enc = xdl_vcdiff_enc_init(&vecb)) == NULL) {
+		xdl_free_mmfile(&mfv);
+		return -1;
+	}
+	ecb.priv = enc;
+	ecb.outf = xdl_vcdiff_enc_outf;
+	if ((rabin ? xdl_rabdiff_mbv(&mb1, 1, &mb2, bdp->flags, &ecb)
+	           : xdl_bdiff_mbv(&mb1, 1, &mb2, bdp, &ecb)) < 0 ||
+	    xdl_vcdiff_enc_end(enc) < 0) {
+		xdl_vcdiff_enc_free(enc);
+		xdl_free_mmfile(&mfv);
+		return -1;
+	}
+	xdl_vcdiff_enc_free(enc);
+
+	if (xdl_init_mmfile(&mfr, XDLT_STD_BLKSIZE, XDL_MMF_ATOMIC) < 0) {
+		xdl_free_mmfile(&mfv);
+		return -1;
+	}
+	vecb.priv = &mfr;
+	if ((res = xdl_vcdiff_patch(&mb1, &mfv, &vecb)) == 0)
+		res = xdl_mmfile_cmp(&mfr, mf2);
+	xdl_free_mmfile(&mfr);
+
+	if (res == 0 && xdl_init_mmfile(&mfr, XDLT_STD_BLKSIZE,
+	                                XDL_MMF_ATOMIC) == 0) {
+		if ((mbw.ptr = (char *)xdl_malloc(mb1.size + 1)) == NULL) {
+			res = -1;
+		} else {
+			memcpy(mbw.ptr, mb1.ptr, mb1.size);
+			mbw.size = mb1.size ? mb1.size : 1;
+			mbw.ptr[mbw.size - 1] ^= 1;
+			if (xdl_vcdiff_patch(&mbw, &mfv, &vecb) == 0 ||
+			    xdl_mmfile_size(&mfr) != 0)
+				res = -1;
+			xdl_free(mbw.ptr);
+		}
+		xdl_free_mmfile(&mfr);
+	}
+
+	if (res == 0 && xdl_init_mmfile(&mfp, XDLT_STD_BLKSIZE,
+	                                XDL_MMF_ATOMIC) == 0) {
+		ecb.priv = &mfp;
+		ecb.outf = xdlt_mmfile_outf;
+		if ((rabin ? xdl_rabdiff_mbv(&mb1, 1, &mb2, bdp->flags, &ecb)
+		           : xdl_bdiff_mbv(&mb1, 1, &mb2, bdp, &ecb)) < 0 ||
+		    xdl_init_mmfile(&mfc, XDLT_STD_BLKSIZE, XDL_MMF_ATOMIC) < 0) {
+			res = -1;
+		} else {
+			vecb.priv = &mfc;
+			if ((res = xdl_vcdiff_encode(&mfp, &vecb)) == 0)
+				res = xdl_mmfile_cmp(&mfc, &mfv);
+			xdl_free_mmfile(&mfc);
+		}
+		xdl_free_mmfile(&mfp);
+	}
+	xdl_free_mmfile(&mfv);
+
+	return res;
+}
+
+/*
+ * A delta put together by hand from the tables in RFC 3284, using a run,
+ * a combined opcode, and every kind of address mode, so that we aren't
+ * only ever decoding what our own encoder writes.  With cksum set the
+ * window carries four bytes of checksum the way xdelta3 writes it.
+ * With apphdr set there's an application header in front of it, and
+ * the delta is read from blocks small enough that the header crosses
+ * one; the header alone, with no windows, has to decode to nothing.
+ */
+static int
+xdlt_do_vcdvector(int cksum, int apphdr)
+{
+	static char const src[] = "abcdefghijklmnop";
+	static char const tgt[] = "abcdefghXYZijklmnopXYZijkQQQQRcdefijkl";
+	static unsigned char const app[] = "yabd-vector";
+	unsigned char head[7 + sizeof(app)] = {
+		0xd6, 0xc3, 0xc4, 0x00, 0x00,
+	};
+	static unsigned char const body[] = {
+		/* data */
+		'X', 'Y', 'Z', 'Q', 'R',
+		/* instructions */
+		0x18, 0x04, 0x18, 0x26, 0x00, 0x04, 0xbb, 0x74,
+		/* addresses */
+		0x00, 0x08, 0x0b, 0x02, 0x08,
+	};
+	int res;
+	unsigned char win[16];
+	long n = 0, nhead = 5;
+	mmfile_t mfv, mfr, mft;
+	mmbuffer_t mbs, mb[3];
+	xdemitcb_t ecb;
+
+	if (apphdr) {
+		head[4] = 0x04;
+		head[nhead++] = sizeof(app) - 1;
+		memcpy(head + nhead, app, sizeof(app) - 1);
+		nhead += sizeof(app) - 1;
+	}
+	win[n++] = cksum ? 0x05 : 0x01;
+	win[n++] = sizeof(src) - 1;
+	win[n++] = 0;
+	win[n++] = 5 + sizeof(body) + (cksum ? 4 : 0);
+	win[n++] = sizeof(tgt) - 1;
+	win[n++] = 0;
+	win[n++] = 5;
+	win[n++] = 8;
+	win[n++] = 5;
+	if (cksum) {
+		memset(win + n, 0xa5, 4);
+		n += 4;
+	}
+
+	mbs.ptr = (char *)src;
+	mbs.size = sizeof(src) - 1;
+	mb[0].ptr = (char *)head;
+	mb[0].size = nhead;
+	mb[1].ptr = (char *)win;
+	mb[1].size = n;
+	mb[2].ptr = (char *)body;
+	mb[2].size = sizeof(body);
+
+	if (apphdr) {
+		if (xdl_init_mmfile(&mfv, 4, XDL_MMF_ATOMIC) < 0) {
+			return -1;
+		}
+		if (xdl_writem_mmfile(&mfv, mb, 1) < 0 ||
+		    xdl_init_mmfile(&mfr, XDLT_STD_BLKSIZE, XDL_MMF_ATOMIC) < 0) {
+			xdl_free_mmfile(&mfv);
+			return -1;
+		}
+		ecb.priv = &mfr;
+		ecb.outf = xdlt_mmfile_outf;
+		res = xdl_vcdiff_patch(&mbs, &mfv, &ecb);
+		if (res == 0 && xdl_mmfile_size(&mfr) != 0)
+			res = -1;
+		xdl_free_mmfile(&mfr);
+		xdl_free_mmfile(&mfv);
+		if (res < 0)
+			return res;
+	}
+
+	if (xdl_init_mmfile(&mfv, apphdr ? 4 : XDLT_STD_BLKSIZE,
+	                    XDL_MMF_ATOMIC) < 0) {
+		return -1;
+	}
+	if (xdl_writem_mmfile(&mfv, mb, 3) < 0 ||
+	    xdl_init_mmfile(&mfr, XDLT_STD_BLKSIZE, XDL_MMF_ATOMIC) < 0) {
+		xdl_free_mmfile(&mfv);
+		return -1;
+	}
+	ecb.priv = &mfr;
+	ecb.outf = xdlt_mmfile_outf;
+	if ((res = xdl_vcdiff_patch(&mbs, &mfv, &ecb)) == 0 &&
+	    (res = xdl_init_mmfile(&mft, XDLT_STD_BLKSIZE,
+	                           XDL_MMF_ATOMIC)) == 0) {
+		if (xdl_write_mmfile(&mft, tgt, sizeof(tgt) - 1) ==
+		    (ssize_t)sizeof(tgt) - 1)
+			res = xdl_mmfile_cmp(&mfr, &mft);
+		else
+			res = -1;
+		xdl_free_mmfile(&mft);
+	}
+	xdl_free_mmfile(&mfr);
+	xdl_free_mmfile(&mfv);
+
+	return res;
+}
+
+int
+xdlt_auto_vcdregress(bdiffparam_t const *bdp, long size, double rmod,
+                     int chmax)
+{
+	int res;
+	mmfile_t mf1, mf2, mfn;
+	bdiffparam_t sbdp;
+
+	if ((res = xdlt_do_vcdvector(0, 0)) < 0 ||
+	    (res = xdlt_do_vcdvector(1, 0)) < 0 ||
+	    (res = xdlt_do_vcdvector(1, 1)) < 0)
+		return res;
+
+	if (xdlt_create_file(&mf1, size) < 0) {
+		return -1;
+	}
+	if (xdlt_change_file(&mf1, &mfn, rmod, chmax) < 0) {
+		xdl_free_mmfile(&mf1);
+		return -1;
+	}
+	if (xdl_mmfile_compact(&mfn, &mf2, XDLT_STD_BLKSIZE,
+	                       XDL_MMF_ATOMIC) < 0) {
+		xdl_free_mmfile(&mfn);
+		xdl_free_mmfile(&mf1);
+		return -1;
+	}
+	xdl_free_mmfile(&mfn);
+
+	sbdp = *bdp;
+	sbdp.flags |= XDL_BDF_SELFREF;
+	if ((res = xdlt_do_vcdregress(&mf1, &mf2, bdp, 0)) == 0 &&
+	    (res = xdlt_do_vcdregress(&mf1, &mf2, &sbdp, 0)) == 0)
+		res = xdlt_do_vcdregress(&mf1, &mf2, &sbdp, 1);
+
+	xdl_free_mmfile(&mf2);
+	xdl_free_mmfile(&mf1);
+
+	return res;
+}
+
+/*
+ * Lay out "machine code" for arch: filler with no branches in it, plus
+ * a branch at each of sites[] to the matching targets[].  With ins > 0
+ * the same code is laid out again with ins bytes of new code added at
+ * "at", and every branch fixed up the way a relink would.
+ */
+static void
+xdlt_lay_code(int arch, char const *filler, long size, long const *sites,
+              long const *targets, long nsites, long at, long ins, char *out)
+{
+	long i, p, t;
+	uint32_t v;
+
+	memcpy(out, filler, at);
+	memcpy(out + at, filler, ins);
+	memcpy(out + at + ins, filler + at, size - at);
+	for (i = 0; i < nsites; i++) {
+		p = sites[i] + (sites[i] >= at ? ins : 0);
+		t = targets[i] + (targets[i] >= at ? ins : 0);
+		if (arch == XDL_BCJ_X86) {
+			out[p] = (char)0xe8;
+			v = (uint32_t)(t - (p + 5));
+			XDL_LE32_PUT(out + p + 1, v);
+		} else {
+			v = 0x94000000 | ((uint32_t)((t - p) / 4) & 0x03ffffff);
+			XDL_LE32_PUT(out + p, v);
+		}
+	}
+}
+
+static long
+xdlt_bcj_diff(char *a, long asize, char *b, long bsize,
+              bdiffparam_t const *bdp, mmfile_t *mfp)
+{
+	mmbuffer_t mba, mbb;
+	xdemitcb_t ecb;
+
+	mba.ptr = a;
+	mba.size = asize;
+	mbb.ptr = b;
+	mbb.size = bsize;
+	if (xdl_init_mmfile(mfp, XDLT_STD_BLKSIZE, XDL_MMF_ATOMIC) < 0) {
+		return -1;
+	}
+	ecb.priv = mfp;
+	ecb.outf = xdlt_mmfile_outf;
+	if (xdl_bdiff_mb(&mba, &mbb, bdp, &ecb) < 0) {
+		xdl_free_mmfile(mfp);
+		return -1;
+	}
+
+	return xdl_mmfile_size(mfp);
+}
+
+/*
+ * Most calls in real code go to a handful of functions, and through
+ * the PLT, which sits in front of the code, so most targets here come
+ * from a small pool at the start of the file.  New code is added after
+ * that.  Filtering has to round trip, and the filtered patch has to be
+ * the smaller one.
+ */
+static int
+xdlt_do_bcjregress(int arch, bdiffparam_t const *bdp, long size)
+{
+	int res = -1;
+	long i, p, at, ins, nsites = 0, asize, bsize, psize, fsize;
+	long pool[32], *sites, *targets;
+	char *filler, *a, *b, *fa, *fb, *tmp;
+	uint32_t v;
+	mmbuffer_t mba;
+	mmfile_t mfp, mfr;
+	xdemitcb_t ecb;
+
+	asize = XDL_MAX(size, 8192) & ~3L;
+	ins = 4 * (1 + rand() % 16);
+	bsize = asize + ins;
+	at = (asize / 8 + rand() % (asize / 2)) & ~3L;
+	filler = (char *)xdl_malloc(asize);
+	sites = (long *)xdl_malloc((asize / 4) * sizeof(long));
+	targets = (long *)xdl_malloc((asize / 4) * sizeof(long));
+	a = (char *)xdl_malloc(asize);
+	fa = (char *)xdl_malloc(asize);
+	b = (char *)xdl_malloc(bsize);
+	fb = (char *)xdl_malloc(bsize);
+	tmp = (char *)xdl_malloc(bsize);
+	if (!filler || !sites || !targets || !a || !fa || !b || !fb || !tmp)
+		goto out;
+
+	for (i = 0; i < asize; i++) {
+		filler[i] = (char)rand();
+		if (arch == XDL_BCJ_X86 && (filler[i] & 0xfe) == 0xe8)
+			filler[i] = (char)0x90;
+	}
+	if (arch == XDL_BCJ_ARM64) {
+		for (i = 0; i < asize; i += 4) {
+			XDL_LE32_GET(filler + i, v);
+			if ((v & 0xfc000000) == 0x94000000)
+				filler[i + 3] = 0;
+		}
+	}
+	for (i = 0; i < 32; i++)
+		pool[i] = (rand() % (asize / 16)) & ~3L;
+	for (p = (asize / 16) & ~3L; p + 5 <= asize;
+	     p += 8 + (rand() % 24 & ~3L)) {
+		if (p < at && p + 5 > at)
+			continue;
+		sites[nsites] = p;
+		targets[nsites++] = rand() % 5 ? pool[rand() % 32]
+		                               : (rand() % asize) & ~3L;
+	}
+	xdlt_lay_code(arch, filler, asize, sites, targets, nsites, at, 0, a);
+	xdlt_lay_code(arch, filler, asize, sites, targets, nsites, at, ins, b);
+	if (xdl_bcj_encode(arch, a, asize, fa) < 0 ||
+	    xdl_bcj_encode(arch, b, bsize, fb) < 0 ||
+	    xdl_bcj_decode(arch, fa, asize, tmp) < 0 || memcmp(tmp, a, asize))
+		goto out;
+
+	if ((psize = xdlt_bcj_diff(a, asize, b, bsize, bdp, &mfp)) < 0)
+		goto out;
+	xdl_free_mmfile(&mfp);
+	if ((fsize = xdlt_bcj_diff(fa, asize, fb, bsize, bdp, &mfp)) < 0)
+		goto out;
+	if (fsize >= psize) {
+		xdl_free_mmfile(&mfp);
+		goto out;
+	}
+
+	if (xdl_init_mmfile(&mfr, XDLT_STD_BLKSIZE, XDL_MMF_ATOMIC) < 0) {
+		xdl_free_mmfile(&mfp);
+		goto out;
+	}
+	mba.ptr = fa;
+	mba.size = asize;
+	ecb.priv = &mfr;
+	ecb.outf = xdlt_mmfile_outf;
+	if (xdl_bpatch_refs(&mba, 1, &mfp, &ecb) == 0 &&
+	    xdl_mmfile_size(&mfr) == bsize && xdl_seek_mmfile(&mfr, 0) == 0 &&
+	    xdl_read_mmfile(&mfr, fb, bsize) == bsize &&
+	    xdl_bcj_decode(arch, fb, bsize, tmp) == 0)
+		res = memcmp(tmp, b, bsize) ? -1 : 0;
+	xdl_free_mmfile(&mfr);
+	xdl_free_mmfile(&mfp);
+
+out:
+	xdl_free(tmp);
+	xdl_free(fb);
+	xdl_free(b);
+	xdl_free(fa);
+	xdl_free(a);
+	xdl_free(targets);
+	xdl_free(sites);
+	xdl_free(filler);
+
+	return res;
+}
+
+int
+xdlt_auto_bcjregress(bdiffparam_t const *bdp, long size)
+{
+	int arch, res = 0;
+
+	for (arch = XDL_BCJ_X86; arch <= XDL_BCJ_ARM64 && res == 0; arch++)
+		res = xdlt_do_bcjregress(arch, bdp, size);
+
+	return res;
+}
+
+static int
+xdlt_store_cmp(xdstore_t *st, long ver, mmfile_t *mf)
+{
+	int res;
+	mmfile_t mfr;
+	xdemitcb_t ecb;
+
+	if (xdl_init_mmfile(&mfr, XDLT_STD_BLKSIZE, XDL_MMF_ATOMIC) < 0)
+		return -1;
+	ecb.priv = &mfr;
+	ecb.outf = xdlt_mmfile_outf;
+	if ((res = xdl_store_get(st, ver, &ecb)) == 0)
+		res = xdl_mmfile_cmp(mf, &mfr);
+	xdl_free_mmfile(&mfr);
+
+	return res;
+}
+
+static int
+xdlt_store_check(xdstore_t *st, mmfile_t *mfs, long n, long maxdepth)
+{
+	long i;
+
+	if (xdl_store_count(st) != n)
+		return -1;
+	for (i = 0; i < n; i++) {
+		if (xdl_store_depth(st, i) > maxdepth ||
+		    xdl_store_size(st, i) != xdl_mmfile_size(&mfs[i]) ||
+		    xdlt_store_cmp(st, i, &mfs[i]) != 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+int
+xdlt_auto_storeregress(bdiffparam_t const *bdp, long size, double rmod,
+                       int chmax, int n)
+{
+	int i, res = -1;
+	mmfile_t *mfs, mfn, mfw, mfc;
+	mmbuffer_t mb, mbw;
+	xdstparam_t xsp;
+	xdstore_t *st, *lst = NULL;
+	xdemitcb_t ecb;
+
+	if ((mfs = (mmfile_t *)xdl_malloc((n + 1) * sizeof(mmfile_t))) ==
+	    NULL)
+		return -1;
+	xsp.maxdepth = 1 + rand() % 8;
+	xsp.bdp = *bdp;
+	if ((st = xdl_store_init(&xsp)) == NULL) {
+		xdl_free(mfs);
+		return -1;
+	}
+	if (xdl_init_mmfile(&mfw, XDLT_STD_BLKSIZE, XDL_MMF_ATOMIC) < 0) {
+		xdl_store_free(st);
+		xdl_free(mfs);
+		return -1;
+	}
+
+	for (i = 0; i <= n; i++) {
+		if (i == 0) {
+			if (xdlt_create_file(&mfn, size) < 0)
+				goto out;
+		} else if (xdlt_change_file(&mfs[i - 1], &mfn, rmod, chmax) <
+		           0) {
+			goto out;
+		}
+		if (xdl_mmfile_compact(&mfn, &mfs[i], XDLT_STD_BLKSIZE,
+		                       XDL_MMF_ATOMIC) < 0) {
+			xdl_free_mmfile(&mfn);
+			goto out;
+		}
+		xdl_free_mmfile(&mfn);
+		if (i == n)
+			break;
+		mb.ptr = (char *)xdl_mmfile_first(&mfs[i], &mb.size);
+		if (xdl_store_add(st, &mb) != i) {
+			xdl_free_mmfile(&mfs[i]);
+			goto out;
+		}
+	}
+	if (xdlt_store_check(st, mfs, n, xsp.maxdepth) < 0)
+		goto out_all;
+
+	/*
+	 * Write it out and load it back, which has to give the same versions
+	 * and take another one on top.
+	 */
+	ecb.priv = &mfw;
+	ecb.outf = xdlt_mmfile_outf;
+	if (xdl_store_write(st, &ecb) < 0 ||
+	    xdl_mmfile_compact(&mfw, &mfc, XDLT_STD_BLKSIZE,
+	                       XDL_MMF_ATOMIC) < 0)
+		goto out_all;
+	mbw.ptr = (char *)xdl_mmfile_first(&mfc, &mbw.size);
+	if ((lst = xdl_store_load(&mbw, &xsp)) == NULL ||
+	    xdlt_store_check(lst, mfs, n, xsp.maxdepth) < 0)
+		goto out_mfc;
+	mb.ptr = (char *)xdl_mmfile_first(&mfs[n], &mb.size);
+	if (xdl_store_add(lst, &mb) != n ||
+	    xdlt_store_check(lst, mfs, n + 1, xsp.maxdepth) < 0)
+		goto out_mfc;
+
+	/*
+	 * A store that got cut short mustn't load.
+	 */
+	mbw.size--;
+	if (xdl_store_load(&mbw, &xsp) != NULL)
+		goto out_mfc;
+	res = 0;
+
+out_mfc:
+	xdl_store_free(lst);
+	lst = NULL;
+	xdl_free_mmfile(&mfc);
+out_all:
+	i = n;
+	xdl_free_mmfile(&mfs[i]);
+out:
+	while (--i >= 0)
+		xdl_free_mmfile(&mfs[i]);
+	xdl_store_free(lst);
+	xdl_store_free(st);
+	xdl_free_mmfile(&mfw);
+	xdl_free(mfs);
+
+	return res;
+}
+
+/*
+ * A file in memory for xdl_bpatch_inplace().  The write numbered crash
+ * only gets half way, and fails, the way it would if the power went,
+ * and step, save and nsave are what markf() was last given, the way a
+ * journal would have them.
+ */
+typedef struct s_xdltipfile {
+	char *buf;
+	size_t size, asize;
+	long writes, crash;
+	int crashed;
+	long step;
+	char *save;
+	size_t nsave, asave;
+} xdltipfile_t;
+
+static int
+xdlt_ip_readf(void *priv, size_t off, char *buf, size_t size)
+{
+	xdltipfile_t *xf = (xdltipfile_t *)priv;
+
+	if (off > xf->size || size > xf->size - off)
+		return -1;
+	memcpy(buf, xf->buf + off, size);
+
+	return 0;
+}
+
+static int
+xdlt_ip_writef(void *priv, size_t off, char const *buf, size_t size)
+{
+	xdltipfile_t *xf = (xdltipfile_t *)priv;
+
+	if (off > xf->size || size > xf->size - off)
+		return -1;
+	if (xf->writes++ == xf->crash) {
+		memcpy(xf->buf + off, buf, size / 2);
+		xf->crashed = 1;
+		return -1;
+	}
+	memcpy(xf->buf + off, buf, size);
+
+	return 0;
+}
+
+static int
+xdlt_ip_sizef(void *priv, size_t size)
+{
+	xdltipfile_t *xf = (xdltipfile_t *)priv;
+	char *buf;
+
+	if (size > xf->asize) {
+		if ((buf = (char *)xdl_realloc(xf->buf, size)) == NULL)
+			return -1;
+		xf->buf = buf;
+		xf->asize = size;
+	}
+	if (size > xf->size)
+		memset(xf->buf + xf->size, 0, size - xf->size);
+	xf->size = size;
+
+	return 0;
+}
+
+static int
+xdlt_ip_markf(void *priv, long step, char const *save, size_t size)
+{
+	xdltipfile_t *xf = (xdltipfile_t *)priv;
+	char *buf;
+
+	xf->step = step;
+	xf->nsave = save ? size : 0;
+	if (!save || save == xf->save)
+		return 0;
+	if (size > xf->asave) {
+		if ((buf = (char *)xdl_realloc(xf->save, size)) == NULL)
+			return -1;
+		xf->save = buf;
+		xf->asave = size;
+	}
+	memcpy(xf->save, save, size);
+
+	return 0;
+}
+
+/*
+ * Apply the in place patch mfi over a copy of mb1, ssize bytes at a
+ * time, crashing up to eight times along the way and picking up from
+ * what markf() was last told each time, and check it comes out as mb2.
+ */
+static int
+xdlt_do_inplace(mmbuffer_t *mb1, mmfile_t *mfi, mmbuffer_t *mb2, size_t ssize)
+{
+	int i, res;
+	xdltipfile_t xf;
+	xdipfile_t ipf;
+
+	memset(&xf, 0, sizeof(xf));
+	if ((xf.buf = (char *)xdl_malloc(mb1->size + 1)) == NULL)
+		return -1;
+	memcpy(xf.buf, mb1->ptr, mb1->size);
+	xf.size = xf.asize = mb1->size;
+	xf.crash = rand() % 16;
+	xf.step = -1;
+	ipf.priv = &xf;
+	ipf.size = xf.size;
+	ipf.readf = xdlt_ip_readf;
+	ipf.writef = xdlt_ip_writef;
+	ipf.sizef = xdlt_ip_sizef;
+	ipf.markf = xdlt_ip_markf;
+	for (i = 0;; i++) {
+		xf.crashed = 0;
+		ipf.size = xf.size;
+		res = xdl_bpatch_inplace(mfi, &ipf, ssize, xf.step,
+		                         xf.nsave ? xf.save : NULL, xf.nsave);
+		if (res == 0 || !xf.crashed)
+			break;
+		xf.crash = i < 8 ? xf.writes + rand() % 16 : -1;
+	}
+	if (res == 0 && (xf.size != mb2->size ||
+	                 memcmp(xf.buf, mb2->ptr, mb2->size) != 0))
+		res = -1;
+	xdl_free(xf.save);
+	xdl_free(xf.buf);
+
+	return res;
+}
+
+/*
+ * Make a target out of a source, half the time with its halves swapped
+ * so that the copies go round in cycles, and the rest of the time not,
+ * so that they mostly overlap what they write.  Diff it with
+ * XDL_BDF_SELFREF and make sure the in place patch for it applies over
+ * the source in a few different step sizes.
+ */
+int
+xdlt_auto_inplaceregress(bdiffparam_t const *bdp, long size, double rmod,
+                         int chmax)
+{
+	int i, res = -1;
+	size_t half;
+	mmfile_t mf1, mf1c, mfx, mfxc, mf2, mf2c, mfp, mfi;
+	mmbuffer_t mb1, mb2;
+	bdiffparam_t sbdp;
+	xdemitcb_t ecb;
+
+	sbdp = *bdp;
+	sbdp.flags |= XDL_BDF_SELFREF;
+	if (xdlt_create_file(&mf1, size) < 0)
+		return -1;
+	if (xdl_mmfile_compact(&mf1, &mf1c, XDLT_STD_BLKSIZE, XDL_MMF_ATOMIC) <
+	    0) {
+		xdl_free_mmfile(&mf1);
+		return -1;
+	}
+	xdl_free_mmfile(&mf1);
+	if ((mb1.ptr = (char *)xdl_mmfile_first(&mf1c, &mb1.size)) == NULL)
+		mb1.size = 0;
+	if (xdl_init_mmfile(&mfx, XDLT_STD_BLKSIZE, 0) < 0) {
+		xdl_free_mmfile(&mf1c);
+		return -1;
+	}
+	half = rand() % 2 ? mb1.size / 2 : 0;
+	if (xdl_write_mmfile(&mfx, mb1.ptr + half, mb1.size - half) !=
+	            (ssize_t)(mb1.size - half) ||
+	    xdl_write_mmfile(&mfx, mb1.ptr, half) != (ssize_t)half ||
+	    xdl_mmfile_compact(&mfx, &mfxc, XDLT_STD_BLKSIZE, XDL_MMF_ATOMIC) <
+	            0) {
+		xdl_free_mmfile(&mfx);
+		xdl_free_mmfile(&mf1c);
+		return -1;
+	}
+	xdl_free_mmfile(&mfx);
+	if (xdlt_change_file(&mfxc, &mf2, rmod, chmax) < 0) {
+		xdl_free_mmfile(&mfxc);
+		xdl_free_mmfile(&mf1c);
+		return -1;
+	}
+	xdl_free_mmfile(&mfxc);
+	if (xdl_mmfile_compact(&mf2, &mf2c, XDLT_STD_BLKSIZE, XDL_MMF_ATOMIC) <
+	    0) {
+		xdl_free_mmfile(&mf2);
+		xdl_free_mmfile(&mf1c);
+		return -1;
+	}
+	xdl_free_mmfile(&mf2);
+	if ((mb2.ptr = (char *)xdl_mmfile_first(&mf2c, &mb2.size)) == NULL)
+		mb2.size = 0;
+
+	if (xdlt_do_bindiff(&mf1c, &mf2c, &sbdp, &mfp) < 0)
+		goto out;
+	if (xdl_init_mmfile(&mfi, XDLT_STD_BLKSIZE, XDL_MMF_ATOMIC) < 0) {
+		xdl_free_mmfile(&mfp);
+		goto out;
+	}
+	ecb.priv = &mfi;
+	ecb.outf = xdlt_mmfile_outf;
+	if (xdl_bdiff_inplace(&mb1, &mfp, &ecb) == 0) {
+		for (res = 0, i = 0; i < 3 && res == 0; i++)
+			res = xdlt_do_inplace(&mb1, &mfi, &mb2,
+			                      i == 2 ? 4096 : 1 + rand() % 64);
+	}
+	xdl_free_mmfile(&mfi);
+	xdl_free_mmfile(&mfp);
+out:
+	xdl_free_mmfile(&mf2c);
+	xdl_free_mmfile(&mf1c);
+
+	return res;
+}
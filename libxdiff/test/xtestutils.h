@@ -40,13 +40,35 @@ int xdlt_auto_regress(xpparam_t const *xpp, xdemitconf_t const *xecfg,
 int xdlt_do_bindiff(mmfile_t *mf1, mmfile_t *mf2, bdiffparam_t const *bdp,
                     mmfile_t *mfp);
 int xdlt_do_rabdiff(mmfile_t *mf1, mmfile_t *mf2, mmfile_t *mfp);
+int xdlt_do_rabdiffp(mmfile_t *mf1, mmfile_t *mf2, rabdiffparam_t const *rdp,
+                     mmfile_t *mfp);
 int xdlt_do_binpatch(mmfile_t *mf, mmfile_t *mfp, mmfile_t *mfr);
 int xdlt_do_binregress(mmfile_t *mf1, mmfile_t *mf2, bdiffparam_t const *bdp);
 int xdlt_do_rabinregress(mmfile_t *mf1, mmfile_t *mf2);
 int xdlt_auto_binregress(bdiffparam_t const *bdp, long size, double rmod,
                          int chmax);
+int xdlt_auto_seekregress(bdiffparam_t const *bdp, long size, double rmod,
+                          int chmax);
 int xdlt_auto_rabinregress(long size, double rmod, int chmax);
+int xdlt_auto_rabpolyregress(long size, double rmod, int chmax);
+int xdlt_auto_gearregress(long size, double rmod, int chmax);
+int xdlt_auto_cdcregress(long size, double rmod, int chmax);
 int xdlt_auto_mbinregress(bdiffparam_t const *bdp, long size, double rmod,
                           int chmax, int n);
+int xdlt_do_refregress(mmbuffer_t *mbs, int n, mmfile_t *mft,
+                       bdiffparam_t const *bdp, int rabin);
+int xdlt_auto_refbinregress(bdiffparam_t const *bdp, long size, double rmod,
+                            int chmax, int n);
+int xdlt_auto_selfregress(bdiffparam_t const *bdp, long size, double rmod,
+                          int chmax);
+int xdlt_do_vcdregress(mmfile_t *mf1, mmfile_t *mf2, bdiffparam_t const *bdp,
+                       int rabin);
+int xdlt_auto_vcdregress(bdiffparam_t const *bdp, long size, double rmod,
+                         int chmax);
+int xdlt_auto_bcjregress(bdiffparam_t const *bdp, long size);
+int xdlt_auto_storeregress(bdiffparam_t const *bdp, long size, double rmod,
+                           int chmax, int n);
+int xdlt_auto_inplaceregress(bdiffparam_t const *bdp, long size, double rmod,
+                             int chmax);
 
 #endif /* #if !defined(XTESTUTILS_H) */
@@ -75,3 +75,21 @@ xdl_adler32(uint32_t adler, const unsigned char *buf, size_t len)
 
 	return (s2 << 16) | s1;
 }
+
+/*
+ * The adler32 of two buffers back to back, from the adler32s of each,
+ * where the second one is len2 bytes long.  Both have to start from 0,
+ * the way xdl_mmb_adler32() does: then the second one's sums just move
+ * up by what the first one's were, and s2 by len2 times the first s1.
+ */
+uint32_t
+xdl_adler32_combine(uint32_t adler1, uint32_t adler2, size_t len2)
+{
+	uint32_t s1 = adler1 & 0xffff, s2 = (adler1 >> 16) & 0xffff;
+	uint64_t rem = len2 % BASE;
+
+	s2 = (uint32_t)((s2 + rem * s1 + ((adler2 >> 16) & 0xffff)) % BASE);
+	s1 = (s1 + (adler2 & 0xffff)) % BASE;
+
+	return (s2 << 16) | s1;
+}
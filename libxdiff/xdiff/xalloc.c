@@ -23,6 +23,7 @@
 #include "xinclude.h"
 
 static memallocator_t xmalt = { NULL, NULL, NULL };
+static XDL_THREAD int xacls = XDL_ALLOC_OTHER;
 
 int
 xdl_set_allocator(memallocator_t const *malt)
@@ -58,3 +59,37 @@ xdl_realloc(void *ptr, size_t size)
 	return xmalt.realloc ? xmalt.realloc(xmalt.priv, ptr, size)
 			     : realloc(ptr, size);
 }
+
+/*
+ * What the allocation currently being made is for, one of XDL_ALLOC_*.
+ * Only meaningful from inside a memallocator_t callback.  It's kept per
+ * thread, so threads diffing at the same time don't tag each other's
+ * allocations.
+ */
+int
+xdl_alloc_class(void)
+{
+	return xacls;
+}
+
+void *
+xdl_cmalloc(size_t size, int cls)
+{
+	void *ptr;
+
+	xacls = cls;
+	ptr = xdl_malloc(size);
+	xacls = XDL_ALLOC_OTHER;
+
+	return ptr;
+}
+
+void *
+xdl_crealloc(void *ptr, size_t size, int cls)
+{
+	xacls = cls;
+	ptr = xdl_realloc(ptr, size);
+	xacls = XDL_ALLOC_OTHER;
+
+	return ptr;
+}
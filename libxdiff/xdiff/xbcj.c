@@ -0,0 +1,222 @@
+/*
+ *  LibXDiff by Davide Libenzi ( File Differential Library )
+ *  Copyright (C) 2003  Davide Libenzi
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *  Davide Libenzi <davidel@xmailserver.org>
+ *
+ */
+
+/*
+ * Branch/call/jump filters for machine code, in the spirit of the BCJ
+ * filters in xz.  Every call to a function that moved gets a different
+ * displacement, and in machine code those are everywhere, so two builds
+ * of the same program match in short runs broken up every few bytes.
+ * The filters move each branch's operand out of the instruction stream
+ * into a table at the end of the buffer, which leaves the code itself
+ * to match in long runs and puts the operands together where they
+ * still share most of their bytes.
+ *
+ * Whether an instruction gets split only depends on bytes that stay in
+ * the code stream, and on where it is, so decoding makes the same
+ * decisions encoding did and gives back exactly the original.  False
+ * positives in data are harmless; they just get moved and moved back.
+ * The output is always the same size as the input.
+ */
+
+#include "xinclude.h"
+
+#define XBCJ_EI_DATA 5
+#define XBCJ_E_MACHINE 18
+#define XBCJ_ELFDATA2LSB 1
+#define XBCJ_EM_386 3
+#define XBCJ_EM_X86_64 62
+#define XBCJ_EM_AARCH64 183
+
+#define XBCJ_ISCALL(op, left) (((op) == 0xe8 || (op) == 0xe9) && (left) >= 5)
+#define XBCJ_ISBL(top) (((top) & 0xfc) == 0x94)
+
+/*
+ * x86: call rel32 (e8) and jmp rel32 (e9).  The opcode stays in the
+ * code stream, the four operand bytes go to the table.
+ */
+static void
+xbcj_x86_enc(unsigned char const *src, size_t size, unsigned char *dst)
+{
+	size_t i, n, ops;
+
+	for (i = 0, n = 0; i < size; i++)
+		if (XBCJ_ISCALL(src[i], size - i)) {
+			n++;
+			i += 4;
+		}
+	ops = size - 4 * n;
+	for (i = 0, n = 0; i < size;) {
+		dst[n++] = src[i];
+		if (XBCJ_ISCALL(src[i], size - i)) {
+			memcpy(dst + ops, src + i + 1, 4);
+			ops += 4;
+			i += 5;
+		} else
+			i++;
+	}
+}
+
+static int
+xbcj_x86_dec(unsigned char const *src, size_t size, unsigned char *dst)
+{
+	size_t i, n, ops;
+
+	for (i = 0, n = 0; i < size; n++)
+		i += XBCJ_ISCALL(src[n], size - i) ? 5 : 1;
+	if (i != size)
+		return -1;
+	for (ops = n, i = 0, n = 0; i < size;) {
+		dst[i] = src[n++];
+		if (XBCJ_ISCALL(dst[i], size - i)) {
+			memcpy(dst + i + 1, src + ops, 4);
+			ops += 4;
+			i += 5;
+		} else
+			i++;
+	}
+
+	return 0;
+}
+
+/*
+ * ARM64: bl imm26.  Every aligned word puts its top byte in the code
+ * stream first; for a bl the other three bytes, which are all offset,
+ * go to the table, and for anything else they follow in the code
+ * stream.  A trailing partial word is copied as it is.
+ */
+static void
+xbcj_arm64_enc(unsigned char const *src, size_t size, unsigned char *dst)
+{
+	size_t i, n, ops;
+
+	for (i = 0, n = 0; i + 4 <= size; i += 4)
+		n += XBCJ_ISBL(src[i + 3]);
+	ops = size - 3 * n;
+	for (i = 0, n = 0; i + 4 <= size; i += 4) {
+		dst[n++] = src[i + 3];
+		if (XBCJ_ISBL(src[i + 3])) {
+			memcpy(dst + ops, src + i, 3);
+			ops += 3;
+		} else {
+			memcpy(dst + n, src + i, 3);
+			n += 3;
+		}
+	}
+	memcpy(dst + n, src + i, size - i);
+}
+
+static int
+xbcj_arm64_dec(unsigned char const *src, size_t size, unsigned char *dst)
+{
+	size_t i, n, ops;
+
+	for (i = 0, n = 0; i + 4 <= size; i += 4)
+		n += XBCJ_ISBL(src[n]) ? 1 : 4;
+	ops = n + size - i;
+	for (i = 0, n = 0; i + 4 <= size; i += 4) {
+		dst[i + 3] = src[n++];
+		if (XBCJ_ISBL(dst[i + 3])) {
+			memcpy(dst + i, src + ops, 3);
+			ops += 3;
+		} else {
+			memcpy(dst + i, src + n, 3);
+			n += 3;
+		}
+	}
+	memcpy(dst + i, src + n, size - i);
+
+	return 0;
+}
+
+
+/*
+ * Pick a filter from an ELF header, or XDL_BCJ_NONE if buf isn't a
+ * little endian ELF file for an architecture we have a filter for.
+ */
+int
+xdl_bcj_detect(char const *buf, size_t size)
+{
+	unsigned char const *ehdr = (unsigned char const *)buf;
+	unsigned int machine;
+
+	if (size < XBCJ_E_MACHINE + 2 || memcmp(ehdr, "\177ELF", 4) ||
+	    ehdr[XBCJ_EI_DATA] != XBCJ_ELFDATA2LSB)
+		return XDL_BCJ_NONE;
+	machine = ehdr[XBCJ_E_MACHINE] | ehdr[XBCJ_E_MACHINE + 1] << 8;
+	switch (machine) {
+	case XBCJ_EM_386:
+	case XBCJ_EM_X86_64:
+		return XDL_BCJ_X86;
+	case XBCJ_EM_AARCH64:
+		return XDL_BCJ_ARM64;
+	default:
+		return XDL_BCJ_NONE;
+	}
+}
+
+/*
+ * Filter size bytes of src into dst, which must not overlap it.  An arch
+ * of XDL_BCJ_NONE just copies.
+ */
+int
+xdl_bcj_encode(int arch, char const *src, size_t size, char *dst)
+{
+	unsigned char const *s = (unsigned char const *) src;
+	unsigned char *d = (unsigned char *) dst;
+
+	switch (arch) {
+	case XDL_BCJ_X86:
+		xbcj_x86_enc(s, size, d);
+		return 0;
+	case XDL_BCJ_ARM64:
+		xbcj_arm64_enc(s, size, d);
+		return 0;
+	case XDL_BCJ_NONE:
+		memcpy(d, s, size);
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+/*
+ * Undo xdl_bcj_encode().  Returns -1 if src can't be the output of the
+ * encoder, which a bad patch or the wrong arch can cause.
+ */
+int
+xdl_bcj_decode(int arch, char const *src, size_t size, char *dst)
+{
+	unsigned char const *s = (unsigned char const *) src;
+	unsigned char *d = (unsigned char *) dst;
+
+	switch (arch) {
+	case XDL_BCJ_X86:
+		return xbcj_x86_dec(s, size, d);
+	case XDL_BCJ_ARM64:
+		return xbcj_arm64_dec(s, size, d);
+	case XDL_BCJ_NONE:
+		memcpy(d, s, size);
+		return 0;
+	default:
+		return -1;
+	}
+}
@@ -22,32 +22,76 @@
 
 #include "xinclude.h"
 
+/*
+ * How many positions ahead of the one being looked up the scan takes
+ * fingerprints, and prefetches their buckets; halfway there, it goes
+ * on to prefetch the first record in the bucket too.  It has to be a
+ * power of two.
+ */
+#define XDL_BDAHEAD 8
+
 typedef struct s_bdrecord {
 	struct s_bdrecord *next;
 	unsigned long fp;
 	char const *ptr;
+	int src;
 } bdrecord_t;
 
+/*
+ * fps has each source's adler32, which the blocks' fingerprints add up
+ * to, so the header doesn't need a pass of its own over the sources.
+ */
 typedef struct s_bdfile {
-	char const *data, *top;
+	mmbuffer_t *srcs;
+	int nsrc;
 	chastore_t cha;
 	unsigned int fphbits;
 	bdrecord_t **fphash;
+	uint32_t fps[XDL_BDIFF_MAXSRC];
 } bdfile_t;
 
+static bdrecord_t *
+xdl_bdfile_add(bdfile_t *bdf, char const *data, long size, int src)
+{
+	long i;
+	bdrecord_t *brec;
+
+	if (!(brec = (bdrecord_t *)xdl_cha_alloc(&bdf->cha)))
+		return NULL;
+
+	brec->fp = xdl_adler32(0, (unsigned char const *)data, size);
+	brec->ptr = data;
+	brec->src = src;
+
+	i = (long)XDL_HASHLONG(brec->fp, bdf->fphbits);
+	brec->next = bdf->fphash[i];
+	bdf->fphash[i] = brec;
+
+	return brec;
+}
+
+/*
+ * All the sources go into the same fingerprint table.  They're indexed
+ * last to first, so that when two sources have the same block, the one
+ * with the lower id ends up first in the chain.  xsize is how much more
+ * we expect to add later on, from the target itself.
+ */
 static int
-xdl_prepare_bdfile(mmbuffer_t *mmb, long fpbsize, bdfile_t *bdf)
+xdl_prepare_bdfile(mmbuffer_t *mmbs, int nsrc, long xsize, long fpbsize,
+                   bdfile_t *bdf)
 {
 	unsigned int fphbits;
-	long i, size, hsize;
+	int s;
+	long i, size, hsize, tsize, fpsize;
 	char const *base, *data, *top;
-	bdrecord_t *brec;
-	bdrecord_t **fphash;
+	bdrecord_t **fphash, *brec;
 
-	fphbits = xdl_hashbits((unsigned int)(mmb->size / fpbsize) + 1);
+	for (tsize = xsize, s = 0; s < nsrc; s++)
+		tsize += mmbs[s].size;
+	fphbits = xdl_hashbits((unsigned int)(tsize / fpbsize) + 1);
 	hsize = 1 << fphbits;
-	if (!(fphash = (bdrecord_t **)xdl_malloc(hsize *
-	                                         sizeof(bdrecord_t *)))) {
+	if (!(fphash = (bdrecord_t **)xdl_cmalloc(hsize * sizeof(bdrecord_t *),
+	                                          XDL_ALLOC_HASH))) {
 		return -1;
 	}
 	for (i = 0; i < hsize; i++)
@@ -57,37 +101,36 @@ xdl_prepare_bdfile(mmbuffer_t *mmb, long fpbsize, bdfile_t *bdf)
 		xdl_free(fphash);
 		return -1;
 	}
+	bdf->srcs = mmbs;
+	bdf->nsrc = nsrc;
+	bdf->fphbits = fphbits;
+	bdf->fphash = fphash;
 
-	if (!(size = mmb->size)) {
-		bdf->data = bdf->top = NULL;
-	} else {
-		bdf->data = data = base = mmb->ptr;
-		bdf->top = top = mmb->ptr + mmb->size;
+	for (s = nsrc - 1; s >= 0; s--) {
+		bdf->fps[s] = 0;
+		if (!(size = mmbs[s].size))
+			continue;
+		data = base = mmbs[s].ptr;
+		top = base + size;
 
 		if ((data += (size / fpbsize) * fpbsize) == top)
 			data -= fpbsize;
 
-		for (; data >= base; data -= fpbsize) {
-			if (!(brec = (bdrecord_t *)xdl_cha_alloc(&bdf->cha))) {
+		for (fpsize = 0; data >= base; data -= fpbsize) {
+			if (!(brec = xdl_bdfile_add(
+				      bdf, data,
+				      XDL_MIN(fpbsize, (long)(top - data)),
+				      s))) {
 				xdl_cha_free(&bdf->cha);
 				xdl_free(fphash);
 				return -1;
 			}
-
-			brec->fp = xdl_adler32(0, (unsigned char const *)data,
-			                       XDL_MIN(fpbsize,
-			                               (long)(top - data)));
-			brec->ptr = data;
-
-			i = (long)XDL_HASHLONG(brec->fp, fphbits);
-			brec->next = fphash[i];
-			fphash[i] = brec;
+			bdf->fps[s] = xdl_adler32_combine(
+				(uint32_t)brec->fp, bdf->fps[s], fpsize);
+			fpsize = top - data;
 		}
 	}
 
-	bdf->fphbits = fphbits;
-	bdf->fphash = fphash;
-
 	return 0;
 }
 
@@ -122,141 +165,253 @@ xdl_mmf_adler32(mmfile_t *mmf)
 	return fp;
 }
 
+/*
+ * Emit the binary patch file header. It will be used to verify that the
+ * file being patched matches in size and fingerprint the one that
+ * generated the patch.  Every source past the first gets an XDL_BDOP_SRC
+ * record right after it, so it can be checked the same way.  If the
+ * caller already has the sources' adler32s, they're in fps; otherwise
+ * it's NULL and they're worked out here.
+ */
 int
-xdl_bdiff_mb(mmbuffer_t *mmb1, mmbuffer_t *mmb2, bdiffparam_t const *bdp,
-             xdemitcb_t *ecb)
+xdl_emit_bdhdr(mmbuffer_t *mmbs, int nsrc, uint32_t const *fps,
+               xdemitcb_t *ecb)
+{
+	int s;
+	uint32_t fp;
+	mmbuffer_t mb[1];
+	unsigned char hdrbuf[XDL_SRCOP_SIZE];
+
+	fp = fps ? fps[0] : xdl_mmb_adler32(&mmbs[0]);
+	XDL_LE32_PUT(hdrbuf, fp);
+	XDL_LE32_PUT(hdrbuf + 4, mmbs[0].size);
+
+	mb[0].ptr = (char *)hdrbuf;
+	mb[0].size = XDL_BPATCH_HDR_SIZE;
+	if (ecb->outf(ecb->priv, mb, 1) < 0)
+		return -1;
+
+	for (s = 1; s < nsrc; s++) {
+		fp = fps ? fps[s] : xdl_mmb_adler32(&mmbs[s]);
+		hdrbuf[0] = XDL_BDOP_SRC;
+		hdrbuf[1] = (unsigned char)s;
+		XDL_LE32_PUT(hdrbuf + 2, fp);
+		XDL_LE32_PUT(hdrbuf + 6, mmbs[s].size);
+
+		mb[0].size = XDL_SRCOP_SIZE;
+		if (ecb->outf(ecb->priv, mb, 1) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+int
+xdl_emit_bdins(char const *data, long size, xdemitcb_t *ecb)
+{
+	mmbuffer_t mb[2];
+	unsigned char insbuf[XDL_INSBOP_SIZE];
+
+	if (size > 255) {
+		insbuf[0] = XDL_BDOP_INSB;
+		XDL_LE32_PUT(insbuf + 1, size);
+
+		mb[0].ptr = (char *)insbuf;
+		mb[0].size = XDL_INSBOP_SIZE;
+	} else {
+		insbuf[0] = XDL_BDOP_INS;
+		insbuf[1] = (unsigned char)size;
+
+		mb[0].ptr = (char *)insbuf;
+		mb[0].size = 2;
+	}
+	mb[1].ptr = (char *)data;
+	mb[1].size = size;
+
+	return ecb->outf(ecb->priv, mb, 2) < 0 ? -1 : 0;
+}
+
+/*
+ * Copies from the first source use the plain XDL_BDOP_CPY, so a patch
+ * made against a single source looks the same as it always did.
+ * XDL_BDOP_CPYT has the same layout, with off into the target.
+ */
+int
+xdl_emit_bdcpy(int src, long off, long size, xdemitcb_t *ecb)
+{
+	mmbuffer_t mb[1];
+	unsigned char cpybuf[XDL_COPYSOP_SIZE];
+
+	if (src <= 0) {
+		cpybuf[0] = src ? XDL_BDOP_CPYT : XDL_BDOP_CPY;
+		XDL_LE32_PUT(cpybuf + 1, off);
+		XDL_LE32_PUT(cpybuf + 5, size);
+		mb[0].size = XDL_COPYOP_SIZE;
+	} else {
+		cpybuf[0] = XDL_BDOP_CPYS;
+		cpybuf[1] = (unsigned char)src;
+		XDL_LE32_PUT(cpybuf + 2, off);
+		XDL_LE32_PUT(cpybuf + 6, size);
+		mb[0].size = XDL_COPYSOP_SIZE;
+	}
+	mb[0].ptr = (char *)cpybuf;
+
+	return ecb->outf(ecb->priv, mb, 1) < 0 ? -1 : 0;
+}
+
+/*
+ * Only in place patches have these.  The ops after one write the target
+ * from tpos on, rather than from where the one before it left off.
+ */
+int
+xdl_emit_bdseek(long tpos, xdemitcb_t *ecb)
 {
-	long i, rsize, size, bsize, csize, msize, moff = 0;
+	mmbuffer_t mb[1];
+	unsigned char seekbuf[XDL_SEEKOP_SIZE];
+
+	seekbuf[0] = XDL_BDOP_SEEK;
+	XDL_LE32_PUT(seekbuf + 1, tpos);
+	mb[0].ptr = (char *)seekbuf;
+	mb[0].size = XDL_SEEKOP_SIZE;
+
+	return ecb->outf(ecb->priv, mb, 1) < 0 ? -1 : 0;
+}
+
+int
+xdl_bdiff_mbv(mmbuffer_t *mmbs, int nsrc, mmbuffer_t *mmb2,
+              bdiffparam_t const *bdp, xdemitcb_t *ecb)
+{
+	int s, selfref, msrc = 0;
+	long i, size, bsize, csize, msize, moff = 0;
 	uint32_t fp;
-	char const *blk, *base, *data, *top, *ptr1, *ptr2;
+	uint32_t ring[XDL_BDAHEAD];
+	char const *blk, *base, *data, *top, *stop, *tnext, *ahead;
 	bdrecord_t *brec;
 	bdfile_t bdf;
-	mmbuffer_t mb[2];
-	unsigned char cpybuf[32];
 
+	if (nsrc < 1 || nsrc > XDL_BDIFF_MAXSRC)
+		return -1;
 	if ((bsize = bdp->bsize) < XDL_MIN_BLKSIZE)
 		bsize = XDL_MIN_BLKSIZE;
-	if (xdl_prepare_bdfile(mmb1, bsize, &bdf) < 0) {
+	selfref = (bdp->flags & XDL_BDF_SELFREF) != 0;
+	xdl_phase_begin(XDL_PHASE_INDEX);
+	if (xdl_prepare_bdfile(mmbs, nsrc, selfref ? mmb2->size : 0, bsize,
+	                       &bdf) < 0) {
+		xdl_phase_end(XDL_PHASE_INDEX, 0);
 		return -1;
 	}
 
-	/*
-	 * Prepare and emit the binary patch file header. It will be used
-	 * to verify that that file being patched matches in size and fingerprint
-	 * the one that generated the patch.
-	 */
-	fp = xdl_mmb_adler32(mmb1);
-	size = mmb1->size;
-	XDL_LE32_PUT(cpybuf, fp);
-	XDL_LE32_PUT(cpybuf + 4, size);
-
-	mb[0].ptr = (char *)cpybuf;
-	mb[0].size = 4 + 4;
-
-	if (ecb->outf(ecb->priv, mb, 1) < 0) {
+	if (xdl_emit_bdhdr(mmbs, nsrc, bdf.fps, ecb) < 0) {
+		xdl_phase_end(XDL_PHASE_INDEX, 0);
 		xdl_free_bdfile(&bdf);
 		return -1;
 	}
+	for (size = 0, s = 0; s < nsrc; s++)
+		size += mmbs[s].size;
+	xdl_phase_end(XDL_PHASE_INDEX, size);
 
+	xdl_phase_begin(XDL_PHASE_SCAN);
 	if ((blk = (char const *)mmb2->ptr) != NULL) {
 		size = mmb2->size;
-		for (base = data = blk, top = data + size; data < top;) {
-			rsize = XDL_MIN(bsize, (long)(top - data));
-			fp = xdl_adler32(0, (unsigned char const *)data, rsize);
+		for (base = data = tnext = ahead = blk, top = data + size;
+		     data < top;) {
+			for (; ahead < top && ahead < data + XDL_BDAHEAD; ahead++) {
+				fp = xdl_adler32(0, (unsigned char const *)ahead,
+				                 XDL_MIN(bsize, (long)(top - ahead)));
+				ring[(ahead - blk) & (XDL_BDAHEAD - 1)] = fp;
+				XDL_PREFETCH(bdf.fphash +
+				             XDL_HASHLONG(fp, bdf.fphbits));
+			}
+			if (data + XDL_BDAHEAD / 2 < top) {
+				fp = ring[(data + XDL_BDAHEAD / 2 - blk) &
+				          (XDL_BDAHEAD - 1)];
+				XDL_PREFETCH(
+					bdf.fphash[XDL_HASHLONG(fp, bdf.fphbits)]);
+			}
 
+			/*
+			 * With XDL_BDF_SELFREF, every target block that starts
+			 * before where we are can be copied from.  The copy
+			 * may run on past where it started; the patcher
+			 * copies front to back, so that works out.
+			 */
+			for (; selfref && tnext < data && top - tnext >= bsize;
+			     tnext += bsize)
+				if (!xdl_bdfile_add(&bdf, tnext, bsize,
+				                    XDL_BDSRC_SELF)) {
+					xdl_phase_end(XDL_PHASE_SCAN, 0);
+					xdl_free_bdfile(&bdf);
+					return -1;
+				}
+
+			fp = ring[(data - blk) & (XDL_BDAHEAD - 1)];
 			i = (long)XDL_HASHLONG(fp, bdf.fphbits);
 			for (msize = 0, brec = bdf.fphash[i]; brec;
 			     brec = brec->next)
 				if (brec->fp == fp) {
-					csize = XDL_MIN(
-						(long)(top - data),
-						(long)(bdf.top - brec->ptr));
-					for (ptr1 = brec->ptr, ptr2 = data;
-					     csize && *ptr1 == *ptr2;
-					     csize--, ptr1++, ptr2++)
-						;
-
-					if ((csize = (long)(ptr1 - brec->ptr)) >
-					    msize) {
+					stop = brec->src == XDL_BDSRC_SELF
+					               ? top
+					               : mmbs[brec->src].ptr +
+					                         mmbs[brec->src].size;
+					csize = xdl_match_fwd(
+						(unsigned char const *)brec->ptr,
+						(unsigned char const *)data,
+						XDL_MIN((long)(top - data),
+						        (long)(stop - brec->ptr)));
+
+					if (csize > msize) {
+						msrc = brec->src;
 						moff = (long)(brec->ptr -
-						              bdf.data);
+						              (msrc == XDL_BDSRC_SELF
+						                       ? blk
+						                       : mmbs[msrc].ptr));
 						msize = csize;
 					}
 				}
 
-			if (msize < XDL_COPYOP_SIZE) {
+			if (msize < (msrc > 0 ? XDL_COPYSOP_SIZE : XDL_COPYOP_SIZE)) {
 				data++;
 			} else {
-				if (data > base) {
-					i = (long)(data - base);
-					if (i > 255) {
-						cpybuf[0] = XDL_BDOP_INSB;
-						XDL_LE32_PUT(cpybuf + 1, i);
-
-						mb[0].ptr = (char *)cpybuf;
-						mb[0].size = XDL_INSBOP_SIZE;
-					} else {
-						cpybuf[0] = XDL_BDOP_INS;
-						cpybuf[1] = (unsigned char)i;
-
-						mb[0].ptr = (char *)cpybuf;
-						mb[0].size = 2;
-					}
-					mb[1].ptr = (char *)base;
-					mb[1].size = i;
-
-					if (ecb->outf(ecb->priv, mb, 2) < 0) {
-						xdl_free_bdfile(&bdf);
-						return -1;
-					}
+				if (data > base &&
+				    xdl_emit_bdins(base, (long)(data - base),
+				                   ecb) < 0) {
+					xdl_phase_end(XDL_PHASE_SCAN, 0);
+					xdl_free_bdfile(&bdf);
+					return -1;
 				}
 
 				data += msize;
+				ahead = XDL_MAX(ahead, data);
 
-				cpybuf[0] = XDL_BDOP_CPY;
-				XDL_LE32_PUT(cpybuf + 1, moff);
-				XDL_LE32_PUT(cpybuf + 5, msize);
-
-				mb[0].ptr = (char *)cpybuf;
-				mb[0].size = XDL_COPYOP_SIZE;
-
-				if (ecb->outf(ecb->priv, mb, 1) < 0) {
+				if (xdl_emit_bdcpy(msrc, moff, msize, ecb) < 0) {
+					xdl_phase_end(XDL_PHASE_SCAN, 0);
 					xdl_free_bdfile(&bdf);
 					return -1;
 				}
 				base = data;
 			}
 		}
-		if (data > base) {
-			i = (long)(data - base);
-			if (i > 255) {
-				cpybuf[0] = XDL_BDOP_INSB;
-				XDL_LE32_PUT(cpybuf + 1, i);
-
-				mb[0].ptr = (char *)cpybuf;
-				mb[0].size = XDL_INSBOP_SIZE;
-			} else {
-				cpybuf[0] = XDL_BDOP_INS;
-				cpybuf[1] = (unsigned char)i;
-
-				mb[0].ptr = (char *)cpybuf;
-				mb[0].size = 2;
-			}
-			mb[1].ptr = (char *)base;
-			mb[1].size = i;
-
-			if (ecb->outf(ecb->priv, mb, 2) < 0) {
-				xdl_free_bdfile(&bdf);
-				return -1;
-			}
+		if (data > base &&
+		    xdl_emit_bdins(base, (long)(data - base), ecb) < 0) {
+			xdl_phase_end(XDL_PHASE_SCAN, 0);
+			xdl_free_bdfile(&bdf);
+			return -1;
 		}
 	}
 
+	xdl_phase_end(XDL_PHASE_SCAN, mmb2->size);
 	xdl_free_bdfile(&bdf);
 
 	return 0;
 }
 
+int
+xdl_bdiff_mb(mmbuffer_t *mmb1, mmbuffer_t *mmb2, bdiffparam_t const *bdp,
+             xdemitcb_t *ecb)
+{
+	return xdl_bdiff_mbv(mmb1, 1, mmb2, bdp, ecb);
+}
+
 int
 xdl_bdiff(mmfile_t *mmf1, mmfile_t *mmf2, bdiffparam_t const *bdp,
           xdemitcb_t *ecb)
@@ -275,13 +430,19 @@ xdl_bdiff(mmfile_t *mmf1, mmfile_t *mmf2, bdiffparam_t const *bdp,
 	return xdl_bdiff_mb(&mmb1, &mmb2, bdp, ecb);
 }
 
-size_t
-xdl_bdiff_tgsize(mmfile_t *mmfp)
+/*
+ * Walk the ops of a patch, adding up how big the target will be, and
+ * noting if any of them copy from the target itself.
+ */
+int
+xdl_bdiff_scan(mmfile_t *mmfp, size_t *tgsize, int *selfref)
 {
-	size_t tgsize = 0, size, off, csize;
+	size_t size, csize;
 	const char *blk;
 	const unsigned char *data, *top;
 
+	*tgsize = 0;
+	*selfref = 0;
 	if ((blk = (const char *)xdl_mmfile_first(mmfp, &size)) == NULL ||
 	    size < XDL_BPATCH_HDR_SIZE) {
 		return -1;
@@ -295,26 +456,48 @@ xdl_bdiff_tgsize(mmfile_t *mmfp)
 			if (*data == XDL_BDOP_INS) {
 				data++;
 				csize = (long)*data++;
-				tgsize += csize;
+				*tgsize += csize;
 				data += csize;
 			} else if (*data == XDL_BDOP_INSB) {
 				data++;
 				XDL_LE32_GET(data, csize);
 				data += 4;
-				tgsize += csize;
+				*tgsize += csize;
 				data += csize;
-			} else if (*data == XDL_BDOP_CPY) {
-				data++;
-				XDL_LE32_GET(data, off);
+			} else if (*data == XDL_BDOP_CPY ||
+			           *data == XDL_BDOP_CPYT) {
+				if (*data == XDL_BDOP_CPYT)
+					*selfref = 1;
+				data += 5;
+				XDL_LE32_GET(data, csize);
 				data += 4;
+				*tgsize += csize;
+			} else if (*data == XDL_BDOP_CPYS) {
+				data += 6;
 				XDL_LE32_GET(data, csize);
 				data += 4;
-				tgsize += csize;
+				*tgsize += csize;
+			} else if (*data == XDL_BDOP_SRC) {
+				data += XDL_SRCOP_SIZE;
+			} else if (*data == XDL_BDOP_SEEK) {
+				data += XDL_SEEKOP_SIZE;
 			} else {
 				return -1;
 			}
 		}
 	} while ((blk = (char const *)xdl_mmfile_next(mmfp, &size)) != NULL);
 
+	return 0;
+}
+
+size_t
+xdl_bdiff_tgsize(mmfile_t *mmfp)
+{
+	int selfref;
+	size_t tgsize;
+
+	if (xdl_bdiff_scan(mmfp, &tgsize, &selfref) < 0)
+		return -1;
+
 	return tgsize;
 }
@@ -27,8 +27,22 @@
 #define XDL_MIN_BLKSIZE 16
 #define XDL_INSBOP_SIZE (1 + 4)
 #define XDL_COPYOP_SIZE (1 + 4 + 4)
+#define XDL_COPYSOP_SIZE (1 + 1 + 4 + 4)
+#define XDL_SRCOP_SIZE (1 + 1 + 4 + 4)
+#define XDL_SEEKOP_SIZE (1 + 4)
+
+/*
+ * The source id that xdl_emit_bdcpy() takes for a copy from earlier in
+ * the target.
+ */
+#define XDL_BDSRC_SELF (-1)
 
-uint32_t xdl_mmb_adler32(mmbuffer_t *mmb);
 uint32_t xdl_mmf_adler32(mmfile_t *mmf);
+int xdl_emit_bdhdr(mmbuffer_t *mmbs, int nsrc, uint32_t const *fps,
+                   xdemitcb_t *ecb);
+int xdl_emit_bdins(char const *data, long size, xdemitcb_t *ecb);
+int xdl_emit_bdcpy(int src, long off, long size, xdemitcb_t *ecb);
+int xdl_emit_bdseek(long tpos, xdemitcb_t *ecb);
+int xdl_bdiff_scan(mmfile_t *mmfp, size_t *tgsize, int *selfref);
 
 #endif /* #if !defined(XBDIFF_H) */
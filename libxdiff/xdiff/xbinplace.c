@@ -0,0 +1,612 @@
+/*
+ *  LibXDiff by Davide Libenzi ( File Differential Library )
+ *  Copyright (C) 2003  Davide Libenzi
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *  Davide Libenzi <davidel@xmailserver.org>
+ *
+ */
+
+/*
+ * In place patches, after Burns and Long.  A patch is applied in place
+ * by writing the target over the source it copies from, so a copy has
+ * to be done before anything writes over what it reads.  Copy u reading
+ * what copy v writes makes an edge from u to v, and the copies go out
+ * in a topological order of that graph.  Where there's a cycle, the
+ * smallest copy on it gets turned into an insert of the bytes it would
+ * have copied, which reads nothing.  Inserts go last, after every copy.
+ * The ops no longer come in target order, so an XDL_BDOP_SEEK goes in
+ * front of any that doesn't carry on from the one before.
+ */
+
+#include "xinclude.h"
+
+#define XIP_MINALLOC 128
+
+/*
+ * A piece of the target, tpos bytes in, that's the size bytes at ptr,
+ * or if ptr is NULL, the ones at off in the source.
+ */
+typedef struct s_xippiece {
+	size_t tpos, size, off;
+	char const *ptr;
+} xippiece_t;
+
+typedef struct s_xipctx {
+	xippiece_t *pcs;
+	long npcs, apcs;
+	size_t size;
+} xipctx_t;
+
+/*
+ * The copies, in target order, with the edges out of copy u being
+ * edges[efirst[u]] up to edges[efirst[u + 1]].
+ */
+typedef struct s_xipgraph {
+	long ncps;
+	long *cps;
+	long *efirst;
+	long *edges;
+} xipgraph_t;
+
+#define XIP_NEW 0
+#define XIP_ONSTACK 1
+#define XIP_DONE 2
+#define XIP_INSERT 3
+
+static int
+xdl_ip_add(xipctx_t *ipc, size_t off, char const *ptr, size_t size)
+{
+	long apcs;
+	xippiece_t *pc;
+
+	if (size == 0)
+		return 0;
+	pc = ipc->npcs ? &ipc->pcs[ipc->npcs - 1] : NULL;
+	if (pc && !ptr && !pc->ptr && pc->off + pc->size == off &&
+	    pc->size + size <= 0xffffffffUL) {
+		pc->size += size;
+		ipc->size += size;
+		return 0;
+	}
+	if (ipc->npcs == ipc->apcs) {
+		apcs = ipc->apcs ? 2 * ipc->apcs : XIP_MINALLOC;
+		if ((pc = (xippiece_t *)xdl_realloc(
+			     ipc->pcs, apcs * sizeof(xippiece_t))) == NULL)
+			return -1;
+		ipc->pcs = pc;
+		ipc->apcs = apcs;
+	}
+	pc = &ipc->pcs[ipc->npcs++];
+	pc->tpos = ipc->size;
+	pc->size = size;
+	pc->off = off;
+	pc->ptr = ptr;
+	ipc->size += size;
+
+	return 0;
+}
+
+/*
+ * The piece that has target offset tpos in it.
+ */
+static long
+xdl_ip_find(xipctx_t const *ipc, size_t tpos)
+{
+	long lo, hi, mid;
+
+	for (lo = 0, hi = ipc->npcs - 1; lo < hi;) {
+		mid = (lo + hi + 1) / 2;
+		if (ipc->pcs[mid].tpos <= tpos)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	return lo;
+}
+
+/*
+ * A copy from earlier in the target is whatever the pieces it covers
+ * came from.  It can run on past where it started, in which case it
+ * picks up the pieces it's just added.
+ */
+static int
+xdl_ip_addself(xipctx_t *ipc, size_t off, size_t size)
+{
+	long i;
+	size_t d, n;
+	xippiece_t pc;
+
+	for (; size > 0; off += n, size -= n) {
+		if (off >= ipc->size)
+			return -1;
+		i = xdl_ip_find(ipc, off);
+		pc = ipc->pcs[i];
+		d = off - pc.tpos;
+		n = XDL_MIN(size, pc.size - d);
+		if (xdl_ip_add(ipc, pc.ptr ? 0 : pc.off + d,
+		               pc.ptr ? pc.ptr + d : NULL, n) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int
+xdl_ip_load(xipctx_t *ipc, mmbuffer_t *mmb1, mmfile_t *mmfp, uint32_t *pfp)
+{
+	size_t size, off, csize;
+	uint32_t fp;
+	char const *blk;
+	unsigned char const *data, *top;
+
+	if ((blk = (char const *)xdl_mmfile_first(mmfp, &size)) == NULL ||
+	    size < XDL_BPATCH_HDR_SIZE)
+		return -1;
+	XDL_LE32_GET(blk, fp);
+	XDL_LE32_GET(blk + 4, csize);
+	if (csize != (size_t)mmb1->size || fp != xdl_mmb_adler32(mmb1))
+		return -1;
+	*pfp = fp;
+	blk += XDL_BPATCH_HDR_SIZE;
+	size -= XDL_BPATCH_HDR_SIZE;
+
+	do {
+		for (data = (unsigned char const *)blk, top = data + size;
+		     data < top;) {
+			if (*data == XDL_BDOP_INS || *data == XDL_BDOP_INSB) {
+				if (*data++ == XDL_BDOP_INS) {
+					csize = (long)*data++;
+				} else {
+					XDL_LE32_GET(data, csize);
+					data += 4;
+				}
+				if (csize > (size_t)(top - data) ||
+				    xdl_ip_add(ipc, 0, (char const *)data,
+				               csize) < 0)
+					return -1;
+				data += csize;
+			} else if (*data == XDL_BDOP_CPY ||
+			           *data == XDL_BDOP_CPYT) {
+				int self = *data++ == XDL_BDOP_CPYT;
+
+				XDL_LE32_GET(data, off);
+				data += 4;
+				XDL_LE32_GET(data, csize);
+				data += 4;
+				if (self) {
+					if (xdl_ip_addself(ipc, off, csize) < 0)
+						return -1;
+				} else if (off > (size_t)mmb1->size ||
+				           csize > (size_t)mmb1->size - off ||
+				           xdl_ip_add(ipc, off, NULL, csize) < 0) {
+					return -1;
+				}
+			} else {
+				return -1;
+			}
+		}
+	} while ((blk = (char const *)xdl_mmfile_next(mmfp, &size)) != NULL);
+
+	return 0;
+}
+
+/*
+ * The first copy, in target order, that writes anything at or past off.
+ */
+static long
+xdl_ip_first_after(xipctx_t const *ipc, xipgraph_t const *ipg, size_t off)
+{
+	long lo, hi, mid;
+	xippiece_t const *pc;
+
+	for (lo = 0, hi = ipg->ncps; lo < hi;) {
+		mid = (lo + hi) / 2;
+		pc = &ipc->pcs[ipg->cps[mid]];
+		if (pc->tpos + pc->size <= off)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static void
+xdl_ip_free_graph(xipgraph_t *ipg)
+{
+	xdl_free(ipg->edges);
+	xdl_free(ipg->efirst);
+	xdl_free(ipg->cps);
+}
+
+/*
+ * Copies write where no other piece does, so the ones that write over
+ * what u reads are a run of them, found with a binary search.  This
+ * goes over them twice, once to count the edges and once to fill them
+ * in.
+ */
+static int
+xdl_ip_build_graph(xipctx_t const *ipc, xipgraph_t *ipg)
+{
+	int pass;
+	long i, u, v, nedges;
+	xippiece_t const *pu, *pv;
+
+	memset(ipg, 0, sizeof(*ipg));
+	if ((ipg->cps = (long *)xdl_malloc((ipc->npcs + 1) * sizeof(long))) ==
+	            NULL ||
+	    (ipg->efirst = (long *)xdl_malloc((ipc->npcs + 1) *
+	                                      sizeof(long))) == NULL) {
+		xdl_ip_free_graph(ipg);
+		return -1;
+	}
+	for (i = 0; i < ipc->npcs; i++)
+		if (!ipc->pcs[i].ptr)
+			ipg->cps[ipg->ncps++] = i;
+
+	for (pass = 0; pass < 2; pass++) {
+		for (nedges = 0, u = 0; u < ipg->ncps; u++) {
+			ipg->efirst[u] = nedges;
+			pu = &ipc->pcs[ipg->cps[u]];
+			for (v = xdl_ip_first_after(ipc, ipg, pu->off);
+			     v < ipg->ncps; v++) {
+				pv = &ipc->pcs[ipg->cps[v]];
+				if (pv->tpos >= pu->off + pu->size)
+					break;
+				if (v == u)
+					continue;
+				if (pass)
+					ipg->edges[nedges] = v;
+				nedges++;
+			}
+		}
+		ipg->efirst[ipg->ncps] = nedges;
+		if (!pass && (ipg->edges = (long *)xdl_malloc(
+			              (nedges + 1) * sizeof(long))) == NULL) {
+			xdl_ip_free_graph(ipg);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Depth first, with the copies that finish going into order, which
+ * backwards is the order they have to be done in.  An edge back to a
+ * copy on the stack closes a cycle, and the smallest copy on it becomes
+ * an insert.  Everything above that on the stack goes back to being
+ * unvisited, since the path it was found along is gone, and gets picked
+ * up again later.
+ */
+static long
+xdl_ip_sort(xipctx_t const *ipc, xipgraph_t const *ipg, unsigned char *state,
+            long *order)
+{
+	int again;
+	long r, u, v, w, i, sp, norder = 0;
+	long *stack, *spos, *it;
+
+	if ((stack = (long *)xdl_malloc((3 * ipg->ncps + 1) * sizeof(long))) ==
+	    NULL)
+		return -1;
+	spos = stack + ipg->ncps;
+	it = spos + ipg->ncps;
+	memset(state, XIP_NEW, ipg->ncps);
+
+	do {
+		again = 0;
+		for (r = 0; r < ipg->ncps; r++) {
+			if (state[r] != XIP_NEW)
+				continue;
+			state[r] = XIP_ONSTACK;
+			it[r] = ipg->efirst[r];
+			spos[r] = 0;
+			stack[0] = r;
+			for (sp = 1; sp > 0;) {
+				u = stack[sp - 1];
+				if (it[u] == ipg->efirst[u + 1]) {
+					state[u] = XIP_DONE;
+					order[norder++] = u;
+					sp--;
+					continue;
+				}
+				v = ipg->edges[it[u]++];
+				if (state[v] == XIP_NEW) {
+					state[v] = XIP_ONSTACK;
+					it[v] = ipg->efirst[v];
+					spos[v] = sp;
+					stack[sp++] = v;
+				} else if (state[v] == XIP_ONSTACK) {
+					for (w = v, i = spos[v] + 1; i < sp; i++)
+						if (ipc->pcs[ipg->cps[stack[i]]].size <
+						    ipc->pcs[ipg->cps[w]].size)
+							w = stack[i];
+					for (; stack[sp - 1] != w; sp--) {
+						state[stack[sp - 1]] = XIP_NEW;
+						again = 1;
+					}
+					state[w] = XIP_INSERT;
+					sp--;
+				}
+			}
+		}
+	} while (again);
+	xdl_free(stack);
+
+	return norder;
+}
+
+static int
+xdl_ip_emit(xipctx_t const *ipc, xipgraph_t const *ipg,
+            unsigned char const *state, long const *order, long norder,
+            mmbuffer_t *mmb1, uint32_t fp, xdemitcb_t *ecb)
+{
+	long i, c;
+	size_t tpos = 0;
+	unsigned char hdr[XDL_BPATCH_HDR_SIZE];
+	mmbuffer_t mb;
+	xippiece_t const *pc;
+
+	XDL_LE32_PUT(hdr, fp);
+	XDL_LE32_PUT(hdr + 4, mmb1->size);
+	mb.ptr = (char *)hdr;
+	mb.size = XDL_BPATCH_HDR_SIZE;
+	if (ecb->outf(ecb->priv, &mb, 1) < 0)
+		return -1;
+
+	for (i = norder - 1; i >= 0; i--) {
+		pc = &ipc->pcs[ipg->cps[order[i]]];
+		if ((pc->tpos != tpos && xdl_emit_bdseek(pc->tpos, ecb) < 0) ||
+		    xdl_emit_bdcpy(0, pc->off, pc->size, ecb) < 0)
+			return -1;
+		tpos = pc->tpos + pc->size;
+	}
+	for (i = 0, c = 0; i < ipc->npcs; i++) {
+		pc = &ipc->pcs[i];
+		if (!pc->ptr && state[c++] != XIP_INSERT)
+			continue;
+		if ((pc->tpos != tpos && xdl_emit_bdseek(pc->tpos, ecb) < 0) ||
+		    xdl_emit_bdins(pc->ptr ? pc->ptr : mmb1->ptr + pc->off,
+		                   pc->size, ecb) < 0)
+			return -1;
+		tpos = pc->tpos + pc->size;
+	}
+
+	return 0;
+}
+
+/*
+ * Turn the patch in mmfp, against mmb1 alone, into one that
+ * xdl_bpatch_inplace() can apply over mmb1 itself.  Copies from earlier
+ * in the target become whatever they copied.
+ */
+int
+xdl_bdiff_inplace(mmbuffer_t *mmb1, mmfile_t *mmfp, xdemitcb_t *ecb)
+{
+	long norder, *order;
+	uint32_t fp;
+	unsigned char *state;
+	xipctx_t ipc;
+	xipgraph_t ipg;
+
+	memset(&ipc, 0, sizeof(ipc));
+	if (xdl_ip_load(&ipc, mmb1, mmfp, &fp) < 0 ||
+	    xdl_ip_build_graph(&ipc, &ipg) < 0) {
+		xdl_free(ipc.pcs);
+		return -1;
+	}
+	if ((order = (long *)xdl_malloc((ipg.ncps + 1) * sizeof(long))) ==
+	    NULL) {
+		xdl_ip_free_graph(&ipg);
+		xdl_free(ipc.pcs);
+		return -1;
+	}
+	if ((state = (unsigned char *)xdl_malloc(ipg.ncps + 1)) == NULL ||
+	    (norder = xdl_ip_sort(&ipc, &ipg, state, order)) < 0 ||
+	    xdl_ip_emit(&ipc, &ipg, state, order, norder, mmb1, fp, ecb) < 0) {
+		xdl_free(state);
+		xdl_free(order);
+		xdl_ip_free_graph(&ipg);
+		xdl_free(ipc.pcs);
+		return -1;
+	}
+	xdl_free(state);
+	xdl_free(order);
+	xdl_ip_free_graph(&ipg);
+	xdl_free(ipc.pcs);
+
+	return 0;
+}
+
+typedef struct s_xipapply {
+	xdipfile_t *ipf;
+	size_t srcsize, tgsize;
+	char *buf;
+	size_t ssize;
+	long step, next;
+	char const *save;
+	size_t nsave;
+} xipapply_t;
+
+/*
+ * Write size bytes at tpos, from data, or if that's NULL from off in
+ * what's left of the source, a step at a time.  When what a copy reads
+ * and writes overlap, it goes back to front if it's moving the bytes up,
+ * so no step reads what an earlier one of its own wrote.
+ */
+static int
+xdl_ip_run(xipapply_t *ipa, size_t tpos, char const *data, size_t off,
+           size_t size)
+{
+	int back;
+	size_t d, n, rel;
+	char const *src;
+	xdipfile_t *ipf = ipa->ipf;
+
+	if (tpos > ipa->tgsize || size > ipa->tgsize - tpos ||
+	    (!data && (off > ipa->srcsize || size > ipa->srcsize - off)))
+		return -1;
+	if (!data && tpos == off)
+		return 0;
+	back = !data && tpos > off && off + size > tpos;
+	for (d = 0; d < size; d += n, ipa->next++) {
+		n = XDL_MIN(size - d, ipa->ssize);
+		if (ipa->next < ipa->step)
+			continue;
+		rel = back ? size - d - n : d;
+		if (data) {
+			src = data + rel;
+		} else if (ipa->next == ipa->step && ipa->save) {
+			if (ipa->nsave != n)
+				return -1;
+			src = ipa->save;
+		} else {
+			if ((*ipf->readf)(ipf->priv, off + rel, ipa->buf, n) < 0)
+				return -1;
+			src = ipa->buf;
+		}
+		if ((*ipf->markf)(ipf->priv, ipa->next,
+		                  !data && off + rel < tpos + rel + n &&
+		                                  tpos + rel < off + rel + n
+		                          ? src
+		                          : NULL,
+		                  n) < 0)
+			return -1;
+		if (ipf->size < ipa->tgsize) {
+			if ((*ipf->sizef)(ipf->priv, ipa->tgsize) < 0)
+				return -1;
+			ipf->size = ipa->tgsize;
+		}
+		if ((*ipf->writef)(ipf->priv, tpos + rel, src, n) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int
+xdl_ip_check(xipapply_t *ipa, uint32_t fp, size_t csize)
+{
+	size_t off, n;
+	uint32_t ha;
+	mmbuffer_t mb;
+	xdipfile_t *ipf = ipa->ipf;
+
+	if (ipf->size != csize)
+		return -1;
+	for (ha = 0, off = 0; off < csize; off += n) {
+		n = XDL_MIN(csize - off, ipa->ssize);
+		if ((*ipf->readf)(ipf->priv, off, ipa->buf, n) < 0)
+			return -1;
+		mb.ptr = ipa->buf;
+		mb.size = n;
+		ha = xdl_adler32_combine(ha, xdl_mmb_adler32(&mb), n);
+	}
+
+	return ha == fp ? 0 : -1;
+}
+
+/*
+ * Apply an in place patch over ipf, reading and writing it ssize bytes
+ * at a time, which is all the memory this needs besides the patch.
+ * With step negative, the file has to be the patch's source, and it's
+ * checked.  Otherwise this picks up at step, with the steps before it
+ * already done, and save and nsave what markf() was last given; ssize
+ * has to be the same as it was, for the steps to come out the same.
+ */
+int
+xdl_bpatch_inplace(mmfile_t *mmfp, xdipfile_t *ipf, size_t ssize, long step,
+                   char const *save, size_t nsave)
+{
+	int selfref, res = -1;
+	size_t size, off, csize, tpos = 0;
+	uint32_t fp;
+	char const *blk;
+	unsigned char const *data, *top;
+	xipapply_t ipa;
+
+	if (ssize == 0 || xdl_bdiff_scan(mmfp, &ipa.tgsize, &selfref) < 0 ||
+	    selfref || (blk = (char const *)xdl_mmfile_first(mmfp, &size)) ==
+	                       NULL)
+		return -1;
+	XDL_LE32_GET(blk, fp);
+	XDL_LE32_GET(blk + 4, csize);
+	ipa.ipf = ipf;
+	ipa.srcsize = csize;
+	ipa.ssize = ssize;
+	ipa.step = XDL_MAX(step, 0);
+	ipa.next = 0;
+	ipa.save = save;
+	ipa.nsave = nsave;
+	if ((ipa.buf = (char *)xdl_malloc(ssize)) == NULL)
+		return -1;
+	if (step < 0 && xdl_ip_check(&ipa, fp, csize) < 0)
+		goto out;
+	blk += XDL_BPATCH_HDR_SIZE;
+	size -= XDL_BPATCH_HDR_SIZE;
+
+	do {
+		for (data = (unsigned char const *)blk, top = data + size;
+		     data < top;) {
+			if (*data == XDL_BDOP_INS || *data == XDL_BDOP_INSB) {
+				if (*data++ == XDL_BDOP_INS) {
+					csize = (long)*data++;
+				} else {
+					XDL_LE32_GET(data, csize);
+					data += 4;
+				}
+				if (csize > (size_t)(top - data) ||
+				    xdl_ip_run(&ipa, tpos, (char const *)data,
+				               0, csize) < 0)
+					goto out;
+				data += csize;
+			} else if (*data == XDL_BDOP_CPY) {
+				data++;
+				XDL_LE32_GET(data, off);
+				data += 4;
+				XDL_LE32_GET(data, csize);
+				data += 4;
+				if (xdl_ip_run(&ipa, tpos, NULL, off, csize) < 0)
+					goto out;
+			} else if (*data == XDL_BDOP_SEEK) {
+				data++;
+				XDL_LE32_GET(data, tpos);
+				data += 4;
+				continue;
+			} else {
+				goto out;
+			}
+			tpos += csize;
+		}
+	} while ((blk = (char const *)xdl_mmfile_next(mmfp, &size)) != NULL);
+
+	if (ipa.next >= ipa.step &&
+	    (*ipf->markf)(ipf->priv, ipa.next, NULL, 0) < 0)
+		goto out;
+	if (ipf->size != ipa.tgsize) {
+		if ((*ipf->sizef)(ipf->priv, ipa.tgsize) < 0)
+			goto out;
+		ipf->size = ipa.tgsize;
+	}
+	res = 0;
+out:
+	xdl_free(ipa.buf);
+
+	return res;
+}
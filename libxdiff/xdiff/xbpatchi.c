@@ -42,6 +42,108 @@ xdl_copy_range(mmfile_t *mmf, size_t off, size_t size, xdemitcb_t *ecb)
 	return 0;
 }
 
+/*
+ * Where a patch's output goes.  When the patch has XDL_BDOP_CPYT ops in
+ * it, buf keeps everything written so far, so they have something to
+ * copy from.  Otherwise it's NULL, and output goes straight through.
+ */
+typedef struct s_bpout {
+	xdemitcb_t *ecb;
+	char *buf;
+	size_t pos, size;
+} bpout_t;
+
+static int
+xdl_bpout_init(bpout_t *bpo, mmfile_t *mmfp, xdemitcb_t *ecb)
+{
+	int selfref;
+	size_t tgsize;
+
+	bpo->ecb = ecb;
+	bpo->buf = NULL;
+	bpo->pos = bpo->size = 0;
+	if (xdl_bdiff_scan(mmfp, &tgsize, &selfref) < 0) {
+		return -1;
+	}
+	if (selfref) {
+		if ((bpo->buf = (char *)xdl_malloc(tgsize + 1)) == NULL) {
+			return -1;
+		}
+		bpo->size = tgsize;
+	}
+
+	return 0;
+}
+
+static void
+xdl_bpout_free(bpout_t *bpo)
+{
+	xdl_free(bpo->buf);
+}
+
+static int
+xdl_bpout_emit(bpout_t *bpo, char const *data, size_t size)
+{
+	mmbuffer_t mb;
+
+	mb.ptr = (char *)data;
+	mb.size = size;
+	if (bpo->buf) {
+		if (size > bpo->size - bpo->pos) {
+			return -1;
+		}
+		memcpy(bpo->buf + bpo->pos, data, size);
+		bpo->pos += size;
+	}
+
+	return bpo->ecb->outf(bpo->ecb->priv, &mb, 1) < 0 ? -1 : 0;
+}
+
+static int
+xdl_bpout_copy(bpout_t *bpo, mmfile_t *mmf, size_t off, size_t size)
+{
+	mmbuffer_t mb;
+
+	if (!bpo->buf) {
+		return xdl_copy_range(mmf, off, size, bpo->ecb);
+	}
+	if (size > bpo->size - bpo->pos || xdl_seek_mmfile(mmf, off) < 0 ||
+	    xdl_read_mmfile(mmf, bpo->buf + bpo->pos, size) != (ssize_t)size) {
+		return -1;
+	}
+	mb.ptr = bpo->buf + bpo->pos;
+	mb.size = size;
+	bpo->pos += size;
+
+	return bpo->ecb->outf(bpo->ecb->priv, &mb, 1) < 0 ? -1 : 0;
+}
+
+/*
+ * Copy from earlier in the target.  The copy may run into the bytes it's
+ * writing, in which case they repeat every pos - off bytes, so go in
+ * steps no bigger than that.
+ */
+static int
+xdl_bpout_self(bpout_t *bpo, size_t off, size_t size)
+{
+	size_t done, n, dist;
+	mmbuffer_t mb;
+
+	if (!bpo->buf || off >= bpo->pos || size > bpo->size - bpo->pos) {
+		return -1;
+	}
+	dist = bpo->pos - off;
+	for (done = 0; done < size; done += n) {
+		n = XDL_MIN(size - done, dist);
+		memcpy(bpo->buf + bpo->pos + done, bpo->buf + off + done, n);
+	}
+	mb.ptr = bpo->buf + bpo->pos;
+	mb.size = size;
+	bpo->pos += size;
+
+	return bpo->ecb->outf(bpo->ecb->priv, &mb, 1) < 0 ? -1 : 0;
+}
+
 int
 xdl_bpatch(mmfile_t *mmf, mmfile_t *mmfp, xdemitcb_t *ecb)
 {
@@ -49,7 +151,7 @@ xdl_bpatch(mmfile_t *mmf, mmfile_t *mmfp, xdemitcb_t *ecb)
 	uint32_t fp, ofp;
 	char const *blk;
 	unsigned char const *data, *top;
-	mmbuffer_t mb;
+	bpout_t bpo;
 
 	if ((blk = (char const *)xdl_mmfile_first(mmfp, &size)) == NULL ||
 	    size < XDL_BPATCH_HDR_SIZE) {
@@ -62,7 +164,11 @@ xdl_bpatch(mmfile_t *mmf, mmfile_t *mmfp, xdemitcb_t *ecb)
 	if (fp != ofp || csize != osize) {
 		return -1;
 	}
+	if (xdl_bpout_init(&bpo, mmfp, ecb) < 0) {
+		return -1;
+	}
 
+	blk = (char const *)xdl_mmfile_first(mmfp, &size);
 	blk += XDL_BPATCH_HDR_SIZE;
 	size -= XDL_BPATCH_HDR_SIZE;
 
@@ -72,54 +178,432 @@ xdl_bpatch(mmfile_t *mmf, mmfile_t *mmfp, xdemitcb_t *ecb)
 			if (*data == XDL_BDOP_INS) {
 				data++;
 
-				mb.size = (long)*data++;
-				mb.ptr = (char *)data;
-				data += mb.size;
+				csize = (long)*data++;
+				if (xdl_bpout_emit(&bpo, (char const *)data,
+				                   csize) < 0) {
+					xdl_bpout_free(&bpo);
+					return -1;
+				}
+				data += csize;
+			} else if (*data == XDL_BDOP_INSB) {
+				data++;
+				XDL_LE32_GET(data, csize);
+				data += 4;
+
+				if (xdl_bpout_emit(&bpo, (char const *)data,
+				                   csize) < 0) {
+					xdl_bpout_free(&bpo);
+					return -1;
+				}
+				data += csize;
+			} else if (*data == XDL_BDOP_CPY) {
+				data++;
+				XDL_LE32_GET(data, off);
+				data += 4;
+				XDL_LE32_GET(data, csize);
+				data += 4;
 
-				if (ecb->outf(ecb->priv, &mb, 1) < 0) {
+				if (xdl_bpout_copy(&bpo, mmf, off, csize) < 0) {
+					xdl_bpout_free(&bpo);
 					return -1;
 				}
+			} else if (*data == XDL_BDOP_CPYT) {
+				data++;
+				XDL_LE32_GET(data, off);
+				data += 4;
+				XDL_LE32_GET(data, csize);
+				data += 4;
+
+				if (xdl_bpout_self(&bpo, off, csize) < 0) {
+					xdl_bpout_free(&bpo);
+					return -1;
+				}
+			} else {
+				xdl_bpout_free(&bpo);
+				return -1;
+			}
+		}
+	} while ((blk = (char const *)xdl_mmfile_next(mmfp, &size)) != NULL);
+	xdl_bpout_free(&bpo);
+
+	return 0;
+}
+
+/*
+ * Apply a patch made by xdl_bdiff_mbv() or xdl_rabdiff_mbv().  mmbs[0] is
+ * the file the patch header describes, and every XDL_BDOP_SRC record has
+ * to match the source with its id before anything may copy from it.
+ */
+int
+xdl_bpatch_refs(mmbuffer_t *mmbs, int nsrc, mmfile_t *mmfp, xdemitcb_t *ecb)
+{
+	int sid;
+	size_t size, off, csize;
+	uint32_t fp;
+	char const *blk;
+	unsigned char const *data, *top;
+	bpout_t bpo;
+	unsigned char known[XDL_BDIFF_MAXSRC];
+
+	if (nsrc < 1 || nsrc > XDL_BDIFF_MAXSRC ||
+	    (blk = (char const *)xdl_mmfile_first(mmfp, &size)) == NULL ||
+	    size < XDL_BPATCH_HDR_SIZE) {
+		return -1;
+	}
+	XDL_LE32_GET(blk, fp);
+	XDL_LE32_GET(blk + 4, csize);
+	if (fp != xdl_mmb_adler32(&mmbs[0]) || csize != (size_t)mmbs[0].size) {
+		return -1;
+	}
+	memset(known, 0, sizeof(known));
+	known[0] = 1;
+	if (xdl_bpout_init(&bpo, mmfp, ecb) < 0) {
+		return -1;
+	}
+
+	blk = (char const *)xdl_mmfile_first(mmfp, &size);
+	blk += XDL_BPATCH_HDR_SIZE;
+	size -= XDL_BPATCH_HDR_SIZE;
+
+	do {
+		for (data = (unsigned char const *)blk, top = data + size;
+		     data < top;) {
+			if (*data == XDL_BDOP_INS) {
+				data++;
+
+				csize = (long)*data++;
+				if (xdl_bpout_emit(&bpo, (char const *)data,
+				                   csize) < 0) {
+					xdl_bpout_free(&bpo);
+					return -1;
+				}
+				data += csize;
 			} else if (*data == XDL_BDOP_INSB) {
 				data++;
 				XDL_LE32_GET(data, csize);
 				data += 4;
 
-				mb.size = csize;
-				mb.ptr = (char *)data;
-				data += mb.size;
+				if (xdl_bpout_emit(&bpo, (char const *)data,
+				                   csize) < 0) {
+					xdl_bpout_free(&bpo);
+					return -1;
+				}
+				data += csize;
+			} else if (*data == XDL_BDOP_CPY ||
+			           *data == XDL_BDOP_CPYS) {
+				sid = *data++ == XDL_BDOP_CPYS ? *data++ : 0;
+				XDL_LE32_GET(data, off);
+				data += 4;
+				XDL_LE32_GET(data, csize);
+				data += 4;
 
-				if (ecb->outf(ecb->priv, &mb, 1) < 0) {
+				if (!known[sid] || off > (size_t)mmbs[sid].size ||
+				    csize > (size_t)mmbs[sid].size - off ||
+				    xdl_bpout_emit(&bpo, mmbs[sid].ptr + off,
+				                   csize) < 0) {
+					xdl_bpout_free(&bpo);
 					return -1;
 				}
-			} else if (*data == XDL_BDOP_CPY) {
+			} else if (*data == XDL_BDOP_CPYT) {
 				data++;
 				XDL_LE32_GET(data, off);
 				data += 4;
 				XDL_LE32_GET(data, csize);
 				data += 4;
 
-				if (xdl_copy_range(mmf, off, csize, ecb) < 0) {
+				if (xdl_bpout_self(&bpo, off, csize) < 0) {
+					xdl_bpout_free(&bpo);
 					return -1;
 				}
+			} else if (*data == XDL_BDOP_SRC) {
+				data++;
+				sid = *data++;
+				XDL_LE32_GET(data, fp);
+				data += 4;
+				XDL_LE32_GET(data, csize);
+				data += 4;
+
+				if (sid == 0 || sid >= nsrc ||
+				    fp != xdl_mmb_adler32(&mmbs[sid]) ||
+				    csize != (size_t)mmbs[sid].size) {
+					xdl_bpout_free(&bpo);
+					return -1;
+				}
+				known[sid] = 1;
 			} else {
+				xdl_bpout_free(&bpo);
 				return -1;
 			}
 		}
 	} while ((blk = (char const *)xdl_mmfile_next(mmfp, &size)) != NULL);
+	xdl_bpout_free(&bpo);
+
+	return 0;
+}
+
+/*
+ * A patch decoded into where each op's bytes land in the target.
+ * XDL_BDOP_INS and XDL_BDOP_CPY ops have their bytes at ptr, and can be
+ * done in any order; a copy also has the source and offset it came
+ * from.  XDL_BDOP_CPYT ops copy from off in the target, so they have to
+ * wait for the bytes they copy.  An op of 0 was taken by the caller.
+ */
+typedef struct s_xdbpop {
+	char const *ptr;
+	size_t off, size, tpos;
+	int op, sid;
+} xdbpop_t;
+
+struct s_xdbpplan {
+	xdbpop_t *ops;
+	long nops, aops, nself;
+	size_t size;
+};
+
+static xdbpop_t *
+xdl_bpplan_add(xdbpplan_t *plan, int op, char const *ptr, int sid, size_t off,
+               size_t size)
+{
+	long aops;
+	xdbpop_t *ops, *bop;
+
+	if (plan->nops == plan->aops) {
+		aops = 2 * plan->aops + 64;
+		if ((ops = (xdbpop_t *)xdl_realloc(
+			     plan->ops, aops * sizeof(xdbpop_t))) == NULL) {
+			return NULL;
+		}
+		plan->ops = ops;
+		plan->aops = aops;
+	}
+	bop = &plan->ops[plan->nops++];
+	bop->op = op;
+	bop->ptr = ptr;
+	bop->sid = sid;
+	bop->off = off;
+	bop->size = size;
+	bop->tpos = plan->size;
+	plan->size += size;
+
+	return bop;
+}
+
+/*
+ * Decode a patch xdl_bpatch_refs() could apply, checking it the same
+ * way, so that it can be applied straight into a buffer the size of
+ * the target by xdl_bpatch_plan_run() on as many threads as there are
+ * pieces of the target, and then xdl_bpatch_plan_self().  The plan
+ * points into mmbs and the patch, so they have to outlive it.  If the
+ * caller has already summed the sources, maybe a piece at a time with
+ * xdl_adler32_combine(), their adler32s are in fps; if it's NULL, each
+ * one is summed here when the header gets to it.
+ */
+xdbpplan_t *
+xdl_bpatch_plan(mmbuffer_t *mmbs, int nsrc, mmfile_t *mmfp,
+                uint32_t const *fps)
+{
+	int sid;
+	size_t size, off, csize;
+	uint32_t fp;
+	char const *blk;
+	unsigned char const *data, *top;
+	xdbpplan_t *plan;
+	unsigned char known[XDL_BDIFF_MAXSRC];
+
+	if (nsrc < 1 || nsrc > XDL_BDIFF_MAXSRC ||
+	    (blk = (char const *)xdl_mmfile_first(mmfp, &size)) == NULL ||
+	    size < XDL_BPATCH_HDR_SIZE) {
+		return NULL;
+	}
+	XDL_LE32_GET(blk, fp);
+	XDL_LE32_GET(blk + 4, csize);
+	if (csize != (size_t)mmbs[0].size ||
+	    fp != (fps ? fps[0] : xdl_mmb_adler32(&mmbs[0]))) {
+		return NULL;
+	}
+	if ((plan = (xdbpplan_t *)xdl_malloc(sizeof(xdbpplan_t))) == NULL) {
+		return NULL;
+	}
+	memset(plan, 0, sizeof(*plan));
+	memset(known, 0, sizeof(known));
+	known[0] = 1;
+
+	blk += XDL_BPATCH_HDR_SIZE;
+	size -= XDL_BPATCH_HDR_SIZE;
+
+	do {
+		for (data = (unsigned char const *)blk, top = data + size;
+		     data < top;) {
+			if (*data == XDL_BDOP_INS || *data == XDL_BDOP_INSB) {
+				if (*data++ == XDL_BDOP_INS) {
+					csize = (long)*data++;
+				} else {
+					XDL_LE32_GET(data, csize);
+					data += 4;
+				}
+				if (csize > (size_t)(top - data) ||
+				    !xdl_bpplan_add(plan, XDL_BDOP_INS,
+				                    (char const *)data, 0, 0, csize))
+					goto error;
+				data += csize;
+			} else if (*data == XDL_BDOP_CPY ||
+			           *data == XDL_BDOP_CPYS) {
+				sid = *data++ == XDL_BDOP_CPYS ? *data++ : 0;
+				XDL_LE32_GET(data, off);
+				data += 4;
+				XDL_LE32_GET(data, csize);
+				data += 4;
+
+				if (!known[sid] || off > (size_t)mmbs[sid].size ||
+				    csize > (size_t)mmbs[sid].size - off ||
+				    !xdl_bpplan_add(plan, XDL_BDOP_CPY,
+				                    mmbs[sid].ptr + off, sid, off,
+				                    csize))
+					goto error;
+			} else if (*data == XDL_BDOP_CPYT) {
+				data++;
+				XDL_LE32_GET(data, off);
+				data += 4;
+				XDL_LE32_GET(data, csize);
+				data += 4;
+
+				if (off >= plan->size ||
+				    !xdl_bpplan_add(plan, XDL_BDOP_CPYT, NULL, 0,
+				                    off, csize))
+					goto error;
+				plan->nself++;
+			} else if (*data == XDL_BDOP_SRC) {
+				data++;
+				sid = *data++;
+				XDL_LE32_GET(data, fp);
+				data += 4;
+				XDL_LE32_GET(data, csize);
+				data += 4;
+
+				if (sid == 0 || sid >= nsrc ||
+				    csize != (size_t)mmbs[sid].size ||
+				    fp != (fps ? fps[sid] :
+				                 xdl_mmb_adler32(&mmbs[sid])))
+					goto error;
+				known[sid] = 1;
+			} else {
+				goto error;
+			}
+		}
+	} while ((blk = (char const *)xdl_mmfile_next(mmfp, &size)) != NULL);
+
+	return plan;
+
+error:
+	xdl_bpatch_plan_free(plan);
+
+	return NULL;
+}
+
+void
+xdl_bpatch_plan_free(xdbpplan_t *plan)
+{
+	if (plan) {
+		xdl_free(plan->ops);
+		xdl_free(plan);
+	}
+}
+
+size_t
+xdl_bpatch_plan_size(xdbpplan_t const *plan)
+{
+	return plan->size;
+}
+
+/*
+ * Offer every copy from a source of at least minsize bytes to cpf, which
+ * returns 0 if it has put the bytes in place itself, 1 to leave them to
+ * xdl_bpatch_plan_run(), or -1 to give up.  It has to be done before the
+ * plan is run, so copies from the target can see what it wrote.
+ */
+int
+xdl_bpatch_plan_copies(xdbpplan_t *plan, size_t minsize,
+                       int (*cpf)(void *, xdbpcopy_t const *), void *priv)
+{
+	int res;
+	long i;
+	xdbpop_t *op;
+	xdbpcopy_t cp;
+
+	for (i = 0; i < plan->nops; i++) {
+		op = &plan->ops[i];
+		if (op->op != XDL_BDOP_CPY || op->size < minsize)
+			continue;
+		cp.sid = op->sid;
+		cp.off = op->off;
+		cp.size = op->size;
+		cp.tpos = op->tpos;
+		if ((res = cpf(priv, &cp)) < 0)
+			return -1;
+		if (res == 0)
+			op->op = 0;
+	}
 
 	return 0;
 }
 
-static uint32_t
-xdl_mmob_adler32(mmoffbuffer_t *obf, int n)
+/*
+ * Write the bytes of the target from start up to end that don't come
+ * from the target itself.  Pieces that don't overlap can be run at the
+ * same time.
+ */
+void
+xdl_bpatch_plan_run(xdbpplan_t const *plan, size_t start, size_t end,
+                    char *out)
 {
-	uint32_t ha;
+	long lo, hi, mid;
+	size_t from, to;
+	xdbpop_t const *op, *top;
 
-	for (ha = 0; n > 0; n--, obf++)
-		ha = xdl_adler32(ha, (unsigned char const *)obf->ptr,
-		                 obf->size);
+	if (start >= end || start >= plan->size) {
+		return;
+	}
+	for (lo = 0, hi = plan->nops - 1; lo < hi;) {
+		mid = (lo + hi + 1) / 2;
+		if (plan->ops[mid].tpos <= start)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	for (op = plan->ops + lo, top = plan->ops + plan->nops;
+	     op < top && op->tpos < end; op++) {
+		if (op->op != XDL_BDOP_INS && op->op != XDL_BDOP_CPY)
+			continue;
+		from = XDL_MAX(start, op->tpos);
+		to = XDL_MIN(end, op->tpos + op->size);
+		if (from < to)
+			memcpy(out + from, op->ptr + (from - op->tpos),
+			       to - from);
+	}
+}
 
-	return ha;
+/*
+ * Once every piece has been run, do the copies from the target, in
+ * order, since they can copy what an earlier one wrote.  Like
+ * xdl_bpout_self(), a copy running into its own output goes in steps.
+ */
+void
+xdl_bpatch_plan_self(xdbpplan_t const *plan, char *out)
+{
+	long i;
+	size_t done, n, dist;
+	xdbpop_t const *op;
+
+	for (i = 0; i < plan->nops && plan->nself; i++) {
+		op = &plan->ops[i];
+		if (op->op != XDL_BDOP_CPYT)
+			continue;
+		dist = op->tpos - op->off;
+		for (done = 0; done < op->size; done += n) {
+			n = XDL_MIN(op->size - done, dist);
+			memcpy(out + op->tpos + done, out + op->off + done, n);
+		}
+	}
 }
 
 static long
@@ -168,13 +652,20 @@ xdl_mmob_find_cntr(mmoffbuffer_t *obf, int n, long off)
 		     : -1;
 }
 
+/*
+ * Merge one more patch onto the pieces in obf.  Only the first patch of a
+ * chain gets its source fingerprint checked, against the base (pfp); the
+ * sources of the later ones are built by the chain itself, so summing
+ * them again at every link costs a pass over each intermediate for
+ * nothing.  Their sizes, which are free, still have to match.
+ */
 static int
-xdl_bmerge(mmoffbuffer_t *obf, int n, mmbuffer_t *mbfp, mmoffbuffer_t **probf,
-           int *pnobf)
+xdl_bmerge(uint32_t const *pfp, mmoffbuffer_t *obf, int n, mmbuffer_t *mbfp,
+           mmoffbuffer_t **probf, int *pnobf)
 {
 	int i, aobf, nobf;
 	long ooff, off, csize;
-	uint32_t fp, ofp;
+	uint32_t fp;
 	unsigned char const *data, *top;
 	mmoffbuffer_t *robf, *cobf;
 
@@ -184,12 +675,11 @@ xdl_bmerge(mmoffbuffer_t *obf, int n, mmbuffer_t *mbfp, mmoffbuffer_t **probf,
 	data = (unsigned char const *)mbfp->ptr;
 	top = data + mbfp->size;
 
-	ofp = xdl_mmob_adler32(obf, n);
 	XDL_LE32_GET(data, fp);
 	data += 4;
 	XDL_LE32_GET(data, csize);
 	data += 4;
-	if (fp != ofp || csize != xdl_mmob_size(obf, n)) {
+	if ((pfp != NULL && fp != *pfp) || csize != xdl_mmob_size(obf, n)) {
 		return -1;
 	}
 	aobf = XDL_MOBF_MINALLOC;
@@ -296,8 +786,10 @@ int
 xdl_bpatch_multi(mmbuffer_t *base, mmbuffer_t *mbpch, int n, xdemitcb_t *ecb)
 {
 	int i, nobf, fnobf;
+	uint32_t fp;
 	mmoffbuffer_t *obf, *fobf;
 
+	fp = xdl_mmb_adler32(base);
 	nobf = 1;
 	if ((obf = (mmoffbuffer_t *)xdl_malloc(nobf * sizeof(mmoffbuffer_t))) ==
 	    NULL) {
@@ -307,7 +799,8 @@ xdl_bpatch_multi(mmbuffer_t *base, mmbuffer_t *mbpch, int n, xdemitcb_t *ecb)
 	obf->ptr = base->ptr;
 	obf->size = base->size;
 	for (i = 0; i < n; i++) {
-		if (xdl_bmerge(obf, nobf, &mbpch[i], &fobf, &fnobf) < 0) {
+		if (xdl_bmerge(i == 0 ? &fp : NULL, obf, nobf, &mbpch[i], &fobf,
+		               &fnobf) < 0) {
 			xdl_free(obf);
 			return -1;
 		}
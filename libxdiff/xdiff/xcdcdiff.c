@@ -0,0 +1,453 @@
+/*
+ *  LibXDiff by Davide Libenzi ( File Differential Library )
+ *  Copyright (C) 2003  Davide Libenzi
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *  Davide Libenzi <davidel@xmailserver.org>
+ *
+ */
+
+/*
+ * Chunk level delta.  The sources and the target are cut into content
+ * defined chunks with xdl_gear_cut(), so that an edit only moves the
+ * boundaries near it, and every source chunk goes into a table under a
+ * 128 bit MurmurHash3 of its contents.  Target chunks that are in the
+ * table become copies, and each run of target chunks that isn't gets
+ * handed to xdl_rabdiff_span() along with the stretch of source between
+ * the copies on either side of it.  The table only has an entry per
+ * chunk, so it stays small however big the inputs get, and the work is
+ * linear in their size.
+ */
+
+#include "xinclude.h"
+
+#define XCDC_AVGBITS 13
+#define XCDC_MINAVGBITS 6
+#define XCDC_MAXAVGBITS 24
+
+/*
+ * A chunk, in source sid or, for XDL_BDSRC_SELF, the target.  A len of
+ * 0 is an empty slot in the table.
+ */
+typedef struct s_xcdcent {
+	uint64_t h[2];
+	long off, len;
+	int sid;
+} xcdcent_t;
+
+/*
+ * The copy in cpy waits to be emitted until the next one turns out not
+ * to carry straight on from it, and psid and pend say where the last
+ * copy from a source ended, or psid is XDL_BDSRC_SELF if there hasn't
+ * been one yet.  whole is the index over all of the first source, made
+ * the first time a gap has nothing closer to go on.
+ */
+typedef struct s_xcdcctx {
+	mmbuffer_t *srcs;
+	int nsrc;
+	mmbuffer_t *tgt;
+	int avgbits;
+	long minsize, maxsize;
+	rabdiffparam_t rdp;
+	xcdcent_t *ents;
+	long nents, mask;
+	xcdcent_t cpy;
+	int psid;
+	long pend;
+	xrabspan_t *whole;
+	xdemitcb_t *ecb;
+} xcdcctx_t;
+
+static uint64_t
+xcdc_rotl(uint64_t v, int r)
+{
+	return (v << r) | (v >> (64 - r));
+}
+
+static uint64_t
+xcdc_fmix(uint64_t k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+
+	return k;
+}
+
+static uint64_t
+xcdc_get64(unsigned char const *p)
+{
+	return (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 |
+	       (uint64_t)p[3] << 24 | (uint64_t)p[4] << 32 |
+	       (uint64_t)p[5] << 40 | (uint64_t)p[6] << 48 |
+	       (uint64_t)p[7] << 56;
+}
+
+/*
+ * MurmurHash3_x64_128, with a seed of 0.
+ */
+static void
+xcdc_murmur3(unsigned char const *data, long size, uint64_t h[2])
+{
+	uint64_t const c1 = 0x87c37b91114253d5ULL;
+	uint64_t const c2 = 0x4cf5ad432745937fULL;
+	uint64_t h1 = 0, h2 = 0, k1, k2;
+	unsigned char const *tail = data + (size & ~15L);
+	long i;
+
+	for (; data < tail; data += 16) {
+		k1 = xcdc_get64(data);
+		k2 = xcdc_get64(data + 8);
+
+		k1 *= c1;
+		k1 = xcdc_rotl(k1, 31);
+		k1 *= c2;
+		h1 ^= k1;
+		h1 = xcdc_rotl(h1, 27);
+		h1 += h2;
+		h1 = h1 * 5 + 0x52dce729;
+
+		k2 *= c2;
+		k2 = xcdc_rotl(k2, 33);
+		k2 *= c1;
+		h2 ^= k2;
+		h2 = xcdc_rotl(h2, 31);
+		h2 += h1;
+		h2 = h2 * 5 + 0x38495ab5;
+	}
+
+	if ((size & 15) > 8) {
+		for (k2 = 0, i = size & 15; i > 8; i--)
+			k2 ^= (uint64_t)tail[i - 1] << ((i - 9) * 8);
+		k2 *= c2;
+		k2 = xcdc_rotl(k2, 33);
+		k2 *= c1;
+		h2 ^= k2;
+	}
+	if (size & 15) {
+		for (k1 = 0, i = XDL_MIN(size & 15, 8); i > 0; i--)
+			k1 ^= (uint64_t)tail[i - 1] << ((i - 1) * 8);
+		k1 *= c1;
+		k1 = xcdc_rotl(k1, 31);
+		k1 *= c2;
+		h1 ^= k1;
+	}
+
+	h1 ^= (uint64_t)size;
+	h2 ^= (uint64_t)size;
+	h1 += h2;
+	h2 += h1;
+	h1 = xcdc_fmix(h1);
+	h2 = xcdc_fmix(h2);
+	h1 += h2;
+	h2 += h1;
+
+	h[0] = h1;
+	h[1] = h2;
+}
+
+static char const *
+xcdc_ptr(xcdcctx_t const *ctx, xcdcent_t const *ent)
+{
+	return (ent->sid == XDL_BDSRC_SELF ? ctx->tgt->ptr :
+	        ctx->srcs[ent->sid].ptr) + ent->off;
+}
+
+static long
+xcdc_cut(xcdcctx_t const *ctx, char const *data, long size)
+{
+	return xdl_gear_cut((unsigned char const *)data, size, ctx->minsize,
+	                    ctx->avgbits, ctx->maxsize);
+}
+
+/*
+ * Double the table once it's half full.
+ */
+static int
+xcdc_grow(xcdcctx_t *ctx)
+{
+	long i, j, size = 2 * (ctx->mask + 1);
+	xcdcent_t *ents;
+
+	if ((ents = (xcdcent_t *)xdl_cmalloc(size * sizeof(xcdcent_t),
+	                                     XDL_ALLOC_HASH)) == NULL)
+		return -1;
+	memset(ents, 0, size * sizeof(xcdcent_t));
+	for (i = 0; i <= ctx->mask; i++) {
+		if (ctx->ents[i].len == 0)
+			continue;
+		for (j = ctx->ents[i].h[0] & (size - 1); ents[j].len;
+		     j = (j + 1) & (size - 1))
+			;
+		ents[j] = ctx->ents[i];
+	}
+	xdl_free(ctx->ents);
+	ctx->ents = ents;
+	ctx->mask = size - 1;
+
+	return 0;
+}
+
+/*
+ * The chunk in ent, if the table already has it; the hash is only taken
+ * as a hint, and it has to match byte for byte too.
+ */
+static xcdcent_t const *
+xcdc_find(xcdcctx_t const *ctx, xcdcent_t const *ent)
+{
+	long i;
+	xcdcent_t const *cur;
+
+	for (i = ent->h[0] & ctx->mask; (cur = ctx->ents + i)->len;
+	     i = (i + 1) & ctx->mask)
+		if (cur->h[0] == ent->h[0] && cur->h[1] == ent->h[1] &&
+		    cur->len == ent->len &&
+		    memcmp(xcdc_ptr(ctx, cur), xcdc_ptr(ctx, ent), ent->len) == 0)
+			return cur;
+
+	return NULL;
+}
+
+/*
+ * The first of any number of the same chunk is the one that stays.
+ */
+static int
+xcdc_add(xcdcctx_t *ctx, xcdcent_t const *ent)
+{
+	long i;
+
+	if (2 * (ctx->nents + 1) > ctx->mask + 1 && xcdc_grow(ctx) < 0)
+		return -1;
+	for (i = ent->h[0] & ctx->mask; ctx->ents[i].len;
+	     i = (i + 1) & ctx->mask)
+		if (ctx->ents[i].h[0] == ent->h[0] &&
+		    ctx->ents[i].h[1] == ent->h[1] &&
+		    ctx->ents[i].len == ent->len)
+			return 0;
+	ctx->ents[i] = *ent;
+	ctx->nents++;
+
+	return 0;
+}
+
+/*
+ * The source's adler32 for the header is summed up a chunk at a time
+ * along with the chunks' hashes, while they're still in the cache.
+ */
+static int
+xcdc_index_src(xcdcctx_t *ctx, int sid, uint32_t *adler)
+{
+	long size = ctx->srcs[sid].size;
+	char const *data = ctx->srcs[sid].ptr;
+	uint32_t ha = 0;
+	xcdcent_t ent;
+
+	ent.sid = sid;
+	for (ent.off = 0; ent.off < size; ent.off += ent.len) {
+		ent.len = xcdc_cut(ctx, data + ent.off, size - ent.off);
+		xcdc_murmur3((unsigned char const *)data + ent.off, ent.len,
+		             ent.h);
+		ha = xdl_adler32(ha, (unsigned char const *)data + ent.off,
+		                 ent.len);
+		if (xcdc_add(ctx, &ent) < 0)
+			return -1;
+	}
+	*adler = ha;
+
+	return 0;
+}
+
+static int
+xcdc_flush_cpy(xcdcctx_t *ctx)
+{
+	if (ctx->cpy.len == 0)
+		return 0;
+	if (xdl_emit_bdcpy(ctx->cpy.sid, ctx->cpy.off, ctx->cpy.len,
+	                   ctx->ecb) < 0)
+		return -1;
+	ctx->cpy.len = 0;
+
+	return 0;
+}
+
+static int
+xcdc_copy(xcdcctx_t *ctx, xcdcent_t const *ent)
+{
+	if (ctx->cpy.len && ctx->cpy.sid == ent->sid &&
+	    ctx->cpy.off + ctx->cpy.len == ent->off) {
+		ctx->cpy.len += ent->len;
+	} else {
+		if (xcdc_flush_cpy(ctx) < 0)
+			return -1;
+		ctx->cpy = *ent;
+	}
+	if (ent->sid != XDL_BDSRC_SELF) {
+		ctx->psid = ent->sid;
+		ctx->pend = ent->off + ent->len;
+	}
+
+	return 0;
+}
+
+/*
+ * Diff the target from start to end, none of which matched a chunk, and
+ * which comes before the chunk next (if there is one).  It gets diffed
+ * against the source after the last copy and the source before next,
+ * which are the same thing when next carries on from the last copy;
+ * neither is ever much more than twice the size of the gap.
+ * With no copies on either side there's nothing to go on, so it gets
+ * all of the first source.  That keeps happening for as long as the
+ * target only copies from itself, so the index over it is only made
+ * once.
+ */
+static int
+xcdc_diff_gap(xcdcctx_t *ctx, long start, long end, xcdcent_t const *next)
+{
+	int s, n = 0, sids[2];
+	long offs[2], cap = 2 * (end - start) + ctx->maxsize;
+	mmbuffer_t smbs[2], tmb;
+
+	if (xcdc_flush_cpy(ctx) < 0)
+		return -1;
+	if (next && next->sid == XDL_BDSRC_SELF)
+		next = NULL;
+	if (ctx->psid != XDL_BDSRC_SELF) {
+		sids[n] = ctx->psid;
+		offs[n] = ctx->pend;
+		smbs[n].size = XDL_MIN((long)ctx->srcs[ctx->psid].size - ctx->pend,
+		                       cap);
+		if (next && next->sid == ctx->psid && next->off >= ctx->pend &&
+		    next->off - ctx->pend <= cap) {
+			smbs[n].size = next->off - ctx->pend;
+			next = NULL;
+		}
+		n++;
+	}
+	if (next) {
+		sids[n] = next->sid;
+		offs[n] = XDL_MAX(next->off - cap, 0);
+		smbs[n].size = next->off - offs[n];
+		n++;
+	}
+	tmb.ptr = ctx->tgt->ptr + start;
+	tmb.size = end - start;
+	if (n == 0) {
+		sids[0] = 0;
+		offs[0] = 0;
+		if (ctx->whole == NULL &&
+		    (ctx->whole = xdl_rabdiff_span_init(ctx->srcs, 1, sids, offs,
+		                                        &ctx->rdp)) == NULL)
+			return -1;
+
+		return xdl_rabdiff_span_run(ctx->whole, &tmb, ctx->ecb);
+	}
+	for (s = 0; s < n; s++)
+		smbs[s].ptr = ctx->srcs[sids[s]].ptr + offs[s];
+
+	return xdl_rabdiff_span(smbs, n, sids, offs, &tmb, &ctx->rdp, ctx->ecb);
+}
+
+static int
+xcdc_diff(xcdcctx_t *ctx, int selfref)
+{
+	long size = ctx->tgt->size, gap = -1;
+	char const *data = ctx->tgt->ptr;
+	xcdcent_t ent;
+	xcdcent_t const *cur;
+
+	ent.sid = XDL_BDSRC_SELF;
+	for (ent.off = 0; ent.off < size; ent.off += ent.len) {
+		ent.len = xcdc_cut(ctx, data + ent.off, size - ent.off);
+		xcdc_murmur3((unsigned char const *)data + ent.off, ent.len,
+		             ent.h);
+		if ((cur = xcdc_find(ctx, &ent)) != NULL) {
+			if (gap >= 0 && xcdc_diff_gap(ctx, gap, ent.off, cur) < 0)
+				return -1;
+			gap = -1;
+			if (xcdc_copy(ctx, cur) < 0)
+				return -1;
+		} else if (gap < 0) {
+			gap = ent.off;
+		}
+		if (selfref && xcdc_add(ctx, &ent) < 0)
+			return -1;
+	}
+	if (gap >= 0 && xcdc_diff_gap(ctx, gap, size, NULL) < 0)
+		return -1;
+
+	return xcdc_flush_cpy(ctx);
+}
+
+int
+xdl_cdcdiff_mbvp(mmbuffer_t *mmbs, int nsrc, mmbuffer_t *mmb2,
+                 cdcdiffparam_t const *cdp, xdemitcb_t *ecb)
+{
+	int s;
+	long size;
+	xcdcctx_t ctx;
+	uint32_t fps[XDL_BDIFF_MAXSRC];
+
+	if (nsrc < 1 || nsrc > XDL_BDIFF_MAXSRC)
+		return -1;
+	ctx.avgbits = cdp->avgbits ? cdp->avgbits : XCDC_AVGBITS;
+	if (ctx.avgbits < XCDC_MINAVGBITS || ctx.avgbits > XCDC_MAXAVGBITS)
+		return -1;
+	ctx.minsize = 1L << (ctx.avgbits - 2);
+	ctx.maxsize = 1L << (ctx.avgbits + 3);
+	ctx.srcs = mmbs;
+	ctx.nsrc = nsrc;
+	ctx.tgt = mmb2;
+	ctx.rdp = cdp->rdp;
+	ctx.nents = 0;
+	ctx.mask = 255;
+	ctx.cpy.len = 0;
+	ctx.psid = XDL_BDSRC_SELF;
+	ctx.whole = NULL;
+	ctx.ecb = ecb;
+	if ((ctx.ents = (xcdcent_t *)xdl_cmalloc(
+		     (ctx.mask + 1) * sizeof(xcdcent_t), XDL_ALLOC_HASH)) == NULL)
+		return -1;
+	memset(ctx.ents, 0, (ctx.mask + 1) * sizeof(xcdcent_t));
+
+	xdl_phase_begin(XDL_PHASE_INDEX);
+	for (size = 0, s = 0; s < nsrc; s++) {
+		if (xcdc_index_src(&ctx, s, &fps[s]) < 0) {
+			xdl_phase_end(XDL_PHASE_INDEX, 0);
+			xdl_free(ctx.ents);
+			return -1;
+		}
+		size += mmbs[s].size;
+	}
+	xdl_phase_end(XDL_PHASE_INDEX, size);
+
+	xdl_phase_begin(XDL_PHASE_SCAN);
+	if (xdl_emit_bdhdr(mmbs, nsrc, fps, ecb) < 0 ||
+	    xcdc_diff(&ctx, (cdp->rdp.flags & XDL_BDF_SELFREF) != 0) < 0) {
+		xdl_phase_end(XDL_PHASE_SCAN, 0);
+		if (ctx.whole)
+			xdl_rabdiff_span_free(ctx.whole);
+		xdl_free(ctx.ents);
+		return -1;
+	}
+	if (ctx.whole)
+		xdl_rabdiff_span_free(ctx.whole);
+	xdl_free(ctx.ents);
+	xdl_phase_end(XDL_PHASE_SCAN, mmb2->size);
+
+	return 0;
+}
@@ -23,6 +23,10 @@
 #if !defined(XDIFF_H)
 #define XDIFF_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif /* #ifdef __cplusplus */
@@ -51,6 +55,29 @@ extern "C" {
 #define XDL_BDOP_INS 1
 #define XDL_BDOP_CPY 2
 #define XDL_BDOP_INSB 3
+#define XDL_BDOP_CPYS 4
+#define XDL_BDOP_SRC 5
+#define XDL_BDOP_CPYT 6
+#define XDL_BDOP_SEEK 7
+
+#define XDL_BDF_SELFREF (1 << 0)
+#define XDL_BDF_GEAR (1 << 1)
+
+#define XDL_BDIFF_MAXSRC 256
+
+#define XDL_BCJ_NONE 0
+#define XDL_BCJ_X86 1
+#define XDL_BCJ_ARM64 2
+
+#define XDL_PHASE_INDEX 1
+#define XDL_PHASE_SCAN 2
+
+#define XDL_ALLOC_OTHER 0
+#define XDL_ALLOC_CHASTORE 1
+#define XDL_ALLOC_HASH 2
+#define XDL_ALLOC_ARENA 3
+#define XDL_ALLOC_MMBLOCK 4
+#define XDL_ALLOC_MAX 5
 
 LIBXDIFF_EXPORT typedef struct s_memallocator {
 	void *priv;
@@ -59,6 +86,12 @@ LIBXDIFF_EXPORT typedef struct s_memallocator {
 	void *(*realloc)(void *, void *, size_t);
 } memallocator_t;
 
+LIBXDIFF_EXPORT typedef struct s_phasehook {
+	void *priv;
+	void (*begin)(void *, int);
+	void (*end)(void *, int, size_t);
+} phasehook_t;
+
 LIBXDIFF_EXPORT typedef struct s_mmblock {
 	struct s_mmblock *next;
 	uint32_t flags;
@@ -66,11 +99,22 @@ LIBXDIFF_EXPORT typedef struct s_mmblock {
 	char *ptr;
 } mmblock_t;
 
+LIBXDIFF_EXPORT typedef struct s_mmbindex {
+	size_t off;
+	mmblock_t *blk;
+} mmbindex_t;
+
+/*
+ * bidx has every block, in order, with where it starts in the file, so
+ * that seeking is a binary search; ridx is rcur's place in it.
+ */
 LIBXDIFF_EXPORT typedef struct s_mmfile {
 	uint32_t flags;
 	mmblock_t *head, *tail;
 	size_t bsize, fsize, rpos;
 	mmblock_t *rcur, *wcur;
+	mmbindex_t *bidx;
+	long nblks, ablks, ridx;
 } mmfile_t;
 
 LIBXDIFF_EXPORT typedef struct s_mmbuffer {
@@ -93,10 +137,74 @@ LIBXDIFF_EXPORT typedef struct s_xdemitconf {
 
 LIBXDIFF_EXPORT typedef struct s_bdiffparam {
 	size_t bsize;
+	uint32_t flags;
 } bdiffparam_t;
 
+/*
+ * A wndsize of 0 is the default window of 20 bytes; otherwise it has to
+ * be 16, 20, 32, 64 or 128.  A poly of 0 is the default polynomial.
+ * With XDL_BDF_GEAR in flags, windows are hashed with a gear hash rather
+ * than a polynomial; the window is then 32 bytes by default, or 16 or
+ * 64, and poly has to be 0.
+ */
+LIBXDIFF_EXPORT typedef struct s_rabdiffparam {
+	uint32_t flags;
+	long wndsize;
+	uint64_t poly;
+} rabdiffparam_t;
+
+/*
+ * The chunks are 2^avgbits bytes on average, between a quarter of that
+ * and eight times it; an avgbits of 0 is 8KB chunks.  What's left over
+ * once the chunks are matched up gets diffed with rdp.
+ */
+LIBXDIFF_EXPORT typedef struct s_cdcdiffparam {
+	int avgbits;
+	rabdiffparam_t rdp;
+} cdcdiffparam_t;
+
+LIBXDIFF_EXPORT typedef struct s_xdvcdenc xdvcdenc_t;
+
+LIBXDIFF_EXPORT typedef struct s_xdbpplan xdbpplan_t;
+
+/*
+ * A copy of size bytes from off in source sid to tpos in the target.
+ */
+LIBXDIFF_EXPORT typedef struct s_xdbpcopy {
+	int sid;
+	size_t off, size, tpos;
+} xdbpcopy_t;
+
+/*
+ * The file xdl_bpatch_inplace() rewrites, size bytes long.  readf and
+ * writef move size bytes at off, and sizef makes the file size bytes
+ * long.  markf is called before each step, once what it's going to
+ * write has been worked out: by the time it returns, everything up to
+ * step has to be on disk, and so does step itself, along with the size
+ * bytes at save if save isn't NULL, which are what the step would need
+ * to be done again but is about to write over.  The last call has the
+ * number of steps there are, and only the file's size is left to fix.
+ */
+LIBXDIFF_EXPORT typedef struct s_xdipfile {
+	void *priv;
+	size_t size;
+	int (*readf)(void *priv, size_t off, char *buf, size_t size);
+	int (*writef)(void *priv, size_t off, char const *buf, size_t size);
+	int (*sizef)(void *priv, size_t size);
+	int (*markf)(void *priv, long step, char const *save, size_t size);
+} xdipfile_t;
+
+LIBXDIFF_EXPORT typedef struct s_xdstparam {
+	long maxdepth;
+	bdiffparam_t bdp;
+} xdstparam_t;
+
+LIBXDIFF_EXPORT typedef struct s_xdstore xdstore_t;
+
 LIBXDIFF_EXPORT int xdl_set_allocator(memallocator_t const *malt);
 LIBXDIFF_EXPORT void *xdl_malloc(size_t size);
+LIBXDIFF_EXPORT int xdl_alloc_class(void);
+LIBXDIFF_EXPORT int xdl_set_phase_hook(phasehook_t const *hook);
 LIBXDIFF_EXPORT void xdl_free(void *ptr);
 LIBXDIFF_EXPORT void *xdl_realloc(void *ptr, size_t size);
 
@@ -134,14 +242,77 @@ LIBXDIFF_EXPORT int xdl_bdiff_mb(mmbuffer_t *mmb1, mmbuffer_t *mmb2,
                                  const bdiffparam_t *bdp, xdemitcb_t *ecb);
 LIBXDIFF_EXPORT int xdl_bdiff(mmfile_t *mmf1, mmfile_t *mmf2,
                               const bdiffparam_t *bdp, xdemitcb_t *ecb);
+LIBXDIFF_EXPORT int xdl_bdiff_mbv(mmbuffer_t *mmbs, int nsrc, mmbuffer_t *mmb2,
+                                  const bdiffparam_t *bdp, xdemitcb_t *ecb);
 LIBXDIFF_EXPORT int xdl_rabdiff_mb(mmbuffer_t *mmb1, mmbuffer_t *mmb2,
                                    xdemitcb_t *ecb);
+LIBXDIFF_EXPORT int xdl_rabdiff_mbv(mmbuffer_t *mmbs, int nsrc,
+                                    mmbuffer_t *mmb2, uint32_t flags,
+                                    xdemitcb_t *ecb);
+LIBXDIFF_EXPORT int xdl_rabdiff_mbvp(mmbuffer_t *mmbs, int nsrc,
+                                     mmbuffer_t *mmb2,
+                                     rabdiffparam_t const *rdp,
+                                     xdemitcb_t *ecb);
+LIBXDIFF_EXPORT int xdl_rabin_polycheck(uint64_t poly);
+LIBXDIFF_EXPORT int xdl_rabin_polygen(uint64_t seed, uint64_t *poly);
 LIBXDIFF_EXPORT int xdl_rabdiff(mmfile_t *mmf1, mmfile_t *mmf2,
                                 xdemitcb_t *ecb);
+LIBXDIFF_EXPORT int xdl_cdcdiff_mbvp(mmbuffer_t *mmbs, int nsrc,
+                                     mmbuffer_t *mmb2,
+                                     cdcdiffparam_t const *cdp,
+                                     xdemitcb_t *ecb);
+LIBXDIFF_EXPORT uint32_t xdl_mmb_adler32(mmbuffer_t *mmb);
+LIBXDIFF_EXPORT uint32_t xdl_adler32_combine(uint32_t adler1, uint32_t adler2,
+                                             size_t len2);
 LIBXDIFF_EXPORT size_t xdl_bdiff_tgsize(mmfile_t *mmfp);
 LIBXDIFF_EXPORT int xdl_bpatch(mmfile_t *mmf, mmfile_t *mmfp, xdemitcb_t *ecb);
+LIBXDIFF_EXPORT int xdl_bpatch_refs(mmbuffer_t *mmbs, int nsrc, mmfile_t *mmfp,
+                                    xdemitcb_t *ecb);
+LIBXDIFF_EXPORT xdbpplan_t *xdl_bpatch_plan(mmbuffer_t *mmbs, int nsrc,
+                                            mmfile_t *mmfp,
+                                            uint32_t const *fps);
+LIBXDIFF_EXPORT void xdl_bpatch_plan_free(xdbpplan_t *plan);
+LIBXDIFF_EXPORT size_t xdl_bpatch_plan_size(xdbpplan_t const *plan);
+LIBXDIFF_EXPORT int xdl_bpatch_plan_copies(xdbpplan_t *plan, size_t minsize,
+                                           int (*cpf)(void *,
+                                                      xdbpcopy_t const *),
+                                           void *priv);
+LIBXDIFF_EXPORT void xdl_bpatch_plan_run(xdbpplan_t const *plan, size_t start,
+                                         size_t end, char *out);
+LIBXDIFF_EXPORT void xdl_bpatch_plan_self(xdbpplan_t const *plan, char *out);
 LIBXDIFF_EXPORT int xdl_bpatch_multi(mmbuffer_t *base, mmbuffer_t *mbpch, int n,
                                      xdemitcb_t *ecb);
+LIBXDIFF_EXPORT int xdl_bdiff_inplace(mmbuffer_t *mmb1, mmfile_t *mmfp,
+                                      xdemitcb_t *ecb);
+LIBXDIFF_EXPORT int xdl_bpatch_inplace(mmfile_t *mmfp, xdipfile_t *ipf,
+                                       size_t ssize, long step,
+                                       char const *save, size_t nsave);
+
+LIBXDIFF_EXPORT xdvcdenc_t *xdl_vcdiff_enc_init(xdemitcb_t *ecb);
+LIBXDIFF_EXPORT int xdl_vcdiff_enc_outf(void *priv, mmbuffer_t *mb,
+                                        size_t nbuf);
+LIBXDIFF_EXPORT int xdl_vcdiff_enc_end(xdvcdenc_t *enc);
+LIBXDIFF_EXPORT void xdl_vcdiff_enc_free(xdvcdenc_t *enc);
+LIBXDIFF_EXPORT int xdl_vcdiff_encode(mmfile_t *mmfp, xdemitcb_t *ecb);
+LIBXDIFF_EXPORT int xdl_vcdiff_patch(mmbuffer_t *src, mmfile_t *mmfp,
+                                     xdemitcb_t *ecb);
+
+LIBXDIFF_EXPORT xdstore_t *xdl_store_init(xdstparam_t const *xsp);
+LIBXDIFF_EXPORT xdstore_t *xdl_store_load(mmbuffer_t *mb,
+                                          xdstparam_t const *xsp);
+LIBXDIFF_EXPORT void xdl_store_free(xdstore_t *st);
+LIBXDIFF_EXPORT long xdl_store_add(xdstore_t *st, mmbuffer_t *mb);
+LIBXDIFF_EXPORT int xdl_store_get(xdstore_t *st, long ver, xdemitcb_t *ecb);
+LIBXDIFF_EXPORT long xdl_store_count(xdstore_t *st);
+LIBXDIFF_EXPORT long xdl_store_size(xdstore_t *st, long ver);
+LIBXDIFF_EXPORT long xdl_store_depth(xdstore_t *st, long ver);
+LIBXDIFF_EXPORT int xdl_store_write(xdstore_t *st, xdemitcb_t *ecb);
+
+LIBXDIFF_EXPORT int xdl_bcj_detect(char const *buf, size_t size);
+LIBXDIFF_EXPORT int xdl_bcj_encode(int arch, char const *src, size_t size,
+                                   char *dst);
+LIBXDIFF_EXPORT int xdl_bcj_decode(int arch, char const *src, size_t size,
+                                   char *dst);
 
 #ifdef __cplusplus
 }
@@ -70,8 +70,8 @@ xdl_emit_diff(xdfenv_t *xe, xdchange_t *xscr, xdemitcb_t *ecb,
 	for (xch = xche = xscr; xch; xch = xche->next) {
 		xche = xdl_get_hunk(xch, xecfg);
 
-		s1 = XDL_MAX(xch->i1 - xecfg->ctxlen, 0);
-		s2 = XDL_MAX(xch->i2 - xecfg->ctxlen, 0);
+		s1 = xch->i1 > xecfg->ctxlen ? xch->i1 - xecfg->ctxlen : 0;
+		s2 = xch->i2 > xecfg->ctxlen ? xch->i2 - xecfg->ctxlen : 0;
 
 		lctx = xecfg->ctxlen;
 		lctx = XDL_MIN(lctx, xe->xdf1.nrec - (xche->i1 + xche->chg1));
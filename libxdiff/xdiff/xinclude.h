@@ -83,5 +83,6 @@ typedef unsigned long uint64_t;
 #include "xdiffi.h"
 #include "xemit.h"
 #include "xbdiff.h"
+#include "xrabdiff.h"
 
 #endif /* #if !defined(XINCLUDE_H) */
@@ -31,6 +31,13 @@
 #define XDL_MASKBITS(b) ((1UL << (b)) - 1)
 #define XDL_HASHLONG(v, b) \
 	(XDL_ADDBITS((unsigned long)(v), b) & XDL_MASKBITS(b))
+#if defined(__GNUC__)
+#define XDL_PREFETCH(p) __builtin_prefetch(p)
+#define XDL_THREAD __thread
+#else
+#define XDL_PREFETCH(p) ((void)(p))
+#define XDL_THREAD __declspec(thread)
+#endif
 #define XDL_PTRFREE(p)               \
 	do {                         \
 		if (p) {             \
@@ -72,7 +72,7 @@ static int xdl_hunk_match(recfile_t *rf, size_t irec, patch_t *pch, int mode,
 static int xdl_find_hunk(recfile_t *rf, size_t ibase, patch_t *pch, int mode,
                          size_t fuzz, size_t *hkpos, int *exact);
 static int xdl_emit_rfile_line(recfile_t *rf, size_t line, xdemitcb_t *ecb);
-static int xdl_flush_section(recfile_t *rf, size_t start, size_t top,
+static int xdl_flush_section(recfile_t *rf, size_t start, ssize_t top,
                              xdemitcb_t *ecb);
 static int xdl_apply_hunk(recfile_t *rf, size_t hkpos, patch_t *pch, int mode,
                           size_t *ibase, xdemitcb_t *ecb);
@@ -421,7 +421,7 @@ xdl_find_hunk(recfile_t *rf, size_t ibase, patch_t *pch, int mode, size_t fuzz,
 		 * number of prefix context lines.
 		 */
 		j = 0;
-		if (hpos - i >= ibase - pch->hi.pctx)
+		if ((ssize_t)(hpos - i) >= (ssize_t)(ibase - pch->hi.pctx))
 			pos[j++] = hpos - i;
 		if (hpos + i + hlen <= rf->nrec)
 			pos[j++] = hpos + i;
@@ -452,9 +452,9 @@ xdl_emit_rfile_line(recfile_t *rf, size_t line, xdemitcb_t *ecb)
 }
 
 static int
-xdl_flush_section(recfile_t *rf, size_t start, size_t top, xdemitcb_t *ecb)
+xdl_flush_section(recfile_t *rf, size_t start, ssize_t top, xdemitcb_t *ecb)
 {
-	size_t i;
+	ssize_t i;
 
 	for (i = start; i <= top; i++) {
 		if (xdl_emit_rfile_line(rf, i, ecb) < 0) {
@@ -482,7 +482,7 @@ xdl_apply_hunk(recfile_t *rf, size_t hkpos, patch_t *pch, int mode,
 	 * to zero.
 	 */
 	hkpos += pch->hi.pctx;
-	if (xdl_flush_section(rf, *ibase, hkpos - 1, ecb) < 0) {
+	if (xdl_flush_section(rf, *ibase, (ssize_t)hkpos - 1, ecb) < 0) {
 		return -1;
 	}
 	*ibase = hkpos;
@@ -624,7 +624,7 @@ xdl_patch(mmfile_t *mf, mmfile_t *mfp, int mode, xdemitcb_t *ecb,
 		xdl_free_recfile(&rff);
 		return -1;
 	}
-	if (xdl_flush_section(&rff, ibase, rff.nrec - 1, ecb) < 0) {
+	if (xdl_flush_section(&rff, ibase, (ssize_t)rff.nrec - 1, ecb) < 0) {
 		xdl_free_patch(&pch);
 		xdl_free_recfile(&rff);
 		return -1;
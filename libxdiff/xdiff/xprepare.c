@@ -26,23 +26,7 @@
 #define XDL_MAX_EQLIMIT 1024
 #define XDL_SIMSCAN_WINDOWN 100
 
-typedef struct s_xdlclass {
-	struct s_xdlclass *next;
-	unsigned long ha;
-	char const *line;
-	size_t size;
-	size_t idx;
-} xdlclass_t;
-
-typedef struct s_xdlclassifier {
-	unsigned int hbits;
-	size_t hsize;
-	xdlclass_t **rchash;
-	chastore_t ncha;
-	size_t count;
-} xdlclassifier_t;
-
-static int
+int
 xdl_init_classifier(xdlclassifier_t *cf, size_t size)
 {
 	size_t i;
@@ -53,8 +37,8 @@ xdl_init_classifier(xdlclassifier_t *cf, size_t size)
 	if (xdl_cha_init(&cf->ncha, sizeof(xdlclass_t), size / 4 + 1) < 0) {
 		return -1;
 	}
-	if (!(cf->rchash = (xdlclass_t **)xdl_malloc(cf->hsize *
-	                                             sizeof(xdlclass_t *)))) {
+	if (!(cf->rchash = (xdlclass_t **)xdl_cmalloc(
+		      cf->hsize * sizeof(xdlclass_t *), XDL_ALLOC_HASH))) {
 		xdl_cha_free(&cf->ncha);
 		return -1;
 	}
@@ -66,14 +50,14 @@ xdl_init_classifier(xdlclassifier_t *cf, size_t size)
 	return 0;
 }
 
-static void
+void
 xdl_free_classifier(xdlclassifier_t *cf)
 {
 	xdl_free(cf->rchash);
 	xdl_cha_free(&cf->ncha);
 }
 
-static int
+int
 xdl_classify_record(xdlclassifier_t *cf, xrecord_t **rhash, unsigned int hbits,
                     xrecord_t *rec)
 {
@@ -134,7 +118,8 @@ xdl_prepare_ctx(mmfile_t *mf, size_t narec, xpparam_t const *xpp,
 
 	hbits = xdl_hashbits((unsigned int)narec);
 	hsize = 1 << hbits;
-	if (!(rhash = (xrecord_t **)xdl_malloc(hsize * sizeof(xrecord_t *)))) {
+	if (!(rhash = (xrecord_t **)xdl_cmalloc(hsize * sizeof(xrecord_t *),
+	                                        XDL_ALLOC_HASH))) {
 		xdl_free(recs);
 		xdl_cha_free(&xdf->rcha);
 		return -1;
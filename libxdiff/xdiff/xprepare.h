@@ -23,6 +23,26 @@
 #if !defined(XPREPARE_H)
 #define XPREPARE_H
 
+typedef struct s_xdlclass {
+	struct s_xdlclass *next;
+	unsigned long ha;
+	char const *line;
+	size_t size;
+	size_t idx;
+} xdlclass_t;
+
+typedef struct s_xdlclassifier {
+	unsigned int hbits;
+	size_t hsize;
+	xdlclass_t **rchash;
+	chastore_t ncha;
+	size_t count;
+} xdlclassifier_t;
+
+int xdl_init_classifier(xdlclassifier_t *cf, size_t size);
+void xdl_free_classifier(xdlclassifier_t *cf);
+int xdl_classify_record(xdlclassifier_t *cf, xrecord_t **rhash,
+                        unsigned int hbits, xrecord_t *rec);
 int xdl_prepare_env(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
                     xdfenv_t *xe);
 void xdl_free_env(xdfenv_t *xe);
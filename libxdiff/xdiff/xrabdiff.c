@@ -31,6 +31,10 @@
 
 #include "xinclude.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #if !defined(XRABPLY_TYPE32) && !defined(XRABPLY_TYPE64)
 #define XRABPLY_TYPE64 long long
 #define XV64(v) ((xply_word)v##ULL)
@@ -38,26 +42,104 @@
 
 #include "xrabply.c"
 
-#define XRAB_SLIDE(v, c)                                   \
-	do {                                               \
-		if (++wpos == XRAB_WNDSIZE)                \
-			wpos = 0;                          \
-		v ^= U[wbuf[wpos]];                        \
-		wbuf[wpos] = (c);                          \
-		v = ((v << 8) | (c)) ^ T[v >> XRAB_SHIFT]; \
-	} while (0)
-
 #define XRAB_MINCPYSIZE 12
 #define XRAB_WBITS (sizeof(xply_word) * 8)
 
+#include "xrabpoly.c"
+#include "xrabgear.c"
+
+/*
+ * The window that XDL_BDF_GEAR uses when it isn't given one.  It has to
+ * divide XRAB_WBITS.
+ */
+#define XRAB_GEARWND 32
+
+/*
+ * How many windows ahead of the one being looked up xrab_diff() hashes,
+ * so the set it needs has been fetched by the time it gets there.  It
+ * has to be a power of two.
+ */
+#define XRAB_AHEAD 16
+
+/*
+ * How far the source's adler32 runs behind the windows xrab_index_src()
+ * is hashing.  It's fed a stretch at a time, while it's still in the
+ * cache from being hashed, so the header doesn't have to read the
+ * sources again.
+ */
+#define XRAB_SUMLAG 4096
+
+/*
+ * Put the byte c in at the bottom of the fingerprint v, and take the one
+ * XRAB_WND bytes back out of it. Both use the tables, and the shift, in
+ * scope where they're used.
+ */
+#define XRAB_PUSH(v, c) ((v) = (((v) << 8) | (c)) ^ T[(v) >> shift])
+#define XRAB_DROP(v, c) ((v) ^= U[c])
+
+/*
+ * The index is a table of sets, each one a cache line that holds up to
+ * XRAB_WAYS32 offsets when everything fits in 32 bits, or XRAB_WAYS64
+ * when it doesn't, and an 8 bit tag for each of them.  A window's
+ * fingerprint picks the set, and the next 8 bits of it are the tag, so
+ * most windows that only share a set get turned away without looking
+ * at the data.  A set keeps its newest offsets first; when it's full,
+ * the oldest one goes.  An offset of 0 is an empty way.
+ */
+#define XRAB_WAYS32 12
+#define XRAB_WAYS64 6
+#define XRAB_LINE 64
+
+typedef struct s_xrabset {
+	unsigned char tags[16];
+	union {
+		uint32_t o32[XRAB_WAYS32];
+		uint64_t o64[XRAB_WAYS64];
+	} offs;
+} xrabset_t;
+
+typedef struct s_xrabkern xrabkern_t;
+
+/*
+ * The index covers every source at once.  Offsets in it are into all the
+ * sources laid end to end, and base[] (nsrc + 1 entries) says where each
+ * one starts.  With XDL_BDF_SELFREF, the target goes on the end, from
+ * base[nsrc] on.  T[], U[] and shift are for the polynomial and window
+ * size in use, and tabs is where T[] and U[] live if they aren't the
+ * ones from xrabply.c.
+ */
 typedef struct s_xrabctx {
-	long idxsize;
-	long *idx;
-	unsigned char const *data;
-	long size;
+	xrabkern_t const *kern;
+	xply_word const *T, *U;
+	xply_word *tabs;
+	int shift;
+	long wnd;
+	void *setmem;
+	xrabset_t *sets;
+	xply_word smask;
+	int sbits;
+	int ways;
+	int wide;
+	mmbuffer_t *srcs;
+	int nsrc;
+	long *base;
+	int selfref;
 } xrabctx_t;
 
+#define XRAB_SET(ctx, fp) ((ctx)->sets + ((fp) & (ctx)->smask))
+#define XRAB_TAG(ctx, fp) ((unsigned char)((fp) >> (ctx)->sbits))
+#define XRAB_GETOFFS(ctx, set, w) \
+	((ctx)->wide ? (long)(set)->offs.o64[w] : (long)(set)->offs.o32[w])
+#define XRAB_SETOFFS(ctx, set, w, v)                  \
+	do {                                          \
+		if ((ctx)->wide)                      \
+			(set)->offs.o64[w] = (v);     \
+		else                                  \
+			(set)->offs.o32[w] = (v);     \
+	} while (0)
+
 typedef struct s_xrabcpyi {
+	int sid;
 	long src;
 	long tgt;
 	long len;
@@ -68,6 +150,18 @@ typedef struct s_xrabcpyi_arena {
 	xrabcpyi_t *acpy;
 } xrabcpyi_arena_t;
 
+/*
+ * The loops that depend on the window size and the hash, from xrabkern.c.
+ */
+struct s_xrabkern {
+	long wnd;
+	int gear;
+	void (*index_src)(unsigned char const *, long, long, xrabctx_t *,
+	                  uint32_t *);
+	int (*diff)(unsigned char const *, long, xrabctx_t *,
+	            xrabcpyi_arena_t *);
+};
+
 static void
 xrab_init_cpyarena(xrabcpyi_arena_t *aca)
 {
@@ -89,8 +183,9 @@ xrab_add_cpy(xrabcpyi_arena_t *aca, xrabcpyi_t const *rcpy)
 
 	if (aca->cnt >= aca->size) {
 		size = 2 * aca->size + 1024;
-		if ((acpy = (xrabcpyi_t *)xdl_realloc(
-			     aca->acpy, size * sizeof(xrabcpyi_t))) == NULL)
+		if ((acpy = (xrabcpyi_t *)xdl_crealloc(
+			     aca->acpy, size * sizeof(xrabcpyi_t),
+			     XDL_ALLOC_ARENA)) == NULL)
 			return -1;
 		aca->acpy = acpy;
 		aca->size = size;
@@ -113,143 +208,332 @@ xrab_cmnseq(unsigned char const *data, long start, long size)
 	return (long)(ptr - (data + start + 1));
 }
 
+/*
+ * Which ways of set have this tag, as a bit mask.  With SSE2 that's one
+ * compare for the whole set.
+ */
+static unsigned int
+xrab_tagmask(xrabset_t const *set, unsigned char tag, int ways)
+{
+#if defined(__SSE2__)
+	__m128i tags = _mm_loadu_si128((__m128i const *)set->tags);
+
+	return (unsigned int)_mm_movemask_epi8(
+		       _mm_cmpeq_epi8(tags, _mm_set1_epi8((char)tag))) &
+	       ((1U << ways) - 1);
+#else
+	int w;
+	unsigned int mask = 0;
+
+	for (w = 0; w < ways; w++)
+		if (set->tags[w] == tag)
+			mask |= 1U << w;
+
+	return mask;
+#endif
+}
+
+/*
+ * Put offs at the front of its set, and let everything else move down
+ * a way.
+ */
+static void
+xrab_insert(xrabctx_t *ctx, xply_word fp, long offs)
+{
+	xrabset_t *set = XRAB_SET(ctx, fp);
+
+	if (ctx->wide) {
+		memmove(set->tags + 1, set->tags, XRAB_WAYS64 - 1);
+		memmove(set->offs.o64 + 1, set->offs.o64,
+		        (XRAB_WAYS64 - 1) * sizeof(uint64_t));
+	} else {
+		memmove(set->tags + 1, set->tags, XRAB_WAYS32 - 1);
+		memmove(set->offs.o32 + 1, set->offs.o32,
+		        (XRAB_WAYS32 - 1) * sizeof(uint32_t));
+	}
+	set->tags[0] = XRAB_TAG(ctx, fp);
+	XRAB_SETOFFS(ctx, set, 0, offs);
+}
+
+/*
+ * Target windows only get a way that's empty or that another target
+ * window has; sources keep theirs.  Among the target's, the oldest one
+ * is the one to go.
+ */
+static void
+xrab_insert_self(xrabctx_t *ctx, xply_word fp, long offs, long tbase)
+{
+	int w, way = -1;
+	long o, oldest = 0;
+	xrabset_t *set = XRAB_SET(ctx, fp);
+
+	for (w = 0; w < ctx->ways; w++) {
+		if ((o = XRAB_GETOFFS(ctx, set, w)) == 0) {
+			way = w;
+			break;
+		}
+		if (o > tbase && (way < 0 || o < oldest)) {
+			way = w;
+			oldest = o;
+		}
+	}
+	if (way < 0)
+		return;
+	set->tags[way] = XRAB_TAG(ctx, fp);
+	XRAB_SETOFFS(ctx, set, way, offs);
+}
+
+/*
+ * Find the source that the (non zero) index offset offs falls in.
+ */
 static int
-xrab_build_ctx(unsigned char const *data, long size, xrabctx_t *ctx)
+xrab_find_src(xrabctx_t const *ctx, long offs)
 {
-	long i, isize, idxsize, seq, wpos = 0;
-	xply_word fp = 0, mask;
-	unsigned char ch;
-	unsigned char const *ptr, *eot;
-	long *idx;
-	unsigned char wbuf[XRAB_WNDSIZE];
-	long maxoffs[256];
-	long maxseq[256];
-	xply_word maxfp[256];
-
-	memset(wbuf, 0, sizeof(wbuf));
-	memset(maxseq, 0, sizeof(maxseq));
-	isize = 2 * (size / XRAB_WNDSIZE);
-	for (idxsize = 1; idxsize < isize; idxsize <<= 1)
-		;
-	mask = (xply_word)(idxsize - 1);
-	if ((idx = (long *)xdl_malloc(idxsize * sizeof(long))) == NULL)
+	int lo = 0, hi = ctx->nsrc - 1, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if (ctx->base[mid] < offs)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	return lo;
+}
+
+static void
+xrab_free_ctx(xrabctx_t *ctx)
+{
+	xdl_free(ctx->setmem);
+	xdl_free(ctx->base);
+	xdl_free(ctx->tabs);
+}
+
+#define XRAB_WND 16
+#include "xrabkern.c"
+#undef XRAB_WND
+#define XRAB_WND 20
+#include "xrabkern.c"
+#undef XRAB_WND
+#define XRAB_WND 32
+#include "xrabkern.c"
+#undef XRAB_WND
+#define XRAB_WND 64
+#include "xrabkern.c"
+#undef XRAB_WND
+#define XRAB_WND 128
+#include "xrabkern.c"
+#undef XRAB_WND
+
+#define XRAB_GEAR
+#define XRAB_WND 16
+#include "xrabkern.c"
+#undef XRAB_WND
+#define XRAB_WND 32
+#include "xrabkern.c"
+#undef XRAB_WND
+#define XRAB_WND 64
+#include "xrabkern.c"
+#undef XRAB_WND
+#undef XRAB_GEAR
+
+static xrabkern_t const xrab_kerns[] = {
+	{ 16, 0, xrab_index_src_16, xrab_diff_16 },
+	{ 20, 0, xrab_index_src_20, xrab_diff_20 },
+	{ 32, 0, xrab_index_src_32, xrab_diff_32 },
+	{ 64, 0, xrab_index_src_64, xrab_diff_64 },
+	{ 128, 0, xrab_index_src_128, xrab_diff_128 },
+	{ 16, 1, xrab_index_src_gear_16, xrab_diff_gear_16 },
+	{ 32, 1, xrab_index_src_gear_32, xrab_diff_gear_32 },
+	{ 64, 1, xrab_index_src_gear_64, xrab_diff_gear_64 },
+};
+
+/*
+ * Pick the kernels and the tables for rdp's hash, window size and
+ * polynomial.  The ones in xrabply.c get used whenever they fit, and
+ * anything else gets tables of its own.  A gear hash has no polynomial,
+ * and its shift is only known once the index has been sized.
+ */
+static int
+xrab_setup_ctx(rabdiffparam_t const *rdp, xrabctx_t *ctx)
+{
+	int k, gear = (rdp->flags & XDL_BDF_GEAR) != 0;
+	long wnd = rdp->wndsize ? rdp->wndsize :
+	           gear ? XRAB_GEARWND : XRAB_WNDSIZE;
+	xply_word poly = rdp->poly ? (xply_word)rdp->poly : XRAB_ROOTPOLY;
+
+	for (k = 0; k < (int)(sizeof(xrab_kerns) / sizeof(xrab_kerns[0])); k++)
+		if (xrab_kerns[k].wnd == wnd && xrab_kerns[k].gear == gear)
+			break;
+	if (k == (int)(sizeof(xrab_kerns) / sizeof(xrab_kerns[0])) ||
+	    (gear && rdp->poly))
+		return -1;
+	ctx->kern = xrab_kerns + k;
+	ctx->wnd = wnd;
+	ctx->tabs = NULL;
+	if (gear) {
+		ctx->T = G;
+		ctx->U = NULL;
+		ctx->shift = 0;
+
+		return 0;
+	}
+	if (wnd == XRAB_WNDSIZE && poly == XRAB_ROOTPOLY) {
+		ctx->T = T;
+		ctx->U = U;
+		ctx->shift = XRAB_SHIFT;
+
+		return 0;
+	}
+	if (poly != XRAB_ROOTPOLY && xdl_rabin_polycheck(rdp->poly) < 0)
+		return -1;
+	if ((ctx->tabs = (xply_word *)xdl_malloc(512 * sizeof(xply_word))) ==
+	    NULL)
+		return -1;
+	ctx->shift = xrab_polytables(poly, wnd, ctx->tabs, ctx->tabs + 256);
+	ctx->T = ctx->tabs;
+	ctx->U = ctx->tabs + 256;
+
+	return 0;
+}
+
+/*
+ * Sources are indexed last to first, so where two of them have the same
+ * window the bucket ends up pointing at the one with the lower id.  If
+ * fps isn't NULL, each source's adler32 goes in it as it's indexed.
+ */
+static int
+xrab_build_ctx(mmbuffer_t *srcs, int nsrc, long xsize,
+               rabdiffparam_t const *rdp, xrabctx_t *ctx, uint32_t *fps)
+{
+	int s, sbits;
+	long nsets, total;
+	long *base;
+	void *setmem;
+
+	if (xrab_setup_ctx(rdp, ctx) < 0)
+		return -1;
+	if ((base = (long *)xdl_malloc((nsrc + 1) * sizeof(long))) == NULL) {
+		xdl_free(ctx->tabs);
 		return -1;
-	memset(idx, 0, idxsize * sizeof(long));
-	for (i = 0; i + XRAB_WNDSIZE < size; i += XRAB_WNDSIZE) {
-		/*
-		 * Generate a brand new hash for the current window. Here we could
-		 * try to perform pseudo-loop unroll by 4 blocks if necessary, and
-		 * if we force XRAB_WNDSIZE to be a multiple of 4, we could reduce
-		 * the branch occurence inside XRAB_SLIDE by a factor of 4.
-		 */
-		for (ptr = data + i, eot = ptr + XRAB_WNDSIZE; ptr < eot; ptr++)
-			XRAB_SLIDE(fp, *ptr);
-
-		/*
-		 * Try to scan for single value scans, and store them in the
-		 * array according to the longest one. Before we do a fast check
-		 * to avoid calling xrab_cmnseq() when not necessary.
-		 */
-		if ((ch = data[i]) == data[i + XRAB_WNDSIZE - 1] &&
-		    (seq = xrab_cmnseq(data, i, size)) > XRAB_WNDSIZE &&
-		    seq > maxseq[ch]) {
-			maxseq[ch] = seq;
-			maxfp[ch] = fp;
-			maxoffs[ch] = i + XRAB_WNDSIZE;
-			seq = (seq / XRAB_WNDSIZE) * XRAB_WNDSIZE;
-			i += seq - XRAB_WNDSIZE;
-		} else
-			idx[fp & mask] = i + XRAB_WNDSIZE;
 	}
+	for (base[0] = 0, s = 0; s < nsrc; s++)
+		base[s + 1] = base[s] + srcs[s].size;
+	total = base[nsrc] + xsize;
+	ctx->wide = total > 0xffffffffL;
+	ctx->ways = ctx->wide ? XRAB_WAYS64 : XRAB_WAYS32;
 
 	/*
-	 * Restore back the logest sequences by overwriting target hash buckets.
+	 * Aim for the sets to be about half full.
 	 */
-	for (i = 0; i < 256; i++)
-		if (maxseq[i])
-			idx[maxfp[i] & mask] = maxoffs[i];
-	ctx->idxsize = idxsize;
-	ctx->idx = idx;
-	ctx->data = data;
-	ctx->size = size;
+	for (nsets = 1, sbits = 0; nsets * ctx->ways < 2 * (total / ctx->wnd);
+	     nsets <<= 1, sbits++)
+		;
+	if ((setmem = xdl_cmalloc(nsets * sizeof(xrabset_t) + XRAB_LINE - 1,
+	                          XDL_ALLOC_HASH)) == NULL) {
+		xdl_free(base);
+		xdl_free(ctx->tabs);
+		return -1;
+	}
+	ctx->setmem = setmem;
+	ctx->sets = (xrabset_t *)(((uintptr_t)setmem + XRAB_LINE - 1) &
+	                          ~(uintptr_t)(XRAB_LINE - 1));
+	memset(ctx->sets, 0, nsets * sizeof(xrabset_t));
+	ctx->smask = (xply_word)(nsets - 1);
+	ctx->sbits = sbits;
+	if (ctx->kern->gear)
+		ctx->shift = XDL_MAX((int)XRAB_WBITS - 8 - sbits, 0);
+	ctx->srcs = srcs;
+	ctx->nsrc = nsrc;
+	ctx->base = base;
+	ctx->selfref = xsize != 0;
+	for (s = nsrc - 1; s >= 0; s--)
+		ctx->kern->index_src((unsigned char const *)srcs[s].ptr,
+		                     srcs[s].size, base[s], ctx,
+		                     fps ? &fps[s] : NULL);
 
 	return 0;
 }
 
-static void
-xrab_free_ctx(xrabctx_t *ctx)
+/*
+ * Roll the fingerprint over every byte of data, the same way xrab_diff()
+ * walks the target with the default window and polynomial, and fold the
+ * results together so none of the work can be skipped.  This is only
+ * here so the rolling hash can be measured on its own.
+ */
+uint64_t
+xdl_rabin_scan(unsigned char const *data, long size)
 {
-	xdl_free(ctx->idx);
+	int shift = XRAB_SHIFT;
+	long i;
+	xply_word fp = 0, acc = 0;
+
+	for (i = 0; i < size && i < XRAB_WNDSIZE; i++) {
+		XRAB_PUSH(fp, data[i]);
+		acc ^= fp;
+	}
+	for (; i < size; i++) {
+		XRAB_DROP(fp, data[i - XRAB_WNDSIZE]);
+		XRAB_PUSH(fp, data[i]);
+		acc ^= fp;
+	}
+
+	return (uint64_t)acc;
 }
 
-static int
-xrab_diff(unsigned char const *data, long size, xrabctx_t *ctx,
-          xrabcpyi_arena_t *aca)
+/*
+ * The same as xdl_rabin_scan(), but with a gear hash over the window
+ * XDL_BDF_GEAR uses by default.
+ */
+uint64_t
+xdl_gear_scan(unsigned char const *data, long size)
 {
-	long i, offs, ssize, src, tgt, esrc, etgt, wpos = 0;
-	xply_word fp = 0, mask;
-	long const *idx;
-	unsigned char const *sdata;
-	xrabcpyi_t rcpy;
-	unsigned char wbuf[XRAB_WNDSIZE];
-
-	xrab_init_cpyarena(aca);
-	memset(wbuf, 0, sizeof(wbuf));
-	for (i = 0; i < XRAB_WNDSIZE - 1 && i < size; i++)
-		XRAB_SLIDE(fp, data[i]);
-	idx = ctx->idx;
-	sdata = ctx->data;
-	ssize = ctx->size;
-	mask = (xply_word)(ctx->idxsize - 1);
-	while (i < size) {
-		unsigned char ch = data[i++];
-
-		XRAB_SLIDE(fp, ch);
-		offs = idx[fp & mask];
-
-		/*
-		 * Fast check here to probabilistically reduce false positives
-		 * that would trigger the slow path below.
-		 */
-		if (offs == 0 || ch != sdata[offs - 1])
-			continue;
+	long i;
+	xply_word h = 0, acc = 0;
 
-		/*
-		 * Stretch the match both sides as far as possible.
-		 */
-		src = offs - 1;
-		tgt = i - 1;
-		for (; tgt > 0 && src > 0 && data[tgt - 1] == sdata[src - 1];
-		     tgt--, src--)
-			;
-		esrc = offs;
-		etgt = i;
-		for (; etgt < size && esrc < ssize && data[etgt] == sdata[esrc];
-		     etgt++, esrc++)
-			;
-
-		/*
-		 * Avoid considering copies smaller than the XRAB_MINCPYSIZE
-		 * threshold.
-		 */
-		if (etgt - tgt >= XRAB_MINCPYSIZE) {
-			rcpy.src = src;
-			rcpy.tgt = tgt;
-			rcpy.len = etgt - tgt;
-			if (xrab_add_cpy(aca, &rcpy) < 0) {
-				xrab_free_cpyarena(aca);
-				return -1;
-			}
+	for (i = 0; i < size; i++) {
+		h = (h << (XRAB_WBITS / XRAB_GEARWND)) + G[data[i]];
+		acc ^= h;
+	}
 
-			/*
-			 * Fill up the new window and exit with 'i' properly set on exit.
-			 */
-			for (i = etgt - XRAB_WNDSIZE; i < etgt; i++)
-				XRAB_SLIDE(fp, data[i]);
-		}
+	return (uint64_t)acc;
+}
+
+/*
+ * Where the content defined chunk at the start of data ends, FastCDC
+ * style: no cut before minsize bytes, a hash that has to have its top
+ * avgbits + 2 bits clear up to 2^avgbits bytes in, and only avgbits - 2
+ * of them after that, so that chunk sizes bunch up around 2^avgbits,
+ * and a forced cut at maxsize.  The hash is the gear hash with a one bit
+ * shift, so its top bit covers the last XRAB_WBITS bytes.
+ */
+long
+xdl_gear_cut(unsigned char const *data, long size, long minsize, int avgbits,
+             long maxsize)
+{
+	long i, normal;
+	xply_word h = 0;
+	xply_word masks = ~(xply_word)0 << (XRAB_WBITS - (avgbits + 2));
+	xply_word maskl = ~(xply_word)0 << (XRAB_WBITS - (avgbits - 2));
+
+	if (size <= minsize)
+		return size;
+	if (size > maxsize)
+		size = maxsize;
+	normal = XDL_MIN(1L << avgbits, size);
+	for (i = minsize; i < normal; i++) {
+		h = (h << 1) + G[data[i]];
+		if (!(h & masks))
+			return i + 1;
+	}
+	for (; i < size; i++) {
+		h = (h << 1) + G[data[i]];
+		if (!(h & maskl))
+			return i + 1;
 	}
 
-	return 0;
+	return size;
 }
 
 static int
@@ -275,23 +559,60 @@ xrab_tune_cpyarena(unsigned char const *data, long size, xrabctx_t *ctx,
 	return 0;
 }
 
+/*
+ * Emit the target as inserts around the copies left in aca once it's
+ * been tuned.
+ */
+static int
+xrab_emit_ops(xrabcpyi_arena_t const *aca, mmbuffer_t *mmb2, xdemitcb_t *ecb)
+{
+	long i, cpos;
+	xrabcpyi_t const *rcpy;
+
+	for (cpos = 0, i = 0; i < aca->cnt; i++) {
+		rcpy = aca->acpy + i;
+		if (rcpy->len == 0)
+			continue;
+		if (cpos < rcpy->tgt) {
+			if (xdl_emit_bdins(mmb2->ptr + cpos, rcpy->tgt - cpos,
+			                   ecb) < 0)
+				return -1;
+			cpos = rcpy->tgt;
+		}
+		if (xdl_emit_bdcpy(rcpy->sid, rcpy->src, rcpy->len, ecb) < 0)
+			return -1;
+		cpos += rcpy->len;
+	}
+	if (cpos < (long)mmb2->size &&
+	    xdl_emit_bdins(mmb2->ptr + cpos, mmb2->size - cpos, ecb) < 0)
+		return -1;
+
+	return 0;
+}
+
 int
-xdl_rabdiff_mb(mmbuffer_t *mmb1, mmbuffer_t *mmb2, xdemitcb_t *ecb)
+xdl_rabdiff_mbvp(mmbuffer_t *mmbs, int nsrc, mmbuffer_t *mmb2,
+                 rabdiffparam_t const *rdp, xdemitcb_t *ecb)
 {
-	long i, cpos, size;
-	uint32_t fp;
-	xrabcpyi_t *rcpy;
 	xrabctx_t ctx;
 	xrabcpyi_arena_t aca;
-	mmbuffer_t mb[2];
-	unsigned char cpybuf[32];
+	uint32_t fps[XDL_BDIFF_MAXSRC];
 
-	fp = xdl_mmb_adler32(mmb1);
-	if (xrab_build_ctx((unsigned char const *)mmb1->ptr, mmb1->size, &ctx) <
-	    0)
+	if (nsrc < 1 || nsrc > XDL_BDIFF_MAXSRC)
+		return -1;
+	xdl_phase_begin(XDL_PHASE_INDEX);
+	if (xrab_build_ctx(mmbs, nsrc,
+	                   (rdp->flags & XDL_BDF_SELFREF) ? mmb2->size : 0,
+	                   rdp, &ctx, fps) < 0) {
+		xdl_phase_end(XDL_PHASE_INDEX, 0);
 		return -1;
-	if (xrab_diff((unsigned char const *)mmb2->ptr, mmb2->size, &ctx,
-	              &aca) < 0) {
+	}
+	xdl_phase_end(XDL_PHASE_INDEX, ctx.base[nsrc]);
+
+	xdl_phase_begin(XDL_PHASE_SCAN);
+	if (ctx.kern->diff((unsigned char const *)mmb2->ptr, mmb2->size, &ctx,
+	                   &aca) < 0) {
+		xdl_phase_end(XDL_PHASE_SCAN, 0);
 		xrab_free_ctx(&ctx);
 		return -1;
 	}
@@ -299,80 +620,129 @@ xdl_rabdiff_mb(mmbuffer_t *mmb1, mmbuffer_t *mmb2, xdemitcb_t *ecb)
 	                   &aca);
 	xrab_free_ctx(&ctx);
 
-	/*
-	 * Prepare and emit the binary patch file header. It will be used
-	 * to verify that that file being patched matches in size and fingerprint
-	 * the one that generated the patch.
-	 */
-	size = mmb1->size;
-	XDL_LE32_PUT(cpybuf, fp);
-	XDL_LE32_PUT(cpybuf + 4, size);
-
-	mb[0].ptr = (char *)cpybuf;
-	mb[0].size = 4 + 4;
-	if (ecb->outf(ecb->priv, mb, 1) < 0) {
+	if (xdl_emit_bdhdr(mmbs, nsrc, fps, ecb) < 0 ||
+	    xrab_emit_ops(&aca, mmb2, ecb) < 0) {
+		xdl_phase_end(XDL_PHASE_SCAN, 0);
 		xrab_free_cpyarena(&aca);
 		return -1;
 	}
-	for (cpos = 0, i = 0; i < aca.cnt; i++) {
-		rcpy = aca.acpy + i;
-		if (rcpy->len == 0)
-			continue;
-		if (cpos < rcpy->tgt) {
-			size = rcpy->tgt - cpos;
-			if (size > 255) {
-				cpybuf[0] = XDL_BDOP_INSB;
-				XDL_LE32_PUT(cpybuf + 1, size);
-				mb[0].ptr = (char *)cpybuf;
-				mb[0].size = XDL_INSBOP_SIZE;
-			} else {
-				cpybuf[0] = XDL_BDOP_INS;
-				cpybuf[1] = (unsigned char)size;
-				mb[0].ptr = (char *)cpybuf;
-				mb[0].size = 2;
-			}
-			mb[1].ptr = mmb2->ptr + cpos;
-			mb[1].size = size;
-			if (ecb->outf(ecb->priv, mb, 2) < 0) {
-				xrab_free_cpyarena(&aca);
-				return -1;
-			}
-			cpos = rcpy->tgt;
-		}
-		cpybuf[0] = XDL_BDOP_CPY;
-		XDL_LE32_PUT(cpybuf + 1, rcpy->src);
-		XDL_LE32_PUT(cpybuf + 5, rcpy->len);
-		mb[0].ptr = (char *)cpybuf;
-		mb[0].size = XDL_COPYOP_SIZE;
-		if (ecb->outf(ecb->priv, mb, 1) < 0) {
-			xrab_free_cpyarena(&aca);
-			return -1;
-		}
-		cpos += rcpy->len;
-	}
 	xrab_free_cpyarena(&aca);
-	if (cpos < mmb2->size) {
-		size = mmb2->size - cpos;
-		if (size > 255) {
-			cpybuf[0] = XDL_BDOP_INSB;
-			XDL_LE32_PUT(cpybuf + 1, size);
-			mb[0].ptr = (char *)cpybuf;
-			mb[0].size = XDL_INSBOP_SIZE;
-		} else {
-			cpybuf[0] = XDL_BDOP_INS;
-			cpybuf[1] = (unsigned char)size;
-			mb[0].ptr = (char *)cpybuf;
-			mb[0].size = 2;
-		}
-		mb[1].ptr = mmb2->ptr + cpos;
-		mb[1].size = size;
-		if (ecb->outf(ecb->priv, mb, 2) < 0)
-			return -1;
+	xdl_phase_end(XDL_PHASE_SCAN, mmb2->size);
+
+	return 0;
+}
+
+/*
+ * An index over the nsrc pieces of sources in srcs, where piece s is the
+ * part of source sids[s] that starts at offs[s], that any number of
+ * targets can be run against with xdl_rabdiff_span_run().  There are no
+ * self references, so running one leaves the index as it was.
+ */
+struct s_xrabspan {
+	xrabctx_t ctx;
+	mmbuffer_t srcs[XDL_BDIFF_MAXSRC];
+	int sids[XDL_BDIFF_MAXSRC];
+	long offs[XDL_BDIFF_MAXSRC];
+};
+
+xrabspan_t *
+xdl_rabdiff_span_init(mmbuffer_t const *srcs, int nsrc, int const *sids,
+                      long const *offs, rabdiffparam_t const *rdp)
+{
+	int s;
+	rabdiffparam_t srdp = *rdp;
+	xrabspan_t *span;
+
+	if (nsrc < 1 || nsrc > XDL_BDIFF_MAXSRC)
+		return NULL;
+	if ((span = (xrabspan_t *)xdl_malloc(sizeof(xrabspan_t))) == NULL)
+		return NULL;
+	for (s = 0; s < nsrc; s++) {
+		span->srcs[s] = srcs[s];
+		span->sids[s] = sids[s];
+		span->offs[s] = offs[s];
+	}
+	srdp.flags &= ~XDL_BDF_SELFREF;
+	if (xrab_build_ctx(span->srcs, nsrc, 0, &srdp, &span->ctx, NULL) < 0) {
+		xdl_free(span);
+		return NULL;
+	}
+
+	return span;
+}
+
+void
+xdl_rabdiff_span_free(xrabspan_t *span)
+{
+	xrab_free_ctx(&span->ctx);
+	xdl_free(span);
+}
+
+/*
+ * Emit just the ops for mmb2, with the copies against the whole of each
+ * source.  There's no header and no phases, since this is a piece of a
+ * bigger diff.
+ */
+int
+xdl_rabdiff_span_run(xrabspan_t *span, mmbuffer_t *mmb2,
+                     xdemitcb_t *ecb)
+{
+	long i;
+	xrabcpyi_arena_t aca;
+
+	if (span->ctx.kern->diff((unsigned char const *)mmb2->ptr, mmb2->size,
+	                         &span->ctx, &aca) < 0)
+		return -1;
+	xrab_tune_cpyarena((unsigned char const *)mmb2->ptr, mmb2->size,
+	                   &span->ctx, &aca);
+	for (i = 0; i < aca.cnt; i++) {
+		aca.acpy[i].src += span->offs[aca.acpy[i].sid];
+		aca.acpy[i].sid = span->sids[aca.acpy[i].sid];
 	}
+	if (xrab_emit_ops(&aca, mmb2, ecb) < 0) {
+		xrab_free_cpyarena(&aca);
+		return -1;
+	}
+	xrab_free_cpyarena(&aca);
 
 	return 0;
 }
 
+/*
+ * A one-off xdl_rabdiff_span_run(), for when the index won't be needed
+ * again.
+ */
+int
+xdl_rabdiff_span(mmbuffer_t *srcs, int nsrc, int const *sids,
+                 long const *offs, mmbuffer_t *mmb2,
+                 rabdiffparam_t const *rdp, xdemitcb_t *ecb)
+{
+	int res;
+	xrabspan_t *span;
+
+	if ((span = xdl_rabdiff_span_init(srcs, nsrc, sids, offs, rdp)) == NULL)
+		return -1;
+	res = xdl_rabdiff_span_run(span, mmb2, ecb);
+	xdl_rabdiff_span_free(span);
+
+	return res;
+}
+
+int
+xdl_rabdiff_mbv(mmbuffer_t *mmbs, int nsrc, mmbuffer_t *mmb2, uint32_t flags,
+                xdemitcb_t *ecb)
+{
+	rabdiffparam_t rdp = { flags, 0, 0 };
+
+	return xdl_rabdiff_mbvp(mmbs, nsrc, mmb2, &rdp, ecb);
+}
+
+int
+xdl_rabdiff_mb(mmbuffer_t *mmb1, mmbuffer_t *mmb2, xdemitcb_t *ecb)
+{
+	return xdl_rabdiff_mbv(mmb1, 1, mmb2, 0, ecb);
+}
+
 int
 xdl_rabdiff(mmfile_t *mmf1, mmfile_t *mmf2, xdemitcb_t *ecb)
 {
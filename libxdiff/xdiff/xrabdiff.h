@@ -0,0 +1,51 @@
+/*
+ *  xrabdiff by Davide Libenzi (Rabin's polynomial fingerprint based delta generator)
+ *  Copyright (C) 2006  Davide Libenzi
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *  Davide Libenzi <davidel@xmailserver.org>
+ *
+ *
+ *  Hints, ideas and code for the implementation came from:
+ *
+ *  Rabin's original paper: http://www.xmailserver.org/rabin.pdf
+ *  Chan & Lu's paper:      http://www.xmailserver.org/rabin_impl.pdf
+ *  Broder's paper:         http://www.xmailserver.org/rabin_apps.pdf
+ *  LBFS source code:       http://www.fs.net/sfswww/lbfs/
+ *  Geert Bosch's post:     http://marc.theaimsgroup.com/?l=git&m=114565424620771&w=2
+ *
+ */
+
+#if !defined(XRABDIFF_H)
+#define XRABDIFF_H
+
+typedef struct s_xrabspan xrabspan_t;
+
+uint64_t xdl_rabin_scan(unsigned char const *data, long size);
+uint64_t xdl_gear_scan(unsigned char const *data, long size);
+long xdl_gear_cut(unsigned char const *data, long size, long minsize, int avgbits,
+                  long maxsize);
+xrabspan_t *xdl_rabdiff_span_init(mmbuffer_t const *srcs, int nsrc,
+                                  int const *sids, long const *offs,
+                                  rabdiffparam_t const *rdp);
+int xdl_rabdiff_span_run(xrabspan_t *span, mmbuffer_t *mmb2,
+                         xdemitcb_t *ecb);
+void xdl_rabdiff_span_free(xrabspan_t *span);
+int xdl_rabdiff_span(mmbuffer_t *srcs, int nsrc, int const *sids,
+                     long const *offs, mmbuffer_t *mmb2,
+                     rabdiffparam_t const *rdp, xdemitcb_t *ecb);
+
+#endif /* #if !defined(XRABDIFF_H) */
@@ -0,0 +1,134 @@
+/*
+ *  xrabdiff by Davide Libenzi (Rabin's polynomial fingerprint based delta generator)
+ *  Copyright (C) 2006  Davide Libenzi
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *  Davide Libenzi <davidel@xmailserver.org>
+ *
+ *
+ *  Hints, ideas and code for the implementation came from:
+ *
+ *  Rabin's original paper: http://www.xmailserver.org/rabin.pdf
+ *  Chan & Lu's paper:      http://www.xmailserver.org/rabin_impl.pdf
+ *  Broder's paper:         http://www.xmailserver.org/rabin_apps.pdf
+ *  LBFS source code:       http://www.fs.net/sfswww/lbfs/
+ *  Geert Bosch's post:     http://marc.theaimsgroup.com/?l=git&m=114565424620771&w=2
+ *
+ */
+
+/*
+ * The table for gear hashing: one random word for each byte value, the
+ * first 256 outputs of splitmix64 started from 0.  Like xrabply.c, it's
+ * included by xrabdiff.c once xply_word is defined, and the words are
+ * cut down to fit it.
+ */
+
+#if defined(XRAB_WBITS)
+
+#define XG(v) ((xply_word)v##ULL)
+
+static const xply_word G[256] = {
+	XG(0xe220a8397b1dcdaf), XG(0x6e789e6aa1b965f4), XG(0x06c45d188009454f),
+	XG(0xf88bb8a8724c81ec), XG(0x1b39896a51a8749b), XG(0x53cb9f0c747ea2ea),
+	XG(0x2c829abe1f4532e1), XG(0xc584133ac916ab3c), XG(0x3ee5789041c98ac3),
+	XG(0xf3b8488c368cb0a6), XG(0x657eecdd3cb13d09), XG(0xc2d326e0055bdef6),
+	XG(0x8621a03fe0bbdb7b), XG(0x8e1f7555983aa92f), XG(0xb54e0f1600cc4d19),
+	XG(0x84bb3f97971d80ab), XG(0x7d29825c75521255), XG(0xc3cf17102b7f7f86),
+	XG(0x3466e9a083914f64), XG(0xd81a8d2b5a4485ac), XG(0xdb01602b100b9ed7),
+	XG(0xa9038a921825f10d), XG(0xedf5f1d90dca2f6a), XG(0x54496ad67bd2634c),
+	XG(0xdd7c01d4f5407269), XG(0x935e82f1db4c4f7b), XG(0x69b82ebc92233300),
+	XG(0x40d29eb57de1d510), XG(0xa2f09dabb45c6316), XG(0xee521d7a0f4d3872),
+	XG(0xf16952ee72f3454f), XG(0x377d35dea8e40225), XG(0x0c7de8064963bab0),
+	XG(0x05582d37111ac529), XG(0xd254741f599dc6f7), XG(0x69630f7593d108c3),
+	XG(0x417ef96181daa383), XG(0x3c3c41a3b43343a1), XG(0x6e19905dcbe531df),
+	XG(0x4fa9fa7324851729), XG(0x84eb4454a792922a), XG(0x134f7096918175ce),
+	XG(0x07dc930b302278a8), XG(0x12c015a97019e937), XG(0xcc06c31652ebf438),
+	XG(0xecee65630a691e37), XG(0x3e84ecb1763e79ad), XG(0x690ed476743aae49),
+	XG(0x774615d7b1a1f2e1), XG(0x22b353f04f4f52da), XG(0xe3ddd86ba71a5eb1),
+	XG(0xdf268adeb6513356), XG(0x2098eb73d4367d77), XG(0x03d6845323ce3c71),
+	XG(0xc952c5620043c714), XG(0x9b196bca844f1705), XG(0x30260345dd9e0ec1),
+	XG(0xcf448a5882bb9698), XG(0xf4a578dccbc87656), XG(0xbfdeaed9a17b3c8f),
+	XG(0xed79402d1d5c5d7b), XG(0x55f070ab1cbbf170), XG(0x3e00a34929a88f1d),
+	XG(0xe255b237b8bb18fb), XG(0x2a7b67af6c6ad50e), XG(0x466d5e7f3e46f143),
+	XG(0x42375cb399a4fc72), XG(0x8c8a1f148a8bb259), XG(0x32fcab5daed5bdfc),
+	XG(0x9e60398c8d8553c0), XG(0xee89cceb8c4064c0), XG(0xdb0215941d86a66f),
+	XG(0x5ccde78203c367a8), XG(0xf1bcbc6a1ec11786), XG(0xef054fceee954551),
+	XG(0xdf82012d0555c6df), XG(0x292566ff72403c08), XG(0xc4dd302a1bfa1137),
+	XG(0xd85f219db5c554e1), XG(0x6a27ff807441bcd2), XG(0x96a573e9b48216e8),
+	XG(0x46a9fdac40bf0048), XG(0x3dd12464a0ee15b4), XG(0x451e521296a7eea1),
+	XG(0x56e4398a98f8a0fd), XG(0x7b7dc2160e3335a7), XG(0xc679ee0bebcb1cca),
+	XG(0x928d6f2d7453424e), XG(0x1b38994205234c6d), XG(0x8086d193a6f2b568),
+	XG(0x21c6e26639ac2c65), XG(0xd9dccac414d23c6f), XG(0x91cd642057e00235),
+	XG(0x77fc607dc6589373), XG(0x05b8abe26dd3aee7), XG(0x12f6436ac376cc66),
+	XG(0x64952424897b2307), XG(0xee8c2baf6343e5c3), XG(0xdc4c613d9eba2304),
+	XG(0x3505b7796bd1a506), XG(0x8176daf800a05f50), XG(0x8bd8ff7a0385cdbc),
+	XG(0x1a764a3cd78101da), XG(0xbe4d15bf6ca266ac), XG(0xa85e1f38bb2dc749),
+	XG(0x56759a968493cd8c), XG(0xf3a9bce7336bd182), XG(0x365b15013741519b),
+	XG(0x1f7a44a6b109ac94), XG(0x3521d628813cb177), XG(0x6a77afab0f7c9370),
+	XG(0x179642d8cde95015), XG(0x5ef102a8fb354461), XG(0xf51c504764ed82f2),
+	XG(0xc58427f041ce6808), XG(0xfad8fc45c9643c37), XG(0xcf8682f9a70fa9c0),
+	XG(0x7e1b3b75a4005729), XG(0x992dd867927b52d8), XG(0x7fbd5db142f6791f),
+	XG(0x370595aacab4adae), XG(0xb1392dbdc5ab61d6), XG(0x9fea7dfc79d452d9),
+	XG(0x40b12b120085641c), XG(0xa192afe3157c85d0), XG(0xc847729f4e08f3a3),
+	XG(0x6f1384a306c41fc2), XG(0x12d05c4045a39c19), XG(0x9899202fd20f0841),
+	XG(0xe9c7191857e774b8), XG(0x4eead809af5b0cc3), XG(0xe809acafa23864a4),
+	XG(0x4da1edaba1d0f7bd), XG(0x846eb9673349f8e4), XG(0x87bae55b86039fe8),
+	XG(0x7f367b8bd953eff2), XG(0x3884700f650d04e1), XG(0xbfe4b2ab46980cad),
+	XG(0xc5fc89075299106c), XG(0x37b2fa361adea7cd), XG(0x7d75d813f04895b4),
+	XG(0x702f5b393f62c0e0), XG(0x0a3fc775f4ecf37f), XG(0xe4b23787a352437f),
+	XG(0xf83fa245c34d6363), XG(0xb99bcf040786cf50), XG(0x38b6ea0a0e6c9d8a),
+	XG(0x093fdc76776e37e1), XG(0x1a75e6f76ba7eee8), XG(0x442cdcfee9660c62),
+	XG(0x22d58d35116b5e0b), XG(0x87d4a5180f6a3645), XG(0x589fb216bd82131b),
+	XG(0x91d031cad319aec0), XG(0xabecf76a553d320b), XG(0xb8686cb347612dcf),
+	XG(0xfcab66337c0a77f5), XG(0xac318214381ec437), XG(0x6eb7f0fca24494ae),
+	XG(0xcf42861dcdc895a9), XG(0x4abad7a1586d7a91), XG(0xc21b318dc2f49745),
+	XG(0xd49474dc2acbd1f0), XG(0xb1d4873747c1c8e1), XG(0x5434dc8c7d015bf6),
+	XG(0xe1c486287511b6a9), XG(0xa8616df62e89a193), XG(0x31ce6319498d8347),
+	XG(0xafd0b486123d6faa), XG(0xe6495f5d102301eb), XG(0x0dc51ced17a43c52),
+	XG(0x8bcbcde81355ef2d), XG(0x2412af73fdee7cfc), XG(0xc8d589e486e29eed),
+	XG(0x23390e8664517f89), XG(0x251ade58e8a6849d), XG(0xf8555dbd2e8f9cb0),
+	XG(0xcb417c3eef54f7c3), XG(0x8028f8e1aac3a919), XG(0x10e31052acf748a0),
+	XG(0x2d886c073b1e1b78), XG(0x972974d90df9faee), XG(0xbc1b7b38796893ba),
+	XG(0x1958ed432070e652), XG(0xca5f297197a12dcc), XG(0xe025a27375704f28),
+	XG(0x418010a570a924fb), XG(0x9828e2941bfc419c), XG(0x4fbacd2f52b85c1f),
+	XG(0x33dd5b756211cc67), XG(0x23c8dfdd1db57ff0), XG(0x32f81801a1a8e901),
+	XG(0x26884eac5ada36da), XG(0xcaa82f9bb42e37d4), XG(0x19fb1a7491d6a7d1),
+	XG(0x5aa0243aa357f38e), XG(0xb31d917809e447f0), XG(0x3f9c197225215be0),
+	XG(0xdc3c315a1e33c095), XG(0x3dd399ad533e80ac), XG(0x566f32cce8301d95),
+	XG(0xc880188083d9ba21), XG(0xb9cc357f3b0e7d2e), XG(0x0237d2123a8a8d6c),
+	XG(0xbf636e9aa7cbf6bd), XG(0xd7bd4284c4e2a6a7), XG(0xda2ebb47d50577a9),
+	XG(0x90ba1c11b539087d), XG(0x44993d31552b4f57), XG(0x32c2d6f80a8a8898),
+	XG(0x450583ed7fb54b19), XG(0xec2b0b09e50ef3ef), XG(0xd918a0b6e2efd65c),
+	XG(0xe37a868d9785f572), XG(0x7d1a6118f2b0f37a), XG(0x9e2e3cc13b343439),
+	XG(0xefd82c11212e37e8), XG(0xaf89c05cd4fc75ed), XG(0x55bc16bb9697108e),
+	XG(0x6c4701fa5db69bee), XG(0x9237338441daf445), XG(0x248cf0831e81a5fc),
+	XG(0xacc13557e77de273), XG(0x520970c25e06513a), XG(0x657329cb02987cab),
+	XG(0xa9b0b3366a4e55a8), XG(0xc4d06ca2f39acdd4), XG(0x5dce37d68170cde1),
+	XG(0x5f1e44e77e1854c9), XG(0x6883d452d55df899), XG(0x05c5bd62f1067032),
+	XG(0xe680b683ce60fab0), XG(0x5dc9da3f286d18b1), XG(0x94b4bf3ab85ed6d8),
+	XG(0xce65f449e3acc5a3), XG(0x34b0209642cea639), XG(0xc14c3c771d904827),
+	XG(0x6addcee2bd9cdee5), XG(0xe24eed137ffbb613), XG(0x75dd58ef79963d1b),
+	XG(0xfdb83ecf6cc24920), XG(0x7a1d0057c57169fb), XG(0x339200f4feb62d07),
+	XG(0xd33f4d4ac88469f4), XG(0x8226f234e68dfee4), XG(0x320def4f2a105536),
+	XG(0x7786f3b13aefc159), XG(0xb28225ac9df63ee2), XG(0x781b9d0376cc6044),
+	XG(0x05bd0115226c6ab6), XG(0xd302230207bdfdab), XG(0xdb898abd8e0d2933),
+	XG(0x9e79a397ba00b9cc), XG(0x89df84a5f0003ee8), XG(0x011f04f2a75fb9be),
+	XG(0x5a5832bb47bcf19e)
+};
+
+#undef XG
+
+#endif /* #if defined(XRAB_WBITS) */
@@ -0,0 +1,265 @@
+/*
+ *  xrabdiff by Davide Libenzi (Rabin's polynomial fingerprint based delta generator)
+ *  Copyright (C) 2006  Davide Libenzi
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *  Davide Libenzi <davidel@xmailserver.org>
+ *
+ *
+ *  Hints, ideas and code for the implementation came from:
+ *
+ *  Rabin's original paper: http://www.xmailserver.org/rabin.pdf
+ *  Chan & Lu's paper:      http://www.xmailserver.org/rabin_impl.pdf
+ *  Broder's paper:         http://www.xmailserver.org/rabin_apps.pdf
+ *  LBFS source code:       http://www.fs.net/sfswww/lbfs/
+ *  Geert Bosch's post:     http://marc.theaimsgroup.com/?l=git&m=114565424620771&w=2
+ *
+ */
+
+/*
+ * The indexing and scanning loops, made once for each window size that
+ * xrabdiff.c supports. It includes this file with XRAB_WND set to the
+ * window size, so the loops over a window have a constant trip count,
+ * and the byte leaving the window is read straight from the data at a
+ * constant distance behind the one coming in.
+ *
+ * With XRAB_GEAR defined as well, the loops use a gear hash instead: a
+ * shift, an add and a lookup in G[] for each byte, and nothing to take
+ * out, because every byte is shifted off the top after XRAB_WND more.
+ * Its low bits only depend on the last few bytes, so the index is keyed
+ * on its top bits, shifted down by ctx->shift.
+ */
+
+#if defined(XRAB_WND)
+
+#if defined(XRAB_GEAR)
+#define XRAB_KPUSH(v, c) ((v) = ((v) << (XRAB_WBITS / XRAB_WND)) + T[c])
+#define XRAB_KDROP(v, c) ((void)U)
+#define XRAB_KEY(v) ((v) >> shift)
+#define XRAB_KNAME(n) XRAB_KNAME2(n##_gear, XRAB_WND)
+#else
+#define XRAB_KPUSH(v, c) XRAB_PUSH(v, c)
+#define XRAB_KDROP(v, c) XRAB_DROP(v, c)
+#define XRAB_KEY(v) (v)
+#define XRAB_KNAME(n) XRAB_KNAME2(n, XRAB_WND)
+#endif
+
+#define XRAB_KCAT(n, w) n##_##w
+#define XRAB_KNAME2(n, w) XRAB_KCAT(n, w)
+
+/*
+ * A brand new hash of the window starting at data.
+ */
+static xply_word
+XRAB_KNAME(xrab_hash)(unsigned char const *data, xply_word const *T, int shift)
+{
+	int k;
+	xply_word h = 0;
+
+	for (k = 0; k < XRAB_WND; k++)
+		XRAB_KPUSH(h, data[k]);
+
+	return h;
+}
+
+static void
+XRAB_KNAME(xrab_index_src)(unsigned char const *data, long size, long base,
+                           xrabctx_t *ctx, uint32_t *adler)
+{
+	int shift = ctx->shift;
+	long i, seq, fed = 0;
+	uint32_t ha = 0;
+	xply_word fp;
+	unsigned char ch;
+	long maxoffs[256];
+	long maxseq[256];
+	xply_word maxfp[256];
+
+	memset(maxseq, 0, sizeof(maxseq));
+	for (i = 0; i + XRAB_WND < size; i += XRAB_WND) {
+		if (adler && i - fed >= XRAB_SUMLAG) {
+			ha = xdl_adler32(ha, data + fed, i - fed);
+			fed = i;
+		}
+		fp = XRAB_KEY(XRAB_KNAME(xrab_hash)(data + i, ctx->T, shift));
+
+		/*
+		 * Try to scan for single value scans, and store them in the
+		 * array according to the longest one. Before we do a fast check
+		 * to avoid calling xrab_cmnseq() when not necessary.
+		 */
+		if ((ch = data[i]) == data[i + XRAB_WND - 1] &&
+		    (seq = xrab_cmnseq(data, i, size)) > XRAB_WND &&
+		    seq > maxseq[ch]) {
+			maxseq[ch] = seq;
+			maxfp[ch] = fp;
+			maxoffs[ch] = base + i + XRAB_WND;
+			seq = (seq / XRAB_WND) * XRAB_WND;
+			i += seq - XRAB_WND;
+		} else
+			xrab_insert(ctx, fp, base + i + XRAB_WND);
+	}
+
+	/*
+	 * Restore back the logest sequences by putting them at the front of
+	 * their sets.
+	 */
+	for (i = 0; i < 256; i++)
+		if (maxseq[i])
+			xrab_insert(ctx, maxfp[i], maxoffs[i]);
+	if (adler)
+		*adler = xdl_adler32(ha, data + fed, size - fed);
+}
+
+static int
+XRAB_KNAME(xrab_diff)(unsigned char const *data, long size, xrabctx_t *ctx,
+                      xrabcpyi_arena_t *aca)
+{
+	int w, sid, shift = ctx->shift;
+	long i, n, offs, ssize, src, tgt, esrc, etgt, tbase;
+	long snext = XRAB_WND;
+	long ia;
+	unsigned int hits;
+	xply_word fp, ha;
+	xply_word ring[XRAB_AHEAD];
+	xply_word const *T = ctx->T, *U = ctx->U;
+	unsigned char ch;
+	unsigned char const *sdata;
+	xrabset_t *set;
+	xrabcpyi_t rcpy;
+
+	xrab_init_cpyarena(aca);
+	if (size < XRAB_WND)
+		return 0;
+	tbase = ctx->base[ctx->nsrc];
+
+	/*
+	 * The window ending at i is what gets looked up, but the hash runs
+	 * XRAB_AHEAD windows further on, in ha, which is the window ending
+	 * at ia.  The keys in between wait in ring[], and their sets get
+	 * prefetched as they go in, so that by the time they're looked up
+	 * they're in the cache.
+	 */
+	ha = XRAB_KNAME(xrab_hash)(data, T, shift);
+	for (i = ia = XRAB_WND;;) {
+		for (; ia <= size && ia < i + XRAB_AHEAD; ia++) {
+			fp = ring[ia & (XRAB_AHEAD - 1)] = XRAB_KEY(ha);
+			XDL_PREFETCH(XRAB_SET(ctx, fp));
+			if (ia < size) {
+				XRAB_KDROP(ha, data[ia - XRAB_WND]);
+				XRAB_KPUSH(ha, data[ia]);
+			}
+		}
+		fp = ring[i & (XRAB_AHEAD - 1)];
+		ch = data[i - 1];
+		set = XRAB_SET(ctx, fp);
+
+		/*
+		 * Every way in the set whose tag matches gets tried, and the
+		 * longest match wins; on a tie, the newer way does.
+		 */
+		hits = xrab_tagmask(set, XRAB_TAG(ctx, fp), ctx->ways);
+		for (rcpy.len = 0, w = 0; hits; w++, hits >>= 1) {
+			if (!(hits & 1) || (offs = XRAB_GETOFFS(ctx, set, w)) == 0)
+				continue;
+			if (offs > tbase) {
+				sid = XDL_BDSRC_SELF;
+				offs -= tbase;
+			} else if (ctx->nsrc > 1) {
+				sid = xrab_find_src(ctx, offs);
+				offs -= ctx->base[sid];
+			} else
+				sid = 0;
+			if (sid == XDL_BDSRC_SELF) {
+				sdata = data;
+				ssize = size;
+			} else {
+				sdata = (unsigned char const *)ctx->srcs[sid].ptr;
+				ssize = ctx->srcs[sid].size;
+			}
+
+			/*
+			 * Fast check here to probabilistically reduce false
+			 * positives that would trigger the slow path below.
+			 */
+			if (ch != sdata[offs - 1])
+				continue;
+
+			/*
+			 * Stretch the match both sides as far as possible.
+			 */
+			src = offs - 1;
+			tgt = i - 1;
+			n = xdl_match_bwd(data + tgt, sdata + src,
+			                  XDL_MIN(tgt, src));
+			src -= n;
+			tgt -= n;
+			esrc = offs;
+			etgt = i;
+			n = xdl_match_fwd(data + etgt, sdata + esrc,
+			                  XDL_MIN(size - etgt, ssize - esrc));
+			esrc += n;
+			etgt += n;
+			if (etgt - tgt > rcpy.len) {
+				rcpy.sid = sid;
+				rcpy.src = src;
+				rcpy.tgt = tgt;
+				rcpy.len = etgt - tgt;
+			}
+		}
+
+		/*
+		 * Index a window of the target every XRAB_WND bytes, so
+		 * later on we can copy from it.
+		 */
+		if (ctx->selfref && i >= snext) {
+			xrab_insert_self(ctx, fp, tbase + i, tbase);
+			snext = i + XRAB_WND;
+		}
+
+		/*
+		 * Avoid considering copies smaller than the XRAB_MINCPYSIZE
+		 * threshold.
+		 */
+		if (rcpy.len >= XRAB_MINCPYSIZE) {
+			if (xrab_add_cpy(aca, &rcpy) < 0) {
+				xrab_free_cpyarena(aca);
+				return -1;
+			}
+
+			/*
+			 * Pick up again with the window that ends where the
+			 * copy does.
+			 */
+			i = ia = rcpy.tgt + rcpy.len;
+			ha = XRAB_KNAME(xrab_hash)(data + i - XRAB_WND, T, shift);
+		}
+		if (i >= size)
+			break;
+		i++;
+	}
+
+	return 0;
+}
+
+#undef XRAB_KNAME
+#undef XRAB_KNAME2
+#undef XRAB_KCAT
+#undef XRAB_KEY
+#undef XRAB_KDROP
+#undef XRAB_KPUSH
+
+#endif /* #if defined(XRAB_WND) */
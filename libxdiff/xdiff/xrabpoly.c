@@ -0,0 +1,197 @@
+/*
+ *  xrabin by Davide Libenzi (Rabin's polynomial generator)
+ *  Copyright (C) 2006  Davide Libenzi
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *  Davide Libenzi <davidel@xmailserver.org>
+ *
+ *
+ *  Hints, ideas and code for the implementation came from:
+ *
+ *  Rabin's original paper: http://www.xmailserver.org/rabin.pdf
+ *  Chan & Lu's paper:      http://www.xmailserver.org/rabin_impl.pdf
+ *  Broder's paper:         http://www.xmailserver.org/rabin_apps.pdf
+ *  LBFS source code:       http://www.fs.net/sfswww/lbfs/
+ *  Geert Bosch's post:     http://marc.theaimsgroup.com/?l=git&m=114565424620771&w=2
+ *
+ */
+
+/*
+ * This is the polynomial arithmetic from tools/xrabin.c, so that the
+ * T[] and U[] tables can be made at run time for a polynomial and a
+ * window size other than the ones in xrabply.c. Like xrabply.c, it's
+ * included by xrabdiff.c, after xply_word has been defined.
+ */
+
+#if defined(XRAB_ROOTPOLY)
+
+#define XRAB_MSB ((xply_word)1 << (XRAB_WBITS - 1))
+
+/*
+ * Polynomials generated by xdl_rabin_polygen() have the same degree as
+ * XRAB_ROOTPOLY, and any other one needs a degree of at least
+ * XRAB_MINDEGREE, so there are bits enough left for the index.
+ */
+#define XRAB_MINDEGREE (int)(XRAB_WBITS / 2)
+
+static int
+xrab_fls(xply_word v)
+{
+	int r;
+
+	for (r = 0; v; v >>= 1, r++)
+		;
+
+	return r;
+}
+
+static xply_word
+xrab_polymod(xply_word nh, xply_word nl, xply_word d)
+{
+	int i, k = xrab_fls(d) - 1;
+
+	d <<= (XRAB_WBITS - 1) - k;
+	if (nh) {
+		if (nh & XRAB_MSB)
+			nh ^= d;
+		for (i = XRAB_WBITS - 2; i >= 0; i--)
+			if (nh & ((xply_word)1 << i)) {
+				nh ^= d >> ((XRAB_WBITS - 1) - i);
+				nl ^= d << (i + 1);
+			}
+	}
+	for (i = XRAB_WBITS - 1; i >= k; i--)
+		if (nl & ((xply_word)1 << i))
+			nl ^= d >> ((XRAB_WBITS - 1) - i);
+
+	return nl;
+}
+
+static xply_word
+xrab_polygcd(xply_word x, xply_word y)
+{
+	for (;;) {
+		if (!y)
+			return x;
+		x = xrab_polymod(0, x, y);
+		if (!x)
+			return y;
+		y = xrab_polymod(0, y, x);
+	}
+}
+
+static void
+xrab_polymult(xply_word *php, xply_word *plp, xply_word x, xply_word y)
+{
+	int i;
+	xply_word ph = 0, pl = 0;
+
+	if (x & 1)
+		pl = y;
+	for (i = 1; i < (int)XRAB_WBITS; i++)
+		if (x & ((xply_word)1 << i)) {
+			ph ^= y >> (XRAB_WBITS - i);
+			pl ^= y << i;
+		}
+	*php = ph;
+	*plp = pl;
+}
+
+static xply_word
+xrab_polymmult(xply_word x, xply_word y, xply_word d)
+{
+	xply_word h, l;
+
+	xrab_polymult(&h, &l, x, y);
+
+	return xrab_polymod(h, l, d);
+}
+
+static int
+xrab_polyirreducible(xply_word f)
+{
+	xply_word u = 2;
+	int i, m = (xrab_fls(f) - 1) >> 1;
+
+	for (i = 0; i < m; i++) {
+		u = xrab_polymmult(u, u, f);
+		if (xrab_polygcd(f, u ^ 2) != 1)
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Fill t[] and u[] for poly and a window of size bytes, the way
+ * xrabply.c's were made. Returns the shift that goes with them.
+ */
+static int
+xrab_polytables(xply_word poly, long size, xply_word *t, xply_word *u)
+{
+	int j, xshift, shift;
+	xply_word t1, ssh;
+
+	xshift = xrab_fls(poly) - 1;
+	shift = xshift - 8;
+	t1 = xrab_polymod(0, (xply_word)1 << xshift, poly);
+	for (j = 0; j < 256; j++)
+		t[j] = xrab_polymmult((xply_word)j, t1, poly) |
+		       ((xply_word)j << xshift);
+	for (j = 1, ssh = 1; j < size; j++)
+		ssh = (ssh << 8) ^ t[ssh >> shift];
+	for (j = 0; j < 256; j++)
+		u[j] = xrab_polymmult((xply_word)j, ssh, poly);
+
+	return shift;
+}
+
+int
+xdl_rabin_polycheck(uint64_t poly)
+{
+	int degree = xrab_fls((xply_word)poly) - 1;
+
+	if ((uint64_t)(xply_word)poly != poly || degree < XRAB_MINDEGREE ||
+	    !xrab_polyirreducible((xply_word)poly))
+		return -1;
+
+	return 0;
+}
+
+/*
+ * The candidates come from a splitmix64 sequence started at seed, so
+ * the same seed always gives the same polynomial.
+ */
+int
+xdl_rabin_polygen(uint64_t seed, uint64_t *poly)
+{
+	xply_word msb, f;
+	uint64_t z;
+
+	msb = (xply_word)1 << (xrab_fls(XRAB_ROOTPOLY) - 1);
+	do {
+		z = (seed += 0x9e3779b97f4a7c15ULL);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		z ^= z >> 31;
+		f = ((xply_word)z & (msb - 1)) | msb | 1;
+	} while (!xrab_polyirreducible(f));
+	*poly = (uint64_t)f;
+
+	return 0;
+}
+
+#endif /* #if defined(XRAB_ROOTPOLY) */
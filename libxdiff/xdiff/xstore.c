@@ -0,0 +1,447 @@
+/*
+ *  LibXDiff by Davide Libenzi ( File Differential Library )
+ *  Copyright (C) 2003  Davide Libenzi
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *  Davide Libenzi <davidel@xmailserver.org>
+ *
+ */
+
+/*
+ * Delta object store.  The versions of an object are kept as chains of
+ * binary deltas, each one against the version before it, that start at
+ * a full copy of some version (a keyframe).  No chain gets more than
+ * maxdepth deltas long; the version after that is stored full, and so
+ * is any version that doesn't delta smaller than itself.  Getting a
+ * version back is a single xdl_bpatch_multi() of its chain over its
+ * keyframe, so it never takes more than maxdepth patches.
+ *
+ * Serialized, a store is a header, an index with an entry for every
+ * version, and then every version's record in order, so where each
+ * record starts follows from the sizes before it:
+ *
+ *   "XDS1" nver
+ *   base size osize adler32     (per version; base is ~0 for keyframes)
+ *   records...
+ *
+ * Numbers are all 32 bit little endian.  osize and adler32 are the
+ * size and fingerprint of the whole version, which is checked every
+ * time one is put back together.
+ */
+
+#include "xinclude.h"
+
+#define XDST_MAGIC "XDS1"
+#define XDST_HDR_SIZE (4 + 4)
+#define XDST_IDX_SIZE (4 + 4 + 4 + 4)
+#define XDST_KEYFRAME 0xffffffffU
+#define XDST_MINALLOC 32
+
+typedef struct s_xdstrec {
+	char *ptr;
+	long size;
+	long osize;
+	uint32_t fp;
+	long base;
+	long depth;
+	int owned;
+} xdstrec_t;
+
+typedef struct s_xdstbuf {
+	char *ptr;
+	long size, alloc;
+} xdstbuf_t;
+
+typedef struct s_xdstcheck {
+	xdemitcb_t *ecb;
+	long size;
+	uint32_t fp;
+} xdstcheck_t;
+
+struct s_xdstore {
+	xdstparam_t xsp;
+	xdstrec_t *recs;
+	long nrec, arec;
+	xdstbuf_t last;
+	int has_last;
+};
+
+static int
+xdl_store_buf_outf(void *priv, mmbuffer_t *mb, size_t nbuf)
+{
+	size_t i;
+	long alloc;
+	char *ptr;
+	xdstbuf_t *buf = (xdstbuf_t *)priv;
+
+	for (i = 0; i < nbuf; i++) {
+		if (buf->size + (long)mb[i].size > buf->alloc) {
+			alloc = XDL_MAX(2 * buf->alloc,
+			                buf->size + (long)mb[i].size);
+			if ((ptr = (char *)xdl_realloc(buf->ptr, alloc)) ==
+			    NULL)
+				return -1;
+			buf->ptr = ptr;
+			buf->alloc = alloc;
+		}
+		memcpy(buf->ptr + buf->size, mb[i].ptr, mb[i].size);
+		buf->size += mb[i].size;
+	}
+
+	return 0;
+}
+
+/*
+ * Sits between xdl_bpatch_multi() and the caller's ecb, and only lets
+ * the version through if it's the one that was stored.
+ */
+static int
+xdl_store_check_outf(void *priv, mmbuffer_t *mb, size_t nbuf)
+{
+	size_t i;
+	long size = 0;
+	uint32_t fp = 0;
+	xdstcheck_t *chk = (xdstcheck_t *)priv;
+
+	for (i = 0; i < nbuf; i++) {
+		fp = xdl_adler32(fp, (unsigned char const *)mb[i].ptr,
+		                 mb[i].size);
+		size += mb[i].size;
+	}
+	if (size != chk->size || fp != chk->fp)
+		return -1;
+
+	return chk->ecb->outf(chk->ecb->priv, mb, nbuf);
+}
+
+xdstore_t *
+xdl_store_init(xdstparam_t const *xsp)
+{
+	xdstore_t *st;
+
+	if ((st = (xdstore_t *)xdl_malloc(sizeof(xdstore_t))) == NULL)
+		return NULL;
+	memset(st, 0, sizeof(*st));
+	st->xsp = *xsp;
+
+	return st;
+}
+
+void
+xdl_store_free(xdstore_t *st)
+{
+	long i;
+
+	if (!st)
+		return;
+	for (i = 0; i < st->nrec; i++)
+		if (st->recs[i].owned)
+			xdl_free(st->recs[i].ptr);
+	xdl_free(st->recs);
+	xdl_free(st->last.ptr);
+	xdl_free(st);
+}
+
+static xdstrec_t *
+xdl_store_new_rec(xdstore_t *st)
+{
+	long arec;
+	xdstrec_t *recs;
+
+	if (st->nrec == st->arec) {
+		arec = st->arec ? 2 * st->arec : XDST_MINALLOC;
+		if ((recs = (xdstrec_t *)xdl_realloc(
+			     st->recs, arec * sizeof(xdstrec_t))) == NULL)
+			return NULL;
+		st->recs = recs;
+		st->arec = arec;
+	}
+	memset(&st->recs[st->nrec], 0, sizeof(xdstrec_t));
+
+	return &st->recs[st->nrec];
+}
+
+/*
+ * The newest version is kept around to diff the next one against; a
+ * store that was just loaded has to rebuild it first.
+ */
+static int
+xdl_store_load_last(xdstore_t *st)
+{
+	xdemitcb_t ecb;
+
+	if (st->has_last)
+		return 0;
+	st->last.size = 0;
+	ecb.priv = &st->last;
+	ecb.outf = xdl_store_buf_outf;
+	if (xdl_store_get(st, st->nrec - 1, &ecb) < 0)
+		return -1;
+	st->has_last = 1;
+
+	return 0;
+}
+
+static int
+xdl_store_set_last(xdstore_t *st, mmbuffer_t *mb)
+{
+	st->last.size = 0;
+	st->has_last = 0;
+	if (xdl_store_buf_outf(&st->last, mb, 1) < 0)
+		return -1;
+	st->has_last = 1;
+
+	return 0;
+}
+
+/*
+ * Add mb as the next version, and return its version number, counting
+ * from 0.  The store keeps its own copy of everything.
+ */
+long
+xdl_store_add(xdstore_t *st, mmbuffer_t *mb)
+{
+	xdstrec_t *rec, *prev;
+	xdstbuf_t delta = { NULL, 0, 0 };
+	mmbuffer_t mbl;
+	xdemitcb_t ecb;
+	bdiffparam_t bdp;
+
+	if ((rec = xdl_store_new_rec(st)) == NULL)
+		return -1;
+	rec->osize = mb->size;
+	rec->fp = xdl_mmb_adler32(mb);
+	rec->owned = 1;
+
+	prev = st->nrec > 0 ? &st->recs[st->nrec - 1] : NULL;
+	if (prev && prev->depth < st->xsp.maxdepth && prev->osize > 0 &&
+	    mb->size > 0) {
+		if (xdl_store_load_last(st) < 0)
+			return -1;
+		mbl.ptr = st->last.ptr;
+		mbl.size = st->last.size;
+
+		/*
+		 * xdl_bpatch_multi() only knows about plain copies from
+		 * the version before.
+		 */
+		bdp = st->xsp.bdp;
+		bdp.flags &= ~XDL_BDF_SELFREF;
+		ecb.priv = &delta;
+		ecb.outf = xdl_store_buf_outf;
+		if (xdl_bdiff_mb(&mbl, mb, &bdp, &ecb) < 0) {
+			xdl_free(delta.ptr);
+			return -1;
+		}
+		if (delta.size < (long)mb->size) {
+			rec->ptr = delta.ptr;
+			rec->size = delta.size;
+			rec->base = st->nrec - 1;
+			rec->depth = prev->depth + 1;
+		} else {
+			xdl_free(delta.ptr);
+		}
+	}
+	if (!rec->ptr) {
+		if ((rec->ptr = (char *)xdl_malloc(XDL_MAX(mb->size, 1))) ==
+		    NULL)
+			return -1;
+		memcpy(rec->ptr, mb->ptr, mb->size);
+		rec->size = mb->size;
+		rec->base = -1;
+		rec->depth = 0;
+	}
+	/*
+	 * The record only counts once nothing else can fail; if keeping
+	 * mb as the newest version doesn't work out, the one before is
+	 * rebuilt next time instead.
+	 */
+	if (xdl_store_set_last(st, mb) < 0) {
+		xdl_free(rec->ptr);
+		return -1;
+	}
+
+	return st->nrec++;
+}
+
+/*
+ * Put version ver back together and hand it to ecb, in a single call.
+ */
+int
+xdl_store_get(xdstore_t *st, long ver, xdemitcb_t *ecb)
+{
+	long i, n;
+	xdstrec_t *rec;
+	mmbuffer_t key, *mbp;
+	xdstcheck_t chk;
+	xdemitcb_t cecb;
+
+	if (ver < 0 || ver >= st->nrec)
+		return -1;
+	rec = &st->recs[ver];
+	chk.ecb = ecb;
+	chk.size = rec->osize;
+	chk.fp = rec->fp;
+	cecb.priv = &chk;
+	cecb.outf = xdl_store_check_outf;
+
+	n = rec->depth;
+	if ((mbp = (mmbuffer_t *)xdl_malloc(XDL_MAX(n, 1) *
+	                                    sizeof(mmbuffer_t))) == NULL)
+		return -1;
+	for (i = n; i > 0; i--) {
+		mbp[i - 1].ptr = rec->ptr;
+		mbp[i - 1].size = rec->size;
+		rec = &st->recs[rec->base];
+	}
+	key.ptr = rec->ptr;
+	key.size = rec->size;
+
+	if (n == 0) {
+		if (xdl_store_check_outf(&chk, &key, 1) < 0) {
+			xdl_free(mbp);
+			return -1;
+		}
+	} else if (xdl_bpatch_multi(&key, mbp, n, &cecb) < 0) {
+		xdl_free(mbp);
+		return -1;
+	}
+	xdl_free(mbp);
+
+	return 0;
+}
+
+long
+xdl_store_count(xdstore_t *st)
+{
+	return st->nrec;
+}
+
+/*
+ * The size of version ver, or -1 if there's no such version.
+ */
+long
+xdl_store_size(xdstore_t *st, long ver)
+{
+	return ver >= 0 && ver < st->nrec ? st->recs[ver].osize : -1;
+}
+
+/*
+ * How many deltas it takes to get version ver back; its keyframe is
+ * version ver minus that.
+ */
+long
+xdl_store_depth(xdstore_t *st, long ver)
+{
+	return ver >= 0 && ver < st->nrec ? st->recs[ver].depth : -1;
+}
+
+int
+xdl_store_write(xdstore_t *st, xdemitcb_t *ecb)
+{
+	long i;
+	unsigned char *hdr, *idx;
+	mmbuffer_t mb;
+
+	mb.size = XDST_HDR_SIZE + st->nrec * XDST_IDX_SIZE;
+	if ((hdr = (unsigned char *)xdl_malloc(mb.size)) == NULL)
+		return -1;
+	memcpy(hdr, XDST_MAGIC, 4);
+	XDL_LE32_PUT(hdr + 4, st->nrec);
+	for (i = 0, idx = hdr + XDST_HDR_SIZE; i < st->nrec;
+	     i++, idx += XDST_IDX_SIZE) {
+		XDL_LE32_PUT(idx, st->recs[i].base < 0 ? XDST_KEYFRAME
+		                                       : st->recs[i].base);
+		XDL_LE32_PUT(idx + 4, st->recs[i].size);
+		XDL_LE32_PUT(idx + 8, st->recs[i].osize);
+		XDL_LE32_PUT(idx + 12, st->recs[i].fp);
+	}
+	mb.ptr = (char *)hdr;
+	if (ecb->outf(ecb->priv, &mb, 1) < 0) {
+		xdl_free(hdr);
+		return -1;
+	}
+	xdl_free(hdr);
+
+	for (i = 0; i < st->nrec; i++) {
+		mb.ptr = st->recs[i].ptr;
+		mb.size = st->recs[i].size;
+		if (ecb->outf(ecb->priv, &mb, 1) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Open a store that xdl_store_write() wrote out.  The records aren't
+ * copied, so mb has to stay around until the store is freed.  Versions
+ * added after loading go by xsp, not by whatever the store was made
+ * with.
+ */
+xdstore_t *
+xdl_store_load(mmbuffer_t *mb, xdstparam_t const *xsp)
+{
+	long i, nrec, off;
+	unsigned long base, size, osize, fp;
+	unsigned char const *data, *idx;
+	xdstore_t *st;
+	xdstrec_t *rec;
+
+	data = (unsigned char const *)mb->ptr;
+	if (mb->size < XDST_HDR_SIZE || memcmp(data, XDST_MAGIC, 4))
+		return NULL;
+	XDL_LE32_GET(data + 4, nrec);
+	if (nrec < 0 ||
+	    (unsigned long)nrec > (mb->size - XDST_HDR_SIZE) / XDST_IDX_SIZE)
+		return NULL;
+
+	if ((st = xdl_store_init(xsp)) == NULL)
+		return NULL;
+	off = XDST_HDR_SIZE + nrec * XDST_IDX_SIZE;
+	for (i = 0, idx = data + XDST_HDR_SIZE; i < nrec;
+	     i++, idx += XDST_IDX_SIZE) {
+		XDL_LE32_GET(idx, base);
+		XDL_LE32_GET(idx + 4, size);
+		XDL_LE32_GET(idx + 8, osize);
+		XDL_LE32_GET(idx + 12, fp);
+		if (size > mb->size - off ||
+		    (base != XDST_KEYFRAME && base >= (unsigned long)i) ||
+		    (rec = xdl_store_new_rec(st)) == NULL) {
+			xdl_store_free(st);
+			return NULL;
+		}
+		rec->ptr = mb->ptr + off;
+		rec->size = size;
+		rec->osize = osize;
+		rec->fp = fp;
+		if (base == XDST_KEYFRAME) {
+			rec->base = -1;
+			rec->depth = 0;
+		} else {
+			rec->base = base;
+			rec->depth = st->recs[base].depth + 1;
+		}
+		st->nrec++;
+		off += size;
+	}
+	if (off != (long)mb->size) {
+		xdl_store_free(st);
+		return NULL;
+	}
+
+	return st;
+}
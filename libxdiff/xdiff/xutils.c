@@ -24,6 +24,32 @@
 
 #define XDL_GUESS_NLINES 256
 
+static phasehook_t xphook = { NULL, NULL, NULL };
+
+int
+xdl_set_phase_hook(phasehook_t const *hook)
+{
+	if (hook)
+		xphook = *hook;
+	else
+		xphook.begin = NULL, xphook.end = NULL;
+	return 0;
+}
+
+void
+xdl_phase_begin(int phase)
+{
+	if (xphook.begin)
+		xphook.begin(xphook.priv, phase);
+}
+
+void
+xdl_phase_end(int phase, size_t size)
+{
+	if (xphook.end)
+		xphook.end(xphook.priv, phase, size);
+}
+
 uint32_t
 xdl_bogosqrt(uint32_t n)
 {
@@ -70,6 +96,8 @@ xdl_init_mmfile(mmfile_t *mmf, size_t bsize, uint32_t flags)
 	mmf->fsize = 0;
 	mmf->rcur = mmf->wcur = NULL;
 	mmf->rpos = 0;
+	mmf->bidx = NULL;
+	mmf->nblks = mmf->ablks = mmf->ridx = 0;
 
 	return 0;
 }
@@ -83,6 +111,41 @@ xdl_free_mmfile(mmfile_t *mmf)
 		cur = cur->next;
 		xdl_free(tmp);
 	}
+	xdl_free(mmf->bidx);
+}
+
+/*
+ * Put a new block on the end of the file, and make it the one that gets
+ * written to.  It starts where the file ends now, since nothing gets
+ * written to a block once there's another one after it.
+ */
+static int
+xdl_mmfile_addblk(mmfile_t *mmf, mmblock_t *blk)
+{
+	long ablks;
+	mmbindex_t *bidx;
+
+	if (mmf->nblks == mmf->ablks) {
+		ablks = 2 * mmf->ablks + 16;
+		if (!(bidx = (mmbindex_t *)xdl_crealloc(
+			      mmf->bidx, ablks * sizeof(mmbindex_t),
+			      XDL_ALLOC_MMBLOCK)))
+			return -1;
+		mmf->bidx = bidx;
+		mmf->ablks = ablks;
+	}
+	mmf->bidx[mmf->nblks].off = mmf->fsize;
+	mmf->bidx[mmf->nblks].blk = blk;
+	mmf->nblks++;
+
+	if (!mmf->head)
+		mmf->head = blk;
+	if (mmf->tail)
+		mmf->tail->next = blk;
+	mmf->tail = blk;
+	mmf->wcur = blk;
+
+	return 0;
 }
 
 int
@@ -91,22 +154,41 @@ xdl_mmfile_iscompact(mmfile_t *mmf)
 	return mmf->head == mmf->tail;
 }
 
+/*
+ * Copies mostly read on from where the last one left off, so the block
+ * we're in and the one after it get tried before the binary search.
+ * Empty blocks start where the next one does, and the search lands on
+ * the last block that starts at or before pos, so it never stops on
+ * one of those.
+ */
 int
 xdl_seek_mmfile(mmfile_t *mmf, size_t pos)
 {
-	size_t bsize;
+	long lo, hi, mid;
+	mmbindex_t const *bidx = mmf->bidx;
 
-	if (xdl_mmfile_first(mmf, &bsize)) {
-		do {
-			if (pos < bsize) {
-				mmf->rpos = pos;
-				return 0;
-			}
-			pos -= bsize;
-		} while (xdl_mmfile_next(mmf, &bsize));
+	if (pos >= mmf->fsize)
+		return -1;
+	lo = mmf->rcur ? mmf->ridx : 0;
+	if (pos >= bidx[lo].off && pos - bidx[lo].off < bidx[lo].blk->size) {
+		hi = lo;
+	} else if (lo + 1 < mmf->nblks && pos >= bidx[lo + 1].off &&
+	           pos - bidx[lo + 1].off < bidx[lo + 1].blk->size) {
+		hi = lo + 1;
+	} else {
+		for (lo = 0, hi = mmf->nblks - 1; lo < hi;) {
+			mid = (lo + hi + 1) / 2;
+			if (bidx[mid].off <= pos)
+				lo = mid;
+			else
+				hi = mid - 1;
+		}
 	}
+	mmf->rcur = bidx[hi].blk;
+	mmf->ridx = hi;
+	mmf->rpos = pos - bidx[hi].off;
 
-	return -1;
+	return 0;
 }
 
 ssize_t
@@ -120,6 +202,7 @@ xdl_read_mmfile(mmfile_t *mmf, void *data, size_t size)
 		if (mmf->rpos >= rcur->size) {
 			if (!(mmf->rcur = rcur = rcur->next))
 				break;
+			mmf->ridx++;
 			mmf->rpos = 0;
 		}
 		csize = XDL_MIN(size - rsize, rcur->size - mmf->rpos);
@@ -146,8 +229,9 @@ xdl_write_mmfile(mmfile_t *mmf, void const *data, size_t size)
 		    (mmf->flags & XDL_MMF_ATOMIC &&
 		     wcur->size + size > wcur->bsize)) {
 			bsize = XDL_MAX(mmf->bsize, size);
-			if (!(wcur = (mmblock_t *)xdl_malloc(sizeof(mmblock_t) +
-			                                     bsize))) {
+			if (!(wcur = (mmblock_t *)xdl_cmalloc(
+				      sizeof(mmblock_t) + bsize,
+				      XDL_ALLOC_MMBLOCK))) {
 				return wsize;
 			}
 			wcur->flags = 0;
@@ -155,12 +239,10 @@ xdl_write_mmfile(mmfile_t *mmf, void const *data, size_t size)
 			wcur->size = 0;
 			wcur->bsize = bsize;
 			wcur->next = NULL;
-			if (!mmf->head)
-				mmf->head = wcur;
-			if (mmf->tail)
-				mmf->tail->next = wcur;
-			mmf->tail = wcur;
-			mmf->wcur = wcur;
+			if (xdl_mmfile_addblk(mmf, wcur) < 0) {
+				xdl_free(wcur);
+				return wsize;
+			}
 		}
 		csize = XDL_MIN(size - wsize, wcur->bsize - wcur->size);
 		memcpy(wcur->ptr + wcur->size, (const char *)data + wsize,
@@ -201,8 +283,8 @@ xdl_mmfile_writeallocate(mmfile_t *mmf, size_t size)
 
 	if (!(wcur = mmf->wcur) || wcur->size + size > wcur->bsize) {
 		bsize = XDL_MAX(mmf->bsize, size);
-		if (!(wcur = (mmblock_t *)xdl_malloc(sizeof(mmblock_t) +
-		                                     bsize))) {
+		if (!(wcur = (mmblock_t *)xdl_cmalloc(sizeof(mmblock_t) + bsize,
+		                                      XDL_ALLOC_MMBLOCK))) {
 			return NULL;
 		}
 		wcur->flags = 0;
@@ -210,12 +292,10 @@ xdl_mmfile_writeallocate(mmfile_t *mmf, size_t size)
 		wcur->size = 0;
 		wcur->bsize = bsize;
 		wcur->next = NULL;
-		if (!mmf->head)
-			mmf->head = wcur;
-		if (mmf->tail)
-			mmf->tail->next = wcur;
-		mmf->tail = wcur;
-		mmf->wcur = wcur;
+		if (xdl_mmfile_addblk(mmf, wcur) < 0) {
+			xdl_free(wcur);
+			return NULL;
+		}
 	}
 
 	blk = wcur->ptr + wcur->size;
@@ -230,19 +310,18 @@ xdl_mmfile_ptradd(mmfile_t *mmf, char *ptr, size_t size, uint32_t flags)
 {
 	mmblock_t *wcur;
 
-	if (!(wcur = (mmblock_t *)xdl_malloc(sizeof(mmblock_t)))) {
+	if (!(wcur = (mmblock_t *)xdl_cmalloc(sizeof(mmblock_t),
+	                                      XDL_ALLOC_MMBLOCK))) {
 		return -1;
 	}
 	wcur->flags = flags;
 	wcur->ptr = ptr;
 	wcur->size = wcur->bsize = size;
 	wcur->next = NULL;
-	if (!mmf->head)
-		mmf->head = wcur;
-	if (mmf->tail)
-		mmf->tail->next = wcur;
-	mmf->tail = wcur;
-	mmf->wcur = wcur;
+	if (xdl_mmfile_addblk(mmf, wcur) < 0) {
+		xdl_free(wcur);
+		return -1;
+	}
 
 	mmf->fsize += size;
 
@@ -260,6 +339,7 @@ xdl_copy_mmfile(mmfile_t *mmf, size_t size, xdemitcb_t *ecb)
 		if (mmf->rpos >= rcur->size) {
 			if (!(mmf->rcur = rcur = rcur->next))
 				break;
+			mmf->ridx++;
 			mmf->rpos = 0;
 		}
 		csize = XDL_MIN(size - rsize, rcur->size - mmf->rpos);
@@ -280,6 +360,7 @@ xdl_mmfile_first(mmfile_t *mmf, size_t *size)
 {
 	if (!(mmf->rcur = mmf->head))
 		return NULL;
+	mmf->ridx = 0;
 
 	*size = mmf->rcur->size;
 
@@ -291,6 +372,7 @@ xdl_mmfile_next(mmfile_t *mmf, size_t *size)
 {
 	if (!mmf->rcur || !(mmf->rcur = mmf->rcur->next))
 		return NULL;
+	mmf->ridx++;
 
 	*size = mmf->rcur->size;
 
@@ -417,8 +499,9 @@ xdl_cha_alloc(chastore_t *cha)
 	void *data;
 
 	if (!(ancur = cha->ancur) || ancur->icurr == cha->nsize) {
-		if (!(ancur = (chanode_t *)xdl_malloc(sizeof(chanode_t) +
-		                                      cha->nsize))) {
+		if (!(ancur = (chanode_t *)xdl_cmalloc(sizeof(chanode_t) +
+		                                               cha->nsize,
+		                                       XDL_ALLOC_CHASTORE))) {
 			return NULL;
 		}
 		ancur->icurr = 0;
@@ -511,6 +594,35 @@ xdl_hash_record(const char **data, const char *top)
 	return ha;
 }
 
+/*
+ * Number of bytes, up to max, that match going forward from p1 and p2.
+ */
+size_t
+xdl_match_fwd(unsigned char const *p1, unsigned char const *p2, size_t max)
+{
+	size_t n;
+
+	for (n = 0; n < max && p1[n] == p2[n]; n++)
+		;
+
+	return n;
+}
+
+/*
+ * Number of bytes, up to max, that match going backward from the bytes
+ * just before p1 and p2.
+ */
+size_t
+xdl_match_bwd(unsigned char const *p1, unsigned char const *p2, size_t max)
+{
+	size_t n;
+
+	for (n = 0; n < max && p1[-1 - (ssize_t)n] == p2[-1 - (ssize_t)n]; n++)
+		;
+
+	return n;
+}
+
 unsigned int
 xdl_hashbits(size_t size)
 {
@@ -34,9 +34,17 @@ void *xdl_cha_first(chastore_t *cha);
 void *xdl_cha_next(chastore_t *cha);
 size_t xdl_guess_lines(mmfile_t *mf);
 unsigned long xdl_hash_record(const char **data, const char *top);
+size_t xdl_match_fwd(unsigned char const *p1, unsigned char const *p2,
+                     size_t max);
+size_t xdl_match_bwd(unsigned char const *p1, unsigned char const *p2,
+                     size_t max);
 unsigned int xdl_hashbits(size_t size);
 int xdl_num_out(char *out, long val);
 long xdl_atol(const char *str, const char **next);
+void *xdl_cmalloc(size_t size, int cls);
+void *xdl_crealloc(void *ptr, size_t size, int cls);
+void xdl_phase_begin(int phase);
+void xdl_phase_end(int phase, size_t size);
 int xdl_emit_hunk_hdr(size_t s1, size_t c1, size_t s2, size_t c2,
                       xdemitcb_t *ecb);
 
@@ -0,0 +1,789 @@
+/*
+ *  LibXDiff by Davide Libenzi ( File Differential Library )
+ *  Copyright (C) 2003  Davide Libenzi
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *  Davide Libenzi <davidel@xmailserver.org>
+ *
+ */
+
+/*
+ * VCDIFF (RFC 3284) support.  The encoder sits on the output side of the
+ * binary diff engines and turns their op stream into a VCDIFF delta with
+ * a single window, using the default code table and address cache.  The
+ * decoder applies such deltas a window at a time.  Neither side supports
+ * secondary compressors, custom code tables, or windows that copy from
+ * an earlier target (VCD_TARGET).
+ */
+
+#include "xinclude.h"
+
+#define XVCD_MAGIC0 0xd6
+#define XVCD_MAGIC1 0xc3
+#define XVCD_MAGIC2 0xc4
+#define XVCD_VERSION 0x00
+#define XVCD_HDR_SIZE 5
+
+#define XVCD_DECOMPRESS (1 << 0)
+#define XVCD_CODETABLE (1 << 1)
+#define XVCD_APPHEADER (1 << 2)
+
+/*
+ * Our application header: a tag, then the adler32 and size of the
+ * source the delta was made against, so it can be checked the way a
+ * native patch's header is.  Anyone else's is skipped.
+ */
+#define XVCD_APPTAG "XDLa"
+#define XVCD_APPTAG_SIZE 4
+#define XVCD_APPHDR_SIZE (XVCD_APPTAG_SIZE + 8)
+
+#define XVCD_SOURCE (1 << 0)
+#define XVCD_TARGET (1 << 1)
+
+#define XVCD_NOOP 0
+#define XVCD_ADD 1
+#define XVCD_RUN 2
+#define XVCD_COPY 3
+
+#define XVCD_S_NEAR 4
+#define XVCD_S_SAME 3
+#define XVCD_MODE_SELF 0
+#define XVCD_MODE_HERE 1
+#define XVCD_MODE_NEAR 2
+#define XVCD_MODE_SAME (XVCD_MODE_NEAR + XVCD_S_NEAR)
+#define XVCD_MODES (XVCD_MODE_SAME + XVCD_S_SAME)
+
+#define XVCD_FIRST_PAIR 163
+
+/* varints are at most 10 bytes for 64 bits */
+#define XVCD_VARINT_MAX 10
+
+typedef struct s_xvcdinst {
+	unsigned char inst1, size1, mode1;
+	unsigned char inst2, size2, mode2;
+} xvcdinst_t;
+
+typedef struct s_xvcdcache {
+	long near[XVCD_S_NEAR];
+	int next;
+	long same[XVCD_S_SAME * 256];
+} xvcdcache_t;
+
+typedef struct s_xvcdbuf {
+	char *ptr;
+	long size, alloc;
+} xvcdbuf_t;
+
+enum {
+	XVCD_ST_HDR,
+	XVCD_ST_OP,
+	XVCD_ST_DATA,
+};
+
+struct s_xdvcdenc {
+	xdemitcb_t *ecb;
+	int state;
+	unsigned char op[XDL_COPYSOP_SIZE];
+	long oplen, opneed;
+	long insleft;
+	long srclen, tpos;
+	unsigned long srcfp;
+	xvcdbuf_t data, inst, addr;
+	xvcdcache_t cache;
+	long lastpos;
+	int lastinst, lastsize, lastmode;
+};
+
+/*
+ * The default instruction code table, laid out the way section 5.6 of
+ * the RFC describes it: RUN, ADD with sizes 0 to 17, COPY with sizes 0
+ * and 4 to 18 in each mode, then the ADD+COPY and COPY+ADD pairs.
+ */
+#define XVA(s) { XVCD_ADD, s, 0, XVCD_NOOP, 0, 0 }
+#define XVC(s, m) { XVCD_COPY, s, m, XVCD_NOOP, 0, 0 }
+#define XVC16(m) XVC(0, m), XVC(4, m), XVC(5, m), XVC(6, m), XVC(7, m), \
+	XVC(8, m), XVC(9, m), XVC(10, m), XVC(11, m), XVC(12, m), \
+	XVC(13, m), XVC(14, m), XVC(15, m), XVC(16, m), XVC(17, m), XVC(18, m)
+#define XVAC(a, c, m) { XVCD_ADD, a, 0, XVCD_COPY, c, m }
+#define XVAC3(a, m) XVAC(a, 4, m), XVAC(a, 5, m), XVAC(a, 6, m)
+#define XVAC12(m) XVAC3(1, m), XVAC3(2, m), XVAC3(3, m), XVAC3(4, m)
+#define XVAC4(m) XVAC(1, 4, m), XVAC(2, 4, m), XVAC(3, 4, m), XVAC(4, 4, m)
+#define XVCA(m) { XVCD_COPY, 4, m, XVCD_ADD, 1, 0 }
+
+static const xvcdinst_t xvcd_table[256] = {
+	{ XVCD_RUN, 0, 0, XVCD_NOOP, 0, 0 },
+	XVA(0), XVA(1), XVA(2), XVA(3), XVA(4), XVA(5),
+	XVA(6), XVA(7), XVA(8), XVA(9), XVA(10), XVA(11),
+	XVA(12), XVA(13), XVA(14), XVA(15), XVA(16), XVA(17),
+	XVC16(0), XVC16(1), XVC16(2),
+	XVC16(3), XVC16(4), XVC16(5),
+	XVC16(6), XVC16(7), XVC16(8),
+	XVAC12(0), XVAC12(1), XVAC12(2),
+	XVAC12(3), XVAC12(4), XVAC12(5),
+	XVAC4(6), XVAC4(7), XVAC4(8),
+	XVCA(0), XVCA(1), XVCA(2), XVCA(3), XVCA(4),
+	XVCA(5), XVCA(6), XVCA(7), XVCA(8),
+};
+
+static void
+xvcd_init_cache(xvcdcache_t *cache)
+{
+	memset(cache, 0, sizeof(*cache));
+}
+
+static void
+xvcd_update_cache(xvcdcache_t *cache, long addr)
+{
+	cache->near[cache->next] = addr;
+	cache->next = (cache->next + 1) % XVCD_S_NEAR;
+	cache->same[addr % (XVCD_S_SAME * 256)] = addr;
+}
+
+static int
+xvcd_varint_len(unsigned long val)
+{
+	int n;
+
+	for (n = 1; val >= 128; val >>= 7)
+		n++;
+
+	return n;
+}
+
+static int
+xvcd_put_varint(unsigned char *buf, unsigned long val)
+{
+	int i, n = xvcd_varint_len(val);
+
+	for (i = n - 1; i >= 0; i--, val >>= 7)
+		buf[i] = (val & 0x7f) | (i == n - 1 ? 0 : 0x80);
+
+	return n;
+}
+
+static int
+xvcd_get_varint(unsigned char const **pdata, unsigned char const *top,
+                long *val)
+{
+	unsigned long v = 0;
+	unsigned char const *data = *pdata;
+
+	do {
+		if (data >= top || v > (LONG_MAX >> 7))
+			return -1;
+		v = (v << 7) | (*data & 0x7f);
+	} while (*data++ & 0x80);
+	*pdata = data;
+	*val = (long)v;
+
+	return 0;
+}
+
+static int
+xvcd_buf_add(xvcdbuf_t *buf, void const *data, long size)
+{
+	long alloc;
+	char *ptr;
+
+	if (buf->size + size > buf->alloc) {
+		for (alloc = buf->alloc ? buf->alloc : 1024;
+		     alloc < buf->size + size; alloc *= 2)
+			;
+		if ((ptr = (char *)xdl_crealloc(buf->ptr, alloc,
+		                                XDL_ALLOC_ARENA)) == NULL)
+			return -1;
+		buf->ptr = ptr;
+		buf->alloc = alloc;
+	}
+	memcpy(buf->ptr + buf->size, data, size);
+	buf->size += size;
+
+	return 0;
+}
+
+static int
+xvcd_buf_varint(xvcdbuf_t *buf, unsigned long val)
+{
+	unsigned char tmp[XVCD_VARINT_MAX];
+
+	return xvcd_buf_add(buf, tmp, xvcd_put_varint(tmp, val));
+}
+
+/*
+ * Pick the cheapest address mode for a copy from addr, write the address
+ * out, and return the mode.  A hit in the "same" cache is one byte;
+ * otherwise it's whichever of the plain, "here" relative or "near"
+ * relative varints is shortest.
+ */
+static int
+xvcd_enc_addr(xdvcdenc_t *enc, long addr, long here)
+{
+	int i, mode, bmode;
+	long val, bval;
+	unsigned char byte;
+	xvcdcache_t *cache = &enc->cache;
+
+	i = (int)(addr % (XVCD_S_SAME * 256));
+	if (cache->same[i] == addr) {
+		mode = XVCD_MODE_SAME + i / 256;
+		byte = (unsigned char)(i % 256);
+		xvcd_update_cache(cache, addr);
+		return xvcd_buf_add(&enc->addr, &byte, 1) < 0 ? -1 : mode;
+	}
+
+	bmode = XVCD_MODE_SELF;
+	bval = addr;
+	val = here - addr;
+	if (xvcd_varint_len(val) < xvcd_varint_len(bval)) {
+		bmode = XVCD_MODE_HERE;
+		bval = val;
+	}
+	for (i = 0; i < XVCD_S_NEAR; i++) {
+		val = addr - cache->near[i];
+		if (val >= 0 && xvcd_varint_len(val) < xvcd_varint_len(bval)) {
+			bmode = XVCD_MODE_NEAR + i;
+			bval = val;
+		}
+	}
+	xvcd_update_cache(cache, addr);
+
+	return xvcd_buf_varint(&enc->addr, bval) < 0 ? -1 : bmode;
+}
+
+/*
+ * Add an instruction to the instruction section.  Small sizes go in the
+ * opcode, and where the default table has a combined opcode for this
+ * instruction and the one before it, the two get folded together.
+ */
+static int
+xvcd_enc_inst(xdvcdenc_t *enc, int inst, long size, int mode)
+{
+	int i;
+	unsigned char opcode;
+	xvcdinst_t const *e;
+
+	if (enc->lastpos >= 0) {
+		for (i = XVCD_FIRST_PAIR; i < 256; i++) {
+			e = &xvcd_table[i];
+			if (e->inst1 == enc->lastinst &&
+			    e->size1 == enc->lastsize &&
+			    e->mode1 == enc->lastmode && e->inst2 == inst &&
+			    e->size2 == size && e->mode2 == mode) {
+				enc->inst.ptr[enc->lastpos] = (char)i;
+				enc->lastpos = -1;
+				return 0;
+			}
+		}
+	}
+
+	if (inst == XVCD_ADD)
+		opcode = size >= 1 && size <= 17 ? 1 + size : 1;
+	else
+		opcode = 19 + mode * 16 + (size >= 4 && size <= 18 ? size - 3 : 0);
+
+	enc->lastpos = -1;
+	if (xvcd_table[opcode].size1 == 0) {
+		if (xvcd_buf_add(&enc->inst, &opcode, 1) < 0 ||
+		    xvcd_buf_varint(&enc->inst, size) < 0)
+			return -1;
+	} else {
+		enc->lastpos = enc->inst.size;
+		enc->lastinst = inst;
+		enc->lastsize = (int)size;
+		enc->lastmode = mode;
+		if (xvcd_buf_add(&enc->inst, &opcode, 1) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int
+xvcd_enc_copy(xdvcdenc_t *enc, long addr, long size)
+{
+	int mode;
+
+	if (size == 0)
+		return 0;
+	if ((mode = xvcd_enc_addr(enc, addr, enc->srclen + enc->tpos)) < 0 ||
+	    xvcd_enc_inst(enc, XVCD_COPY, size, mode) < 0)
+		return -1;
+	enc->tpos += size;
+
+	return 0;
+}
+
+/*
+ * How many bytes of op header we need, given its first byte.
+ */
+static long
+xvcd_op_size(unsigned char op)
+{
+	switch (op) {
+	case XDL_BDOP_INS:
+		return 2;
+	case XDL_BDOP_INSB:
+		return XDL_INSBOP_SIZE;
+	case XDL_BDOP_CPY:
+	case XDL_BDOP_CPYT:
+		return XDL_COPYOP_SIZE;
+	default:
+		/* VCDIFF only has the one source */
+		return -1;
+	}
+}
+
+static int
+xvcd_enc_op(xdvcdenc_t *enc)
+{
+	long off, size;
+	unsigned char const *op = enc->op;
+
+	switch (op[0]) {
+	case XDL_BDOP_INS:
+		size = op[1];
+		break;
+	case XDL_BDOP_INSB:
+		XDL_LE32_GET(op + 1, size);
+		break;
+	case XDL_BDOP_CPY:
+	case XDL_BDOP_CPYT:
+		XDL_LE32_GET(op + 1, off);
+		XDL_LE32_GET(op + 5, size);
+		if (op[0] == XDL_BDOP_CPY) {
+			if (off > enc->srclen || size > enc->srclen - off)
+				return -1;
+		} else {
+			if (off >= enc->tpos)
+				return -1;
+			off += enc->srclen;
+		}
+		enc->state = XVCD_ST_OP;
+		return xvcd_enc_copy(enc, off, size);
+	default:
+		return -1;
+	}
+
+	if (size == 0) {
+		enc->state = XVCD_ST_OP;
+		return 0;
+	}
+	if (xvcd_enc_inst(enc, XVCD_ADD, size, 0) < 0)
+		return -1;
+	enc->tpos += size;
+	enc->insleft = size;
+	enc->state = XVCD_ST_DATA;
+
+	return 0;
+}
+
+xdvcdenc_t *
+xdl_vcdiff_enc_init(xdemitcb_t *ecb)
+{
+	xdvcdenc_t *enc;
+
+	if ((enc = (xdvcdenc_t *)xdl_malloc(sizeof(xdvcdenc_t))) == NULL)
+		return NULL;
+	memset(enc, 0, sizeof(*enc));
+	enc->ecb = ecb;
+	enc->state = XVCD_ST_HDR;
+	enc->opneed = XDL_BPATCH_HDR_SIZE;
+	enc->lastpos = -1;
+	xvcd_init_cache(&enc->cache);
+
+	return enc;
+}
+
+void
+xdl_vcdiff_enc_free(xdvcdenc_t *enc)
+{
+	if (!enc)
+		return;
+	xdl_free(enc->data.ptr);
+	xdl_free(enc->inst.ptr);
+	xdl_free(enc->addr.ptr);
+	xdl_free(enc);
+}
+
+/*
+ * This is an outf for xdemitcb_t, so it can be handed straight to
+ * xdl_bdiff() and friends with the encoder as priv.  Ops may be split
+ * across buffers any way at all.
+ */
+int
+xdl_vcdiff_enc_outf(void *priv, mmbuffer_t *mb, size_t nbuf)
+{
+	size_t i;
+	long n;
+	unsigned char const *data, *top;
+	xdvcdenc_t *enc = (xdvcdenc_t *)priv;
+
+	for (i = 0; i < nbuf; i++) {
+		data = (unsigned char const *)mb[i].ptr;
+		for (top = data + mb[i].size; data < top;) {
+			if (enc->state == XVCD_ST_DATA) {
+				n = XDL_MIN(enc->insleft, (long)(top - data));
+				if (xvcd_buf_add(&enc->data, data, n) < 0)
+					return -1;
+				data += n;
+				if ((enc->insleft -= n) == 0)
+					enc->state = XVCD_ST_OP;
+				continue;
+			}
+			if (enc->state == XVCD_ST_OP && enc->oplen == 0 &&
+			    (enc->opneed = xvcd_op_size(*data)) < 0)
+				return -1;
+
+			n = XDL_MIN(enc->opneed - enc->oplen, (long)(top - data));
+			memcpy(enc->op + enc->oplen, data, n);
+			data += n;
+			if ((enc->oplen += n) < enc->opneed)
+				continue;
+			enc->oplen = 0;
+
+			if (enc->state == XVCD_ST_HDR) {
+				XDL_LE32_GET(enc->op, enc->srcfp);
+				XDL_LE32_GET(enc->op + 4, enc->srclen);
+				enc->state = XVCD_ST_OP;
+			} else if (xvcd_enc_op(enc) < 0) {
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Write out the file header and the window.  An empty target has no
+ * window at all.
+ */
+int
+xdl_vcdiff_enc_end(xdvcdenc_t *enc)
+{
+	int n = 0;
+	long enclen;
+	mmbuffer_t mb[4];
+	unsigned char hdr[XVCD_HDR_SIZE + 1 + XVCD_APPHDR_SIZE +
+	                  8 * XVCD_VARINT_MAX];
+
+	if (enc->state == XVCD_ST_HDR || enc->state == XVCD_ST_DATA ||
+	    enc->oplen != 0)
+		return -1;
+
+	hdr[n++] = XVCD_MAGIC0;
+	hdr[n++] = XVCD_MAGIC1;
+	hdr[n++] = XVCD_MAGIC2;
+	hdr[n++] = XVCD_VERSION;
+	hdr[n++] = XVCD_APPHEADER;
+	n += xvcd_put_varint(hdr + n, XVCD_APPHDR_SIZE);
+	memcpy(hdr + n, XVCD_APPTAG, XVCD_APPTAG_SIZE);
+	n += XVCD_APPTAG_SIZE;
+	XDL_LE32_PUT(hdr + n, enc->srcfp);
+	XDL_LE32_PUT(hdr + n + 4, enc->srclen);
+	n += 8;
+	if (enc->tpos > 0) {
+		if (enc->srclen > 0) {
+			hdr[n++] = XVCD_SOURCE;
+			n += xvcd_put_varint(hdr + n, enc->srclen);
+			n += xvcd_put_varint(hdr + n, 0);
+		} else {
+			hdr[n++] = 0;
+		}
+		enclen = xvcd_varint_len(enc->tpos) + 1 +
+		         xvcd_varint_len(enc->data.size) +
+		         xvcd_varint_len(enc->inst.size) +
+		         xvcd_varint_len(enc->addr.size) + enc->data.size +
+		         enc->inst.size + enc->addr.size;
+		n += xvcd_put_varint(hdr + n, enclen);
+		n += xvcd_put_varint(hdr + n, enc->tpos);
+		hdr[n++] = 0;
+		n += xvcd_put_varint(hdr + n, enc->data.size);
+		n += xvcd_put_varint(hdr + n, enc->inst.size);
+		n += xvcd_put_varint(hdr + n, enc->addr.size);
+	}
+
+	mb[0].ptr = (char *)hdr;
+	mb[0].size = n;
+	mb[1].ptr = enc->data.ptr;
+	mb[1].size = enc->data.size;
+	mb[2].ptr = enc->inst.ptr;
+	mb[2].size = enc->inst.size;
+	mb[3].ptr = enc->addr.ptr;
+	mb[3].size = enc->addr.size;
+
+	return enc->ecb->outf(enc->ecb->priv, mb, enc->tpos > 0 ? 4 : 1) < 0
+	               ? -1
+	               : 0;
+}
+
+/*
+ * Turn a whole binary patch into VCDIFF.
+ */
+int
+xdl_vcdiff_encode(mmfile_t *mmfp, xdemitcb_t *ecb)
+{
+	size_t size;
+	char const *blk;
+	mmbuffer_t mb;
+	xdvcdenc_t *enc;
+
+	if ((enc = xdl_vcdiff_enc_init(ecb)) == NULL)
+		return -1;
+	for (blk = (char const *)xdl_mmfile_first(mmfp, &size); blk;
+	     blk = (char const *)xdl_mmfile_next(mmfp, &size)) {
+		mb.ptr = (char *)blk;
+		mb.size = size;
+		if (xdl_vcdiff_enc_outf(enc, &mb, 1) < 0) {
+			xdl_vcdiff_enc_free(enc);
+			return -1;
+		}
+	}
+	if (xdl_vcdiff_enc_end(enc) < 0) {
+		xdl_vcdiff_enc_free(enc);
+		return -1;
+	}
+	xdl_vcdiff_enc_free(enc);
+
+	return 0;
+}
+
+static int
+xvcd_read_byte(mmfile_t *mmfp, unsigned char *byte)
+{
+	return xdl_read_mmfile(mmfp, byte, 1) == 1 ? 0 : -1;
+}
+
+static int
+xvcd_read_varint(mmfile_t *mmfp, long *val)
+{
+	int i;
+	unsigned char buf[XVCD_VARINT_MAX];
+	unsigned char const *data = buf;
+
+	for (i = 0; i < XVCD_VARINT_MAX; i++) {
+		if (xvcd_read_byte(mmfp, &buf[i]) < 0)
+			return -1;
+		if (!(buf[i] & 0x80))
+			return xvcd_get_varint(&data, buf + i + 1, val);
+	}
+
+	return -1;
+}
+
+/*
+ * The read position is only kept within the current block, so skipping
+ * is done by reading.
+ */
+static int
+xvcd_skip(mmfile_t *mmfp, long len)
+{
+	long n;
+	char buf[256];
+
+	for (; len > 0; len -= n) {
+		n = XDL_MIN(len, (long)sizeof(buf));
+		if (xdl_read_mmfile(mmfp, buf, n) != n)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int
+xvcd_dec_addr(xvcdcache_t *cache, int mode, long here,
+              unsigned char const **paddr, unsigned char const *atop,
+              long *paddrv)
+{
+	long addr;
+
+	if (mode >= XVCD_MODE_SAME) {
+		if (*paddr >= atop)
+			return -1;
+		addr = cache->same[(mode - XVCD_MODE_SAME) * 256 + *(*paddr)++];
+	} else {
+		if (xvcd_get_varint(paddr, atop, &addr) < 0)
+			return -1;
+		if (mode == XVCD_MODE_HERE)
+			addr = here - addr;
+		else if (mode >= XVCD_MODE_NEAR)
+			addr += cache->near[mode - XVCD_MODE_NEAR];
+	}
+	if (addr < 0 || addr >= here)
+		return -1;
+	xvcd_update_cache(cache, addr);
+	*paddrv = addr;
+
+	return 0;
+}
+
+/*
+ * Run one window's instructions.  seg is the source segment, and copies
+ * address it followed by the target window, so a copy may run from the
+ * end of one into the start of the other, or into itself.
+ */
+static int
+xvcd_dec_window(char const *seg, long seglen, unsigned char const *enc,
+                long enclen, xdemitcb_t *ecb)
+{
+	int j, inst, mode;
+	long tgtlen, datalen, instlen, addrlen, size, addr, n, tpos = 0;
+	unsigned char const *ptr, *top, *data, *dtop, *ip, *itop, *ap, *atop;
+	char *tgt;
+	xvcdcache_t cache;
+	xvcdinst_t const *e;
+	mmbuffer_t mb;
+
+	ptr = enc;
+	top = enc + enclen;
+	if (xvcd_get_varint(&ptr, top, &tgtlen) < 0 || ptr >= top ||
+	    *ptr++ != 0 || xvcd_get_varint(&ptr, top, &datalen) < 0 ||
+	    xvcd_get_varint(&ptr, top, &instlen) < 0 ||
+	    xvcd_get_varint(&ptr, top, &addrlen) < 0)
+		return -1;
+	/*
+	 * Anything left over in front of the sections is a checksum from
+	 * an encoder extension; we don't know which one, so it's skipped.
+	 */
+	if (datalen > top - ptr || instlen > top - ptr - datalen ||
+	    addrlen > top - ptr - datalen - instlen)
+		return -1;
+	ptr = top - (datalen + instlen + addrlen);
+	data = ptr;
+	dtop = ip = data + datalen;
+	itop = ap = ip + instlen;
+	atop = ap + addrlen;
+
+	if ((tgt = (char *)xdl_malloc(tgtlen + 1)) == NULL)
+		return -1;
+	xvcd_init_cache(&cache);
+	while (ip < itop) {
+		e = &xvcd_table[*ip++];
+		for (j = 0; j < 2; j++) {
+			inst = j ? e->inst2 : e->inst1;
+			size = j ? e->size2 : e->size1;
+			mode = j ? e->mode2 : e->mode1;
+			if (inst == XVCD_NOOP)
+				continue;
+			if (size == 0 && xvcd_get_varint(&ip, itop, &size) < 0)
+				goto err;
+			if (size > tgtlen - tpos)
+				goto err;
+
+			switch (inst) {
+			case XVCD_ADD:
+				if (size > dtop - data)
+					goto err;
+				memcpy(tgt + tpos, data, size);
+				data += size;
+				break;
+			case XVCD_RUN:
+				if (data >= dtop)
+					goto err;
+				memset(tgt + tpos, *data++, size);
+				break;
+			case XVCD_COPY:
+				if (xvcd_dec_addr(&cache, mode, seglen + tpos, &ap,
+				                  atop, &addr) < 0)
+					goto err;
+				for (n = 0; n < size && addr + n < seglen; n++)
+					tgt[tpos + n] = seg[addr + n];
+				for (; n < size; n++)
+					tgt[tpos + n] = tgt[addr + n - seglen];
+				break;
+			}
+			tpos += size;
+		}
+	}
+	if (tpos != tgtlen || data != dtop || ap != atop)
+		goto err;
+
+	mb.ptr = tgt;
+	mb.size = tgtlen;
+	if (tgtlen > 0 && ecb->outf(ecb->priv, &mb, 1) < 0)
+		goto err;
+	xdl_free(tgt);
+
+	return 0;
+
+err:
+	xdl_free(tgt);
+	return -1;
+}
+
+/*
+ * Apply a VCDIFF delta to src, a window at a time.  If the delta has
+ * our application header, src is checked against it before anything is
+ * written, the same as for a native patch.
+ */
+int
+xdl_vcdiff_patch(mmbuffer_t *src, mmfile_t *mmfp, xdemitcb_t *ecb)
+{
+	long len, seglen, segpos, enclen;
+	unsigned char ind, hdr[XVCD_HDR_SIZE], app[XVCD_APPHDR_SIZE];
+	unsigned char *enc;
+	unsigned long fp;
+	size_t size;
+	char const *seg;
+
+	if (xdl_seek_mmfile(mmfp, 0) < 0 ||
+	    xdl_read_mmfile(mmfp, hdr, XVCD_HDR_SIZE) != XVCD_HDR_SIZE ||
+	    hdr[0] != XVCD_MAGIC0 || hdr[1] != XVCD_MAGIC1 ||
+	    hdr[2] != XVCD_MAGIC2 || hdr[3] != XVCD_VERSION ||
+	    (hdr[4] & (XVCD_DECOMPRESS | XVCD_CODETABLE)))
+		return -1;
+	if (hdr[4] & XVCD_APPHEADER) {
+		if (xvcd_read_varint(mmfp, &len) < 0)
+			return -1;
+		if (len == XVCD_APPHDR_SIZE) {
+			if (xdl_read_mmfile(mmfp, app, len) != len)
+				return -1;
+			XDL_LE32_GET(app + XVCD_APPTAG_SIZE, fp);
+			XDL_LE32_GET(app + XVCD_APPTAG_SIZE + 4, size);
+			if (!memcmp(app, XVCD_APPTAG, XVCD_APPTAG_SIZE) &&
+			    (size != src->size || fp != xdl_mmb_adler32(src)))
+				return -1;
+		} else if (xvcd_skip(mmfp, len) < 0) {
+			return -1;
+		}
+	}
+
+	while (xvcd_read_byte(mmfp, &ind) == 0) {
+		seg = NULL;
+		seglen = 0;
+		if (ind & XVCD_TARGET || ind & ~(XVCD_SOURCE | XVCD_TARGET | 4))
+			return -1;
+		if (ind & XVCD_SOURCE) {
+			if (xvcd_read_varint(mmfp, &seglen) < 0 ||
+			    xvcd_read_varint(mmfp, &segpos) < 0 ||
+			    segpos > (long)src->size ||
+			    seglen > (long)src->size - segpos)
+				return -1;
+			seg = src->ptr + segpos;
+		}
+		if (xvcd_read_varint(mmfp, &enclen) < 0 ||
+		    (enc = (unsigned char *)xdl_malloc(enclen + 1)) == NULL)
+			return -1;
+		if (xdl_read_mmfile(mmfp, enc, enclen) != enclen ||
+		    xvcd_dec_window(seg, seglen, enc, enclen, ecb) < 0) {
+			xdl_free(enc);
+			return -1;
+		}
+		xdl_free(enc);
+	}
+
+	return 0;
+}
@@ -0,0 +1,193 @@
+// SPDX-License-Identifier: GPLv3-or-later
+/*
+ * mem.c - libxdiff allocation accounting
+ * Copyright Peter Jones <pjones@redhat.com>
+ */
+
+#include "bindiff.h"
+
+#include <stdalign.h>
+#include <xdiff.h>
+
+/*
+ * Every allocation libxdiff makes gets one of these in front of it, so
+ * that free and realloc know what they're giving back and who to
+ * credit it to.
+ */
+struct mem_hdr {
+	alignas(max_align_t) size_t size;
+	uint8_t cls;
+	uint8_t phase;
+};
+
+struct mem_stats {
+	size_t allocs;
+	size_t bytes;
+	size_t live;
+	size_t peak;
+};
+
+static const char * const class_names[XDL_ALLOC_MAX] = {
+	[XDL_ALLOC_OTHER] = "other",
+	[XDL_ALLOC_CHASTORE] = "chastore",
+	[XDL_ALLOC_HASH] = "hash",
+	[XDL_ALLOC_ARENA] = "arena",
+	[XDL_ALLOC_MMBLOCK] = "mmblock",
+};
+
+/*
+ * by_phase[TIMING_MAX] is for allocations made outside of any phase.
+ * For phases, "peak" is the most libxdiff memory that was live at any
+ * point while that phase was running, no matter who allocated it.
+ */
+static struct mem_stats by_class[XDL_ALLOC_MAX];
+static struct mem_stats by_phase[TIMING_MAX + 1];
+static struct mem_stats total;
+static bool installed = false;
+
+static void
+account(struct mem_hdr *hdr, ssize_t delta, bool new)
+{
+	struct mem_stats *c = &by_class[hdr->cls];
+	struct mem_stats *p = &by_phase[hdr->phase];
+	struct mem_stats *cur = &by_phase[timing_phase()];
+
+	c->live += delta;
+	p->live += delta;
+	total.live += delta;
+	if (new) {
+		c->allocs += 1;
+		p->allocs += 1;
+		total.allocs += 1;
+	}
+	if (delta > 0) {
+		c->bytes += delta;
+		p->bytes += delta;
+		total.bytes += delta;
+
+		c->peak = MAX(c->peak, c->live);
+		cur->peak = MAX(cur->peak, total.live);
+		total.peak = MAX(total.peak, total.live);
+	}
+}
+
+/*
+ * Called on every phase change, so phases that don't allocate anything
+ * themselves (like scan) still show what they were holding on to.
+ */
+HIDDEN void
+mem_phase_mark(timing_phase_t phase)
+{
+	if (installed)
+		by_phase[phase].peak = MAX(by_phase[phase].peak, total.live);
+}
+
+static void *
+mem_malloc(void *priv UNUSED, size_t size)
+{
+	struct mem_hdr *hdr;
+	int cls = xdl_alloc_class();
+
+	hdr = malloc(sizeof(*hdr) + size);
+	if (!hdr)
+		return NULL;
+
+	hdr->size = size;
+	hdr->cls = cls >= 0 && cls < XDL_ALLOC_MAX ? cls : XDL_ALLOC_OTHER;
+	hdr->phase = timing_phase();
+	account(hdr, size, true);
+
+	return hdr + 1;
+}
+
+static void
+mem_free(void *priv UNUSED, void *ptr)
+{
+	struct mem_hdr *hdr;
+
+	if (!ptr)
+		return;
+
+	hdr = (struct mem_hdr *)ptr - 1;
+	account(hdr, -(ssize_t)hdr->size, false);
+	free(hdr);
+}
+
+static void *
+mem_realloc(void *priv, void *ptr, size_t size)
+{
+	struct mem_hdr *hdr, *newhdr;
+
+	if (!ptr)
+		return mem_malloc(priv, size);
+
+	hdr = (struct mem_hdr *)ptr - 1;
+	newhdr = realloc(hdr, sizeof(*hdr) + size);
+	if (!newhdr)
+		return NULL;
+
+	account(newhdr, (ssize_t)size - (ssize_t)newhdr->size, false);
+	newhdr->size = size;
+
+	return newhdr + 1;
+}
+
+/*
+ * This has to happen before libxdiff allocates anything, since we
+ * can't free memory that doesn't have our header on it.
+ */
+HIDDEN void
+mem_init(void)
+{
+	memallocator_t malt = {
+		.malloc = mem_malloc,
+		.free = mem_free,
+		.realloc = mem_realloc,
+	};
+
+	xdl_set_allocator(&malt);
+	installed = true;
+}
+
+static void
+report_row(FILE *out, const char *name, struct mem_stats *s,
+	   unsigned int runs)
+{
+	fprintf(out, "%-9s %12zu %14zu %14zu\n", name, s->allocs / runs,
+		s->bytes / runs, s->peak);
+}
+
+HIDDEN void
+mem_report(FILE *out, unsigned int runs, size_t srcsize, size_t tgtsize)
+{
+	if (runs == 0)
+		runs = 1;
+
+	fprintf(out, "libxdiff memory, source %zu bytes, target %zu bytes%s\n",
+		srcsize, tgtsize, runs > 1 ? ", counts are per run" : "");
+
+	fprintf(out, "%-9s %12s %14s %14s\n", "class", "allocs", "bytes",
+		"peak live");
+	for (int cls = 0; cls < XDL_ALLOC_MAX; cls++) {
+		if (by_class[cls].allocs)
+			report_row(out, class_names[cls], &by_class[cls], runs);
+	}
+
+	fprintf(out, "%-9s %12s %14s %14s\n", "phase", "allocs", "bytes",
+		"peak live");
+	for (timing_phase_t phase = 0; phase <= TIMING_MAX; phase++) {
+		if (by_phase[phase].allocs ||
+		    (phase < TIMING_MAX && by_phase[phase].peak))
+			report_row(out, phase < TIMING_MAX
+					? timing_phase_names[phase]
+					: "none",
+				   &by_phase[phase], runs);
+	}
+
+	report_row(out, "total", &total, runs);
+	if (srcsize)
+		fprintf(out, "peak live is %.2fx the source size\n",
+			(double)total.peak / srcsize);
+}
+
+// vim:fenc=utf-8:tw=75:noet
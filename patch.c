@@ -0,0 +1,892 @@
+// SPDX-License-Identifier: GPLv3-or-later
+/*
+ * patch.c - writing and applying patch files
+ * Copyright Peter Jones <pjones@redhat.com>
+ */
+
+#include "bindiff.h"
+
+#include <libgen.h>
+#include <linux/fs.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <xdiff.h>
+
+static const unsigned char vcdiff_magic[] = { 0xd6, 0xc3, 0xc4 };
+
+static int
+write_all(int fd, const char *buf, size_t sz)
+{
+	while (sz > 0) {
+		ssize_t rc = write(fd, buf, sz);
+
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += rc;
+		sz -= rc;
+	}
+	return 0;
+}
+
+static int
+write_outf(void *priv, mmbuffer_t *mb, size_t nbuf)
+{
+	int fd = *(int *)priv;
+
+	for (size_t i = 0; i < nbuf; i++) {
+		if (write_all(fd, mb[i].ptr, mb[i].size) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * The filter can't work in place, and the inputs are read only maps
+ * anyway, so each one gets filtered into a new buffer.
+ */
+static int
+filter_copy(int filter, mmbuffer_t *dst, mmbuffer_t *src, int n)
+{
+	for (int i = 0; i < n; i++) {
+		dst[i].size = src[i].size;
+		dst[i].ptr = malloc(MAX(src[i].size, 1));
+		if (!dst[i].ptr) {
+			while (i-- > 0)
+				free(dst[i].ptr);
+			return -1;
+		}
+		xdl_bcj_encode(filter, src[i].ptr, src[i].size, dst[i].ptr);
+	}
+	return 0;
+}
+
+static void
+filter_free(mmbuffer_t *bufs, int n)
+{
+	for (int i = 0; i < n; i++)
+		free(bufs[i].ptr);
+}
+
+static int
+resolve_filter(int filter, mmbuffer_t *src)
+{
+	if (filter == PATCH_FILTER_AUTO)
+		return xdl_bcj_detect(src->ptr, src->size);
+	return filter;
+}
+
+static int
+mmfile_outf(void *priv, mmbuffer_t *mb, size_t nbuf)
+{
+	return xdl_writem_mmfile(priv, mb, nbuf) < 0 ? -1 : 0;
+}
+
+/*
+ * An in place patch is worked out from the whole of a native one, so
+ * that's kept in memory until the differ's done.
+ */
+static int
+diff_inplace(struct differ *differ, mmbuffer_t *src, mmbuffer_t *tgt,
+	     xdemitcb_t *out)
+{
+	xdemitcb_t mfcb;
+	mmfile_t mf;
+	int rc;
+
+	if (xdl_init_mmfile(&mf, 64 * 1024, XDL_MMF_ATOMIC) < 0)
+		return -1;
+	mfcb.priv = &mf;
+	mfcb.outf = mmfile_outf;
+
+	rc = differ->diff(src, 1, tgt, &mfcb);
+	if (rc >= 0)
+		rc = xdl_bdiff_inplace(src, &mf, out);
+	xdl_free_mmfile(&mf);
+	return rc;
+}
+
+static int
+diff_patch(struct differ *differ, patch_format_t format, mmbuffer_t *srcs,
+	   int nsrc, mmbuffer_t *tgt, xdemitcb_t *out)
+{
+	xdemitcb_t encb;
+	xdvcdenc_t *enc;
+	int rc;
+
+	if (format == PATCH_NATIVE)
+		return differ->diff(srcs, nsrc, tgt, out);
+
+	if (nsrc != 1) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (format == PATCH_INPLACE)
+		return diff_inplace(differ, &srcs[0], tgt, out);
+
+	enc = xdl_vcdiff_enc_init(out);
+	if (!enc)
+		return -1;
+	encb.priv = enc;
+	encb.outf = xdl_vcdiff_enc_outf;
+
+	rc = differ->diff(srcs, nsrc, tgt, &encb);
+	if (rc >= 0)
+		rc = xdl_vcdiff_enc_end(enc);
+	xdl_vcdiff_enc_free(enc);
+	return rc;
+}
+
+/*
+ * Native patches come straight out of the differ.  For VCDIFF the
+ * differ's ops go through the encoder on their way out, so we never
+ * hold a native copy of the patch.
+ */
+HIDDEN int
+make_patch(struct differ *differ, patch_format_t format, int filter,
+	   mmbuffer_t *srcs, int nsrc, mmbuffer_t *tgt, int fd)
+{
+	xdemitcb_t out = { .priv = &fd, .outf = write_outf };
+	mmbuffer_t *bufs;
+	int rc;
+
+	filter = resolve_filter(filter, &srcs[0]);
+	debug("filter is %d", filter);
+	if (filter == XDL_BCJ_NONE)
+		return diff_patch(differ, format, srcs, nsrc, tgt, &out);
+
+	bufs = calloc(nsrc + 1, sizeof(*bufs));
+	if (!bufs)
+		return -1;
+	if (filter_copy(filter, bufs, srcs, nsrc) < 0) {
+		free(bufs);
+		return -1;
+	}
+	if (filter_copy(filter, &bufs[nsrc], tgt, 1) < 0) {
+		filter_free(bufs, nsrc);
+		free(bufs);
+		return -1;
+	}
+
+	rc = diff_patch(differ, format, bufs, nsrc, &bufs[nsrc], &out);
+
+	filter_free(bufs, nsrc + 1);
+	free(bufs);
+	return rc;
+}
+
+/*
+ * The filter puts branch operands at the end of the file, so it can't
+ * be undone until the whole patched file is here; this collects it.
+ */
+struct unfilter {
+	char *buf;
+	size_t len;
+	size_t alloc;
+};
+
+static int
+unfilter_outf(void *priv, mmbuffer_t *mb, size_t nbuf)
+{
+	struct unfilter *uf = priv;
+
+	for (size_t i = 0; i < nbuf; i++) {
+		if (uf->len + mb[i].size > uf->alloc) {
+			size_t alloc = MAX(uf->alloc * 2, uf->len + mb[i].size);
+			char *buf = realloc(uf->buf, alloc);
+
+			if (!buf)
+				return -1;
+			uf->buf = buf;
+			uf->alloc = alloc;
+		}
+		memcpy(uf->buf + uf->len, mb[i].ptr, mb[i].size);
+		uf->len += mb[i].size;
+	}
+	return 0;
+}
+
+static int
+unfilter_write(int filter, struct unfilter *uf, int fd)
+{
+	char *buf;
+	int rc;
+
+	buf = malloc(MAX(uf->len, 1));
+	if (!buf)
+		return -1;
+	rc = xdl_bcj_decode(filter, uf->buf, uf->len, buf);
+	if (rc < 0)
+		errno = EINVAL;
+	else
+		rc = write_all(fd, buf, uf->len);
+	free(buf);
+	return rc;
+}
+
+/*
+ * A native patch going into a regular file doesn't have to be streamed.
+ * Once it's decoded, every op knows where its bytes go, so the file is
+ * made as big as the target, mapped, and cut into pieces that the
+ * threads take turns filling in.  Copies from the target itself are
+ * done after that, in order, since they read what's been written.
+ */
+#define APPLY_PIECE (4UL << 20)
+
+struct apply_job {
+	xdbpplan_t *plan;
+	char *out;
+	size_t size;
+	size_t n_pieces;
+	size_t next;
+};
+
+static void *
+apply_worker(void *arg)
+{
+	struct apply_job *job = arg;
+	size_t i;
+
+	while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) <
+	       job->n_pieces)
+		xdl_bpatch_plan_run(job->plan, i * APPLY_PIECE,
+				    MIN((i + 1) * APPLY_PIECE, job->size),
+				    job->out);
+	return NULL;
+}
+
+/*
+ * Run worker on nthreads threads, this one included, and wait for them
+ * all.  If threads can't be had, this one does it all by itself.
+ */
+static void
+run_workers(void *(*worker)(void *), void *arg, size_t nthreads)
+{
+	pthread_t *threads = NULL;
+	size_t started = 0;
+
+	if (nthreads > 1)
+		threads = calloc(nthreads - 1, sizeof(*threads));
+	while (threads && started + 1 < nthreads &&
+	       pthread_create(&threads[started], NULL, worker, arg) == 0)
+		started++;
+	worker(arg);
+	for (size_t i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+}
+
+/*
+ * The header's adler32s for the sources are checked before anything is
+ * written, and on a big source summing it is most of the time that
+ * takes.  So each source is cut up the same way the target is, the
+ * pieces are summed on all the threads, and xdl_adler32_combine() puts
+ * them back together.
+ */
+struct sum_job {
+	mmbuffer_t *srcs;
+	int nsrc;
+	size_t *first;
+	uint32_t *sums;
+	size_t n_pieces;
+	size_t next;
+};
+
+static void *
+sum_worker(void *arg)
+{
+	struct sum_job *job = arg;
+	mmbuffer_t mmb;
+	size_t i;
+	int s;
+
+	while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) <
+	       job->n_pieces) {
+		for (s = 0; job->first[s + 1] <= i; s++)
+			;
+		mmb.ptr = job->srcs[s].ptr + (i - job->first[s]) * APPLY_PIECE;
+		mmb.size = MIN((long)APPLY_PIECE, job->srcs[s].ptr +
+				job->srcs[s].size - mmb.ptr);
+		job->sums[i] = xdl_mmb_adler32(&mmb);
+	}
+	return NULL;
+}
+
+static int
+sum_sources(mmbuffer_t *srcs, int nsrc, unsigned int jobs, uint32_t *fps)
+{
+	struct sum_job job = { .srcs = srcs, .nsrc = nsrc, };
+	int s;
+
+	job.first = calloc(nsrc + 1, sizeof(*job.first));
+	if (!job.first)
+		return -1;
+	for (s = 0; s < nsrc; s++)
+		job.first[s + 1] = job.first[s] +
+			(srcs[s].size + APPLY_PIECE - 1) / APPLY_PIECE;
+	job.n_pieces = job.first[nsrc];
+	job.sums = calloc(job.n_pieces + 1, sizeof(*job.sums));
+	if (!job.sums) {
+		free(job.first);
+		return -1;
+	}
+
+	run_workers(sum_worker, &job, MIN((size_t)jobs, job.n_pieces));
+
+	for (s = 0; s < nsrc; s++) {
+		fps[s] = 0;
+		for (size_t i = job.first[s]; i < job.first[s + 1]; i++)
+			fps[s] = xdl_adler32_combine(fps[s], job.sums[i],
+				MIN(APPLY_PIECE, srcs[s].size -
+				    (i - job.first[s]) * APPLY_PIECE));
+	}
+	free(job.sums);
+	free(job.first);
+	return 0;
+}
+
+/*
+ * With src_fds, copies of APPLY_CLONE_MIN or more go to the kernel
+ * rather than through the map.  Where the source and the target are at
+ * the same place within a block, the whole blocks are cloned, so on a
+ * filesystem that can share them they cost neither time nor space; the
+ * rest goes through copy_file_range().  Anything the kernel won't do is
+ * left to the map, and once it's said no, it isn't asked again.
+ */
+#define APPLY_CLONE_MIN (256UL << 10)
+
+struct apply_clone {
+	const int *src_fds;
+	int fd;
+	off_t pos;
+	off_t blksz;
+	bool no_clone;
+	bool no_copy;
+	size_t cloned;
+	size_t copied;
+};
+
+static int
+copy_range(struct apply_clone *ac, int sfd, off_t soff, off_t doff,
+	   size_t size)
+{
+	while (size > 0 && !ac->no_copy) {
+		ssize_t rc = copy_file_range(sfd, &soff, ac->fd, &doff, size, 0);
+
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc <= 0) {
+			ac->no_copy = true;
+			break;
+		}
+		size -= rc;
+		ac->copied += rc;
+	}
+	return size == 0 ? 0 : -1;
+}
+
+static int
+apply_clone(void *priv, xdbpcopy_t const *cp)
+{
+	struct apply_clone *ac = priv;
+	int sfd = ac->src_fds[cp->sid];
+	off_t soff = cp->off;
+	off_t doff = ac->pos + cp->tpos;
+	off_t head = (ac->blksz - doff % ac->blksz) % ac->blksz;
+	off_t body = 0;
+
+	if (sfd < 0)
+		return 1;
+	if (!ac->no_clone && soff % ac->blksz == doff % ac->blksz &&
+	    (off_t)cp->size > head)
+		body = ((off_t)cp->size - head) / ac->blksz * ac->blksz;
+	if (body > 0) {
+		struct file_clone_range fcr = {
+			.src_fd = sfd,
+			.src_offset = soff + head,
+			.src_length = body,
+			.dest_offset = doff + head,
+		};
+
+		if (ioctl(ac->fd, FICLONERANGE, &fcr) < 0) {
+			ac->no_clone = true;
+			body = 0;
+		} else {
+			ac->cloned += body;
+		}
+	}
+	if (body > 0) {
+		if (copy_range(ac, sfd, soff, doff, head) < 0 ||
+		    copy_range(ac, sfd, soff + head + body, doff + head + body,
+			       cp->size - head - body) < 0)
+			return 1;
+		return 0;
+	}
+	return copy_range(ac, sfd, soff, doff, cp->size) < 0 ? 1 : 0;
+}
+
+/*
+ * Returns 1 if fd isn't somewhere we can map, so the patch should be
+ * streamed instead.  The target goes where fd's offset is, and the
+ * offset is left after it, as if it had been written.  Mapping needs
+ * the file open for reading too, which a shell's "> file" isn't, so it
+ * gets opened again through /proc.
+ */
+static int
+apply_direct(mmbuffer_t *srcs, int nsrc, mmfile_t *mfp, int fd,
+	     unsigned int jobs, const int *src_fds)
+{
+	struct apply_job job = { 0, };
+	uint32_t fps[XDL_BDIFF_MAXSRC];
+	long pagesz = sysconf(_SC_PAGESIZE);
+	char path[sizeof("/proc/self/fd/") + 11];
+	struct stat sb;
+	off_t pos, start;
+	char *map;
+	int rwfd;
+	int rc = -1;
+
+	if (nsrc > XDL_BDIFF_MAXSRC ||
+	    fstat(fd, &sb) < 0 || !S_ISREG(sb.st_mode) ||
+	    (fcntl(fd, F_GETFL) & O_APPEND) ||
+	    (pos = lseek(fd, 0, SEEK_CUR)) < 0)
+		return 1;
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+	rwfd = open(path, O_RDWR | O_CLOEXEC);
+	if (rwfd < 0)
+		return 1;
+
+	if (sum_sources(srcs, nsrc, jobs, fps) < 0)
+		goto out;
+	job.plan = xdl_bpatch_plan(srcs, nsrc, mfp, fps);
+	if (!job.plan) {
+		errno = EINVAL;
+		goto out;
+	}
+	job.size = xdl_bpatch_plan_size(job.plan);
+	job.n_pieces = (job.size + APPLY_PIECE - 1) / APPLY_PIECE;
+	debug("applying %zu bytes in %zu pieces", job.size, job.n_pieces);
+	if (job.size == 0) {
+		rc = 0;
+		goto out;
+	}
+
+	/*
+	 * The file gets longer, and never shorter, same as writing would.
+	 * fallocate() only goes over it once the clones are in, so it
+	 * doesn't allocate blocks that they then replace.
+	 */
+	if (sb.st_size < pos + (off_t)job.size &&
+	    ftruncate(rwfd, pos + job.size) < 0)
+		goto out;
+	if (src_fds) {
+		struct apply_clone ac = {
+			.src_fds = src_fds,
+			.fd = rwfd,
+			.pos = pos,
+			.blksz = MAX(sb.st_blksize, 1),
+		};
+
+		xdl_bpatch_plan_copies(job.plan, APPLY_CLONE_MIN, apply_clone,
+				       &ac);
+		debug("cloned %zu bytes, copied %zu", ac.cloned, ac.copied);
+	}
+	/*
+	 * Running out of room while writing through the map would only
+	 * show up as SIGBUS, so the blocks have to be had up front.  Where
+	 * the filesystem can't do that, the patch is streamed instead.
+	 */
+	while ((rc = fallocate(rwfd, 0, pos, job.size)) < 0 && errno == EINTR)
+		;
+	if (rc < 0) {
+		if (errno == EOPNOTSUPP)
+			rc = 1;
+		goto out;
+	}
+	rc = -1;
+	start = pos & ~(off_t)(pagesz - 1);
+	map = mmap(NULL, pos - start + job.size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED, rwfd, start);
+	if (map == MAP_FAILED)
+		goto out;
+	job.out = map + (pos - start);
+
+	run_workers(apply_worker, &job, MIN((size_t)jobs, job.n_pieces));
+	xdl_bpatch_plan_self(job.plan, job.out);
+
+	munmap(map, pos - start + job.size);
+	if (lseek(fd, pos + job.size, SEEK_SET) >= 0)
+		rc = 0;
+out:
+	xdl_bpatch_plan_free(job.plan);
+	close(rwfd);
+	return rc;
+}
+
+/*
+ * The format is sniffed from the first bytes.  A native patch starts
+ * with the source's adler32, which can only look like the VCDIFF magic
+ * for about one source in sixteen million.
+ */
+HIDDEN int
+apply_patch(mmbuffer_t *srcs, int nsrc, mmbuffer_t *patch, int filter, int fd,
+	    unsigned int jobs, const int *src_fds)
+{
+	struct unfilter uf = { 0, };
+	xdemitcb_t out = { .priv = &fd, .outf = write_outf };
+	mmbuffer_t *bufs = srcs;
+	mmfile_t mfp;
+	bool vcdiff;
+	int rc;
+
+	vcdiff = patch->size >= sizeof(vcdiff_magic) &&
+		 !memcmp(patch->ptr, vcdiff_magic, sizeof(vcdiff_magic));
+	if (vcdiff && nsrc != 1) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	filter = resolve_filter(filter, &srcs[0]);
+	debug("filter is %d", filter);
+	if (filter != XDL_BCJ_NONE) {
+		bufs = calloc(nsrc, sizeof(*bufs));
+		if (!bufs)
+			return -1;
+		if (filter_copy(filter, bufs, srcs, nsrc) < 0) {
+			free(bufs);
+			return -1;
+		}
+		out.priv = &uf;
+		out.outf = unfilter_outf;
+	}
+
+	rc = xdl_init_mmfile(&mfp, 8 * 1024, XDL_MMF_ATOMIC);
+	if (rc < 0)
+		goto out;
+	if (patch->size > 0 &&
+	    xdl_mmfile_ptradd(&mfp, patch->ptr, patch->size,
+			      XDL_MMB_READONLY) < 0) {
+		rc = -1;
+		goto out_free;
+	}
+
+	if (vcdiff) {
+		rc = xdl_vcdiff_patch(&bufs[0], &mfp, &out);
+	} else {
+		rc = filter == XDL_BCJ_NONE ?
+			apply_direct(bufs, nsrc, &mfp, fd, jobs, src_fds) : 1;
+		if (rc > 0)
+			rc = xdl_bpatch_refs(bufs, nsrc, &mfp, &out);
+	}
+	if (rc >= 0 && filter != XDL_BCJ_NONE)
+		rc = unfilter_write(filter, &uf, fd);
+
+out_free:
+	xdl_free_mmfile(&mfp);
+out:
+	if (bufs != srcs) {
+		filter_free(bufs, nsrc);
+		free(bufs);
+	}
+	free(uf.buf);
+	return rc;
+}
+
+
+/*
+ * In place patches are applied over the file itself, INPLACE_SCRATCH
+ * bytes at a time.  Before each step, whatever it's about to write over
+ * that it still needs goes into a journal next to the file, so if we're
+ * stopped part way through, running the same thing again picks up where
+ * it left off.  The journal has two slots, and each step writes the one
+ * the step before it didn't, so whatever happens while one of them is
+ * being written, the other is whole.
+ */
+#define INPLACE_SCRATCH (1UL << 20)
+#define INPLACE_MAGIC 0x70696279
+
+struct inplace_slot {
+	uint32_t magic;
+	uint32_t sum;
+	uint32_t patch_sum;
+	uint32_t scratch;
+	int64_t step;
+	uint64_t nsave;
+};
+
+#define INPLACE_SLOT_SIZE (sizeof(struct inplace_slot) + INPLACE_SCRATCH)
+
+struct inplace {
+	int fd;
+	int jfd;
+	uint32_t patch_sum;
+	bool marked;
+	char *slot;
+};
+
+static int
+pread_all(int fd, char *buf, size_t sz, off_t off)
+{
+	while (sz > 0) {
+		ssize_t rc = pread(fd, buf, sz, off);
+
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc <= 0) {
+			if (rc == 0)
+				errno = EIO;
+			return -1;
+		}
+		buf += rc;
+		off += rc;
+		sz -= rc;
+	}
+	return 0;
+}
+
+static int
+pwrite_all(int fd, const char *buf, size_t sz, off_t off)
+{
+	while (sz > 0) {
+		ssize_t rc = pwrite(fd, buf, sz, off);
+
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += rc;
+		off += rc;
+		sz -= rc;
+	}
+	return 0;
+}
+
+/*
+ * The sum covers everything in the slot after it, what's saved too.
+ */
+static uint32_t
+inplace_slot_sum(char *slot)
+{
+	struct inplace_slot *hdr = (struct inplace_slot *)slot;
+	mmbuffer_t mmb = {
+		.ptr = slot + offsetof(struct inplace_slot, patch_sum),
+		.size = sizeof(*hdr) - offsetof(struct inplace_slot, patch_sum) +
+			hdr->nsave,
+	};
+
+	return xdl_mmb_adler32(&mmb);
+}
+
+static int
+inplace_readf(void *priv, size_t off, char *buf, size_t size)
+{
+	struct inplace *ip = priv;
+
+	return pread_all(ip->fd, buf, size, off);
+}
+
+static int
+inplace_writef(void *priv, size_t off, char const *buf, size_t size)
+{
+	struct inplace *ip = priv;
+
+	return pwrite_all(ip->fd, buf, size, off);
+}
+
+static int
+inplace_sizef(void *priv, size_t size)
+{
+	struct inplace *ip = priv;
+
+	return ftruncate(ip->fd, size);
+}
+
+/*
+ * Nothing the step before wrote can be lost once the journal says it's
+ * done, so the file goes to disk first, and then the journal does.
+ */
+static int
+inplace_markf(void *priv, long step, char const *save, size_t size)
+{
+	struct inplace *ip = priv;
+	struct inplace_slot *hdr = (struct inplace_slot *)ip->slot;
+
+	if (fdatasync(ip->fd) < 0)
+		return -1;
+	hdr->magic = INPLACE_MAGIC;
+	hdr->patch_sum = ip->patch_sum;
+	hdr->scratch = INPLACE_SCRATCH;
+	hdr->step = step;
+	hdr->nsave = save ? size : 0;
+	if (save)
+		memmove(ip->slot + sizeof(*hdr), save, size);
+	hdr->sum = inplace_slot_sum(ip->slot);
+	if (pwrite_all(ip->jfd, ip->slot, sizeof(*hdr) + hdr->nsave,
+		       (step & 1) * INPLACE_SLOT_SIZE) < 0 ||
+	    fdatasync(ip->jfd) < 0)
+		return -1;
+	ip->marked = true;
+	return 0;
+}
+
+/*
+ * Reads slot i into ip->slot, and returns 1 if it's whole and from
+ * this patch, 0 if there's nothing usable there, or -1 if it's from
+ * some other patch.
+ */
+static int
+inplace_read_slot(struct inplace *ip, int i)
+{
+	struct inplace_slot *hdr = (struct inplace_slot *)ip->slot;
+	size_t len = 0;
+
+	while (len < INPLACE_SLOT_SIZE) {
+		ssize_t rc = pread(ip->jfd, ip->slot + len,
+				   INPLACE_SLOT_SIZE - len,
+				   i * INPLACE_SLOT_SIZE + len);
+
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc < 0)
+			return -1;
+		if (rc == 0)
+			break;
+		len += rc;
+	}
+	if (len < sizeof(*hdr) || hdr->magic != INPLACE_MAGIC ||
+	    hdr->nsave > INPLACE_SCRATCH || len < sizeof(*hdr) + hdr->nsave ||
+	    hdr->step < 0 || hdr->sum != inplace_slot_sum(ip->slot))
+		return 0;
+	if (hdr->patch_sum != ip->patch_sum ||
+	    hdr->scratch != INPLACE_SCRATCH) {
+		errno = EEXIST;
+		return -1;
+	}
+	return 1;
+}
+
+/*
+ * Leaves the slot to go on from in ip->slot, and its step in step, or
+ * -1 there if there isn't one and the file hasn't been touched yet.
+ */
+static int
+inplace_resume(struct inplace *ip, long *step)
+{
+	struct inplace_slot *hdr = (struct inplace_slot *)ip->slot;
+	int64_t steps[2] = { -1, -1 };
+	int i, rc;
+
+	for (i = 0; i < 2; i++) {
+		rc = inplace_read_slot(ip, i);
+		if (rc < 0)
+			return -1;
+		if (rc > 0)
+			steps[i] = hdr->step;
+	}
+	i = steps[1] > steps[0];
+	*step = steps[i];
+	if (*step >= 0 && inplace_read_slot(ip, i) <= 0)
+		return -1;
+	return 0;
+}
+
+static int
+sync_dir(const char *path)
+{
+	char *dir = strdup(path);
+	int fd, rc;
+
+	if (!dir)
+		return -1;
+	fd = open(dirname(dir), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	free(dir);
+	if (fd < 0)
+		return -1;
+	rc = fsync(fd);
+	close(fd);
+	return rc;
+}
+
+HIDDEN int
+apply_inplace(const char *path, mmbuffer_t *patch)
+{
+	struct inplace ip = { .fd = -1, .jfd = -1, };
+	struct inplace_slot *hdr;
+	xdipfile_t ipf = {
+		.priv = &ip,
+		.readf = inplace_readf,
+		.writef = inplace_writef,
+		.sizef = inplace_sizef,
+		.markf = inplace_markf,
+	};
+	char *jpath = NULL;
+	struct stat sb;
+	mmfile_t mfp;
+	long step = -1;
+	bool fresh = false;
+	int rc = -1;
+
+	if (asprintf(&jpath, "%s.inplace", path) < 0)
+		return -1;
+	ip.fd = open(path, O_RDWR | O_CLOEXEC);
+	if (ip.fd < 0 || fstat(ip.fd, &sb) < 0)
+		goto out;
+	if (!S_ISREG(sb.st_mode)) {
+		errno = EINVAL;
+		goto out;
+	}
+	ip.slot = malloc(INPLACE_SLOT_SIZE);
+	if (!ip.slot)
+		goto out;
+	ip.jfd = open(jpath, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (ip.jfd < 0 || sync_dir(jpath) < 0)
+		goto out;
+
+	ip.patch_sum = xdl_mmb_adler32(patch);
+	if (inplace_resume(&ip, &step) < 0) {
+		if (errno == EEXIST)
+			warnx("\"%s\" is from some other patch", jpath);
+		goto out;
+	}
+	fresh = step < 0;
+	hdr = (struct inplace_slot *)ip.slot;
+	debug("%s at step %ld", step < 0 ? "starting" : "resuming", step);
+
+	if (xdl_init_mmfile(&mfp, 8 * 1024, XDL_MMF_ATOMIC) < 0)
+		goto out;
+	if (patch->size > 0 &&
+	    xdl_mmfile_ptradd(&mfp, patch->ptr, patch->size,
+			      XDL_MMB_READONLY) < 0) {
+		xdl_free_mmfile(&mfp);
+		goto out;
+	}
+	ipf.size = sb.st_size;
+	rc = xdl_bpatch_inplace(&mfp, &ipf, INPLACE_SCRATCH, step,
+				step >= 0 && hdr->nsave ?
+				ip.slot + sizeof(*hdr) : NULL,
+				step >= 0 ? hdr->nsave : 0);
+	xdl_free_mmfile(&mfp);
+	if (rc >= 0)
+		rc = fsync(ip.fd);
+
+out:
+	/*
+	 * The journal goes once we're done, or if we never got as far as
+	 * touching the file, so there's nothing to pick up.
+	 */
+	if (rc >= 0 || (fresh && !ip.marked))
+		unlink(jpath);
+	if (ip.jfd >= 0)
+		close(ip.jfd);
+	if (ip.fd >= 0)
+		close(ip.fd);
+	free(ip.slot);
+	free(jpath);
+	return rc;
+}
+
+// vim:fenc=utf-8:tw=75:noet
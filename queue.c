@@ -0,0 +1,148 @@
+// SPDX-License-Identifier: GPLv3-or-later
+/*
+ * queue.c - a bounded queue from one thread to another
+ * Copyright Peter Jones <pjones@redhat.com>
+ *
+ * This is a ring with the head only ever written by the consumer and
+ * the tail only ever written by the producer, so while there's room
+ * and there's something in it, neither side takes a lock or makes a
+ * system call.  Only when one side has to wait for the other does it
+ * sleep, on a futex that the other side bumps every time it moves.
+ */
+
+#include "bindiff.h"
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+struct queue_side {
+	size_t pos;
+	uint32_t seq;
+	uint32_t waiting;
+} __attribute__((__aligned__(64)));
+
+struct queue {
+	size_t mask;
+	size_t esize;
+	char *ring;
+	bool closed;
+	struct queue_side head;
+	struct queue_side tail;
+};
+
+HIDDEN struct queue *
+queue_new(size_t n, size_t esize)
+{
+	struct queue *q;
+	size_t size = 1;
+
+	while (size < n)
+		size <<= 1;
+
+	q = aligned_alloc(64, sizeof(*q));
+	if (!q)
+		return NULL;
+	memset(q, 0, sizeof(*q));
+	q->ring = calloc(size, esize);
+	if (!q->ring) {
+		free(q);
+		return NULL;
+	}
+	q->mask = size - 1;
+	q->esize = esize;
+	return q;
+}
+
+HIDDEN void
+queue_free(struct queue *q)
+{
+	if (!q)
+		return;
+	free(q->ring);
+	free(q);
+}
+
+/*
+ * Tell the other side we've moved, and wake it if it's asleep.
+ */
+static void
+queue_notify(struct queue_side *side)
+{
+	__atomic_add_fetch(&side->seq, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&side->waiting, __ATOMIC_SEQ_CST))
+		syscall(SYS_futex, &side->seq, FUTEX_WAKE_PRIVATE, 1, NULL,
+			NULL, 0);
+}
+
+/*
+ * Wait until the other side moves.  The sequence number is read before
+ * ready() is checked, so if the other side moves after that, the futex
+ * won't match and we don't go to sleep.
+ */
+static void
+queue_wait(struct queue *q, struct queue_side *side,
+	   bool (*ready)(struct queue *q))
+{
+	for (;;) {
+		uint32_t seq = __atomic_load_n(&side->seq, __ATOMIC_SEQ_CST);
+
+		if (ready(q))
+			return;
+		__atomic_store_n(&side->waiting, 1, __ATOMIC_SEQ_CST);
+		if (!ready(q)) {
+			syscall(SYS_futex, &side->seq, FUTEX_WAIT_PRIVATE, seq,
+				NULL, NULL, 0);
+		}
+		__atomic_store_n(&side->waiting, 0, __ATOMIC_SEQ_CST);
+	}
+}
+
+static bool
+queue_has_room(struct queue *q)
+{
+	return q->tail.pos - __atomic_load_n(&q->head.pos, __ATOMIC_ACQUIRE) <=
+	       q->mask;
+}
+
+static bool
+queue_has_entry(struct queue *q)
+{
+	return __atomic_load_n(&q->tail.pos, __ATOMIC_ACQUIRE) != q->head.pos ||
+	       __atomic_load_n(&q->closed, __ATOMIC_ACQUIRE);
+}
+
+HIDDEN void
+queue_push(struct queue *q, const void *e)
+{
+	size_t pos = q->tail.pos;
+
+	if (!queue_has_room(q))
+		queue_wait(q, &q->head, queue_has_room);
+	memcpy(q->ring + (pos & q->mask) * q->esize, e, q->esize);
+	__atomic_store_n(&q->tail.pos, pos + 1, __ATOMIC_RELEASE);
+	queue_notify(&q->tail);
+}
+
+HIDDEN bool
+queue_pop(struct queue *q, void *e)
+{
+	size_t pos = q->head.pos;
+
+	if (!queue_has_entry(q))
+		queue_wait(q, &q->tail, queue_has_entry);
+	if (__atomic_load_n(&q->tail.pos, __ATOMIC_ACQUIRE) == pos)
+		return false;
+	memcpy(e, q->ring + (pos & q->mask) * q->esize, q->esize);
+	__atomic_store_n(&q->head.pos, pos + 1, __ATOMIC_RELEASE);
+	queue_notify(&q->head);
+	return true;
+}
+
+HIDDEN void
+queue_close(struct queue *q)
+{
+	__atomic_store_n(&q->closed, true, __ATOMIC_RELEASE);
+	queue_notify(&q->tail);
+}
+
+// vim:fenc=utf-8:tw=75:noet
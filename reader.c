@@ -0,0 +1,536 @@
+// SPDX-License-Identifier: GPLv3-or-later
+/*
+ * reader.c - reading files in with io_uring
+ * Copyright Peter Jones <pjones@redhat.com>
+ *
+ * Mapping the files means every page we touch first is a page fault
+ * and a read we wait on, one at a time.  Here the files are read in big
+ * chunks instead, with up to READER_DEPTH of them in flight at once, so
+ * a slow disk always has a queue to work on, and whatever is still
+ * coming in keeps coming in while we get on with the files we have.
+ *
+ * The chunks land straight in each file's buffer, since the differs
+ * want every file in one piece anyway.  If the kernel lets us, those
+ * buffers are registered with the ring, so it doesn't have to map them
+ * for every read.  This talks to the kernel directly rather than using
+ * liburing, since it's only a handful of system calls.  Kernels before
+ * 5.6 have io_uring but not IORING_OP_READ; a file whose reads come back
+ * -EINVAL is read with pread() instead.
+ */
+
+#include "bindiff.h"
+
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <xdiff.h>
+
+#define READER_CHUNK (1024 * 1024)
+#define READER_DEPTH 64
+/*
+ * The kernel won't register a buffer bigger than this.
+ */
+#define READER_FIXED_MAX (1024ul * 1024 * 1024)
+
+struct reader_file {
+	const char *name;
+	int fd;
+	mmbuffer_t *mmb;
+	size_t next;
+	size_t done;
+	unsigned int inflight;
+	bool use_pread;
+	int error;
+};
+
+struct reader_io {
+	int file;
+	size_t off;
+	size_t len;
+};
+
+struct reader {
+	struct reader_file *files;
+	int n_files;
+	int n_file_bufs;
+
+	int ring_fd;
+	bool fixed;
+	unsigned int sq_next;
+	unsigned int queued;
+	unsigned int inflight;
+	struct reader_io ios[READER_DEPTH];
+	unsigned int free_ios[READER_DEPTH];
+	unsigned int n_free_ios;
+
+	void *sq_ring;
+	size_t sq_ring_sz;
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+	struct io_uring_sqe *sqes;
+	size_t sqes_sz;
+
+	void *cq_ring;
+	size_t cq_ring_sz;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	int hook_file;
+	pthread_t reaper;
+	bool reaping;
+};
+
+static int
+ring_setup(struct reader *rd)
+{
+	struct io_uring_params p = { 0, };
+	char *sq, *cq;
+
+	rd->ring_fd = syscall(SYS_io_uring_setup, READER_DEPTH, &p);
+	if (rd->ring_fd < 0)
+		return -1;
+
+	rd->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	rd->cq_ring_sz = p.cq_off.cqes +
+			 p.cq_entries * sizeof(struct io_uring_cqe);
+	rd->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	rd->sq_ring = mmap(NULL, rd->sq_ring_sz, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, rd->ring_fd,
+			   IORING_OFF_SQ_RING);
+	if (rd->sq_ring == MAP_FAILED)
+		goto err_close;
+	rd->cq_ring = mmap(NULL, rd->cq_ring_sz, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, rd->ring_fd,
+			   IORING_OFF_CQ_RING);
+	if (rd->cq_ring == MAP_FAILED)
+		goto err_sq;
+	rd->sqes = mmap(NULL, rd->sqes_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, rd->ring_fd,
+			IORING_OFF_SQES);
+	if (rd->sqes == MAP_FAILED)
+		goto err_cq;
+
+	sq = rd->sq_ring;
+	rd->sq_head = (unsigned int *)(sq + p.sq_off.head);
+	rd->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+	rd->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+	rd->sq_array = (unsigned int *)(sq + p.sq_off.array);
+
+	cq = rd->cq_ring;
+	rd->cq_head = (unsigned int *)(cq + p.cq_off.head);
+	rd->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+	rd->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+	rd->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	rd->sq_next = *rd->sq_tail;
+	return 0;
+
+err_cq:
+	munmap(rd->cq_ring, rd->cq_ring_sz);
+err_sq:
+	munmap(rd->sq_ring, rd->sq_ring_sz);
+err_close:
+	close(rd->ring_fd);
+	rd->ring_fd = -1;
+	return -1;
+}
+
+static void
+ring_teardown(struct reader *rd)
+{
+	if (rd->ring_fd < 0)
+		return;
+	munmap(rd->sqes, rd->sqes_sz);
+	munmap(rd->cq_ring, rd->cq_ring_sz);
+	munmap(rd->sq_ring, rd->sq_ring_sz);
+	close(rd->ring_fd);
+	rd->ring_fd = -1;
+}
+
+HIDDEN struct reader *
+reader_new(void)
+{
+	struct reader *rd;
+
+	rd = calloc(1, sizeof(*rd));
+	if (!rd)
+		return NULL;
+	rd->hook_file = -1;
+	if (ring_setup(rd) < 0)
+		debug("no io_uring (%m), using pread()");
+	return rd;
+}
+
+HIDDEN int
+reader_add(struct reader *rd, const char *filename, mmbuffer_t *mmb)
+{
+	struct reader_file *rf;
+	struct stat sb;
+	int errnum;
+
+	if (rd->n_files == rd->n_file_bufs) {
+		int n = rd->n_file_bufs ? rd->n_file_bufs * 2 : 4;
+		struct reader_file *files;
+
+		files = reallocarray(rd->files, n, sizeof(*files));
+		if (!files)
+			return -1;
+		rd->files = files;
+		rd->n_file_bufs = n;
+	}
+	rf = &rd->files[rd->n_files];
+	memset(rf, 0, sizeof(*rf));
+	rf->name = filename;
+	rf->mmb = mmb;
+
+	rf->fd = open(filename, O_RDONLY);
+	if (rf->fd < 0)
+		return -1;
+	if (fstat(rf->fd, &sb) < 0)
+		goto err_close;
+	mmb->size = sb.st_size;
+	mmb->ptr = malloc(MAX(mmb->size, 1));
+	if (!mmb->ptr)
+		goto err_close;
+
+	return rd->n_files++;
+
+err_close:
+	errnum = errno;
+	close(rf->fd);
+	errno = errnum;
+	return -1;
+}
+
+static void
+ring_queue(struct reader *rd, int file, size_t off, size_t len)
+{
+	struct reader_file *rf = &rd->files[file];
+	unsigned int idx = rd->sq_next++ & *rd->sq_mask;
+	unsigned int io = rd->free_ios[--rd->n_free_ios];
+	struct io_uring_sqe *sqe = &rd->sqes[idx];
+
+	rd->ios[io] = (struct reader_io){ .file = file, .off = off, .len = len };
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = rd->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+	sqe->fd = rf->fd;
+	sqe->off = off;
+	sqe->addr = (uintptr_t)(rf->mmb->ptr + off);
+	sqe->len = len;
+	if (rd->fixed)
+		sqe->buf_index = file;
+	sqe->user_data = io;
+	rd->sq_array[idx] = idx;
+
+	rd->queued += 1;
+	rd->inflight += 1;
+	rf->inflight += 1;
+}
+
+/*
+ * Fill the ring back up, front to back, so the files that were added
+ * first are the first ones to be done.
+ */
+static void
+ring_fill(struct reader *rd)
+{
+	for (int i = 0; i < rd->n_files && rd->n_free_ios > 0; i++) {
+		struct reader_file *rf = &rd->files[i];
+
+		while (!rf->error && !rf->use_pread &&
+		       rf->next < rf->mmb->size && rd->n_free_ios > 0) {
+			size_t len = MIN(rf->mmb->size - rf->next,
+					 READER_CHUNK);
+
+			ring_queue(rd, i, rf->next, len);
+			rf->next += len;
+		}
+	}
+}
+
+static int
+ring_enter(struct reader *rd, unsigned int min_complete)
+{
+	unsigned int flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+	int rc;
+
+	__atomic_store_n(rd->sq_tail, rd->sq_next, __ATOMIC_RELEASE);
+	do {
+		rc = syscall(SYS_io_uring_enter, rd->ring_fd, rd->queued,
+			     min_complete, flags, NULL, 0);
+	} while (rc < 0 && errno == EINTR);
+	if (rc < 0)
+		return -1;
+	rd->queued -= MIN((unsigned int)rc, rd->queued);
+	return 0;
+}
+
+/*
+ * A short read only means the rest of that chunk has to be asked for
+ * again.  Reading nothing at all means the file got shorter.  -EINVAL
+ * from a plain read is a kernel without IORING_OP_READ, so that file
+ * gets read with pread() once the ring is done with it.
+ */
+static void
+ring_reap(struct reader *rd)
+{
+	unsigned int head = *rd->cq_head;
+	unsigned int tail = __atomic_load_n(rd->cq_tail, __ATOMIC_ACQUIRE);
+
+	for (; head != tail; head++) {
+		struct io_uring_cqe *cqe = &rd->cqes[head & *rd->cq_mask];
+		struct reader_io *io = &rd->ios[cqe->user_data];
+		struct reader_file *rf = &rd->files[io->file];
+
+		rd->inflight -= 1;
+		rf->inflight -= 1;
+		rd->free_ios[rd->n_free_ios++] = cqe->user_data;
+		if (cqe->res == -EINVAL && !rd->fixed) {
+			rf->use_pread = true;
+		} else if (cqe->res < 0) {
+			rf->error = -cqe->res;
+		} else if (cqe->res == 0) {
+			rf->error = EIO;
+		} else {
+			rf->done += cqe->res;
+			if ((size_t)cqe->res < io->len)
+				ring_queue(rd, io->file, io->off + cqe->res,
+					   io->len - cqe->res);
+		}
+	}
+	__atomic_store_n(rd->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static int
+pread_file(struct reader_file *rf)
+{
+	while (rf->done < rf->mmb->size) {
+		ssize_t rc = pread(rf->fd, rf->mmb->ptr + rf->done,
+				   rf->mmb->size - rf->done, rf->done);
+
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (rc == 0) {
+			errno = EIO;
+			return -1;
+		}
+		rf->done += rc;
+	}
+	return 0;
+}
+
+/*
+ * Whatever parts of a file did make it in through the ring get read
+ * again; it's simpler than keeping track of which ones they were, and
+ * it only happens on old kernels.
+ */
+static void
+ring_fallback(struct reader *rd)
+{
+	for (int i = 0; i < rd->n_files; i++) {
+		struct reader_file *rf = &rd->files[i];
+
+		if (!rf->use_pread || rf->inflight > 0 || rf->error ||
+		    rf->done == rf->mmb->size)
+			continue;
+		debug("reading \"%s\" with pread()", rf->name);
+		rf->done = 0;
+		if (pread_file(rf) < 0)
+			rf->error = errno;
+	}
+}
+
+static void
+register_buffers(struct reader *rd)
+{
+	struct iovec *iov;
+	int rc;
+
+	iov = calloc(rd->n_files, sizeof(*iov));
+	if (!iov)
+		return;
+	for (int i = 0; i < rd->n_files; i++) {
+		if (rd->files[i].mmb->size > READER_FIXED_MAX) {
+			free(iov);
+			return;
+		}
+		iov[i].iov_base = rd->files[i].mmb->ptr;
+		iov[i].iov_len = MAX(rd->files[i].mmb->size, 1);
+	}
+	rc = syscall(SYS_io_uring_register, rd->ring_fd,
+		     IORING_REGISTER_BUFFERS, iov, rd->n_files);
+	if (rc < 0)
+		debug("could not register buffers: %m");
+	rd->fixed = rc >= 0;
+	free(iov);
+}
+
+HIDDEN int
+reader_start(struct reader *rd)
+{
+	if (rd->ring_fd < 0) {
+		for (int i = 0; i < rd->n_files; i++) {
+			if (pread_file(&rd->files[i]) < 0)
+				rd->files[i].error = errno;
+		}
+		return 0;
+	}
+
+	rd->n_free_ios = READER_DEPTH;
+	for (unsigned int i = 0; i < READER_DEPTH; i++)
+		rd->free_ios[i] = READER_DEPTH - i - 1;
+	register_buffers(rd);
+	ring_fill(rd);
+	return ring_enter(rd, 0);
+}
+
+static bool
+reader_done(struct reader *rd, int n, int *error)
+{
+	int first = n < 0 ? 0 : n;
+	int last = n < 0 ? rd->n_files : n + 1;
+
+	for (int i = first; i < last; i++) {
+		if (rd->files[i].error) {
+			*error = rd->files[i].error;
+			return true;
+		}
+		if (rd->files[i].done < rd->files[i].mmb->size)
+			return false;
+	}
+	return true;
+}
+
+HIDDEN int
+reader_wait(struct reader *rd, int n)
+{
+	int error = 0;
+
+	if (n >= rd->n_files) {
+		errno = EINVAL;
+		return -1;
+	}
+	while (!reader_done(rd, n, &error)) {
+		if (rd->ring_fd < 0 || rd->inflight == 0) {
+			error = EIO;
+			break;
+		}
+		if (ring_enter(rd, 1) < 0)
+			return -1;
+		ring_reap(rd);
+		ring_fallback(rd);
+		ring_fill(rd);
+	}
+	/*
+	 * Whatever the last fill queued has to go in now, or the files
+	 * after this one sit there until somebody waits for them.
+	 */
+	if (rd->ring_fd >= 0 && rd->queued > 0 && ring_enter(rd, 0) < 0)
+		return -1;
+	if (error) {
+		errno = error;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * While the sources are being indexed nobody else touches the ring, so
+ * this keeps it fed until file n is in.  Anything that goes wrong gets
+ * found again by the reader_wait() in the hook.
+ */
+static void *
+reader_reap(void *priv)
+{
+	struct reader *rd = priv;
+
+	reader_wait(rd, rd->hook_file);
+	return NULL;
+}
+
+static void
+reader_join(struct reader *rd)
+{
+	if (!rd->reaping)
+		return;
+	pthread_join(rd->reaper, NULL);
+	rd->reaping = false;
+}
+
+static void
+reader_hook_begin(void *priv, int phase)
+{
+	struct reader *rd = priv;
+
+	if (phase != XDL_PHASE_SCAN || rd->hook_file < 0)
+		return;
+	reader_join(rd);
+	if (reader_wait(rd, rd->hook_file) < 0)
+		err(1, "Could not read \"%s\"", rd->files[rd->hook_file].name);
+}
+
+HIDDEN void
+reader_overlap(struct reader *rd, int n)
+{
+	phasehook_t hook = {
+		.priv = rd,
+		.begin = reader_hook_begin,
+	};
+
+	rd->hook_file = n;
+	xdl_set_phase_hook(&hook);
+	if (rd->ring_fd >= 0)
+		rd->reaping = pthread_create(&rd->reaper, NULL, reader_reap,
+					     rd) == 0;
+}
+
+HIDDEN void
+reader_put(struct reader *rd)
+{
+	if (rd->hook_file >= 0) {
+		reader_join(rd);
+		xdl_set_phase_hook(NULL);
+		rd->hook_file = -1;
+	}
+
+	/*
+	 * The kernel may still be writing into the buffers, so they
+	 * can't go until it's done with them.
+	 */
+	while (rd->ring_fd >= 0 && rd->inflight > 0) {
+		if (ring_enter(rd, 1) < 0)
+			break;
+		ring_reap(rd);
+	}
+	if (rd->fixed) {
+		syscall(SYS_io_uring_register, rd->ring_fd,
+			IORING_UNREGISTER_BUFFERS, NULL, 0);
+		rd->fixed = false;
+	}
+
+	for (int i = 0; i < rd->n_files; i++) {
+		struct reader_file *rf = &rd->files[i];
+
+		close(rf->fd);
+		free(rf->mmb->ptr);
+		rf->mmb->ptr = NULL;
+		rf->mmb->size = 0;
+	}
+	rd->n_files = 0;
+}
+
+HIDDEN void
+reader_free(struct reader *rd)
+{
+	if (!rd)
+		return;
+	reader_put(rd);
+	ring_teardown(rd);
+	free(rd->files);
+	free(rd);
+}
+
+// vim:fenc=utf-8:tw=75:noet
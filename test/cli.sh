@@ -0,0 +1,60 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPLv3-or-later
+#
+# cli.sh - round trip patches through bindiff
+# Copyright Peter Jones <pjones@redhat.com>
+#
+# Every differ makes a patch in each format, and applying it has to give
+# the target back.  The target repeats itself, so with --self it also
+# gets made from an empty source and from no source at all.
+#
+
+set -eu
+
+bindiff="$(realpath "${1:-./bindiff}")"
+tmp="$(mktemp -d)"
+trap 'rm -rf "${tmp}"' EXIT
+cd "${tmp}"
+
+head -c 65536 /dev/urandom > blk
+head -c 32768 /dev/urandom > src
+{ cat blk; head -c 4096 /dev/urandom; cat blk src; } > tgt
+: > empty
+
+fails=0
+check() {
+	local name="$1" ; shift
+
+	if "$@" > out 2> err && cmp -s out tgt ; then
+		echo "PASS: ${name}"
+	else
+		echo "FAIL: ${name}"
+		cat err
+		fails=$((fails + 1))
+	fi
+}
+
+for differ in xbdiff xcdcdiff xgeardiff xrabdiff ; do
+	for format in native vcdiff ; do
+		opts=(-d "${differ}" --format "${format}")
+		t="${differ} ${format}"
+
+		"${bindiff}" --make-patch "${opts[@]}" src tgt > p
+		check "${t}" "${bindiff}" --apply src p
+
+		"${bindiff}" --make-patch --self "${opts[@]}" src tgt > p
+		check "${t} --self" "${bindiff}" --apply src p
+
+		"${bindiff}" --make-patch --self "${opts[@]}" empty tgt > p
+		check "${t} --self, empty source" "${bindiff}" --apply empty p
+
+		"${bindiff}" --make-patch --self "${opts[@]}" tgt > p
+		check "${t} --self, no source" "${bindiff}" --apply --self p
+		if [[ $(stat -c %s p) -ge $(stat -c %s tgt) ]] ; then
+			echo "FAIL: ${t} --self, no source: patch isn't smaller"
+			fails=$((fails + 1))
+		fi
+	done
+done
+
+exit $((fails > 0))
@@ -0,0 +1,275 @@
+// SPDX-License-Identifier: GPLv3-or-later
+/*
+ * timing.c - per-phase wall and cpu time accounting
+ * Copyright Peter Jones <pjones@redhat.com>
+ */
+
+#include "bindiff.h"
+
+#include <xdiff.h>
+
+struct timing_sample {
+	struct timespec wall;
+	struct timespec cpu;
+	size_t bytes;
+};
+
+const char * const timing_phase_names[TIMING_MAX] = {
+	[TIMING_MAP] = "map",
+	[TIMING_INDEX] = "index",
+	[TIMING_SCAN] = "scan",
+	[TIMING_COLLECT] = "collect",
+	[TIMING_REORDER] = "reorder",
+	[TIMING_RENDER] = "render",
+};
+
+static bool enabled = false;
+static unsigned int n_runs = 0;
+static unsigned int run = 0;
+static struct timing_sample *samples = NULL;
+
+static timing_phase_t stack[TIMING_MAX * 2];
+static unsigned int depth = 0;
+static struct timespec mark_wall, mark_cpu;
+
+static inline struct timing_sample *
+sample(unsigned int r, timing_phase_t phase)
+{
+	return &samples[r * TIMING_MAX + phase];
+}
+
+static void
+now(struct timespec *wall, struct timespec *cpu)
+{
+	clock_gettime(CLOCK_MONOTONIC, wall);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, cpu);
+}
+
+/*
+ * Charge everything since the last mark to whatever phase is on top of
+ * the stack, and move the mark up to now.
+ */
+static void
+charge(const struct timespec *wall, const struct timespec *cpu)
+{
+	struct timespec delta;
+
+	if (depth > 0 && run < n_runs) {
+		struct timing_sample *s = sample(run, stack[depth - 1]);
+
+		tssub(wall, &mark_wall, &delta);
+		tsadd(&s->wall, &delta, &s->wall);
+		tssub(cpu, &mark_cpu, &delta);
+		tsadd(&s->cpu, &delta, &s->cpu);
+	}
+	mark_wall = *wall;
+	mark_cpu = *cpu;
+}
+
+HIDDEN void
+timing_start(timing_phase_t phase)
+{
+	struct timespec wall, cpu;
+
+	if (!enabled)
+		return;
+	if (depth >= sizeof(stack) / sizeof(stack[0]))
+		errx(1, "timing phases nested too deeply");
+
+	now(&wall, &cpu);
+	charge(&wall, &cpu);
+	stack[depth++] = phase;
+	mem_phase_mark(phase);
+}
+
+HIDDEN void
+timing_stop(timing_phase_t phase, size_t bytes)
+{
+	struct timespec wall, cpu;
+
+	if (!enabled)
+		return;
+	if (depth == 0 || stack[depth - 1] != phase) {
+		debug("timing_stop(%s) doesn't match timing_start(%s)",
+		      timing_phase_names[phase],
+		      depth ? timing_phase_names[stack[depth - 1]] : "none");
+		return;
+	}
+
+	now(&wall, &cpu);
+	charge(&wall, &cpu);
+	if (run < n_runs)
+		sample(run, phase)->bytes += bytes;
+	depth -= 1;
+	mem_phase_mark(timing_phase());
+}
+
+HIDDEN void
+timing_end_run(void)
+{
+	if (!enabled)
+		return;
+	if (run < n_runs)
+		run += 1;
+}
+
+/*
+ * The phase we're in right now, or TIMING_MAX if none is.
+ */
+HIDDEN timing_phase_t
+timing_phase(void)
+{
+	return depth ? stack[depth - 1] : TIMING_MAX;
+}
+
+static void
+xdl_phase_begin_hook(void *priv UNUSED, int phase)
+{
+	timing_start(phase == XDL_PHASE_INDEX ? TIMING_INDEX : TIMING_SCAN);
+}
+
+static void
+xdl_phase_end_hook(void *priv UNUSED, int phase, size_t size)
+{
+	timing_stop(phase == XDL_PHASE_INDEX ? TIMING_INDEX : TIMING_SCAN, size);
+}
+
+HIDDEN int
+timing_init(unsigned int runs)
+{
+	phasehook_t hook = {
+		.begin = xdl_phase_begin_hook,
+		.end = xdl_phase_end_hook,
+	};
+
+	if (runs == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	samples = calloc(runs * TIMING_MAX, sizeof(*samples));
+	if (!samples)
+		return -1;
+
+	n_runs = runs;
+	run = 0;
+	depth = 0;
+	enabled = true;
+	xdl_set_phase_hook(&hook);
+	return 0;
+}
+
+HIDDEN void
+timing_fini(void)
+{
+	xdl_set_phase_hook(NULL);
+	free(samples);
+	samples = NULL;
+	n_runs = run = depth = 0;
+	enabled = false;
+}
+
+static int
+ts_compare(const void *a, const void *b)
+{
+	cmp_result_t result = eq;
+
+	tscmp(a, b, &result);
+	return result;
+}
+
+static inline double
+ts_seconds(const struct timespec *ts)
+{
+	return ts->tv_sec + ts->tv_nsec / (double)NSEC_PER_SEC;
+}
+
+/*
+ * min, median and 99th percentile of a set of times.  The median of an
+ * even count is the lower of the middle two.
+ */
+static void
+summarize(struct timespec *ts, unsigned int n, double *min, double *median,
+	  double *p99)
+{
+	unsigned int p99i = (n * 99 + 99) / 100;
+
+	qsort(ts, n, sizeof(*ts), ts_compare);
+	*min = ts_seconds(&ts[0]);
+	*median = ts_seconds(&ts[(n - 1) / 2]);
+	*p99 = ts_seconds(&ts[MAX(p99i, 1) - 1]);
+}
+
+static void
+report_row(FILE *out, const char *name, struct timespec *wall,
+	   struct timespec *cpu, unsigned int n, size_t bytes)
+{
+	double wmin, wmed, wp99, cmin, cmed, cp99;
+
+	summarize(wall, n, &wmin, &wmed, &wp99);
+	summarize(cpu, n, &cmin, &cmed, &cp99);
+
+	fprintf(out, "%-8s %9.6f %9.6f %9.6f  %9.6f %9.6f %9.6f ", name,
+		wmin, wmed, wp99, cmin, cmed, cp99);
+	if (bytes && wmed > 0)
+		fprintf(out, "%10.2f\n", (bytes / 1e6) / wmed);
+	else
+		fprintf(out, "%10s\n", "-");
+}
+
+HIDDEN void
+timing_report(FILE *out)
+{
+	struct timespec *wall, *cpu, *twall, *tcpu;
+	unsigned int n = run;
+	size_t tbytes = 0;
+
+	if (!enabled || n == 0)
+		return;
+
+	wall = calloc(n, sizeof(*wall));
+	cpu = calloc(n, sizeof(*cpu));
+	twall = calloc(n, sizeof(*twall));
+	tcpu = calloc(n, sizeof(*tcpu));
+	if (!wall || !cpu || !twall || !tcpu)
+		err(1, "Could not allocate memory");
+
+	fprintf(out, "%u run%s, times in seconds, throughput from the median\n",
+		n, n == 1 ? "" : "s");
+	fprintf(out, "%-8s %9s %9s %9s  %9s %9s %9s %10s\n", "phase",
+		"wall min", "median", "p99", "cpu min", "median", "p99",
+		"MB/s");
+
+	for (timing_phase_t phase = 0; phase < TIMING_MAX; phase++) {
+		bool seen = false;
+		size_t bytes = 0;
+
+		for (unsigned int r = 0; r < n; r++) {
+			struct timing_sample *s = sample(r, phase);
+
+			wall[r] = s->wall;
+			cpu[r] = s->cpu;
+			tsadd(&twall[r], &s->wall, &twall[r]);
+			tsadd(&tcpu[r], &s->cpu, &tcpu[r]);
+			if (!tszero(s->wall) || s->bytes)
+				seen = true;
+			/* every run processes the same data */
+			if (r == 0)
+				bytes = s->bytes;
+		}
+		if (!seen)
+			continue;
+
+		report_row(out, timing_phase_names[phase], wall, cpu, n, bytes);
+		if (phase == TIMING_MAP)
+			tbytes = bytes;
+	}
+	report_row(out, "total", twall, tcpu, n, tbytes);
+
+	free(tcpu);
+	free(twall);
+	free(cpu);
+	free(wall);
+}
+
+// vim:fenc=utf-8:tw=75:noet
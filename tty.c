@@ -6,15 +6,223 @@
 
 #include "bindiff.h"
 
-// struct term {
-//	size_t
-// };
+#include <sys/ioctl.h>
 
+/*
+ * Figure out how long the escape sequence at the start of buf is.
+ *
+ * Returns the number of bytes in the sequence, or -1 with errno set to
+ * EINVAL if buf doesn't start with an escape, or EAGAIN if the sequence
+ * is cut off before its end.
+ */
 HIDDEN ssize_t
 get_esc_sz(const char *buf, const size_t size)
 {
-	errno = ENOSYS;
-	return -1;
+	size_t pos;
+
+	if (!buf || size < 1 || buf[0] != '\033') {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (size < 2) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	switch (buf[1]) {
+	case '[':
+		/*
+		 * CSI: parameter bytes 0x30-0x3f, intermediate bytes
+		 * 0x20-0x2f, then one final byte 0x40-0x7e.
+		 */
+		for (pos = 2; pos < size && buf[pos] >= 0x30 && buf[pos] <= 0x3f;
+		     pos++)
+			;
+		for (; pos < size && buf[pos] >= 0x20 && buf[pos] <= 0x2f; pos++)
+			;
+		if (pos >= size) {
+			errno = EAGAIN;
+			return -1;
+		}
+		if (buf[pos] < 0x40 || buf[pos] > 0x7e) {
+			errno = EINVAL;
+			return -1;
+		}
+		return pos + 1;
+	case ']':
+	case 'P':
+	case '_':
+	case '^':
+		/*
+		 * OSC, DCS, APC and PM are terminated by BEL or ST (ESC \)
+		 */
+		for (pos = 2; pos < size; pos++) {
+			if (buf[pos] == '\a')
+				return pos + 1;
+			if (buf[pos] == '\033') {
+				if (pos + 1 >= size)
+					break;
+				if (buf[pos + 1] == '\\')
+					return pos + 2;
+			}
+		}
+		errno = EAGAIN;
+		return -1;
+	case 'O':
+		/*
+		 * SS3, which is what most terminals send for F1-F4 and for
+		 * the cursor keys in application mode.
+		 */
+		if (size < 3) {
+			errno = EAGAIN;
+			return -1;
+		}
+		return 3;
+	default:
+		/*
+		 * Two byte sequences like save cursor (ESC 7) and restore
+		 * cursor (ESC 8).
+		 */
+		return 2;
+	}
+}
+
+/*
+ * Find how many bytes of buf fit in cols columns once escape sequences
+ * are skipped over.  Escapes are never split.
+ */
+HIDDEN size_t
+tty_clip(const char *buf, const size_t size, const size_t cols)
+{
+	size_t pos = 0, vis = 0;
+
+	while (pos < size && buf[pos]) {
+		if (buf[pos] == '\033') {
+			ssize_t sz = get_esc_sz(&buf[pos], size - pos);
+			if (sz < 0)
+				break;
+			pos += sz;
+			continue;
+		}
+		if (vis == cols)
+			break;
+		vis += 1;
+		pos += 1;
+	}
+
+	return pos;
+}
+
+HIDDEN int
+tty_get_size(int fd, unsigned int *rows, unsigned int *cols)
+{
+	struct winsize ws = { 0, };
+	int rc;
+
+	rc = ioctl(fd, TIOCGWINSZ, &ws);
+	if (rc < 0)
+		return rc;
+
+	*rows = ws.ws_row ? ws.ws_row : 24;
+	*cols = ws.ws_col ? ws.ws_col : 80;
+	return 0;
+}
+
+HIDDEN int
+tty_raw(int fd, struct termios *saved)
+{
+	struct termios raw;
+	int rc;
+
+	rc = tcgetattr(fd, saved);
+	if (rc < 0)
+		return rc;
+
+	raw = *saved;
+	raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+	raw.c_oflag &= ~(OPOST);
+	raw.c_cflag |= CS8;
+	raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+	raw.c_cc[VMIN] = 1;
+	raw.c_cc[VTIME] = 0;
+
+	return tcsetattr(fd, TCSAFLUSH, &raw);
+}
+
+HIDDEN int
+tty_restore(int fd, const struct termios *saved)
+{
+	return tcsetattr(fd, TCSAFLUSH, saved);
+}
+
+/*
+ * Read one key press.  Printable keys come back as themselves, anything
+ * we recognize as an escape sequence comes back as one of the TTY_KEY_*
+ * values, and everything else is TTY_KEY_UNKNOWN.
+ */
+HIDDEN int
+tty_read_key(int fd)
+{
+	static const struct {
+		const char *seq;
+		int key;
+	} keys[] = {
+		{ "\033[A", TTY_KEY_UP },
+		{ "\033OA", TTY_KEY_UP },
+		{ "\033[B", TTY_KEY_DOWN },
+		{ "\033OB", TTY_KEY_DOWN },
+		{ "\033[H", TTY_KEY_HOME },
+		{ "\033OH", TTY_KEY_HOME },
+		{ "\033[1~", TTY_KEY_HOME },
+		{ "\033[F", TTY_KEY_END },
+		{ "\033OF", TTY_KEY_END },
+		{ "\033[4~", TTY_KEY_END },
+		{ "\033[5~", TTY_KEY_PGUP },
+		{ "\033[6~", TTY_KEY_PGDN },
+	};
+	/*
+	 * Several keys can show up in one read (pasted text, or typing
+	 * ahead of a slow redraw), so hang on to whatever we don't use.
+	 */
+	static char buf[64];
+	static size_t pending = 0;
+	ssize_t sz, escsz;
+	int key = TTY_KEY_UNKNOWN;
+
+	if (pending == 0) {
+		/*
+		 * EINTR is left to the caller, so that things like SIGWINCH
+		 * can get handled while we're waiting here.
+		 */
+		sz = read(fd, buf, sizeof(buf));
+		if (sz <= 0)
+			return sz < 0 ? -1 : TTY_KEY_EOF;
+		pending = sz;
+	}
+
+	if (buf[0] != '\033') {
+		key = (unsigned char)buf[0];
+		escsz = 1;
+	} else {
+		escsz = get_esc_sz(buf, pending);
+		if (escsz < 0) {
+			if (errno == EAGAIN && pending == 1)
+				key = TTY_KEY_ESC;
+			escsz = pending;
+		}
+		for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+			if (strlen(keys[i].seq) == (size_t)escsz &&
+			    !memcmp(keys[i].seq, buf, escsz)) {
+				key = keys[i].key;
+				break;
+			}
+		}
+	}
+
+	pending -= escsz;
+	memmove(buf, buf + escsz, pending);
+	return key;
 }
 
 // vim:fenc=utf-8:tw=75:noet
@@ -0,0 +1,531 @@
+// SPDX-License-Identifier: GPLv3-or-later
+/*
+ * viewer.c - interactive viewport over a list of diff hunks
+ * Copyright Peter Jones <pjones@redhat.com>
+ */
+
+#include "bindiff.h"
+
+#include <signal.h>
+
+/*
+ * The viewer never renders a hunk in full.  Each hunk covers
+ * ceil((pos % 16 + size) / 16) rows of hexdiff output, so we keep a
+ * prefix sum of those row counts (one size_t per hunk) and map any
+ * screen row back to (hunk, byte offset) with a binary search.  Only
+ * the rows that are actually visible ever get formatted.
+ */
+struct viewer {
+	struct differ_hunk *hunks;
+	size_t n_hunks;
+	size_t *rowstart;
+	size_t n_rows;
+
+	int fd;
+	struct termios saved;
+	unsigned int rows, cols;
+	size_t top;
+	bool drawn;
+
+	char *screen;
+	size_t screensz;
+	size_t screenlen;
+
+	char status[256];
+};
+
+static volatile sig_atomic_t winch = 0;
+
+static void
+handle_winch(int sig UNUSED)
+{
+	winch = 1;
+}
+
+static inline uint64_t
+hunk_pos(const struct differ_hunk *hunk)
+{
+	return hunk->op == DELETE ? hunk->apos : hunk->bpos;
+}
+
+static inline size_t
+hunk_rows(const struct differ_hunk *hunk)
+{
+	if (hunk->op == IGNORE || hunk->sz == 0)
+		return 0;
+	return (hunk_pos(hunk) % 16 + hunk->sz + 15) / 16;
+}
+
+/*
+ * Byte offset into the hunk of its n'th row.  The first row is short
+ * when the hunk doesn't start on a 16 byte boundary.
+ */
+static inline size_t
+hunk_row_offset(const struct differ_hunk *hunk, size_t row)
+{
+	size_t first = 16 - hunk_pos(hunk) % 16;
+
+	if (row == 0)
+		return 0;
+	return first + (row - 1) * 16;
+}
+
+static size_t
+row_to_hunk(struct viewer *v, size_t row)
+{
+	size_t lo = 0, hi = v->n_hunks;
+
+	/*
+	 * find the last hunk whose first row is <= row, skipping over
+	 * any hunks that render as zero rows.
+	 */
+	while (hi - lo > 1) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (v->rowstart[mid] <= row)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	while (lo + 1 < v->n_hunks && v->rowstart[lo + 1] <= row)
+		lo++;
+	return lo;
+}
+
+static int
+build_rows(struct viewer *v)
+{
+	v->rowstart = calloc(v->n_hunks + 1, sizeof(*v->rowstart));
+	if (!v->rowstart)
+		return -1;
+
+	for (size_t i = 0; i < v->n_hunks; i++)
+		v->rowstart[i + 1] = v->rowstart[i] + hunk_rows(&v->hunks[i]);
+	v->n_rows = v->rowstart[v->n_hunks];
+	return 0;
+}
+
+static inline size_t
+body_rows(struct viewer *v)
+{
+	return v->rows > 1 ? v->rows - 1 : 1;
+}
+
+static inline size_t
+max_top(struct viewer *v)
+{
+	return v->n_rows > body_rows(v) ? v->n_rows - body_rows(v) : 0;
+}
+
+static int
+screen_append(struct viewer *v, const char *buf, size_t sz)
+{
+	if (v->screenlen + sz > v->screensz) {
+		size_t newsz = MAX(v->screensz * 2, v->screenlen + sz + 4096);
+		char *screen = realloc(v->screen, newsz);
+		if (!screen)
+			return -1;
+		v->screen = screen;
+		v->screensz = newsz;
+	}
+	memcpy(v->screen + v->screenlen, buf, sz);
+	v->screenlen += sz;
+	return 0;
+}
+
+static int PRINTF(2, 3)
+screen_printf(struct viewer *v, const char *fmt, ...)
+{
+	char buf[256];
+	va_list ap;
+	int sz;
+
+	va_start(ap, fmt);
+	sz = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	if (sz < 0)
+		return sz;
+	return screen_append(v, buf, MIN((size_t)sz, sizeof(buf) - 1));
+}
+
+static int
+screen_flush(struct viewer *v)
+{
+	size_t off = 0;
+
+	while (off < v->screenlen) {
+		ssize_t sz = write(v->fd, v->screen + off, v->screenlen - off);
+		if (sz < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		off += sz;
+	}
+	v->screenlen = 0;
+	return 0;
+}
+
+/*
+ * Render one row of the diff at screen line y (1-based).
+ */
+static int
+draw_row(struct viewer *v, size_t row, unsigned int y)
+{
+	char linebuf[4096];
+	ssize_t sz = 0;
+
+	screen_printf(v, "\033[%u;1H\033[2K", y);
+	if (row < v->n_rows) {
+		size_t k = row_to_hunk(v, row);
+		struct differ_hunk *hunk = &v->hunks[k];
+		size_t off = hunk_row_offset(hunk, row - v->rowstart[k]);
+		size_t consumed = 0;
+
+		sz = hexdiff_line(linebuf, sizeof(linebuf), hunk->op,
+				  hunk->apos + off, hunk->bpos + off,
+				  (uint8_t *)hunk->buf + off, hunk->sz - off,
+				  hunk->color->fg, &consumed);
+		if (sz < 0)
+			sz = 0;
+		sz = tty_clip(linebuf, sz, v->cols);
+		screen_append(v, linebuf, sz);
+		screen_printf(v, "\033[0m");
+	} else {
+		screen_printf(v, "~");
+	}
+	return 0;
+}
+
+static void
+draw_status(struct viewer *v)
+{
+	size_t k = v->n_hunks ? row_to_hunk(v, v->top) : 0;
+	size_t len;
+
+	screen_printf(v, "\033[%u;1H\033[2K\033[7m", v->rows);
+	if (v->status[0]) {
+		len = strnlen(v->status, sizeof(v->status));
+	} else {
+		len = snprintf(v->status, sizeof(v->status),
+			       "row %zu/%zu  hunk %zu/%zu  "
+			       "[j/k] scroll [n/N] change [:] seek [q] quit",
+			       v->n_rows ? v->top + 1 : 0, v->n_rows,
+			       v->n_hunks ? k + 1 : 0, v->n_hunks);
+		len = MIN(len, sizeof(v->status) - 1);
+	}
+	screen_append(v, v->status, MIN(len, (size_t)v->cols));
+	screen_printf(v, "\033[0m");
+	v->status[0] = '\0';
+}
+
+/*
+ * Bring the screen up to date with v->top.  Small moves scroll the
+ * terminal and only draw the rows that were exposed, everything else
+ * redraws the (viewport sized) body.
+ */
+static int
+redraw(struct viewer *v, size_t oldtop)
+{
+	size_t body = body_rows(v);
+	size_t first = 0, last = body;
+
+	if (v->drawn && oldtop != v->top) {
+		size_t delta = oldtop < v->top ? v->top - oldtop
+					       : oldtop - v->top;
+		if (delta < body) {
+			screen_printf(v, "\033[1;%zur", body);
+			if (oldtop < v->top) {
+				screen_printf(v, "\033[%zuS", delta);
+				first = body - delta;
+			} else {
+				screen_printf(v, "\033[%zuT", delta);
+				last = delta;
+			}
+			screen_printf(v, "\033[r");
+		}
+	} else if (v->drawn) {
+		first = last = 0;
+	}
+
+	for (size_t y = first; y < last; y++)
+		draw_row(v, v->top + y, y + 1);
+	draw_status(v);
+	v->drawn = true;
+
+	return screen_flush(v);
+}
+
+static void
+scroll_to(struct viewer *v, ssize_t row)
+{
+	if (row < 0)
+		row = 0;
+	v->top = MIN((size_t)row, max_top(v));
+}
+
+static bool
+is_change(const struct differ_hunk *hunk)
+{
+	return hunk->op == DELETE || hunk->op == INSERT;
+}
+
+static void
+next_change(struct viewer *v)
+{
+	size_t k = row_to_hunk(v, v->top);
+
+	/*
+	 * If the top of the screen is already inside a change, skip past
+	 * the rest of it first.
+	 */
+	while (k < v->n_hunks && is_change(&v->hunks[k]))
+		k++;
+	while (k < v->n_hunks && !is_change(&v->hunks[k]))
+		k++;
+	if (k == v->n_hunks) {
+		snprintf(v->status, sizeof(v->status), "no more changes");
+		return;
+	}
+	scroll_to(v, v->rowstart[k]);
+}
+
+static void
+prev_change(struct viewer *v)
+{
+	size_t k = row_to_hunk(v, v->top);
+
+	if (v->n_hunks == 0) {
+		snprintf(v->status, sizeof(v->status), "no previous changes");
+		return;
+	}
+	while (k > 0 && is_change(&v->hunks[k]) &&
+	       v->rowstart[k] == v->top)
+		k--;
+	while (k > 0 && !is_change(&v->hunks[k]))
+		k--;
+	if (!is_change(&v->hunks[k])) {
+		snprintf(v->status, sizeof(v->status), "no previous changes");
+		return;
+	}
+	/* back up to the start of a run of changes */
+	while (k > 0 && is_change(&v->hunks[k - 1]))
+		k--;
+	scroll_to(v, v->rowstart[k]);
+}
+
+/*
+ * Find the row showing offset "off" in the new file, or in the old
+ * file when "old" is set.  New file positions only ever increase
+ * along the hunk list, so that's a binary search; old file positions
+ * can go backwards (copies can come from anywhere), so we walk.
+ */
+static int
+seek_offset(struct viewer *v, uint64_t off, bool old)
+{
+	size_t k;
+
+	if (old) {
+		for (k = 0; k < v->n_hunks; k++) {
+			struct differ_hunk *hunk = &v->hunks[k];
+			if (hunk->op != DELETE && hunk->op != COPY)
+				continue;
+			if (off >= hunk->apos && off < hunk->apos + hunk->sz)
+				break;
+		}
+	} else {
+		size_t lo = 0, hi = v->n_hunks;
+
+		while (lo < hi) {
+			size_t mid = lo + (hi - lo) / 2;
+			if (v->hunks[mid].bpos <= off)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		for (k = lo; k > 0; k--) {
+			struct differ_hunk *hunk = &v->hunks[k - 1];
+			if (hunk->op != COPY && hunk->op != INSERT)
+				continue;
+			if (off >= hunk->bpos && off < hunk->bpos + hunk->sz)
+				break;
+		}
+		if (k == 0)
+			k = v->n_hunks;
+		else
+			k -= 1;
+	}
+
+	if (k >= v->n_hunks) {
+		snprintf(v->status, sizeof(v->status),
+			 "offset 0x%" PRIx64 " not found in %s file", off,
+			 old ? "old" : "new");
+		return -1;
+	}
+
+	uint64_t start = old ? v->hunks[k].apos : v->hunks[k].bpos;
+	uint64_t pos = hunk_pos(&v->hunks[k]);
+	size_t row = (pos % 16 + (off - start)) / 16;
+	scroll_to(v, v->rowstart[k] + row);
+	return 0;
+}
+
+static void
+prompt_seek(struct viewer *v)
+{
+	char buf[32] = "";
+	size_t len = 0;
+	bool old = false;
+	int key;
+
+	for (;;) {
+		screen_printf(v, "\033[%u;1H\033[2Kseek to [a]0x%.*s", v->rows,
+			      (int)len, buf);
+		screen_flush(v);
+
+		key = tty_read_key(v->fd);
+		if (key < 0 || key == TTY_KEY_EOF || key == TTY_KEY_ESC ||
+		    key == 0x03)
+			return;
+		if (key == '\r' || key == '\n')
+			break;
+		if ((key == 0x7f || key == 0x08) && len > 0) {
+			buf[--len] = '\0';
+		} else if (len < sizeof(buf) - 1 && key < 0x100 &&
+			   isxdigit(key)) {
+			buf[len++] = key;
+			buf[len] = '\0';
+		} else if (len == 0 && (key == 'a' || key == 'A')) {
+			old = !old;
+			snprintf(v->status, sizeof(v->status), "%s file",
+				 old ? "old" : "new");
+		}
+	}
+
+	if (len == 0)
+		return;
+	seek_offset(v, strtoull(buf, NULL, 16), old);
+}
+
+static void
+viewer_cleanup(struct viewer *v)
+{
+	screen_printf(v, "\033[r\033[?25h\033[?1049l");
+	screen_flush(v);
+	tty_restore(v->fd, &v->saved);
+	close(v->fd);
+	free(v->screen);
+	free(v->rowstart);
+}
+
+int
+view_diff(struct differ_hunk *hunks, size_t n_hunks)
+{
+	struct viewer v = {
+		.hunks = hunks,
+		.n_hunks = n_hunks,
+		.fd = -1,
+	};
+	struct sigaction sa = { .sa_handler = handle_winch, };
+	struct sigaction oldsa;
+	bool done = false;
+	int rc;
+
+	v.fd = open("/dev/tty", O_RDWR | O_CLOEXEC);
+	if (v.fd < 0)
+		return -1;
+
+	if (build_rows(&v) < 0 || tty_get_size(v.fd, &v.rows, &v.cols) < 0 ||
+	    tty_raw(v.fd, &v.saved) < 0) {
+		int errnum = errno;
+		free(v.rowstart);
+		close(v.fd);
+		errno = errnum;
+		return -1;
+	}
+
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGWINCH, &sa, &oldsa);
+
+	screen_printf(&v, "\033[?1049h\033[?25l\033[2J");
+	rc = redraw(&v, v.top);
+
+	while (!done && rc >= 0) {
+		size_t oldtop = v.top;
+		size_t page = body_rows(&v);
+		int key;
+
+		key = tty_read_key(v.fd);
+		if (winch) {
+			winch = 0;
+			tty_get_size(v.fd, &v.rows, &v.cols);
+			scroll_to(&v, v.top);
+			v.drawn = false;
+			screen_printf(&v, "\033[2J");
+		}
+
+		switch (key) {
+		case -1:
+			if (errno == EINTR)
+				break;
+			rc = -1;
+			break;
+		case 'q':
+		case 'Q':
+		case 0x03:
+		case TTY_KEY_ESC:
+		case TTY_KEY_EOF:
+			done = true;
+			continue;
+		case 'j':
+		case '\r':
+		case '\n':
+		case TTY_KEY_DOWN:
+			scroll_to(&v, v.top + 1);
+			break;
+		case 'k':
+		case TTY_KEY_UP:
+			scroll_to(&v, (ssize_t)v.top - 1);
+			break;
+		case ' ':
+		case 'f':
+		case TTY_KEY_PGDN:
+			scroll_to(&v, v.top + page);
+			break;
+		case 'b':
+		case TTY_KEY_PGUP:
+			scroll_to(&v, (ssize_t)v.top - page);
+			break;
+		case 'g':
+		case '<':
+		case TTY_KEY_HOME:
+			scroll_to(&v, 0);
+			break;
+		case 'G':
+		case '>':
+		case TTY_KEY_END:
+			scroll_to(&v, max_top(&v));
+			break;
+		case 'n':
+			next_change(&v);
+			break;
+		case 'N':
+		case 'p':
+			prev_change(&v);
+			break;
+		case ':':
+		case 'o':
+			prompt_seek(&v);
+			break;
+		default:
+			break;
+		}
+		if (rc >= 0)
+			rc = redraw(&v, oldtop);
+	}
+
+	sigaction(SIGWINCH, &oldsa, NULL);
+	viewer_cleanup(&v);
+	return rc;
+}
+
+// vim:fenc=utf-8:tw=75:noet
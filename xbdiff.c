@@ -6,6 +6,10 @@
 
 #include "bindiff.h"
 
+#include <xdiff.h>
+
+HIDDEN uint32_t differ_flags = 0;
+
 struct xbdiff_priv {
 };
 
@@ -15,8 +19,21 @@ xbdiff_collect(void *priv)
 
 }
 
+static int
+xbdiff_diff(mmbuffer_t *srcs, int nsrc, mmbuffer_t *tgt, xdemitcb_t *ecb)
+{
+	bdiffparam_t bdp = {
+		16,
+		differ_flags,
+	};
+
+	return xdl_bdiff_mbv(srcs, nsrc, tgt, &bdp, ecb);
+}
+
 struct differ xbdiff = {
+	.name = "xbdiff",
 	.collect = xbdiff_collect,
+	.diff = xbdiff_diff,
 };
 
 
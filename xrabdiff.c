@@ -6,5 +6,70 @@
 
 #include "bindiff.h"
 
+#include <xdiff.h>
+
+static rabdiffparam_t xrabdiff_params = {
+	0,
+};
+
+HIDDEN void
+xrabdiff_set_params(long wndsize, uint64_t poly)
+{
+	xrabdiff_params.wndsize = wndsize;
+	xrabdiff_params.poly = poly;
+}
+
+static int
+xrabdiff_diff(mmbuffer_t *srcs, int nsrc, mmbuffer_t *tgt, xdemitcb_t *ecb)
+{
+	rabdiffparam_t rdp = xrabdiff_params;
+
+	rdp.flags |= differ_flags;
+	return xdl_rabdiff_mbvp(srcs, nsrc, tgt, &rdp, ecb);
+}
+
+struct differ xrabdiff = {
+	.name = "xrabdiff",
+	.diff = xrabdiff_diff,
+};
+
+static int
+xgeardiff_diff(mmbuffer_t *srcs, int nsrc, mmbuffer_t *tgt, xdemitcb_t *ecb)
+{
+	rabdiffparam_t rdp = {
+		XDL_BDF_GEAR | differ_flags,
+		xrabdiff_params.wndsize,
+		0,
+	};
+
+	return xdl_rabdiff_mbvp(srcs, nsrc, tgt, &rdp, ecb);
+}
+
+struct differ xgeardiff = {
+	.name = "xgeardiff",
+	.diff = xgeardiff_diff,
+};
+
+/*
+ * Chunks that turn up whole in a source become copies, and whatever's
+ * left between them gets diffed by xrabdiff, with its window size and
+ * polynomial.
+ */
+static int
+xcdcdiff_diff(mmbuffer_t *srcs, int nsrc, mmbuffer_t *tgt, xdemitcb_t *ecb)
+{
+	cdcdiffparam_t cdp = {
+		0,
+		xrabdiff_params,
+	};
+
+	cdp.rdp.flags |= differ_flags;
+	return xdl_cdcdiff_mbvp(srcs, nsrc, tgt, &cdp, ecb);
+}
+
+struct differ xcdcdiff = {
+	.name = "xcdcdiff",
+	.diff = xcdcdiff_diff,
+};
 
 // vim:fenc=utf-8:tw=75:noet